@@ -1,103 +1,454 @@
 
-#include <iostream>
+#include <cmath>
+#include <algorithm>
 #include "Aggregator.h"
-#include <pretty.h>
-#include "../parsing/Parser.h"
-#include <map>
-
-Aggregator::Aggregator() {}
-
-void Aggregator::handle(rapidjson::Value *doc, const rapidjson::Value *field, rapidjson::Document::AllocatorType &allocator) {
-	rapidjson::Value &d = *doc;
-	rapidjson::Value f(*field, allocator);
-	std::string field_name = f["field"].GetString();
-	std::string function = f["function"].GetString();
-	rapidjson::Value val;
-	bool remove = false;
-
-	if (d.HasMember(field_name.c_str())) {
-		rapidjson::Value v(d[field_name.c_str()], allocator);
-		if (v.GetType() == rapidjson::kObjectType) {
-			// check for temp
-			if (v.HasMember("_temporary")) {
-				val = v["_temporary"];
-				remove = true;
+
+bool aggregateFunction(const std::string &name, Parsing::Aggregate &f) {
+	int numAggregates = sizeof(Parsing::Aggregates) / sizeof(std::string);
+	for (int i = 0; i < numAggregates; ++i) {
+		if (Parsing::Aggregates[i] == name) {
+			f = (Parsing::Aggregate)i;
+			return true;
+		}
+	}
+	return false;
+}
+
+/*
+ *      Accumulator
+ */
+
+Accumulator::Accumulator(const Accumulator &other): count(other.count), isum(other.isum), fsum(other.fsum), exact(other.exact),
+	min(other.min), max(other.max), imin(other.imin), imax(other.imax), mean(other.mean), m2(other.m2),
+	distinct(other.distinct ? new Storage::HyperLogLog<>(*other.distinct) : NULL),
+	digest(other.digest ? new Storage::TDigest(*other.digest) : NULL) {
+}
+
+Accumulator::Accumulator(Accumulator &&other) noexcept: count(other.count), isum(other.isum), fsum(other.fsum), exact(other.exact),
+	min(other.min), max(other.max), imin(other.imin), imax(other.imax), mean(other.mean), m2(other.m2), distinct(other.distinct), digest(other.digest) {
+	other.distinct = NULL;
+	other.digest = NULL;
+}
+
+Accumulator &Accumulator::operator=(Accumulator other) noexcept {
+	count = other.count;
+	isum = other.isum;
+	fsum = other.fsum;
+	exact = other.exact;
+	min = other.min;
+	max = other.max;
+	imin = other.imin;
+	imax = other.imax;
+	mean = other.mean;
+	m2 = other.m2;
+	std::swap(distinct, other.distinct);
+	std::swap(digest, other.digest);
+	return *this;
+}
+
+Accumulator::~Accumulator() {
+	delete distinct;
+	delete digest;
+}
+
+bool Accumulator::remove(Parsing::Aggregate f, double v, bool integer, int64_t i) {
+	if (count == 0 || f == Parsing::APPROX_COUNT_DISTINCT || f == Parsing::PERCENTILE || f == Parsing::MEDIAN) {
+		return false;
+	}
+	--count;
+	if (count == 0) {
+		*this = Accumulator();
+		return true;
+	}
+	switch (f) {
+		case Parsing::SUM:
+		case Parsing::AVG:
+			if (integer && i != INT64_MIN) {
+				addInt(-i);
+			} else {
+				fsum -= v;
 			}
-		} else {
-			val = v;
+			break;
+		case Parsing::MIN:
+			// Some other value may be the minimum now, or the same one again
+			return exact && integer ? i > imin : v > min;
+		case Parsing::MAX:
+			return exact && integer ? i < imax : v < max;
+		case Parsing::STDDEV:
+		case Parsing::VARIANCE:
+			{
+				// Welford backwards
+				double old = mean;
+				mean = (old * (count + 1) - v) / count;
+				m2 = std::max(0.0, m2 - (v - mean) * (v - old));
+			}
+			break;
+		default:
+			break;
+	}
+	return true;
+}
+
+void Accumulator::merge(Parsing::Aggregate f, const Accumulator &other) {
+	if (other.count == 0) {
+		return;
+	}
+	switch (f) {
+		case Parsing::SUM:
+		case Parsing::AVG:
+			addInt(other.isum);
+			fsum += other.fsum;
+			exact = exact && other.exact;
+			break;
+		case Parsing::MIN:
+			min = count == 0 || other.min < min ? other.min : min;
+			imin = count == 0 || other.imin < imin ? other.imin : imin;
+			exact = exact && other.exact;
+			break;
+		case Parsing::MAX:
+			max = count == 0 || other.max > max ? other.max : max;
+			imax = count == 0 || other.imax > imax ? other.imax : imax;
+			exact = exact && other.exact;
+			break;
+		case Parsing::STDDEV:
+		case Parsing::VARIANCE:
+			{
+				// Chan et al.: combine the means and the deviations of both halves.
+				double n = (double)(count + other.count);
+				double delta = other.mean - mean;
+				mean += delta * other.count / n;
+				m2 += other.m2 + delta * delta * count * other.count / n;
+			}
+			break;
+		case Parsing::APPROX_COUNT_DISTINCT:
+			if (other.distinct) {
+				if (!distinct) {
+					distinct = new Storage::HyperLogLog<>();
+				}
+				distinct->merge(*other.distinct);
+			}
+			break;
+		case Parsing::PERCENTILE:
+		case Parsing::MEDIAN:
+			if (other.digest) {
+				if (!digest) {
+					digest = new Storage::TDigest();
+				}
+				digest->merge(*other.digest);
+			}
+			break;
+		default:
+			break;
+	}
+	count += other.count;
+}
+
+void Accumulator::result(Parsing::Aggregate f, double p, rapidjson::Value &v) const {
+	v.SetNull();
+	if (f == Parsing::COUNT) {
+		v.SetUint64(count);
+		return;
+	}
+	if (f == Parsing::APPROX_COUNT_DISTINCT) {
+		// Never more than the values seen, the estimate can overshoot small counts
+		v.SetUint64(distinct ? std::min(count, (uint64_t)std::llround(distinct->estimate())) : 0);
+		return;
+	}
+	if (count == 0) {
+		return;
+	}
+	switch (f) {
+		case Parsing::SUM:
+			if (exact) {
+				v.SetInt64(isum);
+			} else {
+				v.SetDouble(fsum + isum);
+			}
+			break;
+		case Parsing::AVG:
+			v.SetDouble((fsum + isum) / count);
+			break;
+		case Parsing::MIN:
+		case Parsing::MAX:
+			if (exact) {
+				v.SetInt64(f == Parsing::MIN ? imin : imax);
+			} else {
+				v.SetDouble(f == Parsing::MIN ? min : max);
+			}
+			break;
+		case Parsing::VARIANCE:
+			v.SetDouble(count > 1 ? m2 / (count - 1) : 0);
+			break;
+		case Parsing::STDDEV:
+			v.SetDouble(count > 1 ? std::sqrt(m2 / (count - 1)) : 0);
+			break;
+		case Parsing::PERCENTILE:
+			v.SetDouble(digest->quantile(p));
+			break;
+		case Parsing::MEDIAN:
+			v.SetDouble(digest->quantile(0.5));
+			break;
+		default:
+			break;
+	}
+}
+
+/*
+ *      Aggregator
+ */
+
+Aggregator::Aggregator(const rapidjson::Value &aggregates) {
+	for (rapidjson::Value::ConstValueIterator it = aggregates.Begin(); it != aggregates.End(); ++it) {
+		Slot s;
+		if (!aggregateFunction((*it)["function"].GetString(), s.function)) {
+			continue;
+		}
+		s.field = (*it)["field"].GetString();
+		s.p = it->HasMember("p") ? (*it)["p"].GetDouble() : 0.5;
+		s.name = Parsing::aggregateName(*it);
+		s.hidden = it->HasMember("hidden");
+		s.spread = -1;
+		s.drawn = s.population = 0;
+		if (it->HasMember("sample")) {
+			s.drawn = (*it)["sample"][0].GetUint64();
+			s.population = (*it)["sample"][1].GetUint64();
+		}
+		size_t index = slots.size();
+		slots.push_back(s);
+		state.push_back(Accumulator());
+
+		if (s.function == Parsing::COUNT && s.field == "*") {
+			countAll.push_back(index);
+			continue;
+		}
+		bool grouped = false;
+		for (auto g = groups.begin(); g != groups.end(); ++g) {
+			if (g->field == s.field) {
+				g->slots.push_back(index);
+				grouped = true;
+				break;
+			}
+		}
+		if (!grouped) {
+			Group g;
+			g.field = s.field;
+			g.slots.push_back(index);
+			groups.push_back(g);
 		}
 	}
 
-	if (results.count(field_name)) {	
-		std::vector<AggregateResult> &r = results[field_name];
-		for (auto it = r.begin(); it != r.end(); ++it) {
-			AggregateResult &v = *it;
-			if (v.field == field_name && v.function == function) {
-				v.result = process(function, v.result, &val);
-				v.count++;
+	for (auto s = slots.begin(); s != slots.end(); ++s) {
+		if (s->population == 0 || (s->function != Parsing::SUM && s->function != Parsing::AVG)) {
+			continue;
+		}
+		for (size_t i = 0; i < slots.size(); ++i) {
+			if (slots[i].hidden && slots[i].function == Parsing::VARIANCE && slots[i].field == s->field) {
+				s->spread = (int)i;
 				break;
 			}
 		}
-	} else {
-		std::vector<AggregateResult> r;
-		r.push_back(AggregateResult(field_name, function, process(&val)));
-		results[field_name] = r;
 	}
+}
 
-	if (remove) {
-		doc->RemoveMember(field_name.c_str());
+void Aggregator::handle(const rapidjson::Value &doc, Accumulator *accs) const {
+	for (auto it = countAll.begin(); it != countAll.end(); ++it) {
+		++accs[*it].count;
+	}
+	if (!doc.IsObject()) {
+		return;
+	}
+	for (auto g = groups.begin(); g != groups.end(); ++g) {
+		rapidjson::Value key(rapidjson::StringRef(g->field.data(), g->field.size()));
+		rapidjson::Value::ConstMemberIterator m = doc.FindMember(key);
+		if (m == doc.MemberEnd()) {
+			continue;
+		}
+		for (auto s = g->slots.begin(); s != g->slots.end(); ++s) {
+			accs[*s].add(slots[*s].function, m->value);
+		}
 	}
 }
 
-AggregateResult *Aggregator::getResult(std::string field, std::string function) {
-	for (auto it = results.begin(); it != results.end(); ++it) {
-		std::string key = it->first;
-		std::vector<AggregateResult> val = it->second;
-		if (key.compare(field) == 0) {
-			for (auto v = val.begin(); v != val.end(); ++v) {
-				AggregateResult r = *v;
-				if (r.function.compare(function) == 0) {
-					if (r.function.compare("AVG") == 0) {
-						r.result = r.result / r.count;
-					}
-					return new AggregateResult(r);
-				}
-			}
+bool Aggregator::retract(const rapidjson::Value &doc, Accumulator *accs) const {
+	for (auto it = countAll.begin(); it != countAll.end(); ++it) {
+		--accs[*it].count;
+	}
+	if (!doc.IsObject()) {
+		return true;
+	}
+	bool undone = true;
+	for (auto g = groups.begin(); g != groups.end(); ++g) {
+		rapidjson::Value key(rapidjson::StringRef(g->field.data(), g->field.size()));
+		rapidjson::Value::ConstMemberIterator m = doc.FindMember(key);
+		if (m == doc.MemberEnd()) {
+			continue;
+		}
+		for (auto s = g->slots.begin(); s != g->slots.end(); ++s) {
+			undone = accs[*s].remove(slots[*s].function, m->value) && undone;
 		}
 	}
-	return NULL;
-} 
+	return undone;
+}
 
-double Aggregator::process(rapidjson::Value *val) {
-	rapidjson::Value &v = *val;
-	double newVal = 0;
-	if (v.IsInt()) {
-		newVal = v.GetInt();
-	} else if (v.IsDouble()) {
-		newVal = v.GetDouble();
+void Aggregator::merge(const Aggregator &other) {
+	for (size_t i = 0; i < slots.size() && i < other.slots.size(); ++i) {
+		state[i].merge(slots[i].function, other.state[i]);
 	}
+}
 
-	return newVal;
+void Aggregator::summarize(const Accumulator *accs, rapidjson::Value &out, rapidjson::Document::AllocatorType &allocator) const {
+	for (size_t i = 0; i < slots.size(); ++i) {
+		if (slots[i].hidden) {
+			continue;
+		}
+		rapidjson::Value v;
+		accs[i].result(slots[i].function, slots[i].p, v);
+		if (v.IsNull()) {
+			continue;
+		}
+		rapidjson::Value interval;
+		if (slots[i].population) {
+			estimate(accs, i, v, interval, allocator);
+		}
+		out.AddMember(rapidjson::Value(slots[i].name.c_str(), allocator), v, allocator);
+		if (!interval.IsNull()) {
+			std::string name = slots[i].name + " 95% CI";
+			out.AddMember(rapidjson::Value(name.c_str(), allocator), interval, allocator);
+		}
+	}
 }
 
-double Aggregator::process(std::string function, double current, rapidjson::Value *val) {
-	rapidjson::Value &v = *val;
+/*
+ *      estimate ---
+ *
+ *      Every one of the n drawn documents contributes y to a SUM (0 if it does not match or
+ *      lacks the field) and 0 or 1 to a COUNT.  Scaled by N / n these estimate the total over
+ *      the N documents, with a standard error of N sqrt((1 - n / N) s^2 / n), s^2 the variance
+ *      of y over the drawn documents.  AVG is left as it is, its standard error is that of a
+ *      mean of the values it saw.  Both intervals are left null with fewer than two documents
+ *      drawn.  The other aggregates are reported over the sample as they are.
+ */
 
-	double newVal = 0;
+void Aggregator::estimate(const Accumulator *accs, size_t slot, rapidjson::Value &v, rapidjson::Value &interval,
+		rapidjson::Document::AllocatorType &allocator) const {
+	const Slot &s = slots[slot];
+	const Accumulator &acc = accs[slot];
+	double n = (double)s.drawn;
+	double N = (double)s.population;
+	double fpc = N > 0 ? std::max(0.0, 1 - n / N) : 0;
 
-	if (v.IsInt()) {
-		newVal = v.GetInt();
-	} else if (v.IsDouble()) {
-		newVal = v.GetDouble();
+	double value;
+	double error;
+	switch (s.function) {
+		case Parsing::COUNT:
+		case Parsing::SUM:
+			{
+				double sum;
+				double squares;
+				if (s.function == Parsing::COUNT) {
+					sum = squares = (double)acc.count;
+				} else if (s.spread >= 0) {
+					const Accumulator &values = accs[s.spread];
+					sum = acc.fsum + acc.isum;
+					squares = values.m2 + values.count * values.mean * values.mean;
+				} else {
+					return;
+				}
+				value = n > 0 ? sum * N / n : 0;
+				if (s.function == Parsing::COUNT || acc.exact) {
+					v.SetInt64(std::llround(value));
+				} else {
+					v.SetDouble(value);
+				}
+				if (n < 2) {
+					// No spread to measure from a single document
+					return;
+				}
+				double variance = std::max(0.0, (squares - sum * sum / n) / (n - 1));
+				error = N * std::sqrt(fpc * variance / n);
+			}
+			break;
+		case Parsing::AVG:
+			{
+				if (s.spread < 0 || acc.count < 2) {
+					return;
+				}
+				const Accumulator &values = accs[s.spread];
+				value = v.GetDouble();
+				error = std::sqrt(fpc * values.m2 / (values.count - 1) / values.count);
+			}
+			break;
+		default:
+			return;
 	}
 
-	if (function == "SUM" || function == "AVG") {
-		return current + newVal;
-	} else if (function == "MIN") {
-		return newVal<current?newVal:current;
-	} else if (function == "MAX") {
-		return newVal>current?newVal:current;
+	interval.SetArray();
+	double low = value - SAMPLE_Z * error;
+	if (s.function == Parsing::COUNT) {
+		// At least the documents that were seen
+		low = std::max(low, (double)acc.count);
 	}
+	interval.PushBack(low, allocator);
+	interval.PushBack(value + SAMPLE_Z * error, allocator);
+}
+
+void sampleAggregates(rapidjson::Document &fields, uint64_t drawn, uint64_t population) {
+	rapidjson::Document::AllocatorType &allocator = fields.GetAllocator();
+	std::vector<std::string> spread;
+	for (auto it = fields.Begin(); it != fields.End(); ++it) {
+		if (!it->IsObject()) {
+			continue;
+		}
+		rapidjson::Value sample(rapidjson::kArrayType);
+		sample.PushBack(drawn, allocator).PushBack(population, allocator);
+		it->AddMember("sample", sample, allocator);
+		std::string function = (*it)["function"].GetString();
+		std::string field = (*it)["field"].GetString();
+		if ((function == "SUM" || function == "AVG") && std::find(spread.begin(), spread.end(), field) == spread.end()) {
+			spread.push_back(field);
+		}
+	}
+	for (auto f = spread.begin(); f != spread.end(); ++f) {
+		rapidjson::Value agg(rapidjson::kObjectType);
+		agg.AddMember("function", "VARIANCE", allocator);
+		agg.AddMember("field", rapidjson::Value(f->c_str(), allocator), allocator);
+		agg.AddMember("hidden", true, allocator);
+		fields.PushBack(agg, allocator);
+	}
+}
 
-	return current;
+std::vector<std::string> Aggregator::fields() const {
+	std::vector<std::string> out;
+	for (auto g = groups.begin(); g != groups.end(); ++g) {
+		out.push_back(g->field);
+	}
+	return out;
+}
+
+size_t Aggregator::sketchBytes() const {
+	size_t bytes = 0;
+	for (auto s = slots.begin(); s != slots.end(); ++s) {
+		if (s->function == Parsing::APPROX_COUNT_DISTINCT) {
+			bytes += sizeof(Storage::HyperLogLog<>);
+		} else if (s->function == Parsing::PERCENTILE || s->function == Parsing::MEDIAN) {
+			bytes += sizeof(Storage::TDigest) + Storage::TDigest::Bytes();
+		}
+	}
+	return bytes;
+}
+
+void printSummary(std::ostream &os, const rapidjson::Value &out) {
+	for (rapidjson::Value::ConstMemberIterator it = out.MemberBegin(); it != out.MemberEnd(); ++it) {
+		os << it->name.GetString() << ": ";
+		if (it->value.IsArray()) {
+			os << "[" << it->value[0].GetDouble() << ", " << it->value[1].GetDouble() << "]";
+		} else if (it->value.IsInt64()) {
+			os << it->value.GetInt64();
+		} else if (it->value.IsUint64()) {
+			os << it->value.GetUint64();
+		} else {
+			os << it->value.GetDouble();
+		}
+		os << std::endl;
+	}
 }
@@ -1,23 +1,234 @@
+#ifndef AGGREGATOR_H_
+#define AGGREGATOR_H_
+
 #include <rapidjson/document.h>
-#include <map>
+#include <string>
 #include <vector>
+#include <iostream>
+#include <cstdint>
+
+#include "../parsing/Parser.h"
+#include "../storage/HyperLogLog.h"
+#include "../storage/TDigest.h"
+
+// Hashes of the values APPROX_COUNT_DISTINCT counts.  Numbers hash by value, so 5 and 5.0 are one.
+inline uint64_t distinctNumber(double d) {
+	d += 0.0;    // -0 is 0
+	return Hash64(reinterpret_cast<const char*>(&d), sizeof(d), 0);
+}
+inline uint64_t distinctString(const char *s, size_t len) { return Hash64(s, len, 1); }
+inline uint64_t distinctBool(bool b) { char c = b; return Hash64(&c, 1, 2); }
+
+/*
+ *      Accumulator ---
+ *
+ *      Running state of one aggregate, updated straight from the scanned values.  Integers are
+ *      summed exactly in 'isum' until it would overflow, everything else goes to 'fsum'; MIN and
+ *      MAX keep the exact integers next to the doubles in the same way.
+ *      STDDEV and VARIANCE keep a running mean and sum of squared deviations (Welford), which
+ *      stays accurate where a sum of squares cancels out.  Values that are not numbers count
+ *      as 0.  Only the state the aggregate's function needs is kept up to date.
+ *
+ *      APPROX_COUNT_DISTINCT and PERCENTILE/MEDIAN keep a HyperLogLog or a t-digest, allocated
+ *      on their first value: fixed size, and merged like the rest.  Only numbers, strings and
+ *      booleans count as distinct values.
+ */
+
+struct Accumulator {
+	uint64_t count;
+	int64_t isum;
+	double fsum;
+	bool exact;           // every value was an integer (and isum did not overflow)
+	double min;
+	double max;
+	int64_t imin;         // min and max exactly, while every value is an integer
+	int64_t imax;
+	double mean;
+	double m2;
+	Storage::HyperLogLog<> *distinct;
+	Storage::TDigest *digest;
+
+	Accumulator(): count(0), isum(0), fsum(0), exact(true), min(0), max(0), imin(0), imax(0), mean(0), m2(0), distinct(NULL), digest(NULL) {}
+	Accumulator(const Accumulator &other);
+	Accumulator(Accumulator &&other) noexcept;
+	Accumulator &operator=(Accumulator other) noexcept;
+	~Accumulator();
+
+	inline void addInt(int64_t v) {
+		if ((v > 0 && isum > INT64_MAX - v) || (v < 0 && isum < INT64_MIN - v)) {
+			fsum += (double)isum;
+			isum = 0;
+			exact = false;
+		}
+		isum += v;
+	}
+
+	inline void addDistinct(uint64_t hash) {
+		++count;
+		if (!distinct) {
+			distinct = new Storage::HyperLogLog<>();
+		}
+		distinct->addHash(hash);
+	}
+
+	// One value: 'v' is its number, 'integer' whether it is an integer equal to 'i'.
+	inline void add(Parsing::Aggregate f, double v, bool integer, int64_t i) {
+		if (f == Parsing::APPROX_COUNT_DISTINCT) {
+			addDistinct(distinctNumber(v));
+			return;
+		}
+		++count;
+		switch (f) {
+			case Parsing::SUM:
+			case Parsing::AVG:
+				if (integer) {
+					addInt(i);
+				} else {
+					fsum += v;
+					exact = false;
+				}
+				break;
+			case Parsing::MIN:
+				min = count == 1 || v < min ? v : min;
+				imin = count == 1 || i < imin ? i : imin;
+				exact = exact && integer;
+				break;
+			case Parsing::MAX:
+				max = count == 1 || v > max ? v : max;
+				imax = count == 1 || i > imax ? i : imax;
+				exact = exact && integer;
+				break;
+			case Parsing::STDDEV:
+			case Parsing::VARIANCE:
+				{
+					double delta = v - mean;
+					mean += delta / count;
+					m2 += delta * (v - mean);
+				}
+				break;
+			case Parsing::PERCENTILE:
+			case Parsing::MEDIAN:
+				if (!digest) {
+					digest = new Storage::TDigest();
+				}
+				digest->add(v);
+				break;
+			default:
+				break;
+		}
+	}
+
+	inline void add(Parsing::Aggregate f, const rapidjson::Value &v) {
+		if (f == Parsing::COUNT) {
+			count += !v.IsNull();
+		} else if (f == Parsing::APPROX_COUNT_DISTINCT && !v.IsNumber()) {
+			if (v.IsString()) {
+				addDistinct(distinctString(v.GetString(), v.GetStringLength()));
+			} else if (v.IsBool()) {
+				addDistinct(distinctBool(v.IsTrue()));
+			}
+		} else if (v.IsInt64()) {
+			add(f, (double)v.GetInt64(), true, v.GetInt64());
+		} else if (v.IsNumber()) {
+			add(f, v.GetDouble(), false, 0);
+		} else {
+			add(f, 0, true, 0);
+		}
+	}
+
+	// Take one value back out again.  False if the state can not be rolled back: the value
+	// was the MIN or MAX, or went into a sketch.
+	bool remove(Parsing::Aggregate f, double v, bool integer, int64_t i);
 
-struct AggregateResult {
-	std::string field;
-	std::string function;
-	double result;
-	int count;
-	AggregateResult(std::string f, std::string fun, double r) : field(f), function(fun), result(r), count(1) {}
-	AggregateResult(const AggregateResult &other): field(other.field), function(other.function), result(other.result), count(other.count) {}
+	inline bool remove(Parsing::Aggregate f, const rapidjson::Value &v) {
+		if (f == Parsing::COUNT) {
+			count -= !v.IsNull();
+			return true;
+		} else if (f == Parsing::APPROX_COUNT_DISTINCT && !v.IsNumber()) {
+			return !v.IsString() && !v.IsBool();
+		} else if (v.IsInt64()) {
+			return remove(f, (double)v.GetInt64(), true, v.GetInt64());
+		} else if (v.IsNumber()) {
+			return remove(f, v.GetDouble(), false, 0);
+		}
+		return remove(f, 0, true, 0);
+	}
+
+	void merge(Parsing::Aggregate f, const Accumulator &other);
+	// Set 'v' to the result, null if nothing was aggregated.  'p' is PERCENTILE's fraction.
+	void result(Parsing::Aggregate f, double p, rapidjson::Value &v) const;
 };
 
+// Normal quantile of the two sided 95% confidence intervals of sampled aggregates.
+const double SAMPLE_Z = 1.96;
+
+/*
+ *      Aggregator ---
+ *
+ *      The aggregates of a select compiled into one slot per aggregate, in select order.
+ *      handle() looks up each aggregated field of a document once and feeds its value to the
+ *      slots over it.  The accumulators live in 'state', or in an array of one Accumulator per
+ *      slot handed in by the caller (a GROUP BY keeps one array per group).  Aggregators of
+ *      parallel workers are merged at the end.
+ *
+ *      Over a sample (see sampleAggregates) SUM and COUNT are scaled up to the whole
+ *      population, and SUM, COUNT and AVG get a 95% confidence interval from the spread of the
+ *      sampled values, which a hidden VARIANCE slot over the same field keeps.
+ */
+
 class Aggregator {
 public:
-	Aggregator();
-	void handle(rapidjson::Value*, const rapidjson::Value*, rapidjson::Document::AllocatorType&);
-	AggregateResult *getResult(std::string, std::string);
+	struct Slot {
+		Parsing::Aggregate function;
+		std::string field;          // "*" for COUNT(*)
+		double p;                   // PERCENTILE's fraction
+		std::string name;           // column of the result
+		bool hidden;                // only feeds another slot's interval
+		int spread;                 // the hidden VARIANCE slot of a sampled SUM or AVG, or -1
+		uint64_t drawn;             // documents sampled, 0 when not sampled
+		uint64_t population;        // documents they were drawn from
+	};
+	std::vector<Slot> slots;
+	std::vector<Accumulator> state;
+
+	Aggregator() {}
+	// From the {"function": ..., "field": ...} objects of a select.
+	explicit Aggregator(const rapidjson::Value &aggregates);
+
+	void handle(const rapidjson::Value &doc) { handle(doc, state.data()); }
+	void handle(const rapidjson::Value &doc, Accumulator *accs) const;
+	// Undo handle() for a document that is gone.  False if some accumulator could not be
+	// rolled back and has to be computed again.
+	bool retract(const rapidjson::Value &doc, Accumulator *accs) const;
+	void merge(const Aggregator &other);
+	// Add a "FUNC(field)": result member for every aggregate with a result.
+	void summarize(rapidjson::Value &out, rapidjson::Document::AllocatorType &allocator) const { summarize(state.data(), out, allocator); }
+	void summarize(const Accumulator *accs, rapidjson::Value &out, rapidjson::Document::AllocatorType &allocator) const;
+	// The distinct fields the aggregates read, COUNT(*) excluded.
+	std::vector<std::string> fields() const;
+	// Bytes the sketches of one set of accumulators can grow to.
+	size_t sketchBytes() const;
 private:
-	std::map<std::string, std::vector<AggregateResult>> results;
-	double process(std::string, double, rapidjson::Value*);
-	double process(rapidjson::Value*);
+	struct Group {
+		std::string field;
+		std::vector<size_t> slots;
+	};
+	std::vector<Group> groups;
+	std::vector<size_t> countAll;
+
+	// Scale a sampled result up and set 'interval' to its confidence interval, or leave it null.
+	void estimate(const Accumulator *accs, size_t slot, rapidjson::Value &v, rapidjson::Value &interval,
+			rapidjson::Document::AllocatorType &allocator) const;
 };
+
+// Mark the aggregates of a field list as computed over 'drawn' documents sampled from
+// 'population', adding the hidden slots their intervals need.
+void sampleAggregates(rapidjson::Document &fields, uint64_t drawn, uint64_t population);
+
+// Name of an aggregate function to its enum, false for unknown names.
+bool aggregateFunction(const std::string &name, Parsing::Aggregate &f);
+
+// Print the members of a summary row as "name: value" lines, intervals as "[low, high]".
+void printSummary(std::ostream &os, const rapidjson::Value &out);
+
+#endif
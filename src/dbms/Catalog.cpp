@@ -0,0 +1,347 @@
+#include "Catalog.h"
+#include "../mmap_filesystem/HerpmapReader.h"
+#include "../utils/Util.h"
+
+const std::string CatalogFile("__CATALOG__");
+const std::string CatalogLogFile("__CATALOG_LOG__");
+const std::string ProjectFilePrefix("__PROJECT__");
+// Where the whole catalog used to be written as one map.
+const std::string LegacyCatalogFile("__DB_METADATA__");
+
+// Log records: the kind, the project name and a DocSet, each after its length as a varint.
+enum LogRecord {
+	Gained = 'G',       // ids the project gained
+	Lost = 'L',         // ids it lost
+	Rewritten = 'W',    // its file was written whole, nothing before this counts; no ids
+};
+
+static void putVarint(std::string &buf, uint64_t value) {
+	char bytes[10];
+	uint64_t pos = 0;
+	WriteVarint(bytes, pos, value);
+	buf.append(bytes, pos);
+}
+
+static void putRecord(std::string &buf, LogRecord kind, const std::string &project, const DOCDS *ids) {
+	buf.push_back(char(kind));
+	putVarint(buf, project.size());
+	buf.append(project);
+	uint64_t size = ids ? ids->Size() : 0;
+	putVarint(buf, size);
+	if (ids) {
+		uint64_t pos = buf.size();
+		buf.resize(pos + size);
+		ids->Write(&buf[0], pos);
+	}
+}
+
+Catalog::Catalog(size_t budget_, uint64_t logLimit_): loads(0), evictions(0), compactions(0), budget(budget_), used(0),
+	logLimit(logLimit_), fs(NULL) {}
+
+Catalog::~Catalog() {
+	for (auto it = entries.begin(); it != entries.end(); ++it) {
+		delete it->second;
+	}
+}
+
+void Catalog::load(FILESYSTEM *fs_) {
+	fs = fs_;
+	log = fs->open_file(CatalogLogFile);
+	File list = fs->open_file(CatalogFile);
+	if (list.size > 0 || log.size > 0) {
+		if (list.size > 0) {
+			char *buffer = fs->read(&list);
+			std::vector<std::string> names = Type<std::vector<std::string> >::Create(buffer, list.size);
+			free(buffer);
+			for (auto n = names.begin(); n != names.end(); ++n) {
+				entries.put(*n, new Entry(*n));
+			}
+		}
+		if (log.size > 0) {
+			char *buffer = fs->read(&log);
+			replay(buffer, log.size);
+			free(buffer);
+		}
+		return;
+	}
+
+	File legacy = fs->open_file(LegacyCatalogFile);
+	if (legacy.size == 0) {
+		fs->deleteFile(&legacy);
+		return;
+	}
+	Storage::HerpmapReader<DOCDS> reader(legacy, fs);
+	Storage::HerpHash<std::string, DOCDS> projects = reader.read();
+	for (auto it = projects.begin(); it != projects.end(); ++it) {
+		// Project names used to be listed under their own key.
+		if (it->first == "__PROJECTS__") {
+			continue;
+		}
+		Entry *e = new Entry(it->first);
+		e->docs.swap(it->second);
+		writeSet(e);
+		e->docs.clear();
+		entries.put(e->name, e);
+	}
+	writeNames();
+	fs->deleteFile(&legacy);
+}
+
+void Catalog::save() {
+	std::vector<Entry*> loaded;
+	{
+		std::lock_guard<std::mutex> l(mutex);
+		for (auto it = lru.begin(); it != lru.end(); ++it) {
+			++(*it)->pins;
+			loaded.push_back(*it);
+		}
+	}
+	for (auto it = loaded.begin(); it != loaded.end(); ++it) {
+		Entry *e = *it;
+		{
+			Storage::ExclusiveGuard g(e->lock);
+			std::lock_guard<std::mutex> l(mutex);
+			checkpoint(e);
+		}
+		unpin(e);
+	}
+	if (logFull()) {
+		compact();
+	}
+}
+
+void Catalog::checkpoint(const std::string &project) {
+	Entry *e;
+	{
+		std::lock_guard<std::mutex> l(mutex);
+		Entry **found = entries.find(project);
+		// A set that is not loaded was checkpointed when it was dropped
+		if (found == NULL || !(*found)->loaded) {
+			return;
+		}
+		e = *found;
+		++e->pins;
+	}
+	{
+		Storage::ExclusiveGuard g(e->lock);
+		std::lock_guard<std::mutex> l(mutex);
+		checkpoint(e);
+	}
+	unpin(e);
+	if (logFull()) {
+		compact();
+	}
+}
+
+void Catalog::compact() {
+	std::vector<std::string> names;
+	{
+		std::lock_guard<std::mutex> l(mutex);
+		for (auto it = entries.begin(); it != entries.end(); ++it) {
+			if (!it->second->logged.empty() || !it->second->pending.empty()) {
+				names.push_back(it->first);
+			}
+		}
+	}
+	for (auto n = names.begin(); n != names.end(); ++n) {
+		Entry *e = pin(*n, false);
+		{
+			Storage::ExclusiveGuard g(e->lock);
+			std::lock_guard<std::mutex> l(mutex);
+			checkpoint(e);
+			if (!e->logged.empty()) {
+				writeSet(e);
+				e->logged.clear();
+			}
+		}
+		unpin(e);
+	}
+
+	// Sets changed since they were written are in the log again; it is kept until next time.
+	std::lock_guard<std::mutex> l(mutex);
+	for (auto it = entries.begin(); it != entries.end(); ++it) {
+		if (!it->second->logged.empty()) {
+			return;
+		}
+	}
+	writeNames();
+	fs->write(&log, "", 0);
+	++compactions;
+}
+
+bool Catalog::contains(const std::string &project) {
+	std::lock_guard<std::mutex> l(mutex);
+	return entries.contains(project);
+}
+
+std::vector<std::string> Catalog::keys() {
+	std::lock_guard<std::mutex> l(mutex);
+	std::vector<std::string> names;
+	names.reserve(entries.size());
+	for (auto it = entries.begin(); it != entries.end(); ++it) {
+		names.push_back(it->first);
+	}
+	return names;
+}
+
+size_t Catalog::size() {
+	std::lock_guard<std::mutex> l(mutex);
+	return entries.size();
+}
+
+size_t Catalog::memory() {
+	std::lock_guard<std::mutex> l(mutex);
+	return used;
+}
+
+void Catalog::print(std::ostream &os) {
+	std::lock_guard<std::mutex> l(mutex);
+	os << "Loaded projects: " << lru.size() << " of " << entries.size() << " (" << used << " of " << budget << " bytes)" << std::endl;
+	os << "Loads: " << loads << ", evictions: " << evictions << std::endl;
+	os << "Catalog log: " << log.size << " of " << logLimit << " bytes, compactions: " << compactions << std::endl;
+}
+
+Catalog::Entry *Catalog::pin(const std::string &project, bool create) {
+	std::lock_guard<std::mutex> l(mutex);
+	Entry **found = entries.find(project);
+	Entry *e;
+	if (found != NULL) {
+		e = *found;
+	} else if (create) {
+		e = new Entry(project);
+		e->loaded = true;
+		e->pending.whole = true;
+		e->bytes = e->docs.memory();
+		lru.push_front(e);
+		e->lru = lru.begin();
+		entries.put(project, e);
+	} else {
+		return NULL;
+	}
+	++e->pins;
+	// A pinned set is always loaded, so nothing but eviction, which skips it, unloads it.
+	if (!e->loaded) {
+		readSet(e);
+		e->loaded = true;
+		e->bytes = e->docs.memory();
+		lru.push_front(e);
+		e->lru = lru.begin();
+		++loads;
+	} else if (e->lru != lru.begin()) {
+		lru.splice(lru.begin(), lru, e->lru);
+	}
+	used += e->bytes - e->counted;
+	e->counted = e->bytes;
+	return e;
+}
+
+void Catalog::unpin(Entry *e) {
+	std::lock_guard<std::mutex> l(mutex);
+	--e->pins;
+	used += e->bytes - e->counted;
+	e->counted = e->bytes;
+	evict();
+}
+
+void Catalog::evict() {
+	auto it = lru.end();
+	while (used > budget && it != lru.begin()) {
+		Entry *e = *--it;
+		if (e->pins > 0) {
+			continue;
+		}
+		checkpoint(e);
+		DOCDS().swap(e->docs);
+		used -= e->counted;
+		e->counted = 0;
+		e->bytes = 0;
+		e->loaded = false;
+		it = lru.erase(it);
+		++evictions;
+	}
+}
+
+void Catalog::checkpoint(Entry *e) {
+	if (e->pending.empty()) {
+		return;
+	}
+	std::string records;
+	if (e->pending.whole) {
+		writeSet(e);
+		e->logged.clear();
+		putRecord(records, Rewritten, e->name, NULL);
+	} else {
+		if (!e->pending.gained.empty()) {
+			putRecord(records, Gained, e->name, &e->pending.gained);
+		}
+		if (!e->pending.lost.empty()) {
+			putRecord(records, Lost, e->name, &e->pending.lost);
+		}
+		e->logged.merge(e->pending);
+	}
+	e->pending.clear();
+	e->bytes = e->docs.memory();
+	fs->append(&log, records.data(), records.size());
+}
+
+bool Catalog::logFull() {
+	std::lock_guard<std::mutex> l(mutex);
+	return log.size > logLimit;
+}
+
+void Catalog::replay(const char *buffer, uint64_t size) {
+	uint64_t pos = 0;
+	while (pos < size) {
+		char kind = buffer[pos++];
+		uint64_t len = ReadVarint(buffer, pos);
+		std::string project(buffer + pos, len);
+		pos += len;
+		len = ReadVarint(buffer, pos);
+		Entry **found = entries.find(project);
+		Entry *e = found ? *found : NULL;
+		if (e == NULL) {
+			e = new Entry(project);
+			entries.put(project, e);
+		}
+		DOCDS::Journal change;
+		if (kind == Gained) {
+			change.gained = DOCDS::Read(buffer + pos, len);
+		} else if (kind == Lost) {
+			change.lost = DOCDS::Read(buffer + pos, len);
+		} else {
+			e->logged.clear();
+		}
+		e->logged.merge(change);
+		pos += len;
+	}
+}
+
+void Catalog::readSet(Entry *e) {
+	File file = fs->open_file(ProjectFilePrefix + e->name);
+	if (file.size > 0) {
+		char *buffer = fs->read(&file);
+		e->docs = Type<DOCDS>::Create(buffer, file.size);
+		free(buffer);
+	}
+	e->logged.apply(e->docs);
+}
+
+void Catalog::writeSet(Entry *e) {
+	File file = fs->open_file(ProjectFilePrefix + e->name);
+	uint64_t size = Type<DOCDS>::Size(e->docs);
+	const char *bytes = Type<DOCDS>::Bytes(e->docs);
+	fs->write(&file, bytes, size);
+	delete[] bytes;
+}
+
+void Catalog::writeNames() {
+	std::vector<std::string> names;
+	for (auto it = entries.begin(); it != entries.end(); ++it) {
+		names.push_back(it->first);
+	}
+	File list = fs->open_file(CatalogFile);
+	uint64_t size = Type<std::vector<std::string> >::Size(names);
+	const char *bytes = Type<std::vector<std::string> >::Bytes(names);
+	fs->write(&list, bytes, size);
+	delete[] bytes;
+}
@@ -0,0 +1,189 @@
+#ifndef CATALOG_H_
+#define CATALOG_H_
+
+#include <list>
+#include <mutex>
+#include <atomic>
+#include <string>
+#include <vector>
+#include <ostream>
+#include <cstdint>
+
+#include "dbms.h"
+#include "../storage/FlatHash.h"
+#include "../storage/RWLock.h"
+#include "../mmap_filesystem/Filesystem.h"
+
+/*
+ *      Catalog ---
+ *
+ *      The document ids of every project.  Each project's DocSet is a file of its own,
+ *      __PROJECT__<name>, read the first time the project is used; the __CATALOG__ file only
+ *      lists the names.  So starting up reads the names and nothing else, and only the projects
+ *      being queried take memory.
+ *
+ *      Changes are not written to the project files but appended to the __CATALOG_LOG__ file:
+ *      the ids each project gained and lost since the last checkpoint, from the set's journal.
+ *      A checkpoint costs as much as what changed, whatever the size of the projects.  What
+ *      the log holds for a project is kept in memory, netted out, and applied whenever its file
+ *      is read.  Once the log is larger than its limit, save folds it into the project files
+ *      and starts it again.  A new project, or a set changed as a whole, is written to its file
+ *      and the log only notes that.
+ *
+ *      The shell checkpoints a project after every command that writes to it, together with the
+ *      next UUID, the indexes, statistics and views, and then flushes the filesystem's metadata,
+ *      which the log and the file of a new set are only found again with.  So a crash only loses
+ *      the changes of the command it interrupts.
+ *
+ *      Loaded sets are kept in LRU order.  When they take more than the budget the coldest ones
+ *      nobody is using are dropped, after a checkpoint of their changes.
+ *
+ *      The sets are handed out like ConcurrentHash does: read and update run a function on a
+ *      set while it is locked, shared or exclusive.  The function must not use the catalog
+ *      again.  Sets in use are never dropped, even over the budget.
+ */
+
+class Catalog {
+public:
+	Catalog(size_t budget_, uint64_t logLimit_);
+	~Catalog();
+
+	// Read the project names and the log, moving a catalog kept in __DB_METADATA__ to one file
+	// per project.
+	void load(FILESYSTEM *fs_);
+	// Checkpoint the changes of every loaded set, and fold the log into the project files if it
+	// grew too large.  One save at a time.
+	void save();
+	// Write every project the log has changes for to its file and empty the log.
+	void compact();
+	// Checkpoint the changes of one project, as the command that made them ends, and compact if
+	// the log grew too large.  They survive a crash once the filesystem's metadata is flushed.
+	void checkpoint(const std::string &project);
+
+	bool contains(const std::string &project);
+	size_t count(const std::string &project) { return contains(project); }
+	std::vector<std::string> keys();
+
+	// f(docs) with the project's set locked shared.  False, without calling f, if it is missing.
+	template <class F>
+	bool read(const std::string &project, F f) {
+		Entry *e = pin(project, false);
+		if (e == NULL) {
+			return false;
+		}
+		{
+			Storage::SharedGuard g(e->lock);
+			f(e->docs);
+		}
+		unpin(e);
+		return true;
+	}
+
+	// f(a, b) for the sets of two projects, locked shared in order.
+	template <class F>
+	bool read(const std::string &a, const std::string &b, F f) {
+		Entry *x = pin(a, false);
+		if (x == NULL) {
+			return false;
+		}
+		Entry *y = pin(b, false);
+		if (y == NULL) {
+			unpin(x);
+			return false;
+		}
+		if (x == y) {
+			Storage::SharedGuard g(x->lock);
+			f(x->docs, x->docs);
+		} else {
+			Storage::SharedGuard first(x < y ? x->lock : y->lock);
+			Storage::SharedGuard second(x < y ? y->lock : x->lock);
+			f(x->docs, y->docs);
+		}
+		unpin(y);
+		unpin(x);
+		return true;
+	}
+
+	// f(docs) with the project's set locked exclusively.  False, without calling f, if it is missing.
+	template <class F>
+	bool update(const std::string &project, F f) {
+		Entry *e = pin(project, false);
+		if (e == NULL) {
+			return false;
+		}
+		changed(e, f);
+		return true;
+	}
+
+	// Like update, but the project is added, empty, if it is missing.
+	template <class F>
+	void upsert(const std::string &project, F f) {
+		changed(pin(project, true), f);
+	}
+
+	size_t size();
+	// Bytes of sets in memory.
+	size_t memory();
+	void print(std::ostream &os);
+
+	uint64_t loads;
+	uint64_t evictions;
+	uint64_t compactions;
+private:
+	struct Entry {
+		std::string name;
+		Storage::RWLock lock;
+		DOCDS docs;
+		DOCDS::Journal pending;               // changes to docs not in the log yet
+		DOCDS::Journal logged;                // changes in the log but not in the project's file
+		bool loaded;
+		int pins;
+		std::atomic<uint64_t> bytes;          // of docs and pending, set under lock
+		uint64_t counted;                     // of bytes, in used
+		std::list<Entry*>::iterator lru;
+
+		explicit Entry(const std::string &name_) : name(name_), loaded(false), pins(0), bytes(0), counted(0) {}
+	};
+
+	std::mutex mutex;                         // guards everything below but the sets
+	Storage::FlatHash<std::string, Entry*> entries;
+	std::list<Entry*> lru;                    // loaded sets, hottest first
+	size_t budget;
+	size_t used;
+	uint64_t logLimit;
+	File log;
+	FILESYSTEM *fs;
+
+	// The entry of a project, loaded and held in memory until unpin.  NULL if it is missing and
+	// not to be created.
+	Entry *pin(const std::string &project, bool create);
+	void unpin(Entry *e);
+
+	template <class F>
+	void changed(Entry *e, F f) {
+		{
+			Storage::ExclusiveGuard g(e->lock);
+			e->docs.attach(&e->pending);
+			f(e->docs);
+			e->docs.attach(NULL);
+			e->bytes = e->docs.memory() + e->pending.memory();
+		}
+		unpin(e);
+	}
+
+	// Append the pending changes of a set to the log.  With mutex held and the set not changing.
+	void checkpoint(Entry *e);
+	bool logFull();
+	// Apply the records of the log to the entries, adding the projects it names.
+	void replay(const char *buffer, uint64_t size);
+	void readSet(Entry *e);
+	void writeSet(Entry *e);
+	void writeNames();
+	// Drop unused sets, coldest first, until the rest fit the budget.  Called with mutex held.
+	void evict();
+
+	Catalog(const Catalog&);
+	Catalog& operator=(const Catalog&);
+};
+
+#endif
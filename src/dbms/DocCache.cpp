@@ -0,0 +1,195 @@
+#include <algorithm>
+
+#include "DocCache.h"
+#include "../utils/Util.h"
+
+// Bytes an entry costs on top of its document: the entry, its list node and its map slot.
+static const size_t ENTRY_OVERHEAD = 128;
+
+/*
+ *      FrequencySketch
+ */
+
+FrequencySketch::FrequencySketch(size_t width): counts(ROWS * width, 0), mask(width - 1), additions(0), sampleSize(10 * width) {}
+
+size_t FrequencySketch::index(uint64_t hash, int row) const {
+	// Four indexes from the two halves of one hash (Kirsch and Mitzenmacher)
+	uint64_t h = (hash >> 32) + (uint64_t)row * (hash & 0xffffffff);
+	return row * (mask + 1) + (h & mask);
+}
+
+void FrequencySketch::increment(uint64_t hash) {
+	bool added = false;
+	for (int r = 0; r < ROWS; ++r) {
+		uint8_t &c = counts[index(hash, r)];
+		if (c < 15) {
+			++c;
+			added = true;
+		}
+	}
+	if (added && ++additions >= sampleSize) {
+		age();
+	}
+}
+
+uint8_t FrequencySketch::frequency(uint64_t hash) const {
+	uint8_t f = 15;
+	for (int r = 0; r < ROWS; ++r) {
+		f = std::min(f, counts[index(hash, r)]);
+	}
+	return f;
+}
+
+void FrequencySketch::age() {
+	for (auto it = counts.begin(); it != counts.end(); ++it) {
+		*it >>= 1;
+	}
+	additions /= 2;
+}
+
+/*
+ *      DocCache
+ */
+
+DocCache::DocCache(size_t budget_): hits(0), misses(0), evictions(0), rejected(0) {
+	size_t shard = budget_ / DOC_CACHE_SHARDS;
+	windowBudget = shard / 100;
+	mainBudget = shard - windowBudget;
+	protectedBudget = mainBudget / 5 * 4;
+}
+
+DocCache::Handle DocCache::get(uint64_t id) {
+	uint64_t hash = Hash64(reinterpret_cast<const char*>(&id), sizeof(id));
+	Shard &s = shards[hash % DOC_CACHE_SHARDS];
+	std::lock_guard<std::mutex> guard(s.lock);
+	s.sketch.increment(hash);
+	auto found = s.entries.find(id);
+	if (found == s.entries.end()) {
+		++misses;
+		return Handle();
+	}
+	List::iterator it = found->second;
+	if (it->region == PROBATION) {
+		move(s, it, PROTECTED);
+		while (s.bytes[PROTECTED] > protectedBudget) {
+			move(s, std::prev(s.lists[PROTECTED].end()), PROBATION);
+		}
+	} else {
+		move(s, it, it->region);
+	}
+	++hits;
+	return Handle(it->stored, &it->stored->doc);
+}
+
+void DocCache::put(uint64_t id, const rapidjson::Value &doc, size_t bytes) {
+	uint64_t hash = Hash64(reinterpret_cast<const char*>(&id), sizeof(id));
+	Shard &s = shards[hash % DOC_CACHE_SHARDS];
+	// Parsed documents take about twice their JSON
+	std::shared_ptr<Stored> stored = std::make_shared<Stored>(doc, std::max<size_t>(2 * bytes, 256));
+
+	std::lock_guard<std::mutex> guard(s.lock);
+	auto found = s.entries.find(id);
+	if (found != s.entries.end()) {
+		drop(s, found->second);
+	}
+	Entry e;
+	e.id = id;
+	e.hash = hash;
+	e.stored = stored;
+	e.bytes = stored->allocator.Capacity() + sizeof(Stored) + ENTRY_OVERHEAD;
+	e.region = WINDOW;
+	s.lists[WINDOW].push_front(e);
+	s.bytes[WINDOW] += e.bytes;
+	s.entries[id] = s.lists[WINDOW].begin();
+	admit(s);
+}
+
+void DocCache::erase(uint64_t id) {
+	uint64_t hash = Hash64(reinterpret_cast<const char*>(&id), sizeof(id));
+	Shard &s = shards[hash % DOC_CACHE_SHARDS];
+	std::lock_guard<std::mutex> guard(s.lock);
+	auto found = s.entries.find(id);
+	if (found != s.entries.end()) {
+		drop(s, found->second);
+	}
+}
+
+void DocCache::clear() {
+	for (size_t i = 0; i < DOC_CACHE_SHARDS; ++i) {
+		Shard &s = shards[i];
+		std::lock_guard<std::mutex> guard(s.lock);
+		s.entries.clear();
+		for (int r = WINDOW; r <= PROTECTED; ++r) {
+			s.lists[r].clear();
+			s.bytes[r] = 0;
+		}
+	}
+}
+
+size_t DocCache::memory() const {
+	size_t total = 0;
+	for (size_t i = 0; i < DOC_CACHE_SHARDS; ++i) {
+		std::lock_guard<std::mutex> guard(shards[i].lock);
+		total += shards[i].bytes[WINDOW] + shards[i].bytes[PROBATION] + shards[i].bytes[PROTECTED];
+	}
+	return total;
+}
+
+size_t DocCache::size() const {
+	size_t total = 0;
+	for (size_t i = 0; i < DOC_CACHE_SHARDS; ++i) {
+		std::lock_guard<std::mutex> guard(shards[i].lock);
+		total += shards[i].entries.size();
+	}
+	return total;
+}
+
+void DocCache::print(std::ostream &os) const {
+	uint64_t lookups = hits + misses;
+	os << "Cached documents: " << size() << " (" << memory() << " of " << DOC_CACHE_SHARDS * (windowBudget + mainBudget) << " bytes)"
+		<< std::endl;
+	os << "Hits: " << hits << ", misses: " << misses;
+	if (lookups) {
+		os << " (" << 100.0 * hits / lookups << "% hit)";
+	}
+	os << ", evictions: " << evictions << ", not admitted: " << rejected << std::endl;
+}
+
+void DocCache::move(Shard &s, List::iterator it, Region to) {
+	s.bytes[it->region] -= it->bytes;
+	s.bytes[to] += it->bytes;
+	s.lists[to].splice(s.lists[to].begin(), s.lists[it->region], it);
+	it->region = to;
+}
+
+void DocCache::drop(Shard &s, List::iterator it) {
+	s.bytes[it->region] -= it->bytes;
+	s.entries.erase(it->id);
+	s.lists[it->region].erase(it);
+}
+
+void DocCache::admit(Shard &s) {
+	while (s.bytes[WINDOW] > windowBudget) {
+		List::iterator candidate = std::prev(s.lists[WINDOW].end());
+		if (candidate->bytes > mainBudget) {
+			drop(s, candidate);
+			++rejected;
+			continue;
+		}
+		if (s.bytes[PROBATION] + s.bytes[PROTECTED] + candidate->bytes > mainBudget) {
+			// The candidate has to be asked for more often than the next document to go.
+			List &victims = s.lists[PROBATION].empty() ? s.lists[PROTECTED] : s.lists[PROBATION];
+			if (s.sketch.frequency(candidate->hash) <= s.sketch.frequency(victims.back().hash)) {
+				drop(s, candidate);
+				++rejected;
+				continue;
+			}
+			while (s.bytes[PROBATION] + s.bytes[PROTECTED] + candidate->bytes > mainBudget) {
+				List &full = s.lists[PROBATION].empty() ? s.lists[PROTECTED] : s.lists[PROBATION];
+				drop(s, std::prev(full.end()));
+				++evictions;
+			}
+		}
+		move(s, candidate, PROBATION);
+	}
+}
@@ -0,0 +1,118 @@
+#ifndef DOCCACHE_H_
+#define DOCCACHE_H_
+
+#include <list>
+#include <mutex>
+#include <memory>
+#include <vector>
+#include <ostream>
+#include <atomic>
+#include <unordered_map>
+#include <cstdint>
+#include <rapidjson/document.h>
+
+// Independently locked parts of the document cache, so parallel scans rarely wait on each other.
+const size_t DOC_CACHE_SHARDS = 16;
+
+/*
+ *      FrequencySketch ---
+ *
+ *      Count-min sketch of how often keys were asked for: four rows of saturating 4 bit
+ *      counts (kept in bytes).  After ten times as many increments as a row has counters every
+ *      count is halved, so the sketch follows what is popular now rather than ever.
+ */
+
+class FrequencySketch {
+public:
+	explicit FrequencySketch(size_t width = 4096);
+	void increment(uint64_t hash);
+	uint8_t frequency(uint64_t hash) const;
+private:
+	static const int ROWS = 4;
+	std::vector<uint8_t> counts;
+	size_t mask;
+	size_t additions;
+	size_t sampleSize;
+
+	size_t index(uint64_t hash, int row) const;
+	void age();
+};
+
+/*
+ *      DocCache ---
+ *
+ *      Parsed documents by id, so documents that are read over and over are neither read from
+ *      their blocks nor parsed again.  Each document is copied into an allocator of its own
+ *      sized to it and handed out read only; readers copy it into their row.  The write paths
+ *      erase the documents they change.
+ *
+ *      Eviction is W-TinyLFU, by bytes.  New documents go to a small LRU window (1% of the
+ *      budget).  Documents pushed out of the window only enter the main part if they were
+ *      asked for more often, by the FrequencySketch, than the document they would evict; so a
+ *      scan over a big project does not flush out the documents that are read all the time.
+ *      The main part is a segmented LRU: documents read again while on probation move to the
+ *      protected segment (80% of it), those falling out of it go back on probation.
+ */
+
+class DocCache {
+public:
+	typedef std::shared_ptr<const rapidjson::Document> Handle;
+
+	explicit DocCache(size_t budget_);
+
+	// The cached document with this id, or null.  Counts a hit or a miss.
+	Handle get(uint64_t id);
+	// Offer a document just parsed after a miss.  'bytes' is the size of its JSON.
+	void put(uint64_t id, const rapidjson::Value &doc, size_t bytes);
+	void erase(uint64_t id);
+	void clear();
+
+	size_t memory() const;
+	size_t size() const;
+	void print(std::ostream &os) const;
+
+	std::atomic<uint64_t> hits;
+	std::atomic<uint64_t> misses;
+	std::atomic<uint64_t> evictions;
+	std::atomic<uint64_t> rejected;       // left the window but were not admitted
+private:
+	struct Stored {
+		rapidjson::MemoryPoolAllocator<> allocator;
+		rapidjson::Document doc;
+		Stored(const rapidjson::Value &v, size_t chunk): allocator(chunk), doc(&allocator) {
+			doc.CopyFrom(v, allocator);
+		}
+	};
+
+	enum Region { WINDOW, PROBATION, PROTECTED };
+
+	struct Entry {
+		uint64_t id;
+		uint64_t hash;
+		std::shared_ptr<Stored> stored;
+		size_t bytes;
+		Region region;
+	};
+	typedef std::list<Entry> List;
+
+	struct Shard {
+		mutable std::mutex lock;
+		std::unordered_map<uint64_t, List::iterator> entries;
+		List lists[3];              // by Region, most recently used first
+		size_t bytes[3];
+		FrequencySketch sketch;
+		Shard() { bytes[0] = bytes[1] = bytes[2] = 0; }
+	};
+
+	size_t windowBudget;
+	size_t protectedBudget;
+	size_t mainBudget;
+	Shard shards[DOC_CACHE_SHARDS];
+
+	void move(Shard &s, List::iterator it, Region to);
+	void drop(Shard &s, List::iterator it);
+	// Make the window fit again, offering what falls out of it to the main part.
+	void admit(Shard &s);
+};
+
+#endif
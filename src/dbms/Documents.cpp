@@ -0,0 +1,506 @@
+#include <cstring>
+#include <cstdint>
+#include <algorithm>
+
+#include "Documents.h"
+
+static const std::string SpecialValueComparisons[] = { "#gt", "#lt", "#eq", "#contains", "#starts", "#ends" };
+static const std::string SpecialKeyComparisons[] = { "#exists", "#isnull", "#isstr", "#isnum", "#isbool", "#isarray", "#isobj" };
+
+// Assume doc is an array or an object.
+rapidjson::Document processFields(rapidjson::Document &doc) {
+    rapidjson::Document newDoc;
+    newDoc.SetArray();
+
+    // Build an array of unique keys
+    for (rapidjson::Value::ConstValueIterator src = doc.Begin(); src != doc.End(); ++src) {
+        if (src->IsString()) {
+            const char *srcVal = src->GetString();
+            //std::string srcVal = src->GetString();
+            bool match = false;
+            for (rapidjson::Value::ConstValueIterator dest = newDoc.Begin(); dest != newDoc.End(); ++dest) {
+                const char* destVal = dest->GetString();
+                //std::string destVal = dest->GetString();
+                //if (srcVal.compare(destVal) == 0) {
+                if (strcmp(srcVal,destVal) == 0) {
+                    match = true;
+                    break;
+                }
+            }
+            if (!match) {
+                rapidjson::Value newVal(srcVal, newDoc.GetAllocator());
+                newDoc.PushBack(newVal, newDoc.GetAllocator());
+            }
+            }
+        }
+
+        return newDoc;
+    }
+
+    rapidjson::Document extractAggregates(rapidjson::Document &fields ) {
+
+        rapidjson::Document newArray;
+        newArray.SetArray();
+
+        for (rapidjson::Value::ConstValueIterator it = fields.Begin(); it != fields.End(); ++it) {
+            if (it->GetType() == rapidjson::kObjectType) {
+                const rapidjson::Value& v_tmp = *it;
+                rapidjson::Value v(v_tmp, newArray.GetAllocator());
+                newArray.PushBack(v, newArray.GetAllocator());
+            }
+        }
+        return newArray;
+    }
+
+
+    // Copy all fields from src to dest
+    int selectAllFields(rapidjson::Document *src, rapidjson::Value *dest, rapidjson::Document::AllocatorType &allocator) {
+        int count = 0;
+        rapidjson::Document &doc = *src;
+        for (rapidjson::Value::ConstMemberIterator field = doc.MemberBegin(); field != doc.MemberEnd(); ++field) {
+            std::string fieldTxt = field->name.GetString();
+            rapidjson::Value k(fieldTxt.c_str(), allocator);
+            rapidjson::Value &v_tmp = doc[fieldTxt.c_str()];
+            rapidjson::Value v(v_tmp, allocator);
+            dest->AddMember(k, v, allocator);
+            count++;
+        }
+        return count;
+    }
+
+    // Copy a subset of fields from src to dest
+    int projectFields(rapidjson::Document *src, rapidjson::Value *dest, rapidjson::Document *fields, rapidjson::Document::AllocatorType &allocator) {
+        rapidjson::Document &doc = *src;
+        int count = 0;
+        for (rapidjson::Value::ConstValueIterator field = fields->Begin(); field != fields->End(); ++field) {
+            if (field->GetType() == rapidjson::kStringType) {
+                std::string fieldTxt = field->GetString();
+                if (doc.HasMember(fieldTxt.c_str())) {
+                    rapidjson::Value k(fieldTxt.c_str(), allocator);
+                    rapidjson::Value &v_tmp = doc[fieldTxt.c_str()];
+                    rapidjson::Value v(v_tmp, allocator);
+                    dest->AddMember(k, v, allocator);
+                    count++;
+                }
+            }
+        }
+        return count;
+    }
+
+    bool validateSpecialValueCompare(std::string &val) {
+        int numSpecials = sizeof(SpecialValueComparisons) / sizeof(SpecialValueComparisons[0]);
+        for (int i=0; i<numSpecials; ++i) {
+            if (SpecialValueComparisons[i].compare(val) == 0) {
+                return true;
+            }
+        }
+        return false;
+    }
+
+    bool validateSpecialKeyCompare(std::string &val) {
+        int numSpecials = sizeof(SpecialKeyComparisons) / sizeof(SpecialKeyComparisons[0]);
+        for (int i=0; i<numSpecials; ++i) {
+            if (SpecialKeyComparisons[i].compare(val) == 0) {
+                return true;
+            }
+        }
+        return false;
+    }
+
+    // Same ordering as std::string::compare, without the copies.
+    static inline int compareStrings(const char *a, size_t aLen, const char *b, size_t bLen) {
+        int c = memcmp(a, b, std::min(aLen, bLen));
+        if (c != 0) {
+            return c;
+        }
+        return aLen < bLen ? -1 : (aLen > bLen ? 1 : 0);
+    }
+
+    // First is the value from the condition.  It may contain special fields... #gt, #lt
+    bool sameValues(rapidjson::Value &first, rapidjson::Value &second, rapidjson::Document::AllocatorType &allocator) {
+        bool foundSpecial = false;
+        std::string specialCompare;
+        rapidjson::Value specialValue;
+
+        // Could be a special condition.
+        if (first.GetType() == rapidjson::kObjectType && second.GetType() != rapidjson::kObjectType) {
+            for (rapidjson::Value::MemberIterator it = first.MemberBegin(); it != first.MemberEnd(); ++it) {
+                specialCompare = it->name.GetString();
+                if (specialCompare[0] == '#') {
+                    foundSpecial = true;
+                    specialValue = rapidjson::Value(first[specialCompare.c_str()], allocator);
+                    break;
+                }
+            }
+            if (!foundSpecial) {
+                return false;
+            }
+        } else {
+            if (first.GetType() != second.GetType()) {
+                return false;
+            }
+        }
+
+        rapidjson::Value condition;
+        rapidjson::Type type;
+        if (foundSpecial) {
+
+            type = specialValue.GetType();
+            if (!validateSpecialValueCompare(specialCompare) || type != second.GetType()) {
+                return false;
+            }
+            condition = rapidjson::Value(specialValue, allocator);
+        } else {
+            type = first.GetType();
+            condition = rapidjson::Value(first, allocator);
+        }
+
+        switch (type) {
+            case rapidjson::kNullType:
+                {
+                    return true;
+                    break;
+                }
+            case rapidjson::kStringType:
+                {
+                    // Compare in place, the strings are not copied out of the documents.
+                    const char *firstStr = condition.GetString();
+                    size_t firstLen = condition.GetStringLength();
+                    const char *secondStr = second.GetString();
+                    size_t secondLen = second.GetStringLength();
+                    if (foundSpecial) {
+                        if (!specialCompare.compare("#gt")) {
+                            return compareStrings(secondStr, secondLen, firstStr, firstLen) > 0;
+                        } else if (!specialCompare.compare("#lt")) {
+                            return compareStrings(secondStr, secondLen, firstStr, firstLen) < 0;
+                        } else if (!specialCompare.compare("#eq")) {
+                            return compareStrings(firstStr, firstLen, secondStr, secondLen) == 0;
+                        } else if (!specialCompare.compare("#contains")) {
+                            if (firstLen == 0) {
+                                return true;
+                            }
+                            return std::search(secondStr, secondStr + secondLen, firstStr, firstStr + firstLen) != secondStr + secondLen;
+                        } else if (!specialCompare.compare("#starts")) {
+                            if (secondLen < firstLen) {
+                                return false;
+                            } else {
+                                return memcmp(secondStr, firstStr, firstLen) == 0;
+                            }
+                        } else if (!specialCompare.compare("#ends")) {
+                            if (secondLen < firstLen) {
+                                return false;
+                            } else {
+                                return memcmp(secondStr + secondLen - firstLen, firstStr, firstLen) == 0;
+                            }
+
+                        }
+                    } else {
+                        return compareStrings(firstStr, firstLen, secondStr, secondLen) == 0;
+                    }
+                    break;
+                }
+            case rapidjson::kNumberType:
+                {
+                    double firstNum;
+                    double secondNum;
+                    if (condition.IsInt()) {
+                        firstNum = (double)condition.GetInt();
+                    } else {
+                        firstNum = condition.GetDouble();
+                    }
+                    if (second.IsInt()) {
+                        secondNum = (double)second.GetInt();
+                    } else {
+                        secondNum = second.GetDouble();
+                    }
+
+                    if (foundSpecial) {
+                        if (!specialCompare.compare("#gt")) {
+                            return secondNum > firstNum;
+                        } else if (!specialCompare.compare("#lt")) {
+                            return secondNum < firstNum;
+                        } else if (!specialCompare.compare("#eq")) {
+                            return secondNum == firstNum;
+                        }
+                    } else {
+                        return firstNum == secondNum;
+                    }
+                    break;
+                }
+            case rapidjson::kFalseType:
+                {
+                    //TODO: Maybe #eq should be supported here
+                    if (foundSpecial) return false;
+                    return true;
+                    break;
+                }
+            case rapidjson::kTrueType:
+                {
+                    //TODO: Maybe #eq should be supported here
+                    if (foundSpecial) return false;
+                    return true;
+                    break;
+                }
+            case rapidjson::kObjectType: // Special case, compare fields recursively.
+                {
+                    for (rapidjson::Value::MemberIterator it = condition.MemberBegin(); it != condition.MemberEnd(); ++it) {
+                        if (!second.HasMember(it->name.GetString())) {
+                            return false;
+                        }
+                        rapidjson::Value &firstEmbed = condition[it->name.GetString()];
+                        rapidjson::Value &secondEmbed = second[it->name.GetString()];
+                        if (!sameValues(firstEmbed, secondEmbed, allocator)) {
+                            return false;
+                        }
+                    }
+                    return true;
+                }
+            case rapidjson::kArrayType:
+                {
+                    // TODO: should the special comparisons work on arrays somehow?
+                    if (foundSpecial) return false;
+                    if (condition.Size() != second.Size()) {
+                        return false;
+                    }
+                    for (rapidjson::SizeType i=0; i < condition.Size(); ++i) {
+                        if (!sameValues(condition[i], second[i], allocator)) {
+                            return false;
+                        }
+                    }
+                    return true;
+                }
+        }
+        return false;
+    }
+
+
+
+    bool documentMatchesConditions(rapidjson::Document &doc, rapidjson::Document &conditions) {
+        auto condIt = conditions.MemberBegin();
+        while (condIt != conditions.MemberEnd()) {
+            std::string condKey = condIt->name.GetString();
+            // Special case for special key comparisons
+            if (validateSpecialKeyCompare(condKey)) {
+                rapidjson::Value &v = conditions[condKey.c_str()];
+                if (v.GetType() != rapidjson::kObjectType) {
+                    return false;
+                }
+                std::string key = v.MemberBegin()->name.GetString();
+                rapidjson::Value &ve = v[key.c_str()];
+
+                // Special case fot exists... 
+                if (condKey.compare("#exists") == 0) {
+                    if (!doc.HasMember(key.c_str()) && ve.GetType() == rapidjson::kTrueType) {
+                        return false;
+                    } else if (doc.HasMember(key.c_str()) && ve.GetType() == rapidjson::kFalseType) {
+                        return false;
+                    } else {
+                        conditions.RemoveMember(condIt);
+                        continue;
+                    }
+                }
+
+                // Everything else relies on the existence of the key
+                if (doc.HasMember(key.c_str())) {
+                    rapidjson::Value &specVal = doc[key.c_str()];
+                    if (condKey.compare("#isnull") == 0) {
+                        if (specVal.GetType() == rapidjson::kNullType && ve.GetType() == rapidjson::kFalseType) {
+                            return false;
+                        } else if (specVal.GetType() != rapidjson::kNullType && ve.GetType() == rapidjson::kTrueType) {
+                            return false;
+                        }
+                    } else if (condKey.compare("#isstr") == 0) {
+                        if (specVal.GetType() == rapidjson::kStringType && ve.GetType() == rapidjson::kFalseType) {
+                            return false;
+                        } else if (specVal.GetType() != rapidjson::kStringType && ve.GetType() == rapidjson::kTrueType) {
+                            return false;
+                        }
+                    } else if (condKey.compare("#isnum") == 0) {
+                        if (specVal.GetType() == rapidjson::kNumberType && ve.GetType() == rapidjson::kFalseType) {
+                            return false;
+                        } else if (specVal.GetType() != rapidjson::kNumberType && ve.GetType() == rapidjson::kTrueType) {
+                            return false;
+                        }
+                    } else if (condKey.compare("#isbool") == 0) {
+                        if ((specVal.GetType() == rapidjson::kFalseType || specVal.GetType() == rapidjson::kTrueType) && 
+                                ve.GetType() == rapidjson::kFalseType) {
+                            return false;
+                        } else if ((specVal.GetType() != rapidjson::kFalseType && specVal.GetType() != rapidjson::kTrueType) && 
+                                ve.GetType() == rapidjson::kTrueType) {
+                            return false;
+                        }
+                    } else if (condKey.compare("#isobj") == 0) {
+                        if (specVal.GetType() == rapidjson::kObjectType && ve.GetType() == rapidjson::kFalseType) {
+                            return false;
+                        } else if (specVal.GetType() != rapidjson::kObjectType && ve.GetType() == rapidjson::kTrueType) {
+                            return false;
+                        }
+                    } else if (condKey.compare("#isarray") == 0) {
+                        if (specVal.GetType() == rapidjson::kArrayType && ve.GetType() == rapidjson::kFalseType) {
+                            return false;
+                        } else if (specVal.GetType() != rapidjson::kArrayType && ve.GetType() == rapidjson::kTrueType) {
+                            return false;
+                        }
+                    }
+                } else {
+                    return false;
+                }
+            } else {
+                if (!doc.HasMember(condKey.c_str())) {
+                    return false;
+                }
+                rapidjson::Value &condVal = conditions[condKey.c_str()];
+                rapidjson::Value &docVal = doc[condKey.c_str()];
+                if (!sameValues(condVal, docVal, conditions.GetAllocator())) {
+                    return false;
+                }
+            }
+            conditions.RemoveMember(condIt);
+        }
+        return true;
+    }
+
+    void deleteFields(rapidjson::Document *doc, rapidjson::Document *fields) {
+        for (rapidjson::Value::ConstValueIterator it = fields->Begin(); it != fields->End(); it++) {
+            const rapidjson::Value &field = *it;
+            if (doc->HasMember(field.GetString())) {
+                doc->RemoveMember(field.GetString());
+            }
+        }
+    }
+
+// The object holding the last step of 'path', and that step in 'leaf'.  NULL if a step on the way is
+// missing and not to be created, or is not an object, or if a step is empty (the parser rejects those).
+static rapidjson::Value *parentOf(rapidjson::Value &doc, const char *path, bool create, rapidjson::Document::AllocatorType &allocator,
+        rapidjson::Value &leaf) {
+    rapidjson::Value *v = &doc;
+    const char *start = path;
+    const char *dot;
+    while ((dot = strchr(start, '.')) != NULL) {
+        if (!v->IsObject() || dot == start) {
+            return NULL;
+        }
+        rapidjson::Value name(rapidjson::StringRef(start, (rapidjson::SizeType)(dot - start)));
+        rapidjson::Value::MemberIterator m = v->FindMember(name);
+        if (m != v->MemberEnd()) {
+            v = &m->value;
+        } else if (create) {
+            v->AddMember(rapidjson::Value(start, (rapidjson::SizeType)(dot - start), allocator), rapidjson::Value(rapidjson::kObjectType),
+                    allocator);
+            v = &(v->MemberEnd() - 1)->value;
+        } else {
+            return NULL;
+        }
+        start = dot + 1;
+    }
+    if (!v->IsObject() || *start == '\0') {
+        return NULL;
+    }
+    leaf.SetString(rapidjson::StringRef(start));
+    return v;
+}
+
+static void setField(rapidjson::Value &doc, const char *path, const rapidjson::Value &value, rapidjson::Document::AllocatorType &allocator) {
+    rapidjson::Value leaf;
+    rapidjson::Value *parent = parentOf(doc, path, true, allocator, leaf);
+    if (!parent) {
+        return;
+    }
+    rapidjson::Value::MemberIterator m = parent->FindMember(leaf);
+    if (m != parent->MemberEnd()) {
+        m->value.CopyFrom(value, allocator);
+    } else {
+        parent->AddMember(rapidjson::Value(leaf.GetString(), leaf.GetStringLength(), allocator), rapidjson::Value(value, allocator), allocator);
+    }
+}
+
+static void incField(rapidjson::Value &doc, const char *path, const rapidjson::Value &by, rapidjson::Document::AllocatorType &allocator) {
+    rapidjson::Value leaf;
+    rapidjson::Value *parent = by.IsNumber() ? parentOf(doc, path, true, allocator, leaf) : NULL;
+    if (!parent) {
+        return;
+    }
+    rapidjson::Value::MemberIterator m = parent->FindMember(leaf);
+    if (m == parent->MemberEnd()) {
+        parent->AddMember(rapidjson::Value(leaf.GetString(), leaf.GetStringLength(), allocator), rapidjson::Value(by, allocator), allocator);
+    } else if (m->value.IsInt64() && by.IsInt64()) {
+        int64_t a = m->value.GetInt64();
+        int64_t b = by.GetInt64();
+        // A sum past the int64 range becomes a double, as in Accumulator::addInt
+        if ((b > 0 && a > INT64_MAX - b) || (b < 0 && a < INT64_MIN - b)) {
+            m->value.SetDouble((double)a + (double)b);
+        } else {
+            m->value.SetInt64(a + b);
+        }
+    } else if (m->value.IsNumber()) {
+        m->value.SetDouble(m->value.GetDouble() + by.GetDouble());
+    }
+}
+
+static void unsetField(rapidjson::Value &doc, const char *path, rapidjson::Document::AllocatorType &allocator) {
+    rapidjson::Value leaf;
+    rapidjson::Value *parent = parentOf(doc, path, false, allocator, leaf);
+    if (!parent) {
+        return;
+    }
+    rapidjson::Value::MemberIterator m = parent->FindMember(leaf);
+    if (m != parent->MemberEnd()) {
+        parent->EraseMember(m);
+    }
+}
+
+static void pushField(rapidjson::Value &doc, const char *path, const rapidjson::Value &value, rapidjson::Document::AllocatorType &allocator) {
+    rapidjson::Value leaf;
+    rapidjson::Value *parent = parentOf(doc, path, true, allocator, leaf);
+    if (!parent) {
+        return;
+    }
+    rapidjson::Value::MemberIterator m = parent->FindMember(leaf);
+    if (m == parent->MemberEnd()) {
+        rapidjson::Value array(rapidjson::kArrayType);
+        array.PushBack(rapidjson::Value(value, allocator), allocator);
+        parent->AddMember(rapidjson::Value(leaf.GetString(), leaf.GetStringLength(), allocator), array, allocator);
+    } else if (m->value.IsArray()) {
+        m->value.PushBack(rapidjson::Value(value, allocator), allocator);
+    }
+}
+
+void applyUpdates(rapidjson::Document &doc, const rapidjson::Value &updates) {
+    rapidjson::Document::AllocatorType &allocator = doc.GetAllocator();
+    for (rapidjson::Value::ConstMemberIterator update = updates.MemberBegin(); update != updates.MemberEnd(); ++update) {
+        const char *key = update->name.GetString();
+        const rapidjson::Value &args = update->value;
+        if (!strcmp(key, "#unset")) {
+            if (args.IsArray()) {
+                for (rapidjson::Value::ConstValueIterator it = args.Begin(); it != args.End(); ++it) {
+                    if (it->IsString()) {
+                        unsetField(doc, it->GetString(), allocator);
+                    }
+                }
+            } else if (args.IsObject()) {
+                for (rapidjson::Value::ConstMemberIterator it = args.MemberBegin(); it != args.MemberEnd(); ++it) {
+                    unsetField(doc, it->name.GetString(), allocator);
+                }
+            }
+        } else if (args.IsObject() && (!strcmp(key, "#set") || !strcmp(key, "#inc") || !strcmp(key, "#push"))) {
+            for (rapidjson::Value::ConstMemberIterator it = args.MemberBegin(); it != args.MemberEnd(); ++it) {
+                const char *path = it->name.GetString();
+                if (!strcmp(key, "#set")) {
+                    setField(doc, path, it->value, allocator);
+                } else if (!strcmp(key, "#inc")) {
+                    incField(doc, path, it->value, allocator);
+                } else {
+                    pushField(doc, path, it->value, allocator);
+                }
+            }
+        } else {
+            // Insert or update the field
+            if (doc.HasMember(key)) {
+                doc.RemoveMember(key);
+            }
+            rapidjson::Value k(key, allocator);
+            rapidjson::Value v(args, allocator);
+            doc.AddMember(k, v, allocator);
+        }
+    }
+}
@@ -0,0 +1,40 @@
+#ifndef DOCUMENTS_H_
+#define DOCUMENTS_H_
+
+#include <string>
+#include <rapidjson/document.h>
+
+/*
+ *      Documents ---
+ *
+ *      Helpers shared by the executor operators that work on a single parsed document:
+ *      field lists, projection and matching a document against a where clause.
+ */
+
+// Unique field names of a select.  Aggregates read their fields from the document itself.
+rapidjson::Document processFields(rapidjson::Document &doc);
+rapidjson::Document extractAggregates(rapidjson::Document &fields);
+
+int selectAllFields(rapidjson::Document *src, rapidjson::Value *dest, rapidjson::Document::AllocatorType &allocator);
+int projectFields(rapidjson::Document *src, rapidjson::Value *dest, rapidjson::Document *fields, rapidjson::Document::AllocatorType &allocator);
+
+bool validateSpecialValueCompare(std::string &val);
+bool validateSpecialKeyCompare(std::string &val);
+bool sameValues(rapidjson::Value &first, rapidjson::Value &second, rapidjson::Document::AllocatorType &allocator);
+
+// Consumes 'conditions', pass a copy of the where clause.
+bool documentMatchesConditions(rapidjson::Document &doc, rapidjson::Document &conditions);
+
+void deleteFields(rapidjson::Document *doc, rapidjson::Document *fields);
+
+// Apply the WITH clause of an UPDATE to a document.  A plain member replaces the top level field of
+// that name.  The operators take fields by dotted path, and #set, #inc and #push create the objects on
+// the way:
+//     "#set": { path: value, ... }        the field becomes value
+//     "#inc": { path: number, ... }       a number field is increased by number, a missing one set to it
+//     "#unset": [ path, ... ]             the fields are removed (or the keys of an object)
+//     "#push": { path: value, ... }       value is appended to an array field, a missing one becomes [ value ]
+// Changed fields keep their place in the document.  Fields of the wrong type are left as they are.
+void applyUpdates(rapidjson::Document &doc, const rapidjson::Value &updates);
+
+#endif
@@ -0,0 +1,854 @@
+#include <chrono>
+#include <cmath>
+#include <random>
+#include <cstring>
+#include <cstdlib>
+#include <algorithm>
+#include <iostream>
+
+#include <pretty.h>
+#include "../include/config.h"
+#include "Executor.h"
+#include "Documents.h"
+#include "Vectorized.h"
+#include "Parallel.h"
+#include "GroupBy.h"
+#include "Sort.h"
+#include "Join.h"
+#include "View.h"
+#include "../threading/ThreadPool.h"
+
+/*
+ *      Row / Batch
+ */
+
+void Row::reset() {
+	out.SetNull();
+	doc.SetNull();
+	// Release the previous document, a reused row would otherwise keep growing.
+	doc.GetAllocator().Clear();
+	summary = false;
+}
+
+void Row::swap(Row &other) {
+	std::swap(id, other.id);
+	std::swap(file, other.file);
+	rapidjson::Document tmp(std::move(doc));
+	doc = std::move(other.doc);
+	other.doc = std::move(tmp);
+	out.Swap(other.out);
+	std::swap(summary, other.summary);
+}
+
+Batch::Batch(size_t capacity): size(0) {
+	for (size_t i = 0; i < capacity; ++i) {
+		rows.push_back(new Row());
+	}
+}
+
+Batch::~Batch() {
+	for (auto it = rows.begin(); it != rows.end(); ++it) {
+		delete *it;
+	}
+}
+
+/*
+ *      Operator
+ */
+
+Operator::~Operator() {
+	for (auto it = children.begin(); it != children.end(); ++it) {
+		delete *it;
+	}
+}
+
+bool Operator::next(Row &row) {
+	auto start = std::chrono::steady_clock::now();
+	bool got = produce(row);
+	millis += std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+	if (got) {
+		++rowsOut;
+	}
+	return got;
+}
+
+size_t Operator::next(Batch &batch) {
+	size_t n = 0;
+	while (n < batch.rows.size() && next(*batch.rows[n])) {
+		++n;
+	}
+	batch.size = n;
+	return n;
+}
+
+void Operator::close() {
+	for (auto it = children.begin(); it != children.end(); ++it) {
+		(*it)->close();
+	}
+	if (node) {
+		node->actualRows = rowsOut;
+		node->rowsIn = rowsIn;
+		node->millis = millis;
+	}
+}
+
+bool Operator::pull(Row &row, size_t child) {
+	if (children[child]->next(row)) {
+		++rowsIn;
+		return true;
+	}
+	return false;
+}
+
+/*
+ *      Access
+ */
+
+void DocSource::load(Row &row, uint64_t id) {
+	row.reset();
+	row.id = id;
+	row.file = fs.open_file(id);
+	++rowsIn;
+	if (cache) {
+		DocCache::Handle cached = cache->get(id);
+		if (cached) {
+			row.doc.CopyFrom(*cached, row.doc.GetAllocator());
+			return;
+		}
+	}
+	char *c = fs.read(&row.file);
+	row.doc.Parse(c);
+	free(c);
+	if (cache) {
+		cache->put(id, row.doc, row.file.size);
+	}
+}
+
+bool DocScan::produce(Row &row) {
+	if (it == end) {
+		return false;
+	}
+	load(row, *it);
+	++it;
+	return true;
+}
+
+bool IndexSeek::produce(Row &row) {
+	if (!started) {
+		std::vector<uint64_t> ids;
+		plan.candidates(indexes, ids);
+		docs.intersect(ids, found);
+		it = found.begin();
+		started = true;
+	}
+	if (it == found.end()) {
+		return false;
+	}
+	load(row, *it);
+	++it;
+	return true;
+}
+
+/*
+ *      Filter / Limit / Project
+ */
+
+bool Filter::produce(Row &row) {
+	while (pull(row)) {
+		// Matching consumes the conditions, work on a copy.
+		rapidjson::Document spare;
+		spare.CopyFrom(where, spare.GetAllocator());
+		if (documentMatchesConditions(row.doc, spare)) {
+			return true;
+		}
+	}
+	return false;
+}
+
+bool Limit::produce(Row &row) {
+	if (limit >= 0 && rowsOut >= (uint64_t)limit) {
+		return false;
+	}
+	return pull(row);
+}
+
+Project::Project(Operator *child, rapidjson::Document &fields_, PlanNode *node_): Operator(node_), fields(fields_), selectAll(false) {
+	add(child);
+	for (rapidjson::Value::ConstValueIterator it = fields.Begin(); it != fields.End(); ++it) {
+		if (it->IsString() && strcmp(it->GetString(), "*") == 0) {
+			selectAll = true;
+		}
+	}
+}
+
+bool Project::produce(Row &row) {
+	if (!pull(row)) {
+		return false;
+	}
+	row.out.SetObject();
+	if (selectAll) {
+		selectAllFields(&row.doc, &row.out, row.doc.GetAllocator());
+	} else {
+		projectFields(&row.doc, &row.out, &fields, row.doc.GetAllocator());
+	}
+	return true;
+}
+
+/*
+ *      Aggregate
+ */
+
+bool Aggregate::produce(Row &row) {
+	if (done) {
+		return false;
+	}
+	while (pull(row)) {
+		aggregator->handle(row.doc);
+		// Rows without any of the selected fields only fed the aggregates.
+		if (row.out.MemberCount() > 0) {
+			return true;
+		}
+	}
+
+	done = true;
+	if (!summarize) {
+		return false;
+	}
+	row.reset();
+	row.summary = true;
+	row.out.SetObject();
+	aggregator->summarize(row.out, row.doc.GetAllocator());
+	return row.out.MemberCount() > 0;
+}
+
+/*
+ *      Output
+ */
+
+bool Output::produce(Row &row) {
+	while (pull(row)) {
+		if (row.out.MemberCount() == 0) {
+			continue;
+		}
+		found = true;
+		if (!quiet) {
+			if (row.summary) {
+				printSummary(std::cout, row.out);
+			} else {
+				std::cout << toString(&row.out) << std::endl;
+			}
+		}
+		return true;
+	}
+	return false;
+}
+
+/*
+ *      UpdateDocs / DeleteDocs
+ */
+
+bool UpdateDocs::produce(Row &row) {
+	if (!pull(row)) {
+		return false;
+	}
+	rapidjson::Document &doc = row.doc;
+	uint64_t id = row.id;
+	indexes.remove(project, id, doc);
+	stats.remove(project, doc);
+	if (views) {
+		views->remove(project, doc);
+	}
+
+	applyUpdates(doc, updates);
+	text.Clear();
+	writer.Reset(text);
+	doc.Accept(writer);
+	// A document that kept its size, say a counter that kept its number of digits, is patched:
+	// only the blocks that changed are written.
+	if (text.GetSize() == row.file.size) {
+		fs.patch(&row.file, text.GetString(), text.GetSize());
+	} else {
+		fs.write(&row.file, text.GetString(), text.GetSize());
+	}
+	indexes.add(project, id, doc);
+	stats.add(project, doc);
+	if (views) {
+		views->add(project, doc);
+	}
+	if (cache) {
+		cache->erase(row.id);
+	}
+	return true;
+}
+
+DeleteDocs::DeleteDocs(Operator *child, rapidjson::Document &fields_, const std::string &project_, IndexCatalog &indexes_, StatsCatalog &stats_,
+		ViewCatalog *views_, DocCache *cache_, FILESYSTEM &fs_, PlanNode *node_):
+	Operator(node_), fields(fields_), selectAll(false), project(project_), indexes(indexes_), stats(stats_), views(views_), cache(cache_),
+	fs(fs_) {
+	add(child);
+	for (rapidjson::Value::ConstValueIterator it = fields.Begin(); it != fields.End(); ++it) {
+		if (it->IsString() && strcmp(it->GetString(), "*") == 0) {
+			selectAll = true;
+			break;
+		}
+	}
+}
+
+bool DeleteDocs::produce(Row &row) {
+	if (!pull(row)) {
+		return false;
+	}
+	uint64_t id = row.id;
+	indexes.remove(project, id, row.doc);
+	stats.remove(project, row.doc);
+	if (views) {
+		views->remove(project, row.doc);
+	}
+	if (cache) {
+		cache->erase(row.id);
+	}
+
+	if (selectAll) {
+		if (fs.deleteFile(&row.file)) {
+			removed.push_back(row.id);
+		}
+	} else {
+		deleteFields(&row.doc, &fields);
+		std::string newData = toString(&row.doc);
+		fs.write(&row.file, newData.c_str(), newData.size());
+		indexes.add(project, id, row.doc);
+		stats.add(project, row.doc);
+		if (views) {
+			views->add(project, row.doc);
+		}
+	}
+	return true;
+}
+
+/*
+ *      Executor
+ */
+
+Executor::Executor(IndexCatalog &indexes_, StatsCatalog &stats_, ViewCatalog *views_): indexes(indexes_), stats(stats_), views(views_),
+	cache(NULL), vectorized(true), pool(NULL), workers(1),
+	ordered(SCAN_ORDERED), groupMemory(GROUP_MEMORY),
+	sortMemory(SORT_MEMORY), joinMemory(JOIN_MEMORY) {
+	setThreads(SCAN_THREADS > 0 ? SCAN_THREADS : std::thread::hardware_concurrency());
+	setDocCacheMemory(DOC_CACHE_MEMORY);
+}
+
+Executor::~Executor() {
+	delete pool;
+	delete cache;
+}
+
+void Executor::setDocCacheMemory(size_t bytes) {
+	delete cache;
+	cache = bytes > 0 ? new DocCache(bytes) : NULL;
+}
+
+void Executor::setThreads(size_t n) {
+	delete pool;
+	pool = NULL;
+	workers = n > 1 ? n : 1;
+}
+
+// The pool is only started by the first scan that is split up.
+ThreadPool &Executor::threads() {
+	if (!pool) {
+		pool = new ThreadPool(workers);
+	}
+	return *pool;
+}
+
+DOCDS &Executor::scanList(Plan &plan, DOCDS &docs, DOCDS &scratch) {
+	if (!plan.indexed()) {
+		return docs;
+	}
+	std::vector<uint64_t> ids;
+	plan.candidates(indexes, ids);
+	docs.intersect(ids, scratch);
+	return scratch;
+}
+
+Operator *Executor::source(Plan &plan, DOCDS &docs, rapidjson::Document *where, int limit, FILESYSTEM &fs) {
+	Operator *op;
+	if (plan.indexed()) {
+		op = new IndexSeek(plan, docs, indexes, fs, cache);
+	} else {
+		op = new DocScan(docs, fs, plan.access, cache);
+	}
+	if (where) {
+		op = new Filter(op, *where, plan.filter);
+	}
+	if (limit > -1) {
+		op = new Limit(op, limit, plan.limit);
+	}
+	return op;
+}
+
+void Executor::run(Operator *root) {
+	Row row;
+	while (root->next(row)) {
+	}
+	root->close();
+}
+
+// Add what an operator of one range saw to the plan node of its stage.
+template <class Op>
+static void account(PlanNode *node, const Op *op) {
+	if (node && op) {
+		node->actualRows += op->rowsOut;
+		node->rowsIn += op->rowsIn;
+		node->millis += op->millis;
+	}
+}
+
+static bool printBatchResults(Plan &plan, const Aggregator &results, uint64_t rows, bool quiet) {
+	rapidjson::Document summary;
+	summary.SetObject();
+	results.summarize(summary, summary.GetAllocator());
+	bool found = summary.MemberCount() > 0;
+	if (!quiet) {
+		printSummary(std::cout, summary);
+	}
+	if (plan.aggregate) {
+		plan.aggregate->actualRows = found ? 1 : 0;
+		plan.aggregate->detail += " [batch]";
+	}
+	if (plan.project_node) {
+		plan.project_node->actualRows = plan.project_node->rowsIn = rows;
+	}
+	return found;
+}
+
+/*
+ *      selectBatches ---
+ *
+ *      Run a select on the column batch operators.  Returns false, without touching anything,
+ *      if the query can not be answered that way.
+ */
+
+bool Executor::selectBatches(Plan &plan, DOCDS &docs, rapidjson::Document &origFields, rapidjson::Document *where, int limit, FILESYSTEM &fs,
+		bool quiet, bool &found) {
+	std::vector<std::string> fields;
+	std::vector<VectorPredicate> preds;
+	std::vector<int> columns;
+	if (!compileVectorized(origFields, where, fields, preds, columns)) {
+		return false;
+	}
+	Aggregator aggs(extractAggregates(origFields));
+
+	VectorOperator *op = new VectorScan(plan, docs, indexes, fs, fields, cache);
+	if (!preds.empty()) {
+		op = new VectorFilter(op, preds, plan.filter);
+	}
+	if (limit > -1) {
+		op = new VectorLimit(op, limit, plan.limit);
+	}
+	VectorAggregator *agg = new VectorAggregator(op, aggs, columns, plan.aggregate);
+	ColumnBatch batch;
+	agg->next(batch);
+	agg->close();
+
+	found = printBatchResults(plan, agg->results(), agg->rowsIn, quiet);
+	delete agg;
+	return true;
+}
+
+/*
+ *      selectParallel ---
+ *
+ *      Run a select as a parallel scan.  Returns false, without touching anything, if there
+ *      are too few documents or the query can not be split up: the aggregates of a limited
+ *      select are over its first 'limit' matches, which only a serial scan knows.
+ */
+
+bool Executor::selectParallel(Plan &plan, DOCDS &docs, rapidjson::Document &origFields, rapidjson::Document *where, int limit, FILESYSTEM &fs,
+		bool quiet, bool &found) {
+	rapidjson::Document aggregates = extractAggregates(origFields);
+	if (workers < 2 || (limit > -1 && !aggregates.Empty())) {
+		return false;
+	}
+	DOCDS scratch;
+	DOCDS &ids = scanList(plan, docs, scratch);
+	if (ids.size() < PARALLEL_MIN_DOCS) {
+		return false;
+	}
+
+	ParallelScan scan(ids, limit, ordered);
+	std::mutex lock;
+	if (plan.access) {
+		plan.access->detail += " [parallel " + std::to_string(workers) + "]";
+	}
+
+	std::vector<std::string> names;
+	std::vector<VectorPredicate> preds;
+	std::vector<int> columns;
+	if (vectorized && compileVectorized(origFields, where, names, preds, columns)) {
+		// Every worker keeps adding to its own copy of the aggregates.
+		std::vector<Aggregator> partial(workers, Aggregator(aggregates));
+		uint64_t rows = 0;
+		scan.run(threads(), workers, [&](size_t w, size_t, DOCDS::iterator begin, DOCDS::iterator end) {
+				VectorScan *vscan = new VectorScan(begin, end, indexes, fs, names, cache);
+				VectorOperator *op = vscan;
+				VectorFilter *filter = NULL;
+				if (!preds.empty()) {
+					op = filter = new VectorFilter(op, preds, NULL);
+				}
+				VectorAggregator *agg = new VectorAggregator(op, partial[w], columns, NULL);
+				ColumnBatch batch;
+				agg->next(batch);
+				partial[w] = agg->results();
+
+				std::lock_guard<std::mutex> _(lock);
+				account(plan.access, vscan);
+				account(plan.filter, filter);
+				rows += agg->rowsIn;
+				delete agg;
+				});
+		for (size_t w = 1; w < workers; ++w) {
+			partial[0].merge(partial[w]);
+		}
+		found = printBatchResults(plan, partial[0], rows, quiet);
+		return true;
+	}
+
+	rapidjson::Document fields = processFields(origFields);
+	std::vector<Aggregator> partial(workers, Aggregator(aggregates));
+	// Ordered, the rows of every range wait for the ranges before them.  An empty line
+	// stands for a row without any of the selected fields, it still counts for the limit.
+	std::vector<std::vector<std::string>> out(ordered ? scan.ranges() : 0);
+	found = false;
+	scan.run(threads(), workers, [&](size_t w, size_t r, DOCDS::iterator begin, DOCDS::iterator end) {
+			DocScan *dscan = new DocScan(begin, end, fs, NULL, cache);
+			Operator *op = dscan;
+			Filter *filter = NULL;
+			if (where) {
+				op = filter = new Filter(op, *where, NULL);
+			}
+			Project *project = new Project(op, fields, NULL);
+			op = project;
+			if (!aggregates.Empty()) {
+				op = new Aggregate(op, aggregates, NULL, &partial[w]);
+			}
+			std::vector<std::string> lines;
+			Row row;
+			while (!scan.stopped() && op->next(row)) {
+				if (!scan.match()) {
+					break;
+				}
+				lines.push_back(row.out.MemberCount() > 0 ? toString(&row.out) : std::string());
+			}
+
+			std::lock_guard<std::mutex> _(lock);
+			account(plan.access, dscan);
+			account(plan.filter, filter);
+			account(plan.project_node, project);
+			if (ordered) {
+				out[r].swap(lines);
+			} else {
+				for (auto it = lines.begin(); it != lines.end(); ++it) {
+					if (it->empty()) {
+						continue;
+					}
+					found = true;
+					if (!quiet) {
+						std::cout << *it << std::endl;
+					}
+				}
+			}
+			delete op;
+			});
+
+	uint64_t kept = plan.project_node ? plan.project_node->actualRows : 0;
+	if (ordered) {
+		kept = 0;
+		for (auto range = out.begin(); range != out.end() && (limit < 0 || kept < (uint64_t)limit); ++range) {
+			for (auto it = range->begin(); it != range->end() && (limit < 0 || kept < (uint64_t)limit); ++it, ++kept) {
+				if (it->empty()) {
+					continue;
+				}
+				found = true;
+				if (!quiet) {
+					std::cout << *it << std::endl;
+				}
+			}
+		}
+	} else if (limit > -1) {
+		kept = std::min(kept, (uint64_t)limit);
+	}
+	if (plan.limit) {
+		plan.limit->rowsIn = plan.filter ? plan.filter->actualRows : (plan.access ? plan.access->actualRows : 0);
+		plan.limit->actualRows = kept;
+	}
+
+	if (!aggregates.Empty()) {
+		for (size_t w = 1; w < workers; ++w) {
+			partial[0].merge(partial[w]);
+		}
+		rapidjson::Document summary;
+		summary.SetObject();
+		partial[0].summarize(summary, summary.GetAllocator());
+		bool any = summary.MemberCount() > 0;
+		if (!quiet) {
+			printSummary(std::cout, summary);
+		}
+		found = found || any;
+		if (plan.aggregate) {
+			plan.aggregate->rowsIn = plan.project_node ? plan.project_node->actualRows : 0;
+			plan.aggregate->actualRows = any ? 1 : 0;
+		}
+	}
+	return true;
+}
+
+/*
+ *      matchParallel ---
+ *
+ *      The filtering half of an UPDATE or DELETE as a parallel scan.  The matches are kept in
+ *      document order so a limit picks the same documents as a serial scan.  Returns false if
+ *      the scan is not worth splitting up: without a where clause every document matches.
+ */
+
+bool Executor::matchParallel(Plan &plan, DOCDS &docs, rapidjson::Document *where, int limit, FILESYSTEM &fs, DOCDS &matches) {
+	if (workers < 2 || !where) {
+		return false;
+	}
+	DOCDS scratch;
+	DOCDS &ids = scanList(plan, docs, scratch);
+	if (ids.size() < PARALLEL_MIN_DOCS) {
+		return false;
+	}
+
+	ParallelScan scan(ids, limit, true);
+	std::mutex lock;
+	std::vector<DOCDS> found(scan.ranges());
+	scan.run(threads(), workers, [&](size_t, size_t r, DOCDS::iterator begin, DOCDS::iterator end) {
+			DocScan *dscan = new DocScan(begin, end, fs, NULL, cache);
+			Filter *filter = new Filter(dscan, *where, NULL);
+			Row row;
+			while (filter->next(row)) {
+				scan.match();
+				found[r].push_back(row.id);
+			}
+
+			std::lock_guard<std::mutex> _(lock);
+			account(plan.access, dscan);
+			account(plan.filter, filter);
+			delete filter;
+			});
+
+	for (auto range = found.begin(); range != found.end(); ++range) {
+		matches.merge(*range);
+	}
+	if (limit > -1) {
+		matches.truncate(limit);
+	}
+	if (plan.access) {
+		plan.access->detail += " [parallel " + std::to_string(workers) + "]";
+	}
+	if (plan.limit) {
+		plan.limit->rowsIn = plan.filter ? plan.filter->actualRows : 0;
+		plan.limit->actualRows = matches.size();
+	}
+	return true;
+}
+
+// Show on the Sort node how many sorted runs went to disk.
+static void noteRuns(Plan &plan, const Sort *sorter) {
+	if (sorter && sorter->runs && plan.sort) {
+		plan.sort->detail += " [" + std::to_string(sorter->runs) + " runs on disk]";
+	}
+}
+
+/*
+ *      finish ---
+ *
+ *      The serial end of a select.  The limit of a grouped select counts groups, so it goes
+ *      above the GroupAggregate, and that of a sorted one goes into the Sort; otherwise the
+ *      caller already applied it to 'input'.
+ */
+
+bool Executor::finish(Plan &plan, Operator *input, rapidjson::Document &origFields, int limit, FILESYSTEM &fs, bool quiet) {
+	rapidjson::Document aggregates = extractAggregates(origFields);
+	rapidjson::Document fields = processFields(origFields);
+	bool sorted = !plan.orderBy.empty();
+
+	Operator *op;
+	GroupAggregate *group = NULL;
+	Sort *sorter = NULL;
+	if (!plan.groupBy.empty()) {
+		op = group = new GroupAggregate(input, plan.groupBy, aggregates, fs, groupMemory, plan.group);
+		if (sorted) {
+			op = sorter = new Sort(op, plan.orderBy, limit, true, fs, sortMemory, plan.sort);
+		} else if (limit > -1) {
+			op = new Limit(op, limit, plan.limit);
+		}
+	} else {
+		op = new Project(input, fields, plan.project_node);
+		if (!aggregates.Empty()) {
+			op = new Aggregate(op, aggregates, plan.aggregate);
+		}
+		if (sorted) {
+			op = sorter = new Sort(op, plan.orderBy, limit, false, fs, sortMemory, plan.sort);
+		}
+	}
+	Output *output = new Output(op, quiet);
+	run(output);
+	if (group && group->spilled && plan.group) {
+		plan.group->detail += " [spilled " + std::to_string(group->spilled) + " rows]";
+	}
+	noteRuns(plan, sorter);
+	bool found = output->foundAny();
+	delete output;
+	return found;
+}
+
+/*
+ *      drawSample ---
+ *
+ *      Pick the ids of a sampled select before any document is read, in document order.  A
+ *      percentage keeps every id with that probability, skipping over the ids in between in
+ *      one step (the gaps are geometric).  A number of rows draws exactly that many: with the
+ *      number of ids known up front each id is kept with probability (rows still wanted) /
+ *      (ids left), Knuth's selection sampling, so no reservoir is needed.
+ */
+
+uint64_t Executor::drawSample(Plan &plan, DOCDS &docs, DOCDS &out) {
+	DOCDS scratch;
+	DOCDS &ids = scanList(plan, docs, scratch);
+	// The candidates of the seeks are in 'ids' now, the drawn ones are scanned directly.
+	plan.seeks.clear();
+
+	const Parsing::Sample &sample = plan.sampling;
+	std::mt19937_64 rng(sample.repeatable ? sample.seed : std::random_device()());
+	auto uniform = [&rng]() { return (rng() >> 11) * (1.0 / 9007199254740992.0); };
+
+	uint64_t population = ids.size();
+	if (sample.rows >= 0) {
+		uint64_t wanted = std::min<uint64_t>(sample.rows, population);
+		uint64_t left = population;
+		for (auto it = ids.begin(); it != ids.end() && wanted > 0; ++it, --left) {
+			if (uniform() * left < wanted) {
+				out.push_back(*it);
+				--wanted;
+			}
+		}
+	} else if (sample.percent >= 100) {
+		out = ids;
+	} else {
+		double skip = std::log1p(-sample.percent / 100);
+		auto it = ids.begin();
+		for (;;) {
+			double gap = std::floor(std::log(1 - uniform()) / skip);
+			if (gap >= (double)population) {
+				break;
+			}
+			uint64_t n = (uint64_t)gap;
+			while (n-- > 0 && it != ids.end()) {
+				++it;
+			}
+			if (it == ids.end()) {
+				break;
+			}
+			out.push_back(*it++);
+		}
+	}
+
+	if (plan.sample) {
+		for (auto child = plan.sample->children.begin(); child != plan.sample->children.end(); ++child) {
+			if ((*child)->type == SCAN) {
+				(*child)->actualRows = (*child)->rowsIn = population;
+			}
+		}
+		plan.sample->detail += " [" + std::to_string(out.size()) + " of " + std::to_string(population) + "]";
+	}
+	return population;
+}
+
+bool Executor::select(Plan &plan, DOCDS &docs, rapidjson::Document &origFields, rapidjson::Document *where, int limit, FILESYSTEM &fs, bool quiet) {
+	if (!plan.sampling.active()) {
+		return selectDocs(plan, docs, origFields, where, limit, fs, quiet);
+	}
+	DOCDS drawn;
+	uint64_t population = drawSample(plan, docs, drawn);
+	rapidjson::Document fields;
+	fields.CopyFrom(origFields, fields.GetAllocator());
+	sampleAggregates(fields, drawn.size(), population);
+	return selectDocs(plan, drawn, fields, where, limit, fs, quiet);
+}
+
+bool Executor::selectDocs(Plan &plan, DOCDS &docs, rapidjson::Document &origFields, rapidjson::Document *where, int limit, FILESYSTEM &fs,
+		bool quiet) {
+	// Groups and sorted rows have to come together in one place, and the limit applies to them instead of the scan.
+	bool serial = !plan.groupBy.empty() || !plan.orderBy.empty();
+	bool found;
+	if (!serial && selectParallel(plan, docs, origFields, where, limit, fs, quiet, found)) {
+		return found;
+	}
+	if (!serial && vectorized && selectBatches(plan, docs, origFields, where, limit, fs, quiet, found)) {
+		return found;
+	}
+	return finish(plan, source(plan, docs, where, serial ? -1 : limit, fs), origFields, limit, fs, quiet);
+}
+
+bool Executor::selectJoin(Plan &plan, DOCDS &left, DOCDS &right, rapidjson::Document &fields, int limit, FILESYSTEM &fs, bool quiet) {
+	JoinSide &b = *plan.build;
+	JoinSide &p = *plan.probe;
+	rapidjson::Document *buildWhere = b.where.IsObject() && b.where.MemberCount() > 0 ? &b.where : NULL;
+	rapidjson::Document *probeWhere = p.where.IsObject() && p.where.MemberCount() > 0 ? &p.where : NULL;
+	DOCDS &probeDocs = p.left ? left : right;
+
+	Operator *build = source(b.plan, b.left ? left : right, buildWhere, -1, fs);
+	Operator *probe;
+	KeySeek *seek = NULL;
+	if (p.seekKeys) {
+		probe = seek = new KeySeek(p.project, p.key, probeDocs, indexes, fs, p.plan.access, cache);
+		if (probeWhere) {
+			probe = new Filter(probe, *probeWhere, p.plan.filter);
+		}
+	} else {
+		probe = source(p.plan, probeDocs, probeWhere, -1, fs);
+	}
+
+	Operator *op = new HashJoin(build, probe, seek, b, p, fs, joinMemory, plan.join);
+	if (limit > -1 && plan.groupBy.empty() && plan.orderBy.empty()) {
+		op = new Limit(op, limit, plan.limit);
+	}
+	return finish(plan, op, fields, limit, fs, quiet);
+}
+
+void Executor::update(Plan &plan, DOCDS &docs, rapidjson::Document &updates, rapidjson::Document *where, int limit, FILESYSTEM &fs) {
+	DOCDS matches;
+	Operator *src;
+	if (matchParallel(plan, docs, where, limit, fs, matches)) {
+		src = new DocScan(matches, fs, NULL, cache);
+	} else {
+		src = source(plan, docs, where, limit, fs);
+	}
+	Operator *op = new UpdateDocs(src, updates, plan.project, indexes, stats, views, cache, fs, plan.root);
+	run(op);
+	delete op;
+}
+
+void Executor::ddelete(Plan &plan, DOCDS &docs, rapidjson::Document &origFields, rapidjson::Document *where, int limit, FILESYSTEM &fs) {
+	rapidjson::Document aggregates = extractAggregates(origFields);
+	rapidjson::Document fields = processFields(origFields);
+
+	DOCDS matches;
+	Operator *src;
+	if (matchParallel(plan, docs, where, limit, fs, matches)) {
+		src = new DocScan(matches, fs, NULL, cache);
+	} else {
+		src = source(plan, docs, where, limit, fs);
+	}
+	DeleteDocs *del = new DeleteDocs(src, fields, plan.project, indexes, stats, views, cache, fs, plan.root);
+	run(del);
+	if (!del->removed.empty()) {
+		for (auto it = del->removed.begin(); it != del->removed.end(); ++it) {
+			docs.erase(*it);
+		}
+	}
+	delete del;
+}
@@ -0,0 +1,308 @@
+#ifndef EXECUTOR_H_
+#define EXECUTOR_H_
+
+#include <set>
+#include <string>
+#include <vector>
+#include <utility>
+#include <rapidjson/document.h>
+#include <rapidjson/stringbuffer.h>
+#include <rapidjson/writer.h>
+
+#include "dbms.h"
+#include "Index.h"
+#include "Planner.h"
+#include "Statistics.h"
+#include "Aggregator.h"
+#include "DocCache.h"
+
+class ThreadPool;
+class ViewCatalog;
+
+// Rows handed over per call by the batch interface.
+const size_t BATCH_SIZE = 1024;
+
+/*
+ *      Row ---
+ *
+ *      One document travelling up the pipeline.  'doc' is the parsed document and 'out' the
+ *      projected result, built with the document's allocator.  Rows are reused: an operator
+ *      fills the row it is handed instead of allocating one per document.  A summary row
+ *      carries aggregate results instead of a document.
+ */
+
+struct Row {
+	uint64_t id;
+	File file;
+	rapidjson::Document doc;
+	rapidjson::Value out;
+	bool summary;
+	Row(): id(0), summary(false) {}
+	void reset();
+	void swap(Row &other);
+};
+
+struct Batch {
+	std::vector<Row*> rows;
+	size_t size;
+	Batch(size_t capacity = BATCH_SIZE);
+	~Batch();
+};
+
+/*
+ *      Operator ---
+ *
+ *      Iterator model.  next() pulls one row from the operator, which pulls what it needs from
+ *      its children.  Every operator counts the rows it took in and handed out and the time
+ *      spent inside it (children included).  close() copies the counters into the plan nodes
+ *      so EXPLAIN can show them.
+ */
+
+class Operator {
+public:
+	uint64_t rowsIn;
+	uint64_t rowsOut;
+	double millis;
+
+	Operator(PlanNode *node_ = NULL): rowsIn(0), rowsOut(0), millis(0), node(node_) {}
+	virtual ~Operator();
+
+	bool next(Row &row);
+	// Fill up to batch.rows.size() rows, returns how many were filled.
+	size_t next(Batch &batch);
+	virtual void close();
+	void add(Operator *child) { children.push_back(child); }
+protected:
+	PlanNode *node;
+	std::vector<Operator*> children;
+
+	virtual bool produce(Row &row) = 0;
+	// Pull a row from a child, counting it as input.
+	bool pull(Row &row, size_t child = 0);
+};
+
+// Reads, parses and hands out documents by id, from the document cache if it is given one.
+class DocSource: public Operator {
+public:
+	DocSource(FILESYSTEM &fs_, PlanNode *node_, DocCache *cache_ = NULL): Operator(node_), fs(fs_), cache(cache_) {}
+protected:
+	FILESYSTEM &fs;
+	DocCache *cache;
+	void load(Row &row, uint64_t id);
+};
+
+// Every document of a project, or of a range of its ids.
+class DocScan: public DocSource {
+public:
+	DocScan(DOCDS &docs_, FILESYSTEM &fs_, PlanNode *node_, DocCache *cache_ = NULL):
+		DocSource(fs_, node_, cache_), it(docs_.begin()), end(docs_.end()) {}
+	DocScan(DOCDS::iterator begin, DOCDS::iterator end_, FILESYSTEM &fs_, PlanNode *node_, DocCache *cache_ = NULL):
+		DocSource(fs_, node_, cache_), it(begin), end(end_) {}
+protected:
+	bool produce(Row &row);
+private:
+	DOCDS::iterator it;
+	DOCDS::iterator end;
+};
+
+// The documents returned by the plan's index seeks.
+class IndexSeek: public DocSource {
+public:
+	IndexSeek(Plan &plan_, DOCDS &docs_, IndexCatalog &indexes_, FILESYSTEM &fs_, DocCache *cache_ = NULL):
+		DocSource(fs_, plan_.access, cache_), plan(plan_), docs(docs_), indexes(indexes_), started(false) {}
+protected:
+	bool produce(Row &row);
+private:
+	Plan &plan;
+	DOCDS &docs;
+	IndexCatalog &indexes;
+	bool started;
+	DOCDS found;                            // the candidates still in the project
+	DOCDS::iterator it;
+};
+
+class Filter: public Operator {
+public:
+	Filter(Operator *child, rapidjson::Document &where_, PlanNode *node_): Operator(node_), where(where_) { add(child); }
+protected:
+	bool produce(Row &row);
+private:
+	rapidjson::Document &where;
+};
+
+class Limit: public Operator {
+public:
+	Limit(Operator *child, int limit_, PlanNode *node_): Operator(node_), limit(limit_) { add(child); }
+protected:
+	bool produce(Row &row);
+private:
+	int limit;
+};
+
+// Builds row.out from the selected fields.
+class Project: public Operator {
+public:
+	Project(Operator *child, rapidjson::Document &fields_, PlanNode *node_);
+protected:
+	bool produce(Row &row);
+private:
+	rapidjson::Document &fields;
+	bool selectAll;
+};
+
+// Feeds the aggregates from each row's document and passes the rows that have selected fields on.  Once the input
+// is exhausted hands out one summary row with the results, unless it feeds an aggregator it
+// was given: a parallel scan merges those itself.
+class Aggregate: public Operator {
+public:
+	Aggregate(Operator *child, rapidjson::Document &aggregates_, PlanNode *node_, Aggregator *into = NULL):
+		Operator(node_), own(aggregates_), aggregator(into ? into : &own), summarize(into == NULL), done(false) { add(child); }
+protected:
+	bool produce(Row &row);
+private:
+	Aggregator own;
+	Aggregator *aggregator;
+	bool summarize;
+	bool done;
+};
+
+// Prints the result rows.  Only the printed rows are counted as output.
+class Output: public Operator {
+public:
+	Output(Operator *child, bool quiet_): Operator(NULL), quiet(quiet_), found(false) { add(child); }
+	bool foundAny() { return found; }
+protected:
+	bool produce(Row &row);
+private:
+	bool quiet;
+	bool found;
+};
+
+// Applies the WITH clause to the matching documents (applyUpdates in Documents.h) and stores them
+// again.  A document that kept its size only has the blocks that changed written.
+class UpdateDocs: public Operator {
+public:
+	UpdateDocs(Operator *child, rapidjson::Document &updates_, const std::string &project_, IndexCatalog &indexes_, StatsCatalog &stats_,
+			ViewCatalog *views_, DocCache *cache_, FILESYSTEM &fs_, PlanNode *node_):
+		Operator(node_), updates(updates_), project(project_), indexes(indexes_), stats(stats_), views(views_), cache(cache_), fs(fs_),
+		writer(text) {
+		add(child);
+	}
+protected:
+	bool produce(Row &row);
+private:
+	rapidjson::Document &updates;
+	std::string project;
+	IndexCatalog &indexes;
+	StatsCatalog &stats;
+	ViewCatalog *views;
+	DocCache *cache;
+	FILESYSTEM &fs;
+	rapidjson::StringBuffer text;             // the updated document, kept for the next one
+	rapidjson::Writer<rapidjson::StringBuffer> writer;
+};
+
+// Deletes the matching documents, or only the listed fields from them.  The ids of deleted
+// documents are collected in 'removed' for the caller to drop from the project.
+class DeleteDocs: public Operator {
+public:
+	DeleteDocs(Operator *child, rapidjson::Document &fields_, const std::string &project_, IndexCatalog &indexes_, StatsCatalog &stats_,
+			ViewCatalog *views_, DocCache *cache_, FILESYSTEM &fs_, PlanNode *node_);
+	DOCDS removed;
+protected:
+	bool produce(Row &row);
+private:
+	rapidjson::Document &fields;
+	bool selectAll;
+	std::string project;
+	IndexCatalog &indexes;
+	StatsCatalog &stats;
+	ViewCatalog *views;
+	DocCache *cache;
+	FILESYSTEM &fs;
+};
+
+/*
+ *      Executor ---
+ *
+ *      Turns a plan into a pipeline of operators and runs it.  SELECT, UPDATE and DELETE share
+ *      the same access (DocScan or IndexSeek), Filter and Limit operators.  Aggregate only
+ *      selects with simple where clauses run on the batch operators of Vectorized.h instead.
+ *
+ *      Scans over at least PARALLEL_MIN_DOCS documents are split into ranges of ids run by
+ *      the workers of a thread pool (Parallel.h), each with its own pipeline and aggregates,
+ *      which are merged at the end.  UPDATE and DELETE only look for the matching documents
+ *      that way; the writes and the index and statistics upkeep stay on the calling thread.
+ *
+ *      GROUP BY and ORDER BY selects run serially, through a GroupAggregate (GroupBy.h) and a
+ *      Sort (Sort.h).
+ *
+ *      A sampled select draws its ids first, then runs like any other select over the drawn
+ *      ids alone, with its aggregates scaled to the ids they were drawn from.
+ *
+ *      A join reads each project through its own access path and filter into a HashJoin
+ *      (Join.h); grouping, aggregates and sorting then run serially on the joined rows.
+ *
+ *      Every access reads its documents through one DocCache (DocCache.h), shared by the
+ *      workers; UPDATE and DELETE erase the documents they write from it.
+ */
+
+class Executor {
+public:
+	// Materialized views, if any, are kept up to date by UPDATE and DELETE.
+	Executor(IndexCatalog &indexes_, StatsCatalog &stats_, ViewCatalog *views_ = NULL);
+	~Executor();
+
+	// Run eligible aggregate queries in column batches (Vectorized.h).  On by default.
+	void setVectorized(bool on) { vectorized = on; }
+	// Workers for parallel scans, 1 turns them off.  SCAN_THREADS by default.
+	void setThreads(size_t n);
+	// Print the rows of a parallel select in document order.  SCAN_ORDERED by default.
+	void setOrdered(bool on) { ordered = on; }
+	// Bytes of groups a GROUP BY keeps in memory before spilling.  GROUP_MEMORY by default.
+	void setGroupMemory(size_t bytes) { groupMemory = bytes; }
+	// Bytes of rows an ORDER BY sorts in memory before writing out a sorted run.  SORT_MEMORY by default.
+	void setSortMemory(size_t bytes) { sortMemory = bytes; }
+	// Bytes of documents a join hashes in memory before partitioning to disk.  JOIN_MEMORY by default.
+	void setJoinMemory(size_t bytes) { joinMemory = bytes; }
+	// Bytes of parsed documents kept in the document cache, 0 turns it off.  DOC_CACHE_MEMORY by default.
+	void setDocCacheMemory(size_t bytes);
+	DocCache *documentCache() { return cache; }
+
+	bool select(Plan &plan, DOCDS &docs, rapidjson::Document &fields, rapidjson::Document *where, int limit, FILESYSTEM &fs, bool quiet = false);
+	// A join of the documents of the FROM project, 'left', with those of the joined one.
+	bool selectJoin(Plan &plan, DOCDS &left, DOCDS &right, rapidjson::Document &fields, int limit, FILESYSTEM &fs, bool quiet = false);
+	void update(Plan &plan, DOCDS &docs, rapidjson::Document &updates, rapidjson::Document *where, int limit, FILESYSTEM &fs);
+	void ddelete(Plan &plan, DOCDS &docs, rapidjson::Document &fields, rapidjson::Document *where, int limit, FILESYSTEM &fs);
+private:
+	IndexCatalog &indexes;
+	StatsCatalog &stats;
+	ViewCatalog *views;
+	DocCache *cache;
+	bool vectorized;
+	ThreadPool *pool;
+	size_t workers;
+	bool ordered;
+	size_t groupMemory;
+	size_t sortMemory;
+	size_t joinMemory;
+
+	ThreadPool &threads();
+	// Draw the ids of a sampled select into 'out', returns how many they were drawn from.
+	uint64_t drawSample(Plan &plan, DOCDS &docs, DOCDS &out);
+	bool selectDocs(Plan &plan, DOCDS &docs, rapidjson::Document &fields, rapidjson::Document *where, int limit, FILESYSTEM &fs, bool quiet);
+	// The ids a plan reads: the candidates of its index seeks that are in 'docs' go into 'scratch'.
+	DOCDS &scanList(Plan &plan, DOCDS &docs, DOCDS &scratch);
+	bool selectParallel(Plan &plan, DOCDS &docs, rapidjson::Document &fields, rapidjson::Document *where, int limit, FILESYSTEM &fs,
+			bool quiet, bool &found);
+	// Collects the ids of the documents an UPDATE or DELETE touches into 'matches'.
+	bool matchParallel(Plan &plan, DOCDS &docs, rapidjson::Document *where, int limit, FILESYSTEM &fs, DOCDS &matches);
+	bool selectBatches(Plan &plan, DOCDS &docs, rapidjson::Document &fields, rapidjson::Document *where, int limit, FILESYSTEM &fs,
+			bool quiet, bool &found);
+	// The serial rest of a select over the rows of 'input': grouping, projection, aggregates and sorting.
+	bool finish(Plan &plan, Operator *input, rapidjson::Document &fields, int limit, FILESYSTEM &fs, bool quiet);
+	Operator *source(Plan &plan, DOCDS &docs, rapidjson::Document *where, int limit, FILESYSTEM &fs);
+	void run(Operator *root);
+};
+
+#endif
@@ -0,0 +1,248 @@
+#include <atomic>
+#include <cstdlib>
+#include <cstring>
+#include <algorithm>
+#include <rapidjson/writer.h>
+#include <rapidjson/stringbuffer.h>
+
+#include "GroupBy.h"
+#include "../utils/Util.h"
+
+// Probe slots of an empty table.
+static const size_t GROUP_TABLE_MIN = 64;
+
+static std::atomic<uint64_t> nextSpillId(0);
+
+/*
+ *      GroupTable
+ */
+
+GroupTable::GroupTable(size_t width_, size_t extra_): width(width_), extra(extra_), keyBytes(0) {
+	clear();
+}
+
+bool GroupTable::find(const std::string &key, uint64_t hash, bool insert, size_t &group) {
+	size_t mask = entries.size() - 1;
+	for (size_t i = hash & mask;; i = (i + 1) & mask) {
+		Entry &e = entries[i];
+		if (e.group == EMPTY) {
+			if (!insert) {
+				return false;
+			}
+			group = keys.size();
+			e.hash = hash;
+			e.group = (uint32_t)group;
+			keys.push_back(key);
+			keyBytes += key.size();
+			states.resize(states.size() + width);
+			if (2 * keys.size() > entries.size()) {
+				grow();
+			}
+			return true;
+		}
+		if (e.hash == hash && keys[e.group] == key) {
+			group = e.group;
+			return true;
+		}
+	}
+}
+
+void GroupTable::grow() {
+	std::vector<Entry> old;
+	old.swap(entries);
+	Entry empty = {0, EMPTY};
+	entries.assign(old.size() * 2, empty);
+	size_t mask = entries.size() - 1;
+	for (auto it = old.begin(); it != old.end(); ++it) {
+		if (it->group == EMPTY) {
+			continue;
+		}
+		size_t i = it->hash & mask;
+		while (entries[i].group != EMPTY) {
+			i = (i + 1) & mask;
+		}
+		entries[i] = *it;
+	}
+}
+
+size_t GroupTable::memory() const {
+	return entries.capacity() * sizeof(Entry) + keys.capacity() * sizeof(std::string) + keyBytes + states.capacity() * sizeof(Accumulator) +
+		keys.size() * extra;
+}
+
+void GroupTable::clear() {
+	// Swapped out rather than cleared, the memory of a spilled level has to go.
+	std::vector<std::string>().swap(keys);
+	std::vector<Accumulator>().swap(states);
+	Entry empty = {0, EMPTY};
+	std::vector<Entry>(GROUP_TABLE_MIN, empty).swap(entries);
+	keyBytes = 0;
+}
+
+/*
+ *      GroupAggregate
+ */
+
+GroupAggregate::GroupAggregate(Operator *child, const std::vector<std::string> &keys_, rapidjson::Document &aggregates, FILESYSTEM &fs_,
+		size_t budget_, PlanNode *node_):
+	Operator(node_), spilled(0), keys(keys_), aggregator(aggregates), fields(aggregator.fields()), fs(fs_), budget(budget_),
+	table(aggregator.slots.size(), aggregator.sketchBytes()), started(false), pos(0), level(0), id(nextSpillId++), files(0) {
+	chunk = std::min(std::max(budget / GROUP_PARTITIONS, (size_t)4096), (size_t)(1 << 20));
+	add(child);
+}
+
+GroupAggregate::~GroupAggregate() {
+	// Whatever a LIMIT did not get to is still on disk.
+	for (auto r = runs.begin(); r != runs.end(); ++r) {
+		for (auto f = r->files.begin(); f != r->files.end(); ++f) {
+			drop(*f);
+		}
+	}
+	for (auto p = partitions.begin(); p != partitions.end(); ++p) {
+		for (auto f = p->files.begin(); f != p->files.end(); ++f) {
+			drop(*f);
+		}
+	}
+}
+
+bool GroupAggregate::produce(Row &row) {
+	if (!started) {
+		started = true;
+		while (pull(row)) {
+			feed(groupKey(keys, row.doc), row.doc);
+		}
+		finishLevel();
+	}
+	while (pos >= table.size()) {
+		if (runs.empty()) {
+			return false;
+		}
+		Run run = runs.front();
+		runs.pop_front();
+		load(run);
+	}
+
+	row.reset();
+	rapidjson::Document::AllocatorType &allocator = row.doc.GetAllocator();
+	row.doc.Parse(table.key(pos).c_str());
+	row.out.SetObject();
+	for (size_t i = 0; i < keys.size(); ++i) {
+		rapidjson::Value value(row.doc[(rapidjson::SizeType)i], allocator);
+		row.out.AddMember(rapidjson::Value(keys[i].c_str(), allocator), value, allocator);
+	}
+	aggregator.summarize(table.state(pos), row.out, allocator);
+	++pos;
+	return true;
+}
+
+// The grouped values as a JSON array, so equal values of different types stay apart.
+std::string groupKey(const std::vector<std::string> &keys, const rapidjson::Value &doc) {
+	rapidjson::StringBuffer buffer;
+	rapidjson::Writer<rapidjson::StringBuffer> writer(buffer);
+	writer.StartArray();
+	for (auto k = keys.begin(); k != keys.end(); ++k) {
+		rapidjson::Value::ConstMemberIterator m;
+		if (doc.IsObject() && (m = doc.FindMember(k->c_str())) != doc.MemberEnd()) {
+			m->value.Accept(writer);
+		} else {
+			writer.Null();
+		}
+	}
+	writer.EndArray();
+	return std::string(buffer.GetString(), buffer.GetSize());
+}
+
+void GroupAggregate::feed(const std::string &key, const rapidjson::Value &values) {
+	uint64_t hash = Hash64(key.data(), key.size(), level);
+	bool full = level < GROUP_MAX_LEVEL && table.memory() >= budget;
+	size_t group;
+	if (table.find(key, hash, !full, group)) {
+		aggregator.handle(values, table.state(group));
+	} else {
+		spill(hash, key, values);
+	}
+}
+
+// A spilled row is two lines: its key and an object of the fields the aggregates read.
+void GroupAggregate::spill(uint64_t hash, const std::string &key, const rapidjson::Value &values) {
+	if (partitions.empty()) {
+		partitions.resize(GROUP_PARTITIONS);
+		buffers.resize(GROUP_PARTITIONS);
+	}
+	// The low bits picked the probe slot, partition on the high ones.
+	size_t p = (hash >> 48) % GROUP_PARTITIONS;
+	rapidjson::StringBuffer buffer;
+	rapidjson::Writer<rapidjson::StringBuffer> writer(buffer);
+	writer.StartObject();
+	if (values.IsObject()) {
+		for (auto f = fields.begin(); f != fields.end(); ++f) {
+			rapidjson::Value::ConstMemberIterator m = values.FindMember(f->c_str());
+			if (m != values.MemberEnd()) {
+				writer.Key(f->c_str(), (rapidjson::SizeType)f->size());
+				m->value.Accept(writer);
+			}
+		}
+	}
+	writer.EndObject();
+
+	std::string &out = buffers[p];
+	out += key;
+	out += '\n';
+	out.append(buffer.GetString(), buffer.GetSize());
+	out += '\n';
+	++spilled;
+	if (out.size() >= chunk) {
+		flush(p);
+	}
+}
+
+void GroupAggregate::flush(size_t partition) {
+	std::string &out = buffers[partition];
+	if (out.empty()) {
+		return;
+	}
+	std::string name = "__GROUP_SPILL__" + std::to_string(id) + "_" + std::to_string(files++);
+	File f = fs.open_file(name);
+	fs.write(&f, out.data(), out.size());
+	partitions[partition].files.push_back(name);
+	std::string().swap(out);
+}
+
+void GroupAggregate::finishLevel() {
+	for (size_t p = 0; p < partitions.size(); ++p) {
+		flush(p);
+		if (!partitions[p].files.empty()) {
+			partitions[p].level = level + 1;
+			runs.push_back(partitions[p]);
+		}
+	}
+	partitions.clear();
+	buffers.clear();
+}
+
+void GroupAggregate::load(const Run &run) {
+	table.clear();
+	pos = 0;
+	level = run.level;
+	for (auto name = run.files.begin(); name != run.files.end(); ++name) {
+		File f = fs.open_file(*name);
+		char *data = fs.read(&f);
+		for (char *line = data; line && *line;) {
+			char *end = strchr(line, '\n');
+			char *next = strchr(end + 1, '\n');
+			*next = 0;
+			rapidjson::Document values;
+			values.Parse(end + 1);
+			feed(std::string(line, end - line), values);
+			line = next + 1;
+		}
+		free(data);
+		fs.deleteFile(&f);
+	}
+	finishLevel();
+}
+
+void GroupAggregate::drop(const std::string &name) {
+	File f = fs.open_file(name);
+	fs.deleteFile(&f);
+}
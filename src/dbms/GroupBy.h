@@ -0,0 +1,117 @@
+#ifndef GROUPBY_H_
+#define GROUPBY_H_
+
+#include <deque>
+#include <string>
+#include <vector>
+#include <rapidjson/document.h>
+
+#include "dbms.h"
+#include "Planner.h"
+#include "Aggregator.h"
+#include "Executor.h"
+
+// Partitions rows are spilled to once the groups outgrow their memory budget.
+const size_t GROUP_PARTITIONS = 16;
+// Spilled partitions that still do not fit are split again, at most this many times.
+const int GROUP_MAX_LEVEL = 6;
+
+// The key of the group a document falls in: a JSON array of its values of 'keys', null where missing.
+std::string groupKey(const std::vector<std::string> &keys, const rapidjson::Value &doc);
+
+/*
+ *      GroupTable ---
+ *
+ *      Open addressing hash table from a group key to the accumulators of the group.  The
+ *      probe array only holds hashes and group numbers, so most probes stay in one cache line;
+ *      keys and accumulators are stored densely by group number, one Accumulator per aggregate
+ *      slot.  Linear probing, grown to stay at most half full.
+ */
+
+class GroupTable {
+public:
+	// 'extra' bytes per group on top of the accumulators, for their sketches.
+	GroupTable(size_t width_, size_t extra_ = 0);
+
+	// Find the group of 'key', creating it if 'insert'.  False if it is neither there nor created.
+	bool find(const std::string &key, uint64_t hash, bool insert, size_t &group);
+	size_t size() const { return keys.size(); }
+	const std::string &key(size_t group) const { return keys[group]; }
+	Accumulator *state(size_t group) { return states.data() + group * width; }
+	// Bytes held by the table.
+	size_t memory() const;
+	void clear();
+private:
+	struct Entry {
+		uint64_t hash;
+		uint32_t group;
+	};
+	static const uint32_t EMPTY = 0xffffffff;
+
+	size_t width;
+	size_t extra;
+	std::vector<Entry> entries;
+	std::vector<std::string> keys;
+	std::vector<Accumulator> states;
+	size_t keyBytes;
+
+	void grow();
+};
+
+/*
+ *      GroupAggregate ---
+ *
+ *      GROUP BY.  Drains its input into a GroupTable, then hands out one row per group holding
+ *      the grouped fields and the results of the aggregates.  A missing grouped field groups
+ *      as null.
+ *
+ *      Once the table outgrows 'budget' bytes, rows of groups it does not hold yet are spilled:
+ *      their key and aggregated fields go to one of GROUP_PARTITIONS partitions by hash, written
+ *      as chunks of files in the filesystem.  A group is then wholly in the table or wholly in
+ *      one partition.  After the table's groups are handed out every partition is aggregated
+ *      on its own the same way, spilling again one level down if it still does not fit.
+ */
+
+class GroupAggregate: public Operator {
+public:
+	GroupAggregate(Operator *child, const std::vector<std::string> &keys_, rapidjson::Document &aggregates, FILESYSTEM &fs_, size_t budget_,
+			PlanNode *node_);
+	~GroupAggregate();
+
+	// Rows written to spill files.
+	uint64_t spilled;
+protected:
+	bool produce(Row &row);
+private:
+	// The chunks of one spilled partition.
+	struct Run {
+		int level;
+		std::vector<std::string> files;
+	};
+
+	std::vector<std::string> keys;
+	Aggregator aggregator;
+	std::vector<std::string> fields;
+	FILESYSTEM &fs;
+	size_t budget;
+	size_t chunk;
+	GroupTable table;
+	bool started;
+	size_t pos;
+	int level;
+	uint64_t id;
+	uint64_t files;
+	std::vector<std::string> buffers;
+	std::vector<Run> partitions;
+	std::deque<Run> runs;
+
+	void feed(const std::string &key, const rapidjson::Value &values);
+	void spill(uint64_t hash, const std::string &key, const rapidjson::Value &values);
+	void flush(size_t partition);
+	// Flush the partitions of the current level and queue them as runs.
+	void finishLevel();
+	void load(const Run &run);
+	void drop(const std::string &name);
+};
+
+#endif
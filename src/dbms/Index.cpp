@@ -0,0 +1,260 @@
+#include <cstring>
+#include <algorithm>
+#include "Index.h"
+#include "../utils/Util.h"
+
+const std::string IndexListFile("__INDEXES__");
+const std::string IndexFilePrefix("__INDEX__");
+
+const rapidjson::Value *lookupPath(const rapidjson::Value &doc, const std::string &path) {
+	const rapidjson::Value *v = &doc;
+	size_t start = 0;
+	while (true) {
+		if (!v->IsObject()) {
+			return NULL;
+		}
+		// The shortest prefix of the rest that is a member is the next step.
+		size_t dot, from = start;
+		rapidjson::Value::ConstMemberIterator m;
+		do {
+			dot = path.find('.', from);
+			from = dot + 1;
+			size_t len = dot == std::string::npos ? path.size() - start : dot - start;
+			rapidjson::Value name(rapidjson::StringRef(path.data() + start, (rapidjson::SizeType)len));
+			m = v->FindMember(name);
+		} while (m == v->MemberEnd() && dot != std::string::npos);
+		if (m == v->MemberEnd()) {
+			return NULL;
+		}
+		v = &m->value;
+		if (dot == std::string::npos) {
+			return v;
+		}
+		start = dot + 1;
+	}
+}
+
+void IndexCatalog::load(Storage::Filesystem *fs) {
+	File list = fs->open_file(IndexListFile);
+	if (list.size == 0) {
+		return;
+	}
+	char *buffer = fs->read(&list);
+	std::vector<std::string> keys = Type<std::vector<std::string> >::Create(buffer, list.size);
+	free(buffer);
+
+	for (auto it = keys.begin(); it != keys.end(); ++it) {
+		size_t dot = it->find('.');
+		Storage::TextIndex &idx = indexes[it->substr(0, dot)][it->substr(dot + 1)];
+		File f = fs->open_file(IndexFilePrefix + *it);
+		if (f.size > 0) {
+			char *data = fs->read(&f);
+			idx.Read(data, 0, f.size);
+			free(data);
+		}
+	}
+}
+
+void IndexCatalog::save(Storage::Filesystem *fs) {
+	std::vector<std::string> keys = list();
+	if (keys.empty()) {
+		return;
+	}
+
+	File listFile = fs->open_file(IndexListFile);
+	uint64_t size = Type<std::vector<std::string> >::Size(keys);
+	const char *bytes = Type<std::vector<std::string> >::Bytes(keys);
+	fs->write(&listFile, bytes, size);
+	delete[] bytes;
+
+	// Only rewrite the indexes that changed since they were loaded.
+	for (auto it = dirty.begin(); it != dirty.end(); ++it) {
+		size_t dot = it->find('.');
+		Storage::TextIndex &idx = indexes[it->substr(0, dot)][it->substr(dot + 1)];
+		uint64_t len = idx.Size();
+		uint64_t pos = 0;
+		char *buffer = (char*)malloc(len + 1);
+		idx.Write(buffer, pos);
+		File f = fs->open_file(IndexFilePrefix + *it);
+		fs->write(&f, buffer, len);
+		free(buffer);
+	}
+	dirty.clear();
+}
+
+bool IndexCatalog::exists(const std::string &project, const std::string &field) {
+	return get(project, field) != NULL;
+}
+
+Storage::TextIndex *IndexCatalog::get(const std::string &project, const std::string &field) {
+	auto p = indexes.find(project);
+	if (p == indexes.end()) {
+		return NULL;
+	}
+	auto f = p->second.find(field);
+	if (f == p->second.end()) {
+		return NULL;
+	}
+	return &f->second;
+}
+
+Storage::TextIndex &IndexCatalog::create(const std::string &project, const std::string &field) {
+	dirty.insert(project + '.' + field);
+	return indexes[project][field];
+}
+
+std::vector<std::string> IndexCatalog::list() {
+	std::vector<std::string> keys;
+	for (auto p = indexes.begin(); p != indexes.end(); ++p) {
+		for (auto f = p->second.begin(); f != p->second.end(); ++f) {
+			keys.push_back(p->first + '.' + f->first);
+		}
+	}
+	return keys;
+}
+
+void IndexCatalog::add(const std::string &project, uint64_t id, const rapidjson::Value &doc) {
+	auto p = indexes.find(project);
+	if (p == indexes.end()) {
+		return;
+	}
+	for (auto f = p->second.begin(); f != p->second.end(); ++f) {
+		const rapidjson::Value *v = lookupPath(doc, f->first);
+		if (v && v->IsString()) {
+			f->second.insert(id, v->GetString(), v->GetStringLength());
+			dirty.insert(project + '.' + f->first);
+		}
+	}
+}
+
+void IndexCatalog::remove(const std::string &project, uint64_t id, const rapidjson::Value &doc) {
+	auto p = indexes.find(project);
+	if (p == indexes.end()) {
+		return;
+	}
+	for (auto f = p->second.begin(); f != p->second.end(); ++f) {
+		const rapidjson::Value *v = lookupPath(doc, f->first);
+		if (v && v->IsString()) {
+			f->second.remove(id, v->GetString(), v->GetStringLength());
+			dirty.insert(project + '.' + f->first);
+		}
+	}
+}
+
+bool IndexCatalog::seek(const std::string &project, const IndexPredicate &p, std::vector<uint64_t> &out) {
+	Storage::TextIndex *idx = get(project, p.field);
+	if (!idx) {
+		return false;
+	}
+	const char *v = p.value.data();
+	size_t len = p.value.size();
+	if (p.op == "#eq") {
+		idx->equals(v, len, out);
+	} else if (p.op == "#gt") {
+		idx->range(v, len, true, out);
+	} else if (p.op == "#lt") {
+		idx->range(v, len, false, out);
+	} else if (p.op == "#starts") {
+		idx->starts(v, len, out);
+	} else if (p.op == "#ends") {
+		idx->ends(v, len, out);
+	} else if (p.op == "#contains") {
+		return idx->contains(v, len, out);
+	} else {
+		return false;
+	}
+	return true;
+}
+
+bool IndexCatalog::estimate(const std::string &project, const IndexPredicate &p, uint64_t cap, uint64_t *rows) {
+	Storage::TextIndex *idx = get(project, p.field);
+	if (!idx) {
+		return false;
+	}
+	const char *v = p.value.data();
+	size_t len = p.value.size();
+	if (p.op == "#eq") {
+		*rows = idx->countEquals(v, len, cap);
+	} else if (p.op == "#gt") {
+		*rows = idx->countRange(v, len, true, cap);
+	} else if (p.op == "#lt") {
+		*rows = idx->countRange(v, len, false, cap);
+	} else if (p.op == "#starts") {
+		*rows = idx->countStarts(v, len, cap);
+	} else if (p.op == "#ends") {
+		*rows = idx->countEnds(v, len, cap);
+	} else if (p.op == "#contains" && len >= Storage::TextIndex::GRAM) {
+		*rows = idx->estimateContains(v, len);
+	} else {
+		return false;
+	}
+	// A capped walk only tells us there are at least 'cap' matches.
+	if (*rows >= cap) {
+		*rows = std::max<uint64_t>(cap, idx->size() / 3);
+	}
+	return true;
+}
+
+bool IndexCatalog::candidates(const std::string &project, const rapidjson::Value &where, std::vector<uint64_t> &out) {
+	if (indexes.count(project) == 0) {
+		return false;
+	}
+
+	std::vector<IndexPredicate> preds;
+	predicates(where, preds);
+
+	// Every condition of a where clause must hold, so the candidate sets are intersected.
+	bool used = false;
+	std::vector<uint64_t> ids;
+	for (auto it = preds.begin(); it != preds.end(); ++it) {
+		if (!seek(project, *it, ids)) {
+			continue;
+		}
+		if (!used) {
+			out.swap(ids);
+			used = true;
+		} else {
+			Storage::TextIndex::Intersect(out, ids);
+		}
+		if (out.empty()) {
+			break;
+		}
+	}
+	return used;
+}
+
+static void collect(const std::string &path, const rapidjson::Value &cond, std::vector<IndexPredicate> &out) {
+	if (cond.IsString()) {
+		out.push_back(IndexPredicate(path, "#eq", std::string(cond.GetString(), cond.GetStringLength())));
+		return;
+	}
+	if (!cond.IsObject()) {
+		return;
+	}
+	// Mirrors sameValues: the first '#' member of a condition object decides the comparison.
+	for (auto it = cond.MemberBegin(); it != cond.MemberEnd(); ++it) {
+		if (it->name.GetString()[0] == '#') {
+			if (it->value.IsString()) {
+				out.push_back(IndexPredicate(path, it->name.GetString(),
+							std::string(it->value.GetString(), it->value.GetStringLength())));
+			}
+			return;
+		}
+	}
+	for (auto it = cond.MemberBegin(); it != cond.MemberEnd(); ++it) {
+		collect(path + '.' + it->name.GetString(), it->value, out);
+	}
+}
+
+void IndexCatalog::predicates(const rapidjson::Value &where, std::vector<IndexPredicate> &out) {
+	if (!where.IsObject()) {
+		return;
+	}
+	for (auto it = where.MemberBegin(); it != where.MemberEnd(); ++it) {
+		// Special key comparisons (#exists, #isnull, ...) can't be answered from an index.
+		if (it->name.GetString()[0] == '#') {
+			continue;
+		}
+		collect(it->name.GetString(), it->value, out);
+	}
+}
@@ -0,0 +1,60 @@
+#ifndef INDEX_H_
+#define INDEX_H_
+
+#include <map>
+#include <set>
+#include <string>
+#include <vector>
+#include <rapidjson/document.h>
+
+#include "../mmap_filesystem/Filesystem.h"
+#include "../storage/TextIndex.h"
+
+// Resolve a dotted field path ("spouse.fName") inside a document.  NULL if any step is missing.
+// A member whose name has dots in it, like "p.name" of a joined row, matches as one step.
+const rapidjson::Value *lookupPath(const rapidjson::Value &doc, const std::string &path);
+
+// A single string comparison pulled out of a where clause.
+struct IndexPredicate {
+	std::string field;
+	std::string op;
+	std::string value;
+	IndexPredicate(std::string f, std::string o, std::string v): field(f), op(o), value(v) {}
+};
+
+/*
+ *      IndexCatalog ---
+ *
+ *      Owns every TextIndex, keyed by project and field.  The list of indexes is kept in the
+ *      __INDEXES__ file and each index in its own __INDEX__<project>.<field> file.
+ */
+
+class IndexCatalog {
+public:
+	void load(Storage::Filesystem *fs);
+	void save(Storage::Filesystem *fs);
+
+	bool exists(const std::string &project, const std::string &field);
+	Storage::TextIndex *get(const std::string &project, const std::string &field);
+	Storage::TextIndex &create(const std::string &project, const std::string &field);
+	std::vector<std::string> list();
+
+	// Maintenance hooks for the write paths.
+	void add(const std::string &project, uint64_t id, const rapidjson::Value &doc);
+	void remove(const std::string &project, uint64_t id, const rapidjson::Value &doc);
+
+	// Sorted candidate doc ids for the where clause.  False if no index applies.
+	bool candidates(const std::string &project, const rapidjson::Value &where, std::vector<uint64_t> &out);
+	bool seek(const std::string &project, const IndexPredicate &p, std::vector<uint64_t> &out);
+
+	// Estimated number of ids a seek would return, walking at most 'cap' index entries.
+	// False if the predicate can't be answered by an index.
+	bool estimate(const std::string &project, const IndexPredicate &p, uint64_t cap, uint64_t *rows);
+
+	static void predicates(const rapidjson::Value &where, std::vector<IndexPredicate> &out);
+private:
+	std::map<std::string, std::map<std::string, Storage::TextIndex> > indexes;
+	std::set<std::string> dirty;
+};
+
+#endif
@@ -0,0 +1,398 @@
+#include <atomic>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <algorithm>
+#include <rapidjson/writer.h>
+#include <rapidjson/stringbuffer.h>
+
+#include "Join.h"
+#include "../utils/Util.h"
+
+// Chains of an empty table.
+static const size_t JOIN_TABLE_MIN = 64;
+
+static std::atomic<uint64_t> nextSpillId(0);
+
+std::string joinKey(const rapidjson::Value *v) {
+	if (!v) {
+		return std::string();
+	}
+	if (v->IsNumber()) {
+		if (v->IsInt64()) {
+			return "n" + std::to_string(v->GetInt64());
+		}
+		if (v->IsUint64()) {
+			return "n" + std::to_string(v->GetUint64());
+		}
+		double d = v->GetDouble();
+		if (d == std::floor(d) && std::fabs(d) < 9.2e18) {
+			return "n" + std::to_string((int64_t)d);
+		}
+		char buffer[32];
+		snprintf(buffer, sizeof(buffer), "n%.17g", d);
+		return buffer;
+	}
+	if (v->IsString() || v->IsBool()) {
+		rapidjson::StringBuffer buffer;
+		rapidjson::Writer<rapidjson::StringBuffer> writer(buffer);
+		v->Accept(writer);
+		return std::string(buffer.GetString(), buffer.GetSize());
+	}
+	return std::string();
+}
+
+/*
+ *      KeySeek
+ */
+
+void KeySeek::keys(const std::vector<std::string> &values, bool all) {
+	scan = !all;
+	it = docs.begin();
+	if (scan) {
+		return;
+	}
+	std::vector<std::string> strings;
+	for (auto v = values.begin(); v != values.end(); ++v) {
+		if (v->empty() || (*v)[0] != '"') {
+			scan = true;
+			return;
+		}
+		rapidjson::Document s;
+		s.Parse(v->c_str());
+		strings.push_back(std::string(s.GetString(), s.GetStringLength()));
+	}
+	std::vector<uint64_t> found;
+	for (auto s = strings.begin(); s != strings.end(); ++s) {
+		found.clear();
+		indexes.seek(project, IndexPredicate(field, "#eq", *s), found);
+		ids.insert(ids.end(), found.begin(), found.end());
+	}
+	std::sort(ids.begin(), ids.end());
+	ids.erase(std::unique(ids.begin(), ids.end()), ids.end());
+	if (node) {
+		node->detail += " [" + std::to_string(strings.size()) + " keys]";
+	}
+}
+
+bool KeySeek::produce(Row &row) {
+	if (scan) {
+		if (it == docs.end()) {
+			return false;
+		}
+		load(row, *it);
+		++it;
+		return true;
+	}
+	if (pos >= ids.size()) {
+		return false;
+	}
+	load(row, ids[pos++]);
+	return true;
+}
+
+/*
+ *      HashJoin
+ */
+
+HashJoin::HashJoin(Operator *build, Operator *probe_, KeySeek *seek_, const JoinSide &buildSide, const JoinSide &probeSide, FILESYSTEM &fs_,
+		size_t budget_, PlanNode *node_):
+	Operator(node_), spilled(0), seek(seek_), buildKey(buildSide.key), probeKey(probeSide.key), buildLeft(buildSide.left), fs(fs_),
+	budget(budget_), id(nextSpillId++), files(0), keyBytes(0), started(false), partitioned(false), level(0), hash(0), match(NONE),
+	data(NULL), line(NULL) {
+	chunk = std::min(std::max(budget / JOIN_PARTITIONS, (size_t)4096), (size_t)(1 << 20));
+	leftPrefix = (buildLeft ? buildSide.alias : probeSide.alias) + ".";
+	rightPrefix = (buildLeft ? probeSide.alias : buildSide.alias) + ".";
+	add(build);
+	add(probe_);
+	clearTable();
+}
+
+HashJoin::~HashJoin() {
+	free(data);
+	// Whatever a LIMIT did not get to is still on disk.
+	for (auto f = probeFiles.begin(); f != probeFiles.end(); ++f) {
+		drop(*f);
+	}
+	for (auto p = passes.begin(); p != passes.end(); ++p) {
+		for (auto f = p->build.begin(); f != p->build.end(); ++f) {
+			drop(*f);
+		}
+		for (auto f = p->probe.begin(); f != p->probe.end(); ++f) {
+			drop(*f);
+		}
+	}
+}
+
+void HashJoin::close() {
+	Operator::close();
+	if (node && spilled) {
+		node->detail += " [spilled " + std::to_string(spilled) + " rows]";
+	}
+}
+
+bool HashJoin::produce(Row &row) {
+	if (!started) {
+		started = true;
+		build();
+	}
+	for (;;) {
+		while (match != NONE) {
+			const Entry &e = entries[match];
+			match = e.next;
+			if (e.hash == hash && e.key == key) {
+				emit(row, store[e.doc]);
+				return true;
+			}
+		}
+		if (!nextProbe() && !nextPass()) {
+			return false;
+		}
+	}
+}
+
+void HashJoin::build() {
+	Row row;
+	while (pull(row, 0)) {
+		std::string k = joinKey(lookupPath(row.doc, buildKey));
+		if (!k.empty()) {
+			insert(k, row.doc);
+		}
+	}
+
+	if (seek) {
+		std::vector<std::string> keys;
+		if (!partitioned) {
+			for (auto e = entries.begin(); e != entries.end(); ++e) {
+				keys.push_back(e->key);
+			}
+			std::sort(keys.begin(), keys.end());
+			keys.erase(std::unique(keys.begin(), keys.end()), keys.end());
+		}
+		seek->keys(keys, !partitioned);
+	}
+
+	// Spilled, the probe rows go to the partitions of their keys too.
+	if (partitioned) {
+		while (pull(probe, 1)) {
+			std::string k = joinKey(lookupPath(probe.doc, probeKey));
+			if (!k.empty()) {
+				spill(1, k, probe.doc);
+			}
+		}
+		finishLevel();
+	}
+}
+
+void HashJoin::insert(const std::string &k, const rapidjson::Value &doc) {
+	if (!partitioned && level < JOIN_MAX_LEVEL && memory() >= budget) {
+		spillTable();
+		partitioned = true;
+	}
+	if (partitioned) {
+		spill(0, k, doc);
+		return;
+	}
+
+	rapidjson::Value copy(doc, store.GetAllocator());
+	store.PushBack(copy, store.GetAllocator());
+	Entry e = {Hash64(k.data(), k.size(), level), NONE, store.Size() - 1, k};
+	if (entries.size() >= heads.size()) {
+		// Rechain everything into twice the chains.
+		std::vector<uint32_t>(heads.size() * 2, NONE).swap(heads);
+		size_t mask = heads.size() - 1;
+		for (size_t i = 0; i < entries.size(); ++i) {
+			size_t b = entries[i].hash & mask;
+			entries[i].next = heads[b];
+			heads[b] = (uint32_t)i;
+		}
+	}
+	size_t b = e.hash & (heads.size() - 1);
+	e.next = heads[b];
+	heads[b] = (uint32_t)entries.size();
+	entries.push_back(e);
+	keyBytes += k.size();
+}
+
+void HashJoin::spillTable() {
+	for (auto e = entries.begin(); e != entries.end(); ++e) {
+		spill(0, e->key, store[e->doc]);
+	}
+	clearTable();
+}
+
+// A spilled row is two lines: its key and its document.
+void HashJoin::spill(int side, const std::string &k, const rapidjson::Value &doc) {
+	if (partitions.empty()) {
+		partitions.resize(JOIN_PARTITIONS);
+		buffers[0].resize(JOIN_PARTITIONS);
+		buffers[1].resize(JOIN_PARTITIONS);
+	}
+	// The low bits of the same hash pick the chains, partition on the high ones.
+	size_t p = (Hash64(k.data(), k.size(), level) >> 48) % JOIN_PARTITIONS;
+	rapidjson::StringBuffer buffer;
+	rapidjson::Writer<rapidjson::StringBuffer> writer(buffer);
+	doc.Accept(writer);
+
+	std::string &out = buffers[side][p];
+	out += k;
+	out += '\n';
+	out.append(buffer.GetString(), buffer.GetSize());
+	out += '\n';
+	++spilled;
+	if (out.size() >= chunk) {
+		flush(side, p);
+	}
+}
+
+void HashJoin::flush(int side, size_t partition) {
+	std::string &out = buffers[side][partition];
+	if (out.empty()) {
+		return;
+	}
+	std::string name = "__JOIN_SPILL__" + std::to_string(id) + "_" + std::to_string(files++);
+	File f = fs.open_file(name);
+	fs.write(&f, out.data(), out.size());
+	(side == 0 ? partitions[partition].build : partitions[partition].probe).push_back(name);
+	std::string().swap(out);
+}
+
+// A partition with no rows on one side has nothing to join, its other side is dropped.
+void HashJoin::finishLevel() {
+	for (size_t p = 0; p < partitions.size(); ++p) {
+		flush(0, p);
+		flush(1, p);
+		Pass &pass = partitions[p];
+		if (!pass.build.empty() && !pass.probe.empty()) {
+			pass.level = level + 1;
+			passes.push_back(pass);
+			continue;
+		}
+		for (auto f = pass.build.begin(); f != pass.build.end(); ++f) {
+			drop(*f);
+		}
+		for (auto f = pass.probe.begin(); f != pass.probe.end(); ++f) {
+			drop(*f);
+		}
+	}
+	partitions.clear();
+	buffers[0].clear();
+	buffers[1].clear();
+	partitioned = false;
+}
+
+bool HashJoin::nextProbe() {
+	for (;;) {
+		std::string k;
+		if (level == 0) {
+			// Nothing was built, or it all went to the partitions: there is nothing to probe.
+			if (entries.empty() || !pull(probe, 1)) {
+				return false;
+			}
+			k = joinKey(lookupPath(probe.doc, probeKey));
+		} else {
+			probe.reset();
+			if (!readSpilled(k, probe.doc)) {
+				return false;
+			}
+		}
+		if (k.empty()) {
+			continue;
+		}
+		key.swap(k);
+		hash = Hash64(key.data(), key.size(), level);
+		match = heads[hash & (heads.size() - 1)];
+		return true;
+	}
+}
+
+bool HashJoin::nextPass() {
+	if (passes.empty()) {
+		return false;
+	}
+	Pass pass = passes.front();
+	passes.pop_front();
+	clearTable();
+	level = pass.level;
+
+	std::string k;
+	rapidjson::Document doc;
+	probeFiles = pass.build;
+	while (readSpilled(k, doc)) {
+		insert(k, doc);
+		doc.SetNull();
+		doc.GetAllocator().Clear();
+	}
+	probeFiles = pass.probe;
+	// The build rows did not fit again, split both sides one level further.
+	if (partitioned) {
+		while (readSpilled(k, doc)) {
+			spill(1, k, doc);
+			doc.SetNull();
+			doc.GetAllocator().Clear();
+		}
+		finishLevel();
+	}
+	return true;
+}
+
+// The next spilled row of 'probeFiles', deleting every file once it is read.
+bool HashJoin::readSpilled(std::string &k, rapidjson::Document &doc) {
+	while (!data || !*line) {
+		free(data);
+		data = NULL;
+		if (probeFiles.empty()) {
+			return false;
+		}
+		File f = fs.open_file(probeFiles.back());
+		data = line = fs.read(&f);
+		fs.deleteFile(&f);
+		probeFiles.pop_back();
+	}
+	char *end = strchr(line, '\n');
+	char *next = strchr(end + 1, '\n');
+	*next = 0;
+	k.assign(line, end - line);
+	doc.Parse(end + 1);
+	line = next + 1;
+	return true;
+}
+
+void HashJoin::clearTable() {
+	// Swapped out rather than cleared, the memory of a spilled level has to go.
+	std::vector<Entry>().swap(entries);
+	std::vector<uint32_t>(JOIN_TABLE_MIN, NONE).swap(heads);
+	store.SetArray();
+	store.GetAllocator().Clear();
+	keyBytes = 0;
+	match = NONE;
+}
+
+size_t HashJoin::memory() {
+	return store.GetAllocator().Size() + entries.capacity() * sizeof(Entry) + keyBytes + heads.capacity() * sizeof(uint32_t);
+}
+
+void HashJoin::emit(Row &row, const rapidjson::Value &built) {
+	row.reset();
+	row.id = 0;
+	row.doc.SetObject();
+	rapidjson::Document::AllocatorType &allocator = row.doc.GetAllocator();
+	const rapidjson::Value *sides[2] = {buildLeft ? &built : &probe.doc, buildLeft ? &probe.doc : &built};
+	const std::string *prefixes[2] = {&leftPrefix, &rightPrefix};
+	for (int s = 0; s < 2; ++s) {
+		if (!sides[s]->IsObject()) {
+			continue;
+		}
+		for (auto m = sides[s]->MemberBegin(); m != sides[s]->MemberEnd(); ++m) {
+			std::string name = *prefixes[s] + m->name.GetString();
+			rapidjson::Value value(m->value, allocator);
+			row.doc.AddMember(rapidjson::Value(name.c_str(), (rapidjson::SizeType)name.size(), allocator), value, allocator);
+		}
+	}
+}
+
+void HashJoin::drop(const std::string &name) {
+	File f = fs.open_file(name);
+	fs.deleteFile(&f);
+}
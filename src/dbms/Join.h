@@ -0,0 +1,145 @@
+#ifndef JOIN_H_
+#define JOIN_H_
+
+#include <deque>
+#include <string>
+#include <vector>
+#include <rapidjson/document.h>
+
+#include "dbms.h"
+#include "Index.h"
+#include "Planner.h"
+#include "Executor.h"
+
+// Partitions both sides of a join are spilled to once the build side outgrows its budget.
+const size_t JOIN_PARTITIONS = 16;
+// Spilled partitions whose build side still does not fit are split again, at most this many times.
+const int JOIN_MAX_LEVEL = 6;
+
+// The join key of a value: numbers by value (5 matches 5.0), strings and booleans as JSON, so
+// a key never holds a line break.  Empty for null, objects and arrays, which match nothing.
+std::string joinKey(const rapidjson::Value *v);
+
+/*
+ *      KeySeek ---
+ *
+ *      The probe side of a join that looks its keys up in an index.  The join hands over the
+ *      keys of its build side before the first row is pulled; the documents holding one of
+ *      them are read in id order.  The index only holds strings, so if any key is not a
+ *      string, or the build side was too big to collect its keys, every document is read.
+ */
+
+class KeySeek: public DocSource {
+public:
+	KeySeek(const std::string &project_, const std::string &field_, DOCDS &docs_, IndexCatalog &indexes_, FILESYSTEM &fs_, PlanNode *node_,
+			DocCache *cache_ = NULL):
+		DocSource(fs_, node_, cache_), project(project_), field(field_), docs(docs_), indexes(indexes_), scan(false), pos(0) {}
+	// The build keys, 'all' false if they are not all known.
+	void keys(const std::vector<std::string> &values, bool all);
+protected:
+	bool produce(Row &row);
+private:
+	std::string project;
+	std::string field;
+	DOCDS &docs;
+	IndexCatalog &indexes;
+	bool scan;
+	DOCDS::iterator it;
+	std::vector<uint64_t> ids;
+	size_t pos;
+};
+
+/*
+ *      HashJoin ---
+ *
+ *      Inner equi-join of two projects.  The rows of the first child (the build side) go into a
+ *      chained hash table on their join key, then every row of the second child (the probe
+ *      side) is looked up in it.  A joined row holds the members of both documents, each named
+ *      "alias.member", those of the FROM project first.
+ *
+ *      The build documents are copied into one allocator.  Once it and the table outgrow
+ *      'budget' bytes the join turns into a grace hash join: the build rows go to
+ *      JOIN_PARTITIONS partitions by hash, written as chunks of files in the filesystem, and so
+ *      do all the probe rows after them.  Every pair of partitions is then joined on its own,
+ *      the probe rows streamed from disk, partitioning again one level down if the build rows
+ *      still do not fit.
+ */
+
+class HashJoin: public Operator {
+public:
+	HashJoin(Operator *build, Operator *probe, KeySeek *seek_, const JoinSide &buildSide, const JoinSide &probeSide, FILESYSTEM &fs_,
+			size_t budget_, PlanNode *node_);
+	~HashJoin();
+	void close();
+
+	// Rows written to spill files, of both sides.
+	uint64_t spilled;
+protected:
+	bool produce(Row &row);
+private:
+	struct Entry {
+		uint64_t hash;
+		uint32_t next;
+		uint32_t doc;
+		std::string key;
+	};
+	static const uint32_t NONE = 0xffffffff;
+
+	// The chunks of one partition of both sides.
+	struct Pass {
+		int level;
+		std::vector<std::string> build;
+		std::vector<std::string> probe;
+	};
+
+	KeySeek *seek;
+	std::string buildKey;
+	std::string probeKey;
+	std::string leftPrefix;
+	std::string rightPrefix;
+	bool buildLeft;
+	FILESYSTEM &fs;
+	size_t budget;
+	size_t chunk;
+	uint64_t id;
+	uint64_t files;
+
+	rapidjson::Document store;
+	std::vector<Entry> entries;
+	std::vector<uint32_t> heads;
+	size_t keyBytes;
+
+	bool started;
+	bool partitioned;           // the rows of the current level go to partitions
+	int level;
+	std::vector<Pass> partitions;
+	std::vector<std::string> buffers[2];
+	std::deque<Pass> passes;
+
+	// The probe row being matched and where in its chain the next match is looked for.
+	Row probe;
+	std::string key;
+	uint64_t hash;
+	uint32_t match;
+
+	// Probe rows of the current pass read back from disk.
+	std::vector<std::string> probeFiles;
+	char *data;
+	char *line;
+
+	void build();
+	void insert(const std::string &key, const rapidjson::Value &doc);
+	void spillTable();
+	void spill(int side, const std::string &key, const rapidjson::Value &doc);
+	void flush(int side, size_t partition);
+	void finishLevel();
+	bool nextProbe();
+	bool nextPass();
+	bool readSpilled(std::string &key, rapidjson::Document &doc);
+	void clearTable();
+	size_t memory();
+	void emit(Row &row, const rapidjson::Value &built);
+	void drop(const std::string &name);
+};
+
+#endif
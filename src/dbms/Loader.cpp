@@ -0,0 +1,230 @@
+#include "../include/config.h"
+
+#include <thread>
+#include <vector>
+#include <cstring>
+#include <rapidjson/memorystream.h>
+
+#include "Loader.h"
+#include "Catalog.h"
+
+/*
+ *      InsertBatch
+ */
+
+InsertBatch::InsertBatch(FILESYSTEM &fs_, META &meta_): fs(fs_), meta(meta_), writer(out) {}
+
+void InsertBatch::add(uint64_t id, const rapidjson::Value &doc) {
+	// The decimal digits of id, backwards from the end of the buffer.
+	char digits[20];
+	char *first = digits + sizeof(digits);
+	uint64_t n = id;
+	do {
+		*--first = char('0' + n % 10);
+		n /= 10;
+	} while (n > 0);
+
+	writer.Reset(out);
+	writer.StartObject();
+	for (auto m = doc.MemberBegin(); m != doc.MemberEnd(); ++m) {
+		writer.Key(m->name.GetString(), m->name.GetStringLength());
+		m->value.Accept(writer);
+	}
+	writer.Key("_doc", 4);
+	writer.String(first, rapidjson::SizeType(digits + sizeof(digits) - first));
+	writer.EndObject(doc.MemberCount() + 1);
+
+	ids.push_back(id);
+	ends.push_back(out.GetSize());
+}
+
+void InsertBatch::store(const std::string &project) {
+	if (ids.empty()) {
+		return;
+	}
+	uint64_t blocks = 0;
+	size_t from = 0;
+	for (auto e = ends.begin(); e != ends.end(); ++e) {
+		blocks += std::max<uint64_t>(1, (*e - from + BLOCK_SIZE - 1) / BLOCK_SIZE);
+		from = *e;
+	}
+	fs.reserve(blocks);
+
+	const char *text = out.GetString();
+	from = 0;
+	for (size_t i = 0; i < ids.size(); ++i) {
+		File file = fs.open_file(ids[i]);
+		fs.write(&file, text + from, ends[i] - from);
+		from = ends[i];
+	}
+	meta.upsert(project, [this](DOCDS &docs) {
+		for (auto id = ids.begin(); id != ids.end(); ++id) {
+			docs.push_back(*id);
+		}
+	});
+
+	out.Clear();
+	ids.clear();
+	ends.clear();
+}
+
+/*
+ *      BulkLoader
+ */
+
+struct BulkLoader::Slice {
+	const char *begin;
+	const char *end;
+	rapidjson::Document docs;               // its parsed lines, an array
+	uint64_t failed;
+	uint64_t first;                         // id of its first document
+	InsertBatch batch;
+
+	Slice(FILESYSTEM &fs, META &meta) : begin(NULL), end(NULL), failed(0), first(0), batch(fs, meta) {}
+};
+
+// Run f(slice) for every slice, one thread each, the first on the calling thread.
+template <class F>
+static void forEachSlice(std::vector<BulkLoader::Slice*> &slices, F f) {
+	std::vector<std::thread> workers;
+	for (size_t i = 1; i < slices.size(); ++i) {
+		workers.push_back(std::thread([&f, &slices, i] { f(*slices[i]); }));
+	}
+	f(*slices[0]);
+	for (auto it = workers.begin(); it != workers.end(); ++it) {
+		it->join();
+	}
+}
+
+static bool blank(const char *begin, const char *end) {
+	for (; begin != end; ++begin) {
+		if (*begin != ' ' && *begin != '\t' && *begin != '\r') {
+			return false;
+		}
+	}
+	return true;
+}
+
+static void parse(BulkLoader::Slice &s) {
+	s.docs.SetArray();
+	rapidjson::Document::AllocatorType &allocator = s.docs.GetAllocator();
+	// Parsed straight into the slice's allocator, so the array takes them without copying.
+	rapidjson::Document line(&allocator);
+	const char *pos = s.begin;
+	while (pos < s.end) {
+		const char *eol = static_cast<const char*>(memchr(pos, '\n', s.end - pos));
+		if (eol == NULL) {
+			eol = s.end;
+		}
+		if (!blank(pos, eol)) {
+			rapidjson::MemoryStream ms(pos, eol - pos);
+			line.ParseStream<rapidjson::kParseDefaultFlags, rapidjson::UTF8<> >(ms);
+			if (line.HasParseError() || !line.IsObject()) {
+				++s.failed;
+			} else {
+				s.docs.PushBack(line, allocator);
+			}
+		}
+		pos = eol + 1;
+	}
+}
+
+static void serialize(BulkLoader::Slice &s) {
+	uint64_t id = s.first;
+	for (auto it = s.docs.Begin(); it != s.docs.End(); ++it, ++id) {
+		s.batch.add(id, *it);
+	}
+}
+
+BulkLoader::BulkLoader(FILESYSTEM &fs_, META &meta_, size_t threads_, size_t batch_): loaded(0), failed(0), fs(fs_), meta(meta_),
+	threads(threads_), batch(batch_) {
+	if (threads == 0) {
+		threads = LOAD_THREADS > 0 ? LOAD_THREADS : std::thread::hardware_concurrency();
+	}
+	if (threads == 0) {
+		threads = 1;
+	}
+	if (batch == 0) {
+		batch = LOAD_BATCH;
+	}
+}
+
+bool BulkLoader::load(const std::string &path, const std::string &project, uint64_t &nextId, Added added) {
+	int fd = open(path.c_str(), O_RDONLY);
+	if (fd == -1) {
+		return false;
+	}
+	struct stat st;
+	if (fstat(fd, &st) != 0) {
+		close(fd);
+		return false;
+	}
+	size_t size = st.st_size;
+	if (size == 0) {
+		close(fd);
+		return true;
+	}
+	void *mapped = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+	if (mapped == MAP_FAILED || mapped == NULL) {
+		close(fd);
+		return false;
+	}
+	const char *data = static_cast<const char*>(mapped);
+
+	size_t pos = 0;
+	while (pos < size) {
+		// A batch ends with a whole line, however long that line is.
+		size_t end = std::min(size, pos + batch);
+		const char *eol = static_cast<const char*>(memchr(data + end - 1, '\n', size - end + 1));
+		end = eol ? eol - data + 1 : size;
+		loadBatch(data + pos, end - pos, project, nextId, added);
+		pos = end;
+	}
+
+	munmap(mapped, size);
+	close(fd);
+	return true;
+}
+
+void BulkLoader::loadBatch(const char *data, size_t size, const std::string &project, uint64_t &nextId, Added &added) {
+	// Cut the batch into slices at line ends, fewer of them if the lines are long.
+	std::vector<Slice*> slices;
+	const char *end = data + size;
+	const char *pos = data;
+	for (size_t i = 0; i < threads && pos < end; ++i) {
+		const char *cut = end;
+		if (i + 1 < threads) {
+			cut = pos + (end - pos) / (threads - i);
+			const char *eol = static_cast<const char*>(memchr(cut, '\n', end - cut));
+			cut = eol ? eol + 1 : end;
+		}
+		Slice *s = new Slice(fs, meta);
+		s->begin = pos;
+		s->end = cut;
+		slices.push_back(s);
+		pos = cut;
+	}
+
+	forEachSlice(slices, parse);
+
+	for (auto it = slices.begin(); it != slices.end(); ++it) {
+		(*it)->first = nextId;
+		nextId += (*it)->docs.Size();
+		failed += (*it)->failed;
+	}
+
+	forEachSlice(slices, serialize);
+
+	for (auto it = slices.begin(); it != slices.end(); ++it) {
+		loaded += (*it)->batch.size();
+		(*it)->batch.store(project);
+	}
+
+	for (auto it = slices.begin(); it != slices.end(); ++it) {
+		uint64_t id = (*it)->first;
+		for (auto doc = (*it)->docs.Begin(); doc != (*it)->docs.End(); ++doc, ++id) {
+			added(id, *doc);
+		}
+		delete *it;
+	}
+}
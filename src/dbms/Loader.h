@@ -0,0 +1,92 @@
+#ifndef LOADER_H_
+#define LOADER_H_
+
+#include <string>
+#include <vector>
+#include <cstdint>
+#include <functional>
+#include <rapidjson/document.h>
+#include <rapidjson/stringbuffer.h>
+#include <rapidjson/writer.h>
+
+#include "dbms.h"
+
+/*
+ *      InsertBatch ---
+ *
+ *      Documents on their way into one project.  Each is written straight from its parsed
+ *      value into one buffer shared by the whole batch, with its "_doc" id written after its
+ *      members, so the value itself is never changed and no text is made per document.
+ *      Storing the batch reserves the blocks of all its documents at once, writes them from
+ *      the buffer and adds their ids to the project in one change.  The buffer keeps its
+ *      memory from one store to the next.
+ */
+
+class InsertBatch {
+public:
+	InsertBatch(FILESYSTEM &fs_, META &meta_);
+
+	// Write 'doc', an object, as document 'id'.  Ids have to be added in increasing order.
+	void add(uint64_t id, const rapidjson::Value &doc);
+	// Store the documents added since the last store into 'project'.
+	void store(const std::string &project);
+	size_t size() const { return ids.size(); }
+private:
+	FILESYSTEM &fs;
+	META &meta;
+	rapidjson::StringBuffer out;            // the documents end to end
+	rapidjson::Writer<rapidjson::StringBuffer> writer;
+	std::vector<uint64_t> ids;
+	std::vector<size_t> ends;               // where each document ends in out
+
+	InsertBatch(const InsertBatch&);
+	InsertBatch& operator=(const InsertBatch&);
+};
+
+/*
+ *      BulkLoader ---
+ *
+ *      LOAD INTO project FROM 'file': inserts the documents of a JSON Lines file, one object
+ *      per line, as INSERT would.  The file is mapped and taken LOAD_BATCH bytes at a time.
+ *      Each batch is cut at line ends into one slice per worker, and the workers parse their
+ *      lines into documents of their own.  The documents are numbered in file order, then each
+ *      worker writes its documents into an InsertBatch.
+ *
+ *      Storing the slices stays on the calling thread: the filesystem only locks in THREADING
+ *      builds.
+ *
+ *      Blank lines are skipped; lines that are not a JSON object are counted as failed and
+ *      skipped too.
+ */
+
+class BulkLoader {
+public:
+	// Called for every stored document, in id order, for the indexes, statistics and views to
+	// see it.
+	typedef std::function<void(uint64_t id, const rapidjson::Value &doc)> Added;
+	// One worker's share of a batch.
+	struct Slice;
+
+	// Workers and batch size, 0 for LOAD_THREADS and LOAD_BATCH.
+	BulkLoader(FILESYSTEM &fs_, META &meta_, size_t threads_ = 0, size_t batch_ = 0);
+
+	// Load the file at 'path' into 'project', numbering the documents from 'nextId' on, which
+	// is left at the id after the last one.  False if the file could not be read.
+	bool load(const std::string &path, const std::string &project, uint64_t &nextId, Added added);
+
+	uint64_t loaded;
+	uint64_t failed;
+private:
+	FILESYSTEM &fs;
+	META &meta;
+	size_t threads;
+	size_t batch;
+
+	// Store the documents of data[0, size), a whole number of lines.
+	void loadBatch(const char *data, size_t size, const std::string &project, uint64_t &nextId, Added &added);
+
+	BulkLoader(const BulkLoader&);
+	BulkLoader& operator=(const BulkLoader&);
+};
+
+#endif
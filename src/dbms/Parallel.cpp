@@ -0,0 +1,42 @@
+#include <future>
+
+#include "Parallel.h"
+#include "../threading/ThreadPool.h"
+
+ParallelScan::ParallelScan(DOCDS &docs, int limit_, bool ordered_): limit(limit_), ordered(ordered_), matched(0), nextRange(0) {
+	size_t n = 0;
+	for (DOCDS::iterator it = docs.begin(); it != docs.end(); ++it, ++n) {
+		if (n % SCAN_RANGE == 0) {
+			bounds.push_back(it);
+		}
+	}
+	bounds.push_back(docs.end());
+}
+
+bool ParallelScan::match() {
+	uint64_t n = ++matched;
+	return ordered || limit < 0 || n <= (uint64_t)limit;
+}
+
+void ParallelScan::run(ThreadPool &pool, size_t workers, Work work) {
+	std::vector<std::future<void>> done;
+	for (size_t w = 0; w < workers; ++w) {
+		done.push_back(pool.enqueue([this, w, &work] {
+			while (!full()) {
+				size_t r = nextRange++;
+				if (r >= ranges()) {
+					break;
+				}
+				work(w, r, bounds[r], bounds[r + 1]);
+			}
+		}));
+	}
+	// Every worker has to be finished before get() hands a worker's exception on to the
+	// caller, the others still use 'work'.
+	for (auto it = done.begin(); it != done.end(); ++it) {
+		it->wait();
+	}
+	for (auto it = done.begin(); it != done.end(); ++it) {
+		it->get();
+	}
+}
@@ -0,0 +1,54 @@
+#ifndef PARALLEL_H_
+#define PARALLEL_H_
+
+#include <atomic>
+#include <vector>
+#include <functional>
+
+#include "dbms.h"
+
+class ThreadPool;
+
+// Document ids per range handed to a worker.
+const size_t SCAN_RANGE = 2048;
+// Smaller scans are not worth splitting up.
+const size_t PARALLEL_MIN_DOCS = 4 * SCAN_RANGE;
+
+/*
+ *      ParallelScan ---
+ *
+ *      Splits a list of document ids into ranges of SCAN_RANGE ids and runs a function over
+ *      them on a thread pool.  Every worker claims the next unclaimed range until none are
+ *      left, so ranges are started in id order.
+ *
+ *      With a limit the scan stops early.  Unordered, the workers stop as soon as 'limit' rows
+ *      matched in total and later matches are dropped.  Ordered, a started range is always
+ *      finished and only no new ranges are claimed: the first 'limit' matches in id order
+ *      are then all inside finished ranges, and the caller cuts the results of the ranges
+ *      laid end to end.
+ */
+
+class ParallelScan {
+public:
+	typedef std::function<void(size_t worker, size_t range, DOCDS::iterator begin, DOCDS::iterator end)> Work;
+
+	ParallelScan(DOCDS &docs, int limit_, bool ordered_);
+
+	size_t ranges() const { return bounds.size() - 1; }
+	// Count a matching row.  False if it is past the limit and has to be dropped.
+	bool match();
+	// Whether a worker can give up on the rest of its range.
+	bool stopped() const { return !ordered && full(); }
+	// Runs 'work' on 'workers' pool threads and waits for all of them.
+	void run(ThreadPool &pool, size_t workers, Work work);
+private:
+	std::vector<DOCDS::iterator> bounds;
+	int limit;
+	bool ordered;
+	std::atomic<uint64_t> matched;
+	std::atomic<size_t> nextRange;
+
+	bool full() const { return limit >= 0 && matched.load() >= (uint64_t)limit; }
+};
+
+#endif
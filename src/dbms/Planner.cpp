@@ -0,0 +1,466 @@
+#include <algorithm>
+#include <sstream>
+#include <iomanip>
+#include <cmath>
+#include <set>
+
+#include <pretty.h>
+#include "Planner.h"
+
+void PlanNode::print(std::ostream &os, int depth, bool actual) {
+	std::ostringstream line;
+	line << std::string(depth * 4, ' ');
+	if (depth > 0) {
+		line << "-> ";
+	}
+	line << PlanNames[type];
+	if (!detail.empty()) {
+		line << " " << detail;
+	}
+	line << std::fixed << std::setprecision(2);
+	line << "  (cost=" << cost << " rows=" << (uint64_t)std::llround(estRows) << ")";
+	if (actual) {
+		line << " (actual rows=" << actualRows << " in=" << rowsIn << std::setprecision(3) << " time=" << millis << "ms)";
+	}
+	os << line.str() << std::endl;
+	for (auto it = children.begin(); it != children.end(); ++it) {
+		(*it)->print(os, depth + 1, actual);
+	}
+}
+
+Plan::~Plan() {
+	delete root;
+	delete build;
+	delete probe;
+}
+
+void Plan::print(std::ostream &os, bool actual) {
+	if (root) {
+		root->print(os, 0, actual);
+	}
+}
+
+void Plan::candidates(IndexCatalog &indexes, std::vector<uint64_t> &out) {
+	std::vector<uint64_t> ids;
+	out.clear();
+	for (size_t i = 0; i < seeks.size(); ++i) {
+		indexes.seek(project, seeks[i], ids);
+		// A lone seek is the access node, the executor counts the documents it visits.
+		if (seekNodes[i] != access) {
+			seekNodes[i]->actualRows = ids.size();
+			seekNodes[i]->rowsIn = ids.size();
+		}
+		if (i == 0) {
+			out.swap(ids);
+		} else {
+			Storage::TextIndex::Intersect(out, ids);
+		}
+	}
+}
+
+static std::string describe(const IndexPredicate &p) {
+	return p.field + " " + p.op + " \"" + p.value + "\"";
+}
+
+double Planner::distinct(const std::string &project, const std::string &field) {
+	ProjectStats *ps = stats.get(project);
+	if (!ps || ps->observed == 0) {
+		return 0;
+	}
+	return ps->distinct(field);
+}
+
+/*
+ *      estimate ---
+ *
+ *      Ids an index seek is expected to return.  The index counts exactly up to ESTIMATE_CAP
+ *      entries, past that the field statistics give a better guess than the index's own.
+ */
+
+double Planner::estimate(const std::string &project, const IndexPredicate &pred, uint64_t numDocs) {
+	uint64_t rows;
+	if (!indexes.estimate(project, pred, ESTIMATE_CAP, &rows)) {
+		return -1;
+	}
+	if (rows >= ESTIMATE_CAP && stats.get(project)) {
+		rapidjson::Document cond;
+		rapidjson::Value value(pred.value.c_str(), pred.value.size(), cond.GetAllocator());
+		if (pred.op == "#eq") {
+			cond.CopyFrom(value, cond.GetAllocator());
+		} else {
+			cond.SetObject();
+			cond.AddMember(rapidjson::Value(pred.op.c_str(), cond.GetAllocator()), value, cond.GetAllocator());
+		}
+		double sel = stats.selectivity(project, pred.field, cond, -1);
+		if (sel >= 0) {
+			rows = std::max<uint64_t>(ESTIMATE_CAP, (uint64_t)(sel * numDocs));
+		}
+	}
+	return std::min(rows, numDocs);
+}
+
+/*
+ *      order ---
+ *
+ *      Rewrite the where clause so its most selective members come first.  Documents are
+ *      rejected on the first member that fails, so cheap rejections should be tried early.
+ */
+
+void Planner::order(const std::string &project, rapidjson::Document &where, std::vector<double> &selectivity) {
+	std::vector<std::pair<double, rapidjson::Value::MemberIterator> > members;
+	for (auto it = where.MemberBegin(); it != where.MemberEnd(); ++it) {
+		members.push_back(std::make_pair(stats.selectivity(project, it->name.GetString(), it->value, DEFAULT_SELECTIVITY), it));
+	}
+	std::stable_sort(members.begin(), members.end(),
+			[](const std::pair<double, rapidjson::Value::MemberIterator> &a, const std::pair<double, rapidjson::Value::MemberIterator> &b) {
+			return a.first < b.first;
+			});
+
+	rapidjson::Value ordered(rapidjson::kObjectType);
+	selectivity.clear();
+	for (auto it = members.begin(); it != members.end(); ++it) {
+		ordered.AddMember(it->second->name, it->second->value, where.GetAllocator());
+		selectivity.push_back(it->first);
+	}
+	static_cast<rapidjson::Value&>(where) = ordered;
+}
+
+/*
+ *      access ---
+ *
+ *      Pick the access path.  The index seeks are ordered by their estimated number of ids and
+ *      added to the intersection greedily for as long as the documents they avoid fetching are
+ *      worth more than the extra index work.  A full scan wins if no seek beats it.
+ */
+
+PlanNode *Planner::access(Plan *plan, rapidjson::Document *where, uint64_t numDocs) {
+	double scanCost = numDocs * DOC_COST;
+
+	std::vector<std::pair<uint64_t, IndexPredicate> > options;
+	if (where) {
+		std::vector<IndexPredicate> preds;
+		IndexCatalog::predicates(*where, preds);
+		for (auto it = preds.begin(); it != preds.end(); ++it) {
+			double rows = estimate(plan->project, *it, numDocs);
+			if (rows >= 0) {
+				options.push_back(std::make_pair((uint64_t)rows, *it));
+			}
+		}
+	}
+	std::stable_sort(options.begin(), options.end(),
+			[](const std::pair<uint64_t, IndexPredicate> &a, const std::pair<uint64_t, IndexPredicate> &b) {
+			return a.first < b.first;
+			});
+
+	if (options.empty()) {
+		return new PlanNode(SCAN, plan->project, numDocs, scanCost);
+	}
+
+	double rows = options[0].first;
+	double indexCost = SEEK_COST + rows * ENTRY_COST;
+	if (indexCost + rows * DOC_COST >= scanCost) {
+		return new PlanNode(SCAN, plan->project, numDocs, scanCost);
+	}
+
+	std::vector<PlanNode*> seeks;
+	seeks.push_back(new PlanNode(INDEX_SEEK, describe(options[0].second), rows, indexCost));
+	plan->seeks.push_back(options[0].second);
+
+	for (size_t i = 1; i < options.size(); ++i) {
+		double found = options[i].first;
+		double selectivity = numDocs ? found / numDocs : 0;
+		double remaining = rows * selectivity;
+		double extra = SEEK_COST + (found + rows) * ENTRY_COST;
+		double saving = (rows - remaining) * DOC_COST;
+		if (saving <= extra) {
+			continue;
+		}
+		seeks.push_back(new PlanNode(INDEX_SEEK, describe(options[i].second), found, SEEK_COST + found * ENTRY_COST));
+		plan->seeks.push_back(options[i].second);
+		indexCost += extra;
+		rows = remaining;
+	}
+	plan->seekNodes = seeks;
+
+	if (seeks.size() == 1) {
+		seeks[0]->cost += rows * DOC_COST;
+		return seeks[0];
+	}
+	PlanNode *node = new PlanNode(INDEX_INTERSECT, "", rows, indexCost + rows * DOC_COST);
+	node->children = seeks;
+	return node;
+}
+
+/*
+ *      sample ---
+ *
+ *      SAMPLE on top of the access path.  The path below only lists the ids, documents are read
+ *      for the drawn ones alone, so the Sample node is where the documents come from.
+ */
+
+PlanNode *Planner::sample(Plan *plan, Parsing::Query *q, PlanNode *node) {
+	plan->sampling = q->sample;
+	double population = node->estRows;
+	double rows;
+	std::string detail;
+	if (q->sample.rows >= 0) {
+		rows = std::min<double>(q->sample.rows, population);
+		detail = std::to_string(q->sample.rows) + " rows";
+	} else {
+		rows = population * q->sample.percent / 100;
+		std::ostringstream percent;
+		percent << q->sample.percent;
+		detail = percent.str() + " percent";
+	}
+	if (q->sample.repeatable) {
+		detail += " repeatable " + std::to_string(q->sample.seed);
+	}
+
+	node->cost = node->type == SCAN ? population * ENTRY_COST : std::max(0.0, node->cost - population * DOC_COST);
+	PlanNode *s = new PlanNode(SAMPLE, detail, rows, node->cost + rows * DOC_COST);
+	s->children.push_back(node);
+	plan->sample = s;
+	return s;
+}
+
+PlanNode *Planner::limit(Plan *plan, PlanNode *node, int limit) {
+	double rows = std::min<double>(limit, node->estRows);
+	double cost = node->estRows > 0 ? node->cost * std::min(1.0, rows / node->estRows) : node->cost;
+	PlanNode *l = new PlanNode(LIMIT, std::to_string(limit), rows, cost);
+	l->children.push_back(node);
+	plan->limit = l;
+	return l;
+}
+
+/*
+ *      group ---
+ *
+ *      Hash aggregation for GROUP BY.  The groups are estimated from the distinct values the
+ *      statistics know of every grouped field, or as the square root of the input.
+ */
+
+PlanNode *Planner::group(Plan *plan, Parsing::Query *q, PlanNode *node) {
+	plan->groupBy = q->groupBy;
+	std::string detail;
+	double groups = 1;
+	for (auto it = q->groupBy.begin(); it != q->groupBy.end(); ++it) {
+		detail += (detail.empty() ? "" : ", ") + *it;
+		double d = distinct(plan->project, *it);
+		groups *= d > 0 ? d : std::sqrt(std::max(1.0, node->estRows));
+	}
+	std::string aggregates;
+	for (auto it = q->fields->Begin(); it != q->fields->End(); ++it) {
+		if (it->IsObject()) {
+			aggregates += (aggregates.empty() ? "" : ", ") + Parsing::aggregateName(*it);
+		}
+	}
+	if (!aggregates.empty()) {
+		detail += ": " + aggregates;
+	}
+	PlanNode *g = new PlanNode(GROUP, detail, std::min(groups, std::max(1.0, node->estRows)), node->cost);
+	g->children.push_back(node);
+	plan->group = g;
+	return g;
+}
+
+/*
+ *      sort ---
+ *
+ *      ORDER BY, on top of everything but the output.  With a LIMIT the sort only keeps the
+ *      first rows (top-K), so there is no separate Limit stage.
+ */
+
+PlanNode *Planner::sort(Plan *plan, Parsing::Query *q, PlanNode *node) {
+	plan->orderBy = q->orderBy;
+	std::string detail;
+	for (auto it = q->orderBy.begin(); it != q->orderBy.end(); ++it) {
+		detail += (detail.empty() ? "" : ", ") + it->first + (it->second ? " DESC" : "");
+	}
+	double rows = node->estRows;
+	double cost = node->cost + rows * std::log2(std::max(2.0, rows)) * ENTRY_COST;
+	if (q->limit > -1) {
+		detail += " [top " + std::to_string(q->limit) + "]";
+		rows = std::min<double>(q->limit, rows);
+	}
+	PlanNode *s = new PlanNode(SORT, detail, rows, cost);
+	s->children.push_back(node);
+	plan->sort = s;
+	return s;
+}
+
+PlanNode *Planner::input(Plan *plan, Parsing::Query *q, rapidjson::Document *where, uint64_t numDocs, PlanNode *path) {
+	std::vector<double> selectivity;
+	if (where && where->IsObject()) {
+		order(plan->project, *where, selectivity);
+	}
+
+	PlanNode *node = path ? path : access(plan, where, numDocs);
+	if (q->command == Parsing::SELECT && q->sample.active()) {
+		node = sample(plan, q, node);
+	}
+	plan->access = node;
+
+	if (where) {
+		// Conditions not answered by a chosen seek still have to be filtered out.
+		std::set<std::string> covered;
+		for (auto it = plan->seeks.begin(); it != plan->seeks.end(); ++it) {
+			covered.insert(it->field.substr(0, it->field.find('.')));
+		}
+		double rows = node->estRows;
+		size_t i = 0;
+		for (auto it = where->MemberBegin(); it != where->MemberEnd(); ++it, ++i) {
+			if (covered.count(it->name.GetString()) == 0) {
+				rows *= i < selectivity.size() ? selectivity[i] : DEFAULT_SELECTIVITY;
+			}
+		}
+		if (node->estRows >= 1) {
+			rows = std::max(1.0, rows);
+		}
+		PlanNode *filter = new PlanNode(FILTER, toString(where), rows, node->cost);
+		filter->children.push_back(node);
+		plan->filter = filter;
+		node = filter;
+	}
+	return node;
+}
+
+PlanNode *Planner::output(Plan *plan, Parsing::Query *q, PlanNode *node) {
+	// A grouped select limits the groups, not the documents, and a sorted one the sorted rows.
+	bool grouped = q->command == Parsing::SELECT && !q->groupBy.empty();
+	bool sorted = q->command == Parsing::SELECT && !q->orderBy.empty();
+	if (q->limit > -1 && !grouped && !sorted) {
+		node = limit(plan, node, q->limit);
+	}
+
+	switch (q->command) {
+		case Parsing::SELECT:
+			if (grouped) {
+				node = group(plan, q, node);
+				if (sorted) {
+					node = sort(plan, q, node);
+				} else if (q->limit > -1) {
+					node = limit(plan, node, q->limit);
+				}
+			} else {
+				std::string fields;
+				std::string aggregates;
+				for (auto it = q->fields->Begin(); it != q->fields->End(); ++it) {
+					if (it->IsString()) {
+						fields += (fields.empty() ? "" : ", ") + std::string(it->GetString());
+					} else if (it->IsObject()) {
+						aggregates += (aggregates.empty() ? "" : ", ") + Parsing::aggregateName(*it);
+					}
+				}
+				PlanNode *project = new PlanNode(PROJECT, fields, node->estRows, node->cost);
+				project->children.push_back(node);
+				plan->project_node = project;
+				node = project;
+				if (!aggregates.empty()) {
+					PlanNode *aggregate = new PlanNode(AGGREGATE, aggregates, 1, node->cost);
+					aggregate->children.push_back(node);
+					plan->aggregate = aggregate;
+					node = aggregate;
+				}
+				if (sorted) {
+					node = sort(plan, q, node);
+				}
+			}
+			break;
+		case Parsing::UPDATE:
+			{
+				PlanNode *update = new PlanNode(UPDATE_DOCS, plan->project, node->estRows, node->cost + node->estRows * DOC_COST);
+				update->children.push_back(node);
+				node = update;
+				break;
+			}
+		case Parsing::DELETE:
+			{
+				PlanNode *del = new PlanNode(DELETE_DOCS, plan->project, node->estRows, node->cost + node->estRows * DOC_COST);
+				del->children.push_back(node);
+				node = del;
+				break;
+			}
+		default:
+			break;
+	}
+
+	return node;
+}
+
+Plan *Planner::plan(Parsing::Query *q, uint64_t numDocs) {
+	Plan *plan = new Plan();
+	plan->project = *q->project;
+	PlanNode *node = input(plan, q, q->where, numDocs);
+	plan->root = output(plan, q, node);
+	return plan;
+}
+
+JoinSide *Planner::side(Parsing::Query *q, bool left, uint64_t numDocs, PlanNode *&node) {
+	JoinSide *s = new JoinSide();
+	s->left = left;
+	s->alias = left ? q->join.alias : q->join.joinedAlias;
+	s->project = left ? *q->project : q->join.project;
+	s->key = left ? q->join.key : q->join.joinedKey;
+	s->plan.project = s->project;
+	if (q->where && q->where->HasMember(s->alias.c_str())) {
+		s->where.CopyFrom((*q->where)[s->alias.c_str()], s->where.GetAllocator());
+	}
+	bool conditions = s->where.IsObject() && s->where.MemberCount() > 0;
+	node = input(&s->plan, q, conditions ? &s->where : NULL, numDocs);
+	return s;
+}
+
+/*
+ *      plan (join) ---
+ *
+ *      Each project gets its own access path and filter, then a hash join builds its table from
+ *      the side expected to be smaller.  If the probe side has an index on its join field and
+ *      looking every build key up in it is cheaper than its access path, the probe side only
+ *      reads the documents holding one of the keys.  The rest of the select runs on the joined
+ *      rows as usual.
+ */
+
+Plan *Planner::plan(Parsing::Query *q, uint64_t numDocs, uint64_t joinedDocs) {
+	Plan *plan = new Plan();
+	plan->project = *q->project;
+
+	PlanNode *left, *right;
+	JoinSide *l = side(q, true, numDocs, left);
+	JoinSide *r = side(q, false, joinedDocs, right);
+	bool buildLeft = left->estRows <= right->estRows;
+	plan->build = buildLeft ? l : r;
+	plan->probe = buildLeft ? r : l;
+	PlanNode *build = buildLeft ? left : right;
+	PlanNode *probe = buildLeft ? right : left;
+	JoinSide *p = plan->probe;
+	uint64_t probeDocs = buildLeft ? joinedDocs : numDocs;
+
+	// Probe documents holding one of the build keys, if the keys are spread like the values.
+	double probeDistinct = distinct(p->project, p->key);
+	double keyed = std::min<double>(probeDocs, build->estRows * (probeDistinct > 0 ? probeDocs / probeDistinct : 1));
+	if (indexes.exists(p->project, p->key)) {
+		double seekCost = build->estRows * SEEK_COST + keyed * DOC_COST;
+		if (seekCost < p->plan.access->cost) {
+			delete probe;
+			p->plan.access = p->plan.filter = NULL;
+			p->plan.seeks.clear();
+			p->plan.seekNodes.clear();
+			p->seekKeys = true;
+			bool conditions = p->where.IsObject() && p->where.MemberCount() > 0;
+			probe = input(&p->plan, q, conditions ? &p->where : NULL, probeDocs,
+					new PlanNode(INDEX_SEEK, p->key + " = join keys", keyed, seekCost));
+		}
+	}
+
+	double buildDistinct = distinct(plan->build->project, plan->build->key);
+	double keys = std::max(buildDistinct, probeDistinct);
+	double rows = keys > 0 ? build->estRows * probe->estRows / keys : std::max(build->estRows, probe->estRows);
+	std::string detail = l->alias + "." + l->key + " = " + r->alias + "." + r->key + " [build " + plan->build->alias + "]";
+	PlanNode *join = new PlanNode(HASH_JOIN, detail, rows, build->cost + probe->cost + (build->estRows + probe->estRows) * ENTRY_COST);
+	join->children.push_back(build);
+	join->children.push_back(probe);
+	plan->join = join;
+
+	plan->root = output(plan, q, join);
+	return plan;
+}
@@ -0,0 +1,146 @@
+#ifndef PLANNER_H_
+#define PLANNER_H_
+
+#include <string>
+#include <vector>
+#include <iostream>
+
+#include "../parsing/Parser.h"
+#include "Index.h"
+#include "Statistics.h"
+
+enum PlanType {
+	SCAN            = 0,
+	INDEX_SEEK      = 1,
+	INDEX_INTERSECT = 2,
+	FILTER          = 3,
+	PROJECT         = 4,
+	AGGREGATE       = 5,
+	LIMIT           = 6,
+	UPDATE_DOCS     = 7,
+	DELETE_DOCS     = 8,
+	GROUP           = 9,
+	SORT            = 10,
+	SAMPLE          = 11,
+	HASH_JOIN       = 12
+};
+
+const std::string PlanNames[] = {"Scan", "IndexSeek", "IndexIntersect", "Filter", "Project", "Aggregate", "Limit", "Update", "Delete",
+	"HashAggregate", "Sort", "Sample", "HashJoin"};
+
+// Relative costs.  One document open + read + parse is the unit.
+const double DOC_COST = 1.0;
+const double ENTRY_COST = 0.01;
+const double SEEK_COST = 0.05;
+
+// Selectivity assumed for a condition nothing is known about.
+const double DEFAULT_SELECTIVITY = 0.1;
+
+// Index entries walked while estimating a seek.
+const uint64_t ESTIMATE_CAP = 1024;
+
+struct PlanNode {
+	PlanType type;
+	std::string detail;
+	double estRows;
+	double cost;
+	uint64_t actualRows;
+	uint64_t rowsIn;
+	double millis;
+	std::vector<PlanNode*> children;
+	PlanNode(PlanType t, std::string d, double rows, double c): type(t), detail(d), estRows(rows), cost(c), actualRows(0), rowsIn(0), millis(0) {}
+	~PlanNode() {
+		for (auto it = children.begin(); it != children.end(); ++it) {
+			delete *it;
+		}
+	}
+	// With 'actual' false only the estimates, for a plan that was not run.
+	void print(std::ostream &os, int depth, bool actual);
+};
+
+struct JoinSide;
+
+/*
+ *      Plan ---
+ *
+ *      Physical plan for a SELECT, UPDATE or DELETE.  The named nodes point into the tree so the
+ *      executor's operators can record the rows and time that actually went through each stage.
+ *      A join plan reads its two projects through the plans of its 'build' and 'probe' sides.
+ */
+
+struct Plan {
+	std::string project;
+	PlanNode *root;
+	PlanNode *access;
+	PlanNode *filter;
+	PlanNode *limit;
+	PlanNode *project_node;
+	PlanNode *aggregate;
+	PlanNode *group;
+	PlanNode *sort;
+	PlanNode *sample;
+	PlanNode *join;
+	JoinSide *build;
+	JoinSide *probe;
+	Parsing::Sample sampling;
+	std::vector<std::string> groupBy;
+	std::vector<std::pair<std::string, bool>> orderBy;
+	std::vector<IndexPredicate> seeks;
+	std::vector<PlanNode*> seekNodes;
+	Plan(): root(NULL), access(NULL), filter(NULL), limit(NULL), project_node(NULL), aggregate(NULL), group(NULL), sort(NULL), sample(NULL),
+		join(NULL), build(NULL), probe(NULL) {}
+	~Plan();
+
+	bool indexed() { return !seeks.empty(); }
+
+	// Run the chosen index seeks and intersect them.  Sorted ids in 'out'.
+	void candidates(IndexCatalog &indexes, std::vector<uint64_t> &out);
+	void print(std::ostream &os, bool actual = true);
+};
+
+/*
+ *      JoinSide ---
+ *
+ *      One project of a join: its own access path and filter, over the conditions the where
+ *      clause put under its alias.  The hash table is built from the side expected to be
+ *      smaller.  With 'seekKeys' the probe side looks its join keys up in an index instead of
+ *      reading every document.  The nodes of 'plan' belong to the join's tree.
+ */
+
+struct JoinSide {
+	std::string alias;
+	std::string project;
+	std::string key;
+	bool left;                  // the FROM project, its members come first in a joined row
+	bool seekKeys;
+	Plan plan;
+	rapidjson::Document where;  // null without conditions
+	JoinSide(): left(false), seekKeys(false) {}
+};
+
+class Planner {
+public:
+	Planner(IndexCatalog &indexes_, StatsCatalog &stats_): indexes(indexes_), stats(stats_) {}
+	Plan *plan(Parsing::Query *q, uint64_t numDocs);
+	// A join, 'numDocs' in the FROM project and 'joinedDocs' in the joined one.
+	Plan *plan(Parsing::Query *q, uint64_t numDocs, uint64_t joinedDocs);
+	// Estimated number of distinct values of a field, 0 if the project was never analyzed.
+	double distinct(const std::string &project, const std::string &field);
+private:
+	IndexCatalog &indexes;
+	StatsCatalog &stats;
+	double estimate(const std::string &project, const IndexPredicate &pred, uint64_t numDocs);
+	void order(const std::string &project, rapidjson::Document &where, std::vector<double> &selectivity);
+	// Access path, sample and filter of one project, on top of 'path' if one is given.
+	PlanNode *input(Plan *plan, Parsing::Query *q, rapidjson::Document *where, uint64_t numDocs, PlanNode *path = NULL);
+	// Everything above the input: limit, grouping, projection, sorting or the write.
+	PlanNode *output(Plan *plan, Parsing::Query *q, PlanNode *node);
+	JoinSide *side(Parsing::Query *q, bool left, uint64_t numDocs, PlanNode *&node);
+	PlanNode *limit(Plan *plan, PlanNode *node, int limit);
+	PlanNode *group(Plan *plan, Parsing::Query *q, PlanNode *node);
+	PlanNode *sort(Plan *plan, Parsing::Query *q, PlanNode *node);
+	PlanNode *access(Plan *plan, rapidjson::Document *where, uint64_t numDocs);
+	PlanNode *sample(Plan *plan, Parsing::Query *q, PlanNode *node);
+};
+
+#endif
@@ -0,0 +1,172 @@
+#include <sstream>
+#include <iterator>
+#include <pretty.h>
+
+#include "ResultCache.h"
+
+/*
+ *      ResultCache
+ */
+
+ResultCache::ResultCache(size_t budget_): hits(0), misses(0), evictions(0), budget(budget_), bytes(0) {}
+
+std::string ResultCache::key(const Parsing::Query &q) {
+	if (q.command != Parsing::SELECT || q.explain || !q.project || !q.fields || (q.sample.active() && !q.sample.repeatable)) {
+		return "";
+	}
+	std::ostringstream key;
+	key << "SELECT " << toString(q.fields) << " FROM " << *q.project;
+	if (q.join.active()) {
+		key << " " << q.join.alias << " JOIN " << q.join.project << " " << q.join.joinedAlias << " ON " << q.join.alias << "." << q.join.key
+			<< " = " << q.join.joinedAlias << "." << q.join.joinedKey;
+	}
+	if (q.sample.active()) {
+		key << " SAMPLE ";
+		if (q.sample.rows >= 0) {
+			key << q.sample.rows << " ROWS";
+		} else {
+			key << q.sample.percent << " PERCENT";
+		}
+		key << " REPEATABLE " << q.sample.seed;
+	}
+	if (q.where) {
+		key << " WHERE " << toString(q.where);
+	}
+	for (auto it = q.groupBy.begin(); it != q.groupBy.end(); ++it) {
+		key << (it == q.groupBy.begin() ? " GROUP BY " : ", ") << *it;
+	}
+	for (auto it = q.orderBy.begin(); it != q.orderBy.end(); ++it) {
+		key << (it == q.orderBy.begin() ? " ORDER BY " : ", ") << it->first << (it->second ? " DESC" : "");
+	}
+	if (q.limit > -1) {
+		key << " LIMIT " << q.limit;
+	}
+	return key.str();
+}
+
+void ResultCache::bump(const std::string &project) {
+	++versions[project];
+}
+
+uint64_t ResultCache::version(const std::string &project) const {
+	auto it = versions.find(project);
+	return it == versions.end() ? 0 : it->second;
+}
+
+bool ResultCache::lookup(const std::string &key, std::string &out) {
+	auto found = entries.find(key);
+	if (found == entries.end()) {
+		++misses;
+		return false;
+	}
+	std::list<Entry>::iterator it = found->second;
+	for (auto v = it->versions.begin(); v != it->versions.end(); ++v) {
+		if (version(v->first) != v->second) {
+			drop(it);
+			++misses;
+			return false;
+		}
+	}
+	lru.splice(lru.begin(), lru, it);
+	out = it->output;
+	++hits;
+	return true;
+}
+
+void ResultCache::store(const std::string &key, const std::vector<std::string> &projects, const std::string &out) {
+	auto found = entries.find(key);
+	if (found != entries.end()) {
+		drop(found->second);
+	}
+	size_t size = sizeof(Entry) + 2 * key.size() + out.size();
+	if (size > budget) {
+		return;
+	}
+	lru.push_front(Entry());
+	Entry &e = lru.front();
+	e.key = key;
+	e.output = out;
+	for (auto p = projects.begin(); p != projects.end(); ++p) {
+		e.versions.push_back(std::make_pair(*p, version(*p)));
+	}
+	e.bytes = size;
+	entries[key] = lru.begin();
+	bytes += size;
+	evict();
+}
+
+void ResultCache::setBudget(size_t bytes_) {
+	budget = bytes_;
+	evict();
+}
+
+void ResultCache::clear() {
+	lru.clear();
+	entries.clear();
+	bytes = 0;
+}
+
+void ResultCache::print(std::ostream &os) const {
+	uint64_t lookups = hits + misses;
+	os << "Cached results: " << entries.size() << " (" << bytes << " of " << budget << " bytes)" << std::endl;
+	os << "Hits: " << hits << ", misses: " << misses;
+	if (lookups) {
+		os << " (" << 100.0 * hits / lookups << "% hit)";
+	}
+	os << ", evictions: " << evictions << std::endl;
+}
+
+void ResultCache::drop(std::list<Entry>::iterator it) {
+	bytes -= it->bytes;
+	entries.erase(it->key);
+	lru.erase(it);
+}
+
+void ResultCache::evict() {
+	while (bytes > budget && !lru.empty()) {
+		drop(std::prev(lru.end()));
+		++evictions;
+	}
+}
+
+/*
+ *      OutputCapture
+ */
+
+OutputCapture::OutputCapture(std::ostream &os_, size_t limit_): os(os_), target(os_.rdbuf()), limit(limit_), overflowed(false) {
+	os.rdbuf(this);
+}
+
+OutputCapture::~OutputCapture() {
+	os.rdbuf(target);
+}
+
+void OutputCapture::keep(const char *s, size_t n) {
+	if (overflowed) {
+		return;
+	}
+	if (text.size() + n > limit) {
+		overflowed = true;
+		std::string().swap(text);
+		return;
+	}
+	text.append(s, n);
+}
+
+int OutputCapture::overflow(int c) {
+	if (c == traits_type::eof()) {
+		return traits_type::not_eof(c);
+	}
+	char ch = traits_type::to_char_type(c);
+	keep(&ch, 1);
+	return target->sputc(ch);
+}
+
+std::streamsize OutputCapture::xsputn(const char *s, std::streamsize n) {
+	keep(s, (size_t)n);
+	return target->sputn(s, n);
+}
+
+int OutputCapture::sync() {
+	return target->pubsync();
+}
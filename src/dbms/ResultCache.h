@@ -0,0 +1,103 @@
+#ifndef RESULTCACHE_H_
+#define RESULTCACHE_H_
+
+#include <list>
+#include <map>
+#include <string>
+#include <vector>
+#include <utility>
+#include <ostream>
+#include <streambuf>
+#include <unordered_map>
+#include <cstdint>
+
+#include "../parsing/Parser.h"
+
+/*
+ *      ResultCache ---
+ *
+ *      The printed output of recent selects, so a select that is repeated while its projects
+ *      are not written to is answered without reading a document.  Entries are keyed by the
+ *      normalized text of the select (key()) and remember the version of every project they
+ *      read.  Each INSERT, UPDATE and DELETE bumps the version of its project, so an entry is
+ *      stale as soon as one of them differs and is dropped when next looked up.
+ *
+ *      Entries are kept in least recently used order and evicted once their key and output
+ *      take more than 'budget' bytes.  Outputs bigger than the whole budget are not kept.
+ */
+
+class ResultCache {
+public:
+	uint64_t hits;
+	uint64_t misses;
+	uint64_t evictions;
+
+	explicit ResultCache(size_t budget_);
+
+	// The key of a select: its parts printed in one canonical form, so spacing and the case
+	// of keywords do not matter.  Empty for selects whose output can not be reused
+	// (EXPLAIN, samples without REPEATABLE).
+	static std::string key(const Parsing::Query &q);
+
+	// A write to 'project' invalidates the entries that read it.
+	void bump(const std::string &project);
+	uint64_t version(const std::string &project) const;
+
+	// Copy the output cached under 'key' into 'out', if still valid.  Counts a hit or a miss.
+	bool lookup(const std::string &key, std::string &out);
+	// Keep the output of a select of 'projects', read at their current versions.
+	void store(const std::string &key, const std::vector<std::string> &projects, const std::string &out);
+
+	void setBudget(size_t bytes);
+	size_t memory() const { return bytes; }
+	size_t size() const { return entries.size(); }
+	void clear();
+	void print(std::ostream &os) const;
+private:
+	struct Entry {
+		std::string key;
+		std::string output;
+		std::vector<std::pair<std::string, uint64_t> > versions;
+		size_t bytes;
+	};
+
+	size_t budget;
+	size_t bytes;
+	std::list<Entry> lru;       // most recently used first
+	std::unordered_map<std::string, std::list<Entry>::iterator> entries;
+	std::map<std::string, uint64_t> versions;
+
+	void drop(std::list<Entry>::iterator it);
+	void evict();
+};
+
+/*
+ *      OutputCapture ---
+ *
+ *      Copies what is written to a stream into 'text' while passing it on unchanged, until
+ *      more than 'limit' bytes were written.  The stream gets its own buffer back when the
+ *      capture goes out of scope.
+ */
+
+class OutputCapture: public std::streambuf {
+public:
+	std::string text;
+
+	OutputCapture(std::ostream &os_, size_t limit_);
+	~OutputCapture();
+	// Everything written was captured.
+	bool complete() const { return !overflowed; }
+protected:
+	int overflow(int c);
+	std::streamsize xsputn(const char *s, std::streamsize n);
+	int sync();
+private:
+	std::ostream &os;
+	std::streambuf *target;
+	size_t limit;
+	bool overflowed;
+
+	void keep(const char *s, size_t n);
+};
+
+#endif
@@ -0,0 +1,305 @@
+#include <atomic>
+#include <cstdlib>
+#include <cstring>
+#include <algorithm>
+#include <pretty.h>
+
+#include "Sort.h"
+#include "Index.h"
+
+static std::atomic<uint64_t> nextSortId(0);
+
+/*
+ *      SortKey
+ */
+
+static void putUint64(std::string &out, uint64_t v) {
+	for (int shift = 56; shift >= 0; shift -= 8) {
+		out += (char)(v >> shift);
+	}
+}
+
+void SortKey::encode(const Row &row, uint64_t seq, std::string &out) const {
+	out.clear();
+	const rapidjson::Value &from = output ? row.out : static_cast<const rapidjson::Value&>(row.doc);
+	for (auto k = keys.begin(); k != keys.end(); ++k) {
+		const rapidjson::Value *v = lookupPath(from, k->first);
+		size_t start = out.size();
+		if (!v) {
+			out += '\0';
+		} else {
+			switch (v->GetType()) {
+				case rapidjson::kNullType:
+					out += '\1';
+					break;
+				case rapidjson::kFalseType:
+				case rapidjson::kTrueType:
+					out += '\2';
+					out += (char)v->IsTrue();
+					break;
+				case rapidjson::kNumberType:
+					{
+						out += '\3';
+						// + 0 turns -0 into 0, they are equal
+						double d = v->GetDouble() + 0.0;
+						uint64_t bits;
+						memcpy(&bits, &d, sizeof(bits));
+						putUint64(out, bits >> 63 ? ~bits : bits | (1ULL << 63));
+					}
+					break;
+				case rapidjson::kStringType:
+					{
+						out += '\4';
+						const char *s = v->GetString();
+						for (rapidjson::SizeType i = 0; i < v->GetStringLength(); ++i) {
+							out += s[i];
+							if (s[i] == '\0') {
+								out += '\xff';
+							}
+						}
+						out += '\0';
+						out += '\0';
+					}
+					break;
+				case rapidjson::kObjectType:
+					out += '\5';
+					break;
+				default:
+					out += '\6';
+					break;
+			}
+		}
+		if (k->second) {
+			for (size_t i = start; i < out.size(); ++i) {
+				out[i] = ~out[i];
+			}
+		}
+	}
+	putUint64(out, seq);
+}
+
+/*
+ *      Sort
+ */
+
+Sort::Sort(Operator *child, const std::vector<Key> &keys_, int limit_, bool output, FILESYSTEM &fs_, size_t budget_, PlanNode *node_):
+	Operator(node_), runs(0), encoder(keys_, output), limit(limit_), fs(fs_), budget(budget_), started(false), seq(0), id(nextSortId++),
+	chunks(0), memory(0), pos(0), summaryPos(0) {
+	chunk = std::min(std::max(budget / SORT_FAN_IN, (size_t)4096), (size_t)(1 << 20));
+	add(child);
+}
+
+Sort::~Sort() {
+	for (auto it = summaries.begin(); it != summaries.end(); ++it) {
+		delete *it;
+	}
+	for (auto it = readers.begin(); it != readers.end(); ++it) {
+		close(*it);
+	}
+	for (auto run = spilled.begin(); run != spilled.end(); ++run) {
+		close(open(*run));
+	}
+}
+
+bool Sort::produce(Row &row) {
+	if (!started) {
+		started = true;
+		consume();
+	}
+	if (!heap.empty()) {
+		auto later = [](const Reader *a, const Reader *b) { return a->key > b->key; };
+		std::pop_heap(heap.begin(), heap.end(), later);
+		Reader *r = heap.back();
+		fill(row, r->json);
+		if (advance(*r)) {
+			std::push_heap(heap.begin(), heap.end(), later);
+		} else {
+			heap.pop_back();
+		}
+		return true;
+	}
+	if (pos < entries.size()) {
+		fill(row, entries[pos].json.c_str());
+		std::string().swap(entries[pos].json);
+		++pos;
+		return true;
+	}
+	if (summaryPos < summaries.size()) {
+		row.swap(*summaries[summaryPos++]);
+		return true;
+	}
+	return false;
+}
+
+void Sort::consume() {
+	Row *r = new Row();
+	Entry e;
+	while (pull(*r)) {
+		if (r->summary) {
+			summaries.push_back(r);
+			r = new Row();
+			continue;
+		}
+		if (r->out.MemberCount() == 0 || limit == 0) {
+			continue;
+		}
+		encoder.encode(*r, seq++, e.key);
+		if (limit > 0) {
+			if (entries.size() == (size_t)limit) {
+				if (!(e.key < entries.front().key)) {
+					continue;
+				}
+				std::pop_heap(entries.begin(), entries.end());
+				entries.pop_back();
+			}
+			e.json = toString(&r->out);
+			entries.push_back(e);
+			std::push_heap(entries.begin(), entries.end());
+			continue;
+		}
+		e.json = toString(&r->out);
+		memory += e.key.size() + e.json.size() + sizeof(Entry);
+		entries.push_back(e);
+		if (memory >= budget) {
+			spill();
+		}
+	}
+	delete r;
+
+	if (spilled.empty()) {
+		std::sort(entries.begin(), entries.end());
+		return;
+	}
+	spill();
+	while (spilled.size() > SORT_FAN_IN) {
+		std::vector<Reader*> from;
+		for (size_t i = 0; i < SORT_FAN_IN; ++i) {
+			from.push_back(open(spilled[i]));
+		}
+		spilled.erase(spilled.begin(), spilled.begin() + SORT_FAN_IN);
+		Writer w;
+		merge(from, w);
+		spilled.push_back(w.files);
+	}
+	for (auto run = spilled.begin(); run != spilled.end(); ++run) {
+		Reader *r = open(*run);
+		readers.push_back(r);
+		if (advance(*r)) {
+			heap.push_back(r);
+		}
+	}
+	spilled.clear();
+	std::make_heap(heap.begin(), heap.end(), [](const Reader *a, const Reader *b) { return a->key > b->key; });
+}
+
+// Write the rows held in memory out as a sorted run.
+void Sort::spill() {
+	if (entries.empty()) {
+		return;
+	}
+	std::sort(entries.begin(), entries.end());
+	Writer w;
+	for (auto it = entries.begin(); it != entries.end(); ++it) {
+		write(w, it->key, it->json.c_str(), it->json.size());
+	}
+	flush(w);
+	spilled.push_back(w.files);
+	std::vector<Entry>().swap(entries);
+	memory = 0;
+	++runs;
+}
+
+// A record is the key's length and bytes, then the JSON's length and bytes ending in a 0.
+void Sort::write(Writer &w, const std::string &key, const char *json, size_t length) {
+	uint32_t n = (uint32_t)key.size();
+	w.buffer.append((const char*)&n, sizeof(n));
+	w.buffer += key;
+	n = (uint32_t)length + 1;
+	w.buffer.append((const char*)&n, sizeof(n));
+	w.buffer.append(json, length + 1);
+	if (w.buffer.size() >= chunk) {
+		flush(w);
+	}
+}
+
+void Sort::flush(Writer &w) {
+	if (w.buffer.empty()) {
+		return;
+	}
+	std::string name = "__SORT_RUN__" + std::to_string(id) + "_" + std::to_string(chunks++);
+	File f = fs.open_file(name);
+	fs.write(&f, w.buffer.data(), w.buffer.size());
+	w.files.push_back(name);
+	std::string().swap(w.buffer);
+}
+
+Sort::Reader *Sort::open(const std::vector<std::string> &files) {
+	return new Reader(files);
+}
+
+// Move to the next record of a run, reading (and dropping) its next chunk when needed.
+bool Sort::advance(Reader &r) {
+	while (r.pos >= r.size) {
+		free(r.data);
+		r.data = NULL;
+		r.size = r.pos = 0;
+		if (r.next >= r.files.size()) {
+			return false;
+		}
+		File f = fs.open_file(r.files[r.next++]);
+		r.data = fs.read(&f);
+		r.size = f.size;
+		fs.deleteFile(&f);
+	}
+	uint32_t n;
+	memcpy(&n, r.data + r.pos, sizeof(n));
+	r.pos += sizeof(n);
+	r.key.assign(r.data + r.pos, n);
+	r.pos += n;
+	memcpy(&n, r.data + r.pos, sizeof(n));
+	r.pos += sizeof(n);
+	r.json = r.data + r.pos;
+	r.pos += n;
+	return true;
+}
+
+// Drop a reader and the chunks it did not get to.
+void Sort::close(Reader *r) {
+	free(r->data);
+	for (size_t i = r->next; i < r->files.size(); ++i) {
+		File f = fs.open_file(r->files[i]);
+		fs.deleteFile(&f);
+	}
+	delete r;
+}
+
+void Sort::merge(std::vector<Reader*> &from, Writer &to) {
+	auto later = [](const Reader *a, const Reader *b) { return a->key > b->key; };
+	std::vector<Reader*> h;
+	for (auto it = from.begin(); it != from.end(); ++it) {
+		if (advance(**it)) {
+			h.push_back(*it);
+		}
+	}
+	std::make_heap(h.begin(), h.end(), later);
+	while (!h.empty()) {
+		std::pop_heap(h.begin(), h.end(), later);
+		Reader *r = h.back();
+		write(to, r->key, r->json, strlen(r->json));
+		if (advance(*r)) {
+			std::push_heap(h.begin(), h.end(), later);
+		} else {
+			h.pop_back();
+		}
+	}
+	flush(to);
+	for (auto it = from.begin(); it != from.end(); ++it) {
+		close(*it);
+	}
+}
+
+void Sort::fill(Row &row, const char *json) {
+	row.reset();
+	row.doc.Parse(json);
+	row.out.Swap(row.doc);
+}
@@ -0,0 +1,114 @@
+#ifndef SORT_H_
+#define SORT_H_
+
+#include <string>
+#include <vector>
+#include <utility>
+#include <rapidjson/document.h>
+
+#include "dbms.h"
+#include "Executor.h"
+
+// Sorted runs merged at once.  More are first merged into longer runs.
+const size_t SORT_FAN_IN = 16;
+
+/*
+ *      SortKey ---
+ *
+ *      The ORDER BY keys of a row encoded into one byte string, so rows compare with a single
+ *      memcmp: missing < null < booleans < numbers < strings < objects < arrays, numbers by
+ *      value and strings bytewise.  Each value is a type byte and then its bytes: a double
+ *      big endian with the sign bit flipped (every bit when negative), a string with its zero
+ *      bytes escaped as 0 0xff and ended by 0 0.  The bytes of descending keys are inverted.
+ *      A sequence number at the end keeps equal rows in input order.
+ */
+
+class SortKey {
+public:
+	typedef std::pair<std::string, bool> Key;   // field path, descending
+
+	// 'output' reads the keys from the projected row rather than the document.
+	SortKey(const std::vector<Key> &keys_, bool output_): keys(keys_), output(output_) {}
+	void encode(const Row &row, uint64_t seq, std::string &out) const;
+private:
+	std::vector<Key> keys;
+	bool output;
+};
+
+/*
+ *      Sort ---
+ *
+ *      ORDER BY.  Rows are kept as their key and their projected row in JSON; holding on to
+ *      the parsed rows would cost a whole allocator chunk each.  With a limit only the first
+ *      'limit' rows are kept, in a heap with the last of them on top.  Without one the rows are
+ *      sorted in memory until they outgrow 'budget' bytes; then they are written out as a
+ *      sorted run, in chunks of files in the filesystem, and merged with the later runs at the
+ *      end, at most SORT_FAN_IN at a time.  Summary rows stay last.
+ */
+
+class Sort: public Operator {
+public:
+	typedef SortKey::Key Key;
+
+	Sort(Operator *child, const std::vector<Key> &keys_, int limit_, bool output, FILESYSTEM &fs_, size_t budget_, PlanNode *node_);
+	~Sort();
+
+	// Sorted runs written to disk.
+	uint64_t runs;
+protected:
+	bool produce(Row &row);
+private:
+	struct Entry {
+		std::string key;
+		std::string json;
+		bool operator<(const Entry &other) const { return key < other.key; }
+	};
+
+	// Reads the records of a run back, a chunk at a time.
+	struct Reader {
+		std::vector<std::string> files;
+		size_t next;
+		char *data;
+		size_t size;
+		size_t pos;
+		std::string key;
+		const char *json;
+		Reader(const std::vector<std::string> &files_): files(files_), next(0), data(NULL), size(0), pos(0), json(NULL) {}
+	};
+
+	// Writes a run, a chunk file whenever 'buffer' is full.
+	struct Writer {
+		std::vector<std::string> files;
+		std::string buffer;
+	};
+
+	SortKey encoder;
+	int limit;
+	FILESYSTEM &fs;
+	size_t budget;
+	size_t chunk;
+	bool started;
+	uint64_t seq;
+	uint64_t id;
+	uint64_t chunks;
+	size_t memory;
+	std::vector<Entry> entries;
+	size_t pos;
+	std::vector<Row*> summaries;
+	size_t summaryPos;
+	std::vector<std::vector<std::string>> spilled;
+	std::vector<Reader*> readers;
+	std::vector<Reader*> heap;
+
+	void consume();
+	void spill();
+	void write(Writer &w, const std::string &key, const char *json, size_t length);
+	void flush(Writer &w);
+	Reader *open(const std::vector<std::string> &files);
+	bool advance(Reader &r);
+	void close(Reader *r);
+	void merge(std::vector<Reader*> &from, Writer &to);
+	void fill(Row &row, const char *json);
+};
+
+#endif
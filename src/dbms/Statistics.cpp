@@ -0,0 +1,608 @@
+#include <algorithm>
+#include <cstring>
+#include <iomanip>
+#include <random>
+#include <sstream>
+
+#include "Statistics.h"
+#include "../utils/Util.h"
+
+const std::string StatsListFile("__STATS__");
+const std::string StatsFilePrefix("__STATS__");
+
+static StatType typeOf(const rapidjson::Value &v) {
+	switch (v.GetType()) {
+		case rapidjson::kNullType:
+			return ST_NULL;
+		case rapidjson::kFalseType:
+		case rapidjson::kTrueType:
+			return ST_BOOL;
+		case rapidjson::kNumberType:
+			return ST_NUMBER;
+		case rapidjson::kStringType:
+			return ST_STRING;
+		case rapidjson::kObjectType:
+			return ST_OBJECT;
+		default:
+			return ST_ARRAY;
+	}
+}
+
+/*
+ *      Histogram
+ */
+
+void Histogram::build(std::vector<double> &values) {
+	bounds.clear();
+	counts.clear();
+	if (values.empty()) {
+		return;
+	}
+	std::sort(values.begin(), values.end());
+	uint64_t n = values.size();
+	uint64_t buckets = std::min(HISTOGRAM_BUCKETS, n);
+	uint64_t prev = 0;
+	bounds.push_back(values[0]);
+	for (uint64_t b = 1; b <= buckets && prev < n; ++b) {
+		uint64_t idx = std::max(b * n / buckets, prev + 1);
+		// A run of equal values is not split, add() and remove() find them all in the first
+		// bucket they bound.
+		while (idx < n && values[idx] == values[idx - 1]) {
+			++idx;
+		}
+		bounds.push_back(values[idx - 1]);
+		counts.push_back(idx - prev);
+		prev = idx;
+	}
+}
+
+static size_t bucketOf(const std::vector<double> &bounds, double v) {
+	auto it = std::lower_bound(bounds.begin() + 1, bounds.end(), v);
+	if (it == bounds.end()) {
+		--it;
+	}
+	return (it - bounds.begin()) - 1;
+}
+
+void Histogram::add(double v) {
+	if (bounds.empty()) {
+		bounds.push_back(v);
+		bounds.push_back(v);
+		counts.push_back(1);
+		return;
+	}
+	if (v < bounds.front()) {
+		bounds.front() = v;
+	} else if (v > bounds.back()) {
+		bounds.back() = v;
+	}
+	counts[bucketOf(bounds, v)]++;
+}
+
+void Histogram::remove(double v) {
+	if (bounds.empty() || v < bounds.front() || v > bounds.back()) {
+		return;
+	}
+	uint64_t &c = counts[bucketOf(bounds, v)];
+	if (c > 0) {
+		--c;
+	}
+}
+
+uint64_t Histogram::total() const {
+	uint64_t sum = 0;
+	for (auto it = counts.begin(); it != counts.end(); ++it) {
+		sum += *it;
+	}
+	return sum;
+}
+
+double Histogram::fractionBelow(double v) const {
+	uint64_t t = total();
+	if (t == 0 || v <= bounds.front()) {
+		return 0;
+	}
+	if (v > bounds.back()) {
+		return 1;
+	}
+	double acc = 0;
+	for (size_t b = 0; b < counts.size(); ++b) {
+		double lo = bounds[b];
+		double hi = bounds[b + 1];
+		if (v > hi) {
+			acc += counts[b];
+		} else {
+			// Values are assumed to be spread evenly inside a bucket.
+			double width = hi - lo;
+			acc += counts[b] * (width > 0 ? (v - lo) / width : 0.5);
+			break;
+		}
+	}
+	return acc / t;
+}
+
+/*
+ *      FieldStats / ProjectStats
+ */
+
+uint64_t FieldStats::present() const {
+	uint64_t sum = 0;
+	for (int i = 0; i < NUM_STAT_TYPES; ++i) {
+		sum += types[i];
+	}
+	return sum;
+}
+
+double ProjectStats::nullFraction(const std::string &path) {
+	if (observed == 0) {
+		return 0;
+	}
+	auto f = fields.find(path);
+	if (f == fields.end()) {
+		return 1;
+	}
+	uint64_t nonNull = f->second.present() - f->second.types[ST_NULL];
+	return 1.0 - std::min(1.0, (double)nonNull / observed);
+}
+
+double ProjectStats::typeFraction(const std::string &path, StatType type) {
+	if (observed == 0) {
+		return 0;
+	}
+	auto f = fields.find(path);
+	if (f == fields.end()) {
+		return 0;
+	}
+	return std::min(1.0, (double)f->second.types[type] / observed);
+}
+
+double ProjectStats::distinct(const std::string &path) {
+	auto f = fields.find(path);
+	if (f == fields.end()) {
+		return 0;
+	}
+	double seen = (double)(f->second.present() - f->second.types[ST_NULL]);
+	double d = std::min(f->second.distinct.estimate(), seen);
+	// Nearly every sampled value was unique, assume that holds for the rest of the project.
+	if (observed > 0 && observed < rows && d > 0.9 * seen) {
+		d *= (double)rows / observed;
+	}
+	return std::max(1.0, d);
+}
+
+/*
+ *      StatsCatalog
+ */
+
+ProjectStats *StatsCatalog::get(const std::string &project) {
+	auto p = projects.find(project);
+	if (p == projects.end()) {
+		return NULL;
+	}
+	return &p->second;
+}
+
+ProjectStats &StatsCatalog::analyze(const std::string &project, const DOCDS &docs, FILESYSTEM &fs, uint64_t seed) {
+	std::vector<uint64_t> sample;
+	sample.reserve(std::min<uint64_t>(docs.size(), ANALYZE_SAMPLE));
+	std::mt19937_64 rng(seed);
+	uint64_t seen = 0;
+	for (auto docID = docs.begin(); docID != docs.end(); ++docID, ++seen) {
+		if (seen < ANALYZE_SAMPLE) {
+			sample.push_back(*docID);
+		} else {
+			uint64_t slot = rng() % (seen + 1);
+			if (slot < ANALYZE_SAMPLE) {
+				sample[slot] = *docID;
+			}
+		}
+	}
+
+	ProjectStats &stats = projects[project];
+	stats = ProjectStats();
+	stats.rows = docs.size();
+	dirty.insert(project);
+	std::map<std::string, std::vector<double> > values;
+	rapidjson::Document doc;
+	for (auto it = sample.begin(); it != sample.end(); ++it) {
+		File file = fs.open_file(*it);
+		char *c = fs.read(&file);
+		doc.Parse(c);
+		free(c);
+		collect(stats, doc, values);
+	}
+	for (auto it = values.begin(); it != values.end(); ++it) {
+		stats.fields[it->first].histogram.build(it->second);
+	}
+	return stats;
+}
+
+void StatsCatalog::walk(ProjectStats &stats, const std::string &path, const rapidjson::Value &v, int delta,
+		std::map<std::string, std::vector<double> > *samples) {
+	FieldStats &f = stats.fields[path];
+	StatType t = typeOf(v);
+	if (delta > 0) {
+		f.types[t]++;
+	} else if (f.types[t] > 0) {
+		f.types[t]--;
+	}
+
+	switch (t) {
+		case ST_NUMBER:
+			{
+				double d = v.GetDouble();
+				if (delta > 0) {
+					// Hash the value, not the representation, so 5 and 5.0 count once.
+					double key = d == 0 ? 0.0 : d;
+					f.distinct.add(reinterpret_cast<const char*>(&key), sizeof(key));
+					if (!f.hasNum || d < f.minNum) f.minNum = d;
+					if (!f.hasNum || d > f.maxNum) f.maxNum = d;
+					f.hasNum = true;
+					if (samples) {
+						(*samples)[path].push_back(d);
+					} else {
+						f.histogram.add(d);
+					}
+				} else {
+					f.histogram.remove(d);
+				}
+				break;
+			}
+		case ST_STRING:
+			{
+				if (delta > 0) {
+					std::string s(v.GetString(), v.GetStringLength());
+					f.distinct.addHash(Hash64(s.data(), s.size(), ST_STRING));
+					if (!f.hasStr || s < f.minStr) f.minStr = s;
+					if (!f.hasStr || s > f.maxStr) f.maxStr = s;
+					f.hasStr = true;
+				}
+				break;
+			}
+		case ST_BOOL:
+			{
+				if (delta > 0) {
+					char b = v.IsTrue() ? 1 : 0;
+					f.distinct.addHash(Hash64(&b, 1, ST_BOOL));
+				}
+				break;
+			}
+		case ST_OBJECT:
+			{
+				for (auto it = v.MemberBegin(); it != v.MemberEnd(); ++it) {
+					walk(stats, path + '.' + it->name.GetString(), it->value, delta, samples);
+				}
+				break;
+			}
+		default:
+			break;
+	}
+}
+
+void StatsCatalog::collect(ProjectStats &stats, const rapidjson::Value &doc, std::map<std::string, std::vector<double> > &samples) {
+	if (!doc.IsObject()) {
+		return;
+	}
+	stats.observed++;
+	for (auto it = doc.MemberBegin(); it != doc.MemberEnd(); ++it) {
+		if (strcmp(it->name.GetString(), "_doc") == 0) continue;
+		walk(stats, it->name.GetString(), it->value, 1, &samples);
+	}
+}
+
+// Whether a document written to a project goes in or out of its field statistics.  Those of a
+// sampled project describe its observed documents, and have to keep doing so: were every write
+// counted, new documents would outweigh the sampled ones, and deleting more documents than were
+// sampled would leave no statistics for those that are left.
+bool StatsCatalog::sampled(const ProjectStats &stats) {
+	if (stats.observed >= stats.rows) {
+		return true;
+	}
+	return std::uniform_real_distribution<double>(0, 1)(rng) * stats.rows < stats.observed;
+}
+
+void StatsCatalog::add(const std::string &project, const rapidjson::Value &doc) {
+	ProjectStats *stats = get(project);
+	if (!stats || !doc.IsObject()) {
+		return;
+	}
+	bool observe = sampled(*stats);
+	stats->rows++;
+	stats->modified++;
+	dirty.insert(project);
+	if (!observe) {
+		return;
+	}
+	stats->observed++;
+	for (auto it = doc.MemberBegin(); it != doc.MemberEnd(); ++it) {
+		if (strcmp(it->name.GetString(), "_doc") == 0) continue;
+		walk(*stats, it->name.GetString(), it->value, 1, NULL);
+	}
+}
+
+void StatsCatalog::remove(const std::string &project, const rapidjson::Value &doc) {
+	ProjectStats *stats = get(project);
+	if (!stats || !doc.IsObject()) {
+		return;
+	}
+	bool observe = sampled(*stats);
+	if (stats->rows > 0) stats->rows--;
+	stats->modified++;
+	dirty.insert(project);
+	if (!observe) {
+		return;
+	}
+	if (stats->observed > 0) stats->observed--;
+	for (auto it = doc.MemberBegin(); it != doc.MemberEnd(); ++it) {
+		if (strcmp(it->name.GetString(), "_doc") == 0) continue;
+		walk(*stats, it->name.GetString(), it->value, -1, NULL);
+	}
+}
+
+double StatsCatalog::fieldSelectivity(ProjectStats &stats, const std::string &path, const rapidjson::Value &cond, double fallback) {
+	if (stats.fields.count(path) == 0) {
+		// The field was never seen, nothing can match.
+		return 0;
+	}
+	FieldStats &f = stats.fields[path];
+
+	switch (cond.GetType()) {
+		case rapidjson::kNullType:
+			return stats.typeFraction(path, ST_NULL);
+		case rapidjson::kFalseType:
+		case rapidjson::kTrueType:
+			return stats.typeFraction(path, ST_BOOL) / 2;
+		case rapidjson::kStringType:
+			return stats.typeFraction(path, ST_STRING) / stats.distinct(path);
+		case rapidjson::kNumberType:
+			return stats.typeFraction(path, ST_NUMBER) / stats.distinct(path);
+		case rapidjson::kObjectType:
+			{
+				for (auto it = cond.MemberBegin(); it != cond.MemberEnd(); ++it) {
+					std::string op = it->name.GetString();
+					if (op[0] != '#') continue;
+					const rapidjson::Value &v = it->value;
+					if (v.IsNumber()) {
+						double num = stats.typeFraction(path, ST_NUMBER);
+						if (op == "#eq") {
+							return num / stats.distinct(path);
+						}
+						double below;
+						if (f.histogram.total() > 0) {
+							below = f.histogram.fractionBelow(v.GetDouble());
+						} else if (f.hasNum && f.maxNum > f.minNum) {
+							below = std::min(1.0, std::max(0.0, (v.GetDouble() - f.minNum) / (f.maxNum - f.minNum)));
+						} else {
+							return num * fallback;
+						}
+						if (op == "#gt") return num * (1 - below);
+						if (op == "#lt") return num * below;
+						return num * fallback;
+					} else if (v.IsString()) {
+						double str = stats.typeFraction(path, ST_STRING);
+						if (op == "#eq") return str / stats.distinct(path);
+						if (op == "#gt" || op == "#lt") return str / 3;
+						return str * fallback;
+					}
+					return fallback;
+				}
+				// No special comparison, every member of the embedded object has to match.
+				double sel = stats.typeFraction(path, ST_OBJECT);
+				for (auto it = cond.MemberBegin(); it != cond.MemberEnd(); ++it) {
+					sel *= std::min(1.0, fieldSelectivity(stats, path + '.' + it->name.GetString(), it->value, fallback) /
+							std::max(stats.typeFraction(path, ST_OBJECT), 1e-9));
+				}
+				return sel;
+			}
+		default:
+			return fallback;
+	}
+}
+
+double StatsCatalog::selectivity(const std::string &project, const std::string &key, const rapidjson::Value &cond, double fallback) {
+	ProjectStats *stats = get(project);
+	if (!stats || stats->observed == 0) {
+		return fallback;
+	}
+
+	if (key[0] != '#') {
+		return std::min(1.0, fieldSelectivity(*stats, key, cond, fallback));
+	}
+
+	// Special key comparisons are answered from the type mix of the field.
+	if (!cond.IsObject() || cond.MemberBegin() == cond.MemberEnd()) {
+		return fallback;
+	}
+	std::string field = cond.MemberBegin()->name.GetString();
+	bool want = cond.MemberBegin()->value.IsTrue();
+	auto f = stats->fields.find(field);
+	double exists = f == stats->fields.end() ? 0 : std::min(1.0, (double)f->second.present() / stats->observed);
+	if (key == "#exists") {
+		return want ? exists : 1 - exists;
+	}
+	double frac;
+	if (key == "#isnull") {
+		frac = stats->typeFraction(field, ST_NULL);
+	} else if (key == "#isstr") {
+		frac = stats->typeFraction(field, ST_STRING);
+	} else if (key == "#isnum") {
+		frac = stats->typeFraction(field, ST_NUMBER);
+	} else if (key == "#isbool") {
+		frac = stats->typeFraction(field, ST_BOOL);
+	} else if (key == "#isobj") {
+		frac = stats->typeFraction(field, ST_OBJECT);
+	} else if (key == "#isarray") {
+		frac = stats->typeFraction(field, ST_ARRAY);
+	} else {
+		return fallback;
+	}
+	return want ? frac : std::max(0.0, exists - frac);
+}
+
+void StatsCatalog::print(const std::string &project, std::ostream &os) {
+	ProjectStats *stats = get(project);
+	if (!stats) {
+		os << "No statistics for '" << project << "'.  Run ANALYZE " << project << ";" << std::endl;
+		return;
+	}
+	os << "Project '" << project << "': " << stats->rows << " documents, statistics from " << stats->observed
+		<< " (" << stats->modified << " writes since ANALYZE)" << std::endl;
+
+	std::ostringstream out;
+	out << std::left << std::setw(24) << "field" << std::setw(8) << "nulls" << std::setw(10) << "distinct"
+		<< std::setw(14) << "min" << std::setw(14) << "max" << "types" << std::endl;
+	out << std::fixed;
+	for (auto it = stats->fields.begin(); it != stats->fields.end(); ++it) {
+		FieldStats &f = it->second;
+		std::string lo, hi;
+		if (f.hasNum) {
+			std::ostringstream a, b;
+			a << f.minNum;
+			b << f.maxNum;
+			lo = a.str();
+			hi = b.str();
+		} else if (f.hasStr) {
+			lo = f.minStr.substr(0, 12);
+			hi = f.maxStr.substr(0, 12);
+		}
+		std::string mix;
+		uint64_t present = f.present();
+		for (int t = 0; t < NUM_STAT_TYPES; ++t) {
+			if (f.types[t] == 0) continue;
+			std::ostringstream m;
+			m << StatTypeNames[t] << ":" << (uint64_t)(100.0 * f.types[t] / std::max<uint64_t>(present, 1)) << "% ";
+			mix += m.str();
+		}
+		out << std::setw(24) << it->first << std::setw(8) << std::setprecision(2) << stats->nullFraction(it->first)
+			<< std::setw(10) << std::setprecision(0) << stats->distinct(it->first)
+			<< std::setw(14) << lo << std::setw(14) << hi << mix << std::endl;
+	}
+	os << out.str();
+}
+
+/*
+ *      Persistence
+ */
+
+static void put64(std::string &buf, uint64_t v) {
+	buf.append(reinterpret_cast<const char*>(&v), sizeof(v));
+}
+
+static void putDouble(std::string &buf, double d) {
+	buf.append(reinterpret_cast<const char*>(&d), sizeof(d));
+}
+
+static void putString(std::string &buf, const std::string &s) {
+	put64(buf, s.size());
+	buf.append(s);
+}
+
+static double readDouble(const char *buffer, uint64_t &pos) {
+	double d;
+	memcpy(&d, buffer + pos, sizeof(d));
+	pos += sizeof(d);
+	return d;
+}
+
+void StatsCatalog::save(Storage::Filesystem *fs) {
+	if (dirty.empty()) {
+		return;
+	}
+	std::vector<std::string> names;
+	for (auto it = projects.begin(); it != projects.end(); ++it) {
+		names.push_back(it->first);
+	}
+	File list = fs->open_file(StatsListFile);
+	uint64_t size = Type<std::vector<std::string> >::Size(names);
+	const char *bytes = Type<std::vector<std::string> >::Bytes(names);
+	fs->write(&list, bytes, size);
+	delete[] bytes;
+
+	for (auto d = dirty.begin(); d != dirty.end(); ++d) {
+		ProjectStats &stats = projects[*d];
+		std::string buf;
+		put64(buf, stats.rows);
+		put64(buf, stats.observed);
+		put64(buf, stats.modified);
+		put64(buf, stats.fields.size());
+		for (auto it = stats.fields.begin(); it != stats.fields.end(); ++it) {
+			FieldStats &f = it->second;
+			putString(buf, it->first);
+			for (int t = 0; t < NUM_STAT_TYPES; ++t) {
+				put64(buf, f.types[t]);
+			}
+			put64(buf, f.hasNum);
+			putDouble(buf, f.minNum);
+			putDouble(buf, f.maxNum);
+			put64(buf, f.hasStr);
+			putString(buf, f.minStr);
+			putString(buf, f.maxStr);
+
+			std::string regs(Storage::HyperLogLog<>::Size(), '\0');
+			uint64_t pos = 0;
+			f.distinct.Write(&regs[0], pos);
+			buf.append(regs);
+
+			put64(buf, f.histogram.counts.size());
+			for (size_t b = 0; b < f.histogram.counts.size(); ++b) {
+				putDouble(buf, f.histogram.bounds[b]);
+				put64(buf, f.histogram.counts[b]);
+			}
+			if (!f.histogram.counts.empty()) {
+				putDouble(buf, f.histogram.bounds.back());
+			}
+		}
+		File file = fs->open_file(StatsFilePrefix + *d);
+		fs->write(&file, buf.data(), buf.size());
+	}
+	dirty.clear();
+}
+
+void StatsCatalog::load(Storage::Filesystem *fs) {
+	File list = fs->open_file(StatsListFile);
+	if (list.size == 0) {
+		return;
+	}
+	char *names_buf = fs->read(&list);
+	std::vector<std::string> names = Type<std::vector<std::string> >::Create(names_buf, list.size);
+	free(names_buf);
+
+	for (auto n = names.begin(); n != names.end(); ++n) {
+		File file = fs->open_file(StatsFilePrefix + *n);
+		if (file.size == 0) continue;
+		char *buffer = fs->read(&file);
+		uint64_t pos = 0;
+
+		ProjectStats &stats = projects[*n];
+		stats.rows = Read64(buffer, pos);
+		stats.observed = Read64(buffer, pos);
+		stats.modified = Read64(buffer, pos);
+		uint64_t numFields = Read64(buffer, pos);
+		for (uint64_t i = 0; i < numFields; ++i) {
+			uint64_t len = Read64(buffer, pos);
+			FieldStats &f = stats.fields[ReadString(buffer, pos, len)];
+			for (int t = 0; t < NUM_STAT_TYPES; ++t) {
+				f.types[t] = Read64(buffer, pos);
+			}
+			f.hasNum = Read64(buffer, pos) != 0;
+			f.minNum = readDouble(buffer, pos);
+			f.maxNum = readDouble(buffer, pos);
+			f.hasStr = Read64(buffer, pos) != 0;
+			len = Read64(buffer, pos);
+			f.minStr = ReadString(buffer, pos, len);
+			len = Read64(buffer, pos);
+			f.maxStr = ReadString(buffer, pos, len);
+			f.distinct.Read(buffer, pos);
+
+			uint64_t buckets = Read64(buffer, pos);
+			for (uint64_t b = 0; b < buckets; ++b) {
+				f.histogram.bounds.push_back(readDouble(buffer, pos));
+				f.histogram.counts.push_back(Read64(buffer, pos));
+			}
+			if (buckets > 0) {
+				f.histogram.bounds.push_back(readDouble(buffer, pos));
+			}
+		}
+		free(buffer);
+	}
+}
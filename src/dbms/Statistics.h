@@ -0,0 +1,123 @@
+#ifndef STATISTICS_H_
+#define STATISTICS_H_
+
+#include <map>
+#include <set>
+#include <string>
+#include <vector>
+#include <random>
+#include <iostream>
+#include <rapidjson/document.h>
+
+#include "dbms.h"
+#include "../storage/HyperLogLog.h"
+
+enum StatType {
+	ST_NULL   = 0,
+	ST_BOOL   = 1,
+	ST_NUMBER = 2,
+	ST_STRING = 3,
+	ST_OBJECT = 4,
+	ST_ARRAY  = 5
+};
+
+const std::string StatTypeNames[] = {"null", "bool", "number", "string", "object", "array"};
+const int NUM_STAT_TYPES = 6;
+
+const uint64_t HISTOGRAM_BUCKETS = 32;
+
+// Projects larger than this are sampled by ANALYZE instead of read in full.
+const uint64_t ANALYZE_SAMPLE = 30000;
+
+/*
+ *      Histogram ---
+ *
+ *      Equi-depth histogram over the numeric values of a field.  When built every bucket holds
+ *      about the same number of values, equal values in the same bucket.  Later writes only bump
+ *      the count of the bucket a value falls in, widening the outer buckets if needed, until the
+ *      next ANALYZE rebuilds it.
+ */
+
+struct Histogram {
+	std::vector<double> bounds;
+	std::vector<uint64_t> counts;
+
+	void build(std::vector<double> &values);
+	void add(double v);
+	void remove(double v);
+	uint64_t total() const;
+	// Estimated fraction of the values that are strictly below v.
+	double fractionBelow(double v) const;
+};
+
+struct FieldStats {
+	uint64_t types[NUM_STAT_TYPES];
+	bool hasNum;
+	double minNum;
+	double maxNum;
+	bool hasStr;
+	std::string minStr;
+	std::string maxStr;
+	Storage::HyperLogLog<> distinct;
+	Histogram histogram;
+	FieldStats(): hasNum(false), minNum(0), maxNum(0), hasStr(false) {
+		for (int i = 0; i < NUM_STAT_TYPES; ++i) {
+			types[i] = 0;
+		}
+	}
+	uint64_t present() const;
+};
+
+struct ProjectStats {
+	uint64_t rows;       // documents in the project
+	uint64_t observed;   // documents the field statistics were computed from
+	uint64_t modified;   // writes since the last ANALYZE
+	std::map<std::string, FieldStats> fields;
+	ProjectStats(): rows(0), observed(0), modified(0) {}
+
+	double nullFraction(const std::string &path);
+	double typeFraction(const std::string &path, StatType type);
+	double distinct(const std::string &path);
+};
+
+/*
+ *      StatsCatalog ---
+ *
+ *      Per project, per field path statistics gathered by ANALYZE and kept up to date by the
+ *      write paths.  Stored in the __STATS__ file (list of projects) and one __STATS__<project>
+ *      file per project.
+ */
+
+class StatsCatalog {
+public:
+	void load(Storage::Filesystem *fs);
+	void save(Storage::Filesystem *fs);
+
+	ProjectStats *get(const std::string &project);
+
+	// ANALYZE: start over for a project, from its documents reservoir sampled down to
+	// ANALYZE_SAMPLE with 'seed'.
+	ProjectStats &analyze(const std::string &project, const DOCDS &docs, FILESYSTEM &fs, uint64_t seed);
+
+	// Incremental maintenance from the write paths.  Only the observed documents are in the
+	// field statistics, so a written one goes in or out of them with probability observed / rows.
+	void add(const std::string &project, const rapidjson::Value &doc);
+	void remove(const std::string &project, const rapidjson::Value &doc);
+
+	// Estimated fraction of the documents that satisfy one member of a where clause.
+	double selectivity(const std::string &project, const std::string &key, const rapidjson::Value &cond, double fallback);
+
+	void print(const std::string &project, std::ostream &os);
+private:
+	std::map<std::string, ProjectStats> projects;
+	std::set<std::string> dirty;
+	std::mt19937_64 rng;
+
+	bool sampled(const ProjectStats &stats);
+	void collect(ProjectStats &stats, const rapidjson::Value &doc, std::map<std::string, std::vector<double> > &samples);
+	void walk(ProjectStats &stats, const std::string &path, const rapidjson::Value &v, int delta,
+			std::map<std::string, std::vector<double> > *samples);
+	double fieldSelectivity(ProjectStats &stats, const std::string &path, const rapidjson::Value &cond, double fallback);
+};
+
+#endif
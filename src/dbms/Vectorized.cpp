@@ -0,0 +1,544 @@
+#include <chrono>
+#include <cstring>
+#include <cstdlib>
+#include <limits>
+#include <algorithm>
+#include <rapidjson/reader.h>
+
+#include "Vectorized.h"
+
+/*
+ *      ColumnBatch
+ */
+
+int ColumnBatch::column(const char *name, size_t len) const {
+	for (size_t i = 0; i < columns.size(); ++i) {
+		const std::string &n = columns[i].name;
+		if (n.size() == len && memcmp(n.data(), name, len) == 0) {
+			return (int)i;
+		}
+	}
+	return -1;
+}
+
+void ColumnBatch::clear() {
+	size = 0;
+	selSize = 0;
+	arena.clear();
+	for (auto it = columns.begin(); it != columns.end(); ++it) {
+		memset(it->type, V_MISSING, sizeof(it->type));
+		memset(it->num, 0, sizeof(it->num));
+		memset(it->inum, 0, sizeof(it->inum));
+		memset(it->present, 0, sizeof(it->present));
+		memset(it->real, 0, sizeof(it->real));
+	}
+}
+
+/*
+ *      Extractor ---
+ *
+ *      SAX handler that stores the top level values of the batch's columns for one document and
+ *      skips everything else.  Like a DOM lookup the first occurrence of a duplicated key wins.
+ */
+
+struct Extractor: public rapidjson::BaseReaderHandler<rapidjson::UTF8<>, Extractor> {
+	ColumnBatch &batch;
+	size_t row;
+	int depth;
+	int target;
+
+	Extractor(ColumnBatch &batch_, size_t row_): batch(batch_), row(row_), depth(0), target(-1) {}
+
+	// The column the current value goes to, NULL if it is skipped.
+	Column *set(uint8_t type, double num, const char *str, size_t len) {
+		if (depth != 1 || target < 0) {
+			return NULL;
+		}
+		Column &c = batch.columns[target];
+		target = -1;
+		if (c.has(row)) {
+			return NULL;
+		}
+		c.type[row] = type;
+		c.num[row] = num;
+		if (type == V_STRING) {
+			c.off[row] = (uint32_t)batch.arena.size();
+			c.len[row] = (uint32_t)len;
+			batch.arena.append(str, len);
+		}
+		c.present[row >> 6] |= uint64_t(1) << (row & 63);
+		return &c;
+	}
+
+	void setInt(int64_t i) {
+		Column *c = set(V_NUMBER, (double)i, NULL, 0);
+		if (c) {
+			c->inum[row] = i;
+		}
+	}
+
+	void setReal(double d) {
+		Column *c = set(V_NUMBER, d, NULL, 0);
+		if (c) {
+			c->real[row >> 6] |= uint64_t(1) << (row & 63);
+		}
+	}
+
+	bool Null() { set(V_NULL, 0, NULL, 0); return true; }
+	bool Bool(bool b) { set(b ? V_TRUE : V_FALSE, 0, NULL, 0); return true; }
+	bool Int(int i) { setInt(i); return true; }
+	bool Uint(unsigned u) { setInt(u); return true; }
+	bool Int64(int64_t i) { setInt(i); return true; }
+	bool Uint64(uint64_t u) {
+		if (u <= (uint64_t)INT64_MAX) {
+			setInt((int64_t)u);
+		} else {
+			setReal((double)u);
+		}
+		return true;
+	}
+	bool Double(double d) { setReal(d); return true; }
+	bool String(const char *str, rapidjson::SizeType len, bool) { set(V_STRING, 0, str, len); return true; }
+	bool Key(const char *str, rapidjson::SizeType len, bool) {
+		if (depth == 1) {
+			target = batch.column(str, len);
+		}
+		return true;
+	}
+	bool StartObject() { set(V_OBJECT, 0, NULL, 0); ++depth; return true; }
+	bool EndObject(rapidjson::SizeType) { --depth; return true; }
+	bool StartArray() { set(V_ARRAY, 0, NULL, 0); ++depth; return true; }
+	bool EndArray(rapidjson::SizeType) { --depth; return true; }
+};
+
+/*
+ *      VectorOperator
+ */
+
+bool VectorOperator::next(ColumnBatch &batch) {
+	auto start = std::chrono::steady_clock::now();
+	bool got = produce(batch);
+	millis += std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+	if (got) {
+		rowsOut += batch.selSize;
+	}
+	return got;
+}
+
+void VectorOperator::close() {
+	if (child) {
+		child->close();
+	}
+	if (node) {
+		node->actualRows = rowsOut;
+		node->rowsIn = rowsIn;
+		node->millis = millis;
+	}
+}
+
+/*
+ *      VectorScan
+ */
+
+VectorScan::VectorScan(Plan &plan_, DOCDS &docs_, IndexCatalog &indexes_, FILESYSTEM &fs_, const std::vector<std::string> &fields_,
+		DocCache *cache_):
+	VectorOperator(plan_.access), plan(&plan_), docs(&docs_), it(docs_.begin()), end(docs_.end()), indexes(indexes_), fs(fs_), fields(fields_),
+	cache(cache_), started(false) {}
+
+VectorScan::VectorScan(DOCDS::iterator begin, DOCDS::iterator end_, IndexCatalog &indexes_, FILESYSTEM &fs_, const std::vector<std::string> &fields_,
+		DocCache *cache_):
+	VectorOperator(NULL), plan(NULL), docs(NULL), it(begin), end(end_), indexes(indexes_), fs(fs_), fields(fields_), cache(cache_), started(false) {}
+
+bool VectorScan::produce(ColumnBatch &batch) {
+	if (!started) {
+		started = true;
+		if (plan && plan->indexed()) {
+			// As scanList does: an id the index still has may have left the project.
+			std::vector<uint64_t> ids;
+			plan->candidates(indexes, ids);
+			docs->intersect(ids, found);
+			it = found.begin();
+			end = found.end();
+		}
+		batch.columns.resize(fields.size());
+		for (size_t i = 0; i < fields.size(); ++i) {
+			batch.columns[i].name = fields[i];
+		}
+	}
+	batch.clear();
+
+	rapidjson::Reader reader;
+	for (; batch.size < BATCH_SIZE && it != end; ++it) {
+		uint64_t id = *it;
+		Extractor handler(batch, batch.size);
+		// A cached document is replayed through the same handler; misses are not kept, as
+		// there is no DOM here to keep.
+		DocCache::Handle cached = cache ? cache->get(id) : DocCache::Handle();
+		if (cached) {
+			cached->Accept(handler);
+		} else {
+			File file = fs.open_file(id);
+			char *c = fs.read(&file);
+			rapidjson::StringStream ss(c);
+			reader.Parse(ss, handler);
+			free(c);
+		}
+		batch.sel[batch.size] = (uint16_t)batch.size;
+		++batch.size;
+		++rowsIn;
+	}
+	batch.selSize = batch.size;
+	return batch.size > 0;
+}
+
+/*
+ *      VectorFilter ---
+ *
+ *      Every predicate narrows a byte mask over the whole batch.  The number and type kernels
+ *      are branch free loops over the column arrays so the compiler can vectorize them; the
+ *      string kernels only look at rows still in the mask.  The survivors are compacted into the
+ *      selection vector at the end.
+ */
+
+static void numberKernel(const Column &c, VectorPredicate::Op op, double v, uint8_t *mask, size_t n) {
+	const uint8_t *t = c.type;
+	const double *x = c.num;
+	switch (op) {
+		case VectorPredicate::EQ:
+			for (size_t i = 0; i < n; ++i) mask[i] &= (t[i] == V_NUMBER) & (x[i] == v);
+			break;
+		case VectorPredicate::GT:
+			for (size_t i = 0; i < n; ++i) mask[i] &= (t[i] == V_NUMBER) & (x[i] > v);
+			break;
+		case VectorPredicate::LT:
+			for (size_t i = 0; i < n; ++i) mask[i] &= (t[i] == V_NUMBER) & (x[i] < v);
+			break;
+		default:
+			memset(mask, 0, n);
+	}
+}
+
+static int compareBytes(const char *a, size_t aLen, const char *b, size_t bLen) {
+	int c = memcmp(a, b, std::min(aLen, bLen));
+	if (c != 0) {
+		return c;
+	}
+	return aLen < bLen ? -1 : (aLen > bLen ? 1 : 0);
+}
+
+static void stringKernel(const Column &c, const std::string &arena, const VectorPredicate &p, uint8_t *mask, size_t n) {
+	const char *needle = p.str.data();
+	size_t nLen = p.str.size();
+	for (size_t i = 0; i < n; ++i) {
+		if (!mask[i]) continue;
+		if (c.type[i] != V_STRING) {
+			mask[i] = 0;
+			continue;
+		}
+		const char *s = arena.data() + c.off[i];
+		size_t len = c.len[i];
+		bool ok;
+		switch (p.op) {
+			case VectorPredicate::EQ:
+				ok = compareBytes(s, len, needle, nLen) == 0;
+				break;
+			case VectorPredicate::GT:
+				ok = compareBytes(s, len, needle, nLen) > 0;
+				break;
+			case VectorPredicate::LT:
+				ok = compareBytes(s, len, needle, nLen) < 0;
+				break;
+			case VectorPredicate::STARTS:
+				ok = len >= nLen && memcmp(s, needle, nLen) == 0;
+				break;
+			case VectorPredicate::ENDS:
+				ok = len >= nLen && memcmp(s + len - nLen, needle, nLen) == 0;
+				break;
+			case VectorPredicate::CONTAINS:
+				ok = nLen == 0 || std::search(s, s + len, needle, needle + nLen) != s + len;
+				break;
+			default:
+				ok = false;
+		}
+		mask[i] = ok;
+	}
+}
+
+static void typeKernel(const Column &c, const VectorPredicate &p, uint8_t *mask, size_t n) {
+	const uint8_t *t = c.type;
+	uint8_t want = p.want;
+	switch (p.op) {
+		case VectorPredicate::EQ:
+			for (size_t i = 0; i < n; ++i) mask[i] &= t[i] == p.type;
+			break;
+		case VectorPredicate::EXISTS:
+			for (size_t i = 0; i < n; ++i) mask[i] &= (t[i] != V_MISSING) == want;
+			break;
+		case VectorPredicate::IS_TYPE:
+			if (p.type == V_FALSE) {
+				// Either boolean
+				for (size_t i = 0; i < n; ++i) mask[i] &= (t[i] != V_MISSING) & (((t[i] == V_FALSE) | (t[i] == V_TRUE)) == want);
+			} else {
+				for (size_t i = 0; i < n; ++i) mask[i] &= (t[i] != V_MISSING) & ((t[i] == p.type) == want);
+			}
+			break;
+		default:
+			memset(mask, 0, n);
+	}
+}
+
+bool VectorFilter::produce(ColumnBatch &batch) {
+	while (child->next(batch)) {
+		rowsIn += batch.selSize;
+		size_t n = batch.size;
+		memset(mask, 0, n);
+		for (size_t k = 0; k < batch.selSize; ++k) {
+			mask[batch.sel[k]] = 1;
+		}
+
+		for (auto p = preds.begin(); p != preds.end(); ++p) {
+			const Column &c = batch.columns[p->column];
+			if (p->op == VectorPredicate::EXISTS || p->op == VectorPredicate::IS_TYPE ||
+					(p->op == VectorPredicate::EQ && p->type != V_NUMBER && p->type != V_STRING)) {
+				typeKernel(c, *p, mask, n);
+			} else if (p->type == V_NUMBER) {
+				numberKernel(c, p->op, p->num, mask, n);
+			} else {
+				stringKernel(c, batch.arena, *p, mask, n);
+			}
+		}
+
+		size_t k = 0;
+		for (size_t i = 0; i < n; ++i) {
+			batch.sel[k] = (uint16_t)i;
+			k += mask[i];
+		}
+		batch.selSize = k;
+		if (k > 0) {
+			return true;
+		}
+	}
+	return false;
+}
+
+bool VectorLimit::produce(ColumnBatch &batch) {
+	if (limit >= 0 && rowsOut >= (uint64_t)limit) {
+		return false;
+	}
+	if (!child->next(batch)) {
+		return false;
+	}
+	rowsIn += batch.selSize;
+	batch.selSize = std::min<size_t>(batch.selSize, limit - rowsOut);
+	return true;
+}
+
+/*
+ *      VectorAggregator
+ */
+
+bool VectorAggregator::produce(ColumnBatch &batch) {
+	while (child->next(batch)) {
+		rowsIn += batch.selSize;
+		const uint16_t *sel = batch.sel;
+		size_t m = batch.selSize;
+		for (size_t i = 0; i < aggs.slots.size(); ++i) {
+			Parsing::Aggregate f = aggs.slots[i].function;
+			Accumulator &acc = aggs.state[i];
+			if (columns[i] < 0) {
+				acc.count += m;
+				continue;
+			}
+			const Column &c = batch.columns[columns[i]];
+			if (f == Parsing::COUNT) {
+				uint64_t count = 0;
+				for (size_t k = 0; k < m; ++k) {
+					count += c.has(sel[k]) & (c.type[sel[k]] != V_NULL);
+				}
+				acc.count += count;
+			} else if (f == Parsing::SUM || f == Parsing::AVG) {
+				// Absent values are 0 in the columns, only the count needs the bitmap.
+				double fsum = 0;
+				uint64_t count = 0;
+				bool real = false;
+				for (size_t k = 0; k < m; ++k) {
+					size_t r = sel[k];
+					bool isReal = c.isReal(r);
+					acc.addInt(c.inum[r]);
+					fsum += isReal ? c.num[r] : 0;
+					real = real || isReal;
+					count += c.has(r);
+				}
+				acc.fsum += fsum;
+				acc.exact = acc.exact && !real;
+				acc.count += count;
+			} else if (f == Parsing::APPROX_COUNT_DISTINCT) {
+				for (size_t k = 0; k < m; ++k) {
+					size_t r = sel[k];
+					if (!c.has(r)) {
+						continue;
+					}
+					switch (c.type[r]) {
+						case V_NUMBER:
+							acc.addDistinct(distinctNumber(c.num[r]));
+							break;
+						case V_STRING:
+							acc.addDistinct(distinctString(batch.arena.data() + c.off[r], c.len[r]));
+							break;
+						case V_TRUE:
+						case V_FALSE:
+							acc.addDistinct(distinctBool(c.type[r] == V_TRUE));
+							break;
+						default:
+							break;
+					}
+				}
+			} else {
+				for (size_t k = 0; k < m; ++k) {
+					size_t r = sel[k];
+					if (c.has(r)) {
+						acc.add(f, c.num[r], !c.isReal(r), c.inum[r]);
+					}
+				}
+			}
+		}
+	}
+	return false;
+}
+
+/*
+ *      compileVectorized
+ */
+
+static int addField(std::vector<std::string> &fields, const std::string &name) {
+	for (size_t i = 0; i < fields.size(); ++i) {
+		if (fields[i] == name) {
+			return (int)i;
+		}
+	}
+	fields.push_back(name);
+	return (int)fields.size() - 1;
+}
+
+static bool compileCondition(const std::string &key, const rapidjson::Value &cond, std::vector<std::string> &fields, VectorPredicate &p) {
+	p.want = true;
+	p.num = 0;
+	if (key[0] == '#') {
+		if (!cond.IsObject() || cond.MemberCount() == 0) {
+			return false;
+		}
+		const rapidjson::Value &ve = cond.MemberBegin()->value;
+		if (!ve.IsBool()) {
+			return false;
+		}
+		p.column = addField(fields, cond.MemberBegin()->name.GetString());
+		p.want = ve.IsTrue();
+		p.op = VectorPredicate::IS_TYPE;
+		if (key == "#exists") {
+			p.op = VectorPredicate::EXISTS;
+		} else if (key == "#isnull") {
+			p.type = V_NULL;
+		} else if (key == "#isstr") {
+			p.type = V_STRING;
+		} else if (key == "#isnum") {
+			p.type = V_NUMBER;
+		} else if (key == "#isbool") {
+			p.type = V_FALSE;
+		} else if (key == "#isobj") {
+			p.type = V_OBJECT;
+		} else if (key == "#isarray") {
+			p.type = V_ARRAY;
+		} else {
+			return false;
+		}
+		return true;
+	}
+
+	p.column = addField(fields, key);
+	const rapidjson::Value *v = &cond;
+	p.op = VectorPredicate::EQ;
+	if (cond.IsObject()) {
+		if (cond.MemberCount() != 1) {
+			return false;
+		}
+		std::string op = cond.MemberBegin()->name.GetString();
+		v = &cond.MemberBegin()->value;
+		if (op == "#eq") {
+			p.op = VectorPredicate::EQ;
+		} else if (op == "#gt") {
+			p.op = VectorPredicate::GT;
+		} else if (op == "#lt") {
+			p.op = VectorPredicate::LT;
+		} else if (op == "#starts" && v->IsString()) {
+			p.op = VectorPredicate::STARTS;
+		} else if (op == "#ends" && v->IsString()) {
+			p.op = VectorPredicate::ENDS;
+		} else if (op == "#contains" && v->IsString()) {
+			p.op = VectorPredicate::CONTAINS;
+		} else {
+			return false;
+		}
+		if (!v->IsNumber() && !v->IsString()) {
+			return false;
+		}
+	}
+
+	switch (v->GetType()) {
+		case rapidjson::kNumberType:
+			p.type = V_NUMBER;
+			p.num = v->GetDouble();
+			return true;
+		case rapidjson::kStringType:
+			p.type = V_STRING;
+			p.str.assign(v->GetString(), v->GetStringLength());
+			return true;
+		case rapidjson::kNullType:
+			p.type = V_NULL;
+			return true;
+		case rapidjson::kFalseType:
+			p.type = V_FALSE;
+			return true;
+		case rapidjson::kTrueType:
+			p.type = V_TRUE;
+			return true;
+		default:
+			return false;
+	}
+}
+
+bool compileVectorized(rapidjson::Document &origFields, rapidjson::Document *where, std::vector<std::string> &fields,
+		std::vector<VectorPredicate> &preds, std::vector<int> &aggColumns) {
+	fields.clear();
+	preds.clear();
+	aggColumns.clear();
+
+	// Plain fields are printed per document, that needs the row path.
+	for (auto it = origFields.Begin(); it != origFields.End(); ++it) {
+		if (!it->IsObject()) {
+			return false;
+		}
+		Parsing::Aggregate f;
+		if (!aggregateFunction((*it)["function"].GetString(), f)) {
+			continue;
+		}
+		std::string field = (*it)["field"].GetString();
+		aggColumns.push_back(f == Parsing::COUNT && field == "*" ? -1 : addField(fields, field));
+	}
+	if (aggColumns.empty()) {
+		return false;
+	}
+
+	if (where) {
+		if (!where->IsObject()) {
+			return false;
+		}
+		for (auto it = where->MemberBegin(); it != where->MemberEnd(); ++it) {
+			VectorPredicate p;
+			if (!compileCondition(it->name.GetString(), it->value, fields, p)) {
+				return false;
+			}
+			preds.push_back(p);
+		}
+	}
+	return true;
+}
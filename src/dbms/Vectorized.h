@@ -0,0 +1,162 @@
+#ifndef VECTORIZED_H_
+#define VECTORIZED_H_
+
+#include <string>
+#include <vector>
+#include <rapidjson/document.h>
+
+#include "dbms.h"
+#include "Index.h"
+#include "Planner.h"
+#include "Executor.h"
+
+/*
+ *      Vectorized ---
+ *
+ *      Batch execution for aggregate queries.  Instead of building a DOM per document, BATCH_SIZE
+ *      documents at a time are run through a SAX pass that keeps only the top level fields the
+ *      query refers to, stored as typed columns.  Filters then work column at a time, producing
+ *      a selection vector of the rows that passed, and the aggregates loop over that.
+ *
+ *      Only queries that select nothing but aggregates and whose where clause is a list of
+ *      simple comparisons on top level fields run this way; everything else uses the row
+ *      operators in Executor.h.
+ */
+
+enum VType {
+	V_MISSING = 0,
+	V_NULL    = 1,
+	V_FALSE   = 2,
+	V_TRUE    = 3,
+	V_NUMBER  = 4,
+	V_STRING  = 5,
+	V_OBJECT  = 6,
+	V_ARRAY   = 7
+};
+
+// One field of a batch.  Numbers are in 'num' (0 for every other type, which is what the
+// aggregates count them as), integers also exactly in 'inum' and the numbers that are not
+// integers are marked in 'real'.  Strings are offsets into the batch's arena.
+struct Column {
+	std::string name;
+	uint8_t type[BATCH_SIZE];
+	double num[BATCH_SIZE];
+	int64_t inum[BATCH_SIZE];
+	uint32_t off[BATCH_SIZE];
+	uint32_t len[BATCH_SIZE];
+	uint64_t present[BATCH_SIZE / 64];
+	uint64_t real[BATCH_SIZE / 64];
+
+	bool has(size_t row) const { return (present[row >> 6] >> (row & 63)) & 1; }
+	bool isReal(size_t row) const { return (real[row >> 6] >> (row & 63)) & 1; }
+};
+
+struct ColumnBatch {
+	size_t size;
+	std::vector<Column> columns;
+	std::string arena;
+	uint16_t sel[BATCH_SIZE];
+	size_t selSize;
+
+	ColumnBatch(): size(0), selSize(0) {}
+	int column(const char *name, size_t len) const;
+	void clear();
+};
+
+// One compiled member of the where clause.
+struct VectorPredicate {
+	enum Op { EQ, GT, LT, STARTS, ENDS, CONTAINS, IS_TYPE, EXISTS };
+	int column;
+	Op op;
+	uint8_t type;         // V_NUMBER / V_STRING for comparisons, the wanted type for IS_TYPE
+	double num;
+	std::string str;
+	bool want;            // #exists / #is... false inverts
+};
+
+class VectorOperator {
+public:
+	uint64_t rowsIn;
+	uint64_t rowsOut;
+	double millis;
+
+	VectorOperator(PlanNode *node_ = NULL): rowsIn(0), rowsOut(0), millis(0), node(node_), child(NULL) {}
+	virtual ~VectorOperator() { delete child; }
+
+	// Hand out the next batch, false once the input is exhausted.
+	bool next(ColumnBatch &batch);
+	void close();
+protected:
+	PlanNode *node;
+	VectorOperator *child;
+	virtual bool produce(ColumnBatch &batch) = 0;
+};
+
+// Reads documents (the project, a range of its ids, or the candidates of the plan's index
+// seeks) and decodes the referenced fields into columns.
+class VectorScan: public VectorOperator {
+public:
+	VectorScan(Plan &plan_, DOCDS &docs_, IndexCatalog &indexes_, FILESYSTEM &fs_, const std::vector<std::string> &fields_,
+		DocCache *cache_ = NULL);
+	VectorScan(DOCDS::iterator begin, DOCDS::iterator end_, IndexCatalog &indexes_, FILESYSTEM &fs_, const std::vector<std::string> &fields_,
+		DocCache *cache_ = NULL);
+protected:
+	bool produce(ColumnBatch &batch);
+private:
+	Plan *plan;
+	DOCDS *docs;
+	DOCDS found;                            // the index candidates still in the project
+	DOCDS::iterator it;
+	DOCDS::iterator end;
+	IndexCatalog &indexes;
+	FILESYSTEM &fs;
+	std::vector<std::string> fields;
+	DocCache *cache;
+	bool started;
+};
+
+class VectorFilter: public VectorOperator {
+public:
+	VectorFilter(VectorOperator *child_, const std::vector<VectorPredicate> &preds_, PlanNode *node_): VectorOperator(node_), preds(preds_) { child = child_; }
+protected:
+	bool produce(ColumnBatch &batch);
+private:
+	std::vector<VectorPredicate> preds;
+	uint8_t mask[BATCH_SIZE];
+};
+
+class VectorLimit: public VectorOperator {
+public:
+	VectorLimit(VectorOperator *child_, int limit_, PlanNode *node_): VectorOperator(node_), limit(limit_) { child = child_; }
+protected:
+	bool produce(ColumnBatch &batch);
+private:
+	int limit;
+};
+
+// Drains its input into the aggregates, then hands out nothing.  'columns' holds the column
+// of every aggregate slot, -1 for COUNT(*).
+class VectorAggregator: public VectorOperator {
+public:
+	VectorAggregator(VectorOperator *child_, const Aggregator &aggs_, const std::vector<int> &columns_, PlanNode *node_):
+		VectorOperator(node_), aggs(aggs_), columns(columns_) { child = child_; }
+	const Aggregator &results() { return aggs; }
+protected:
+	bool produce(ColumnBatch &batch);
+private:
+	Aggregator aggs;
+	std::vector<int> columns;
+};
+
+/*
+ *      compileVectorized ---
+ *
+ *      Check whether a select can run in batches.  On success fills the list of fields to
+ *      decode, the compiled predicates and the column of every aggregate, in the order of
+ *      the slots of an Aggregator over the select's aggregates.
+ */
+
+bool compileVectorized(rapidjson::Document &origFields, rapidjson::Document *where, std::vector<std::string> &fields,
+		std::vector<VectorPredicate> &preds, std::vector<int> &aggColumns);
+
+#endif
@@ -0,0 +1,367 @@
+#include <cstring>
+
+#include "View.h"
+#include "Documents.h"
+#include "../utils/Util.h"
+
+#include <pretty.h>
+
+const std::string ViewListFile("__VIEWS__");
+const std::string ViewFilePrefix("__VIEW__");
+
+static void put64(std::string &buf, uint64_t v) {
+	buf.append(reinterpret_cast<const char*>(&v), sizeof(v));
+}
+
+static void putDouble(std::string &buf, double d) {
+	buf.append(reinterpret_cast<const char*>(&d), sizeof(d));
+}
+
+static void putString(std::string &buf, const std::string &s) {
+	put64(buf, s.size());
+	buf.append(s);
+}
+
+static double readDouble(const char *buffer, uint64_t &pos) {
+	double d;
+	memcpy(&d, buffer + pos, sizeof(d));
+	pos += sizeof(d);
+	return d;
+}
+
+static rapidjson::Document aggregatesOf(const rapidjson::Value &fields) {
+	rapidjson::Document copy;
+	copy.CopyFrom(fields, copy.GetAllocator());
+	return extractAggregates(copy);
+}
+
+/*
+ *      MaterializedView
+ */
+
+MaterializedView::MaterializedView(const std::string &name_, const std::string &project_, const rapidjson::Value &fields_,
+		const rapidjson::Value *where_, const std::vector<std::string> &groupBy_):
+	name(name_), project(project_), groupBy(groupBy_), stale(false), aggregator(aggregatesOf(fields_)),
+	table(aggregator.slots.size(), aggregator.sketchBytes()) {
+	fields.CopyFrom(fields_, fields.GetAllocator());
+	if (where_) {
+		where.CopyFrom(*where_, where.GetAllocator());
+	}
+	clear();
+}
+
+void MaterializedView::clear() {
+	table.clear();
+	rows.clear();
+	if (groupBy.empty()) {
+		size_t g;
+		group("[]", true, g);
+	}
+}
+
+bool MaterializedView::matches(const rapidjson::Value &doc) {
+	if (where.IsNull()) {
+		return true;
+	}
+	// Matching consumes the conditions and wants a document of its own.
+	rapidjson::Document copy;
+	copy.CopyFrom(doc, copy.GetAllocator());
+	rapidjson::Document spare;
+	spare.CopyFrom(where, spare.GetAllocator());
+	return documentMatchesConditions(copy, spare);
+}
+
+Accumulator *MaterializedView::group(const std::string &key, bool insert, size_t &g) {
+	if (!table.find(key, Hash64(key.data(), key.size(), 0), insert, g)) {
+		return NULL;
+	}
+	if (g >= rows.size()) {
+		rows.push_back(0);
+	}
+	return table.state(g);
+}
+
+void MaterializedView::add(const rapidjson::Value &doc) {
+	// A stale view is computed again from scratch anyway
+	if (stale || !matches(doc)) {
+		return;
+	}
+	size_t g;
+	Accumulator *accs = group(groupKey(groupBy, doc), true, g);
+	aggregator.handle(doc, accs);
+	++rows[g];
+}
+
+void MaterializedView::remove(const rapidjson::Value &doc) {
+	if (stale || !matches(doc)) {
+		return;
+	}
+	size_t g;
+	Accumulator *accs = group(groupKey(groupBy, doc), false, g);
+	if (!accs || rows[g] == 0) {
+		stale = true;
+		return;
+	}
+	if (--rows[g] == 0) {
+		// The last document of the group, whatever the aggregates are it starts over.
+		for (size_t i = 0; i < aggregator.slots.size(); ++i) {
+			accs[i] = Accumulator();
+		}
+	} else if (!aggregator.retract(doc, accs)) {
+		stale = true;
+	}
+}
+
+void MaterializedView::refresh(DOCDS &docs, FILESYSTEM &fs) {
+	stale = false;
+	clear();
+	rapidjson::Document doc;
+	for (auto it = docs.begin(); it != docs.end(); ++it) {
+		File file = fs.open_file(*it);
+		char *c = fs.read(&file);
+		doc.Parse(c);
+		free(c);
+		add(doc);
+	}
+}
+
+bool MaterializedView::print(std::ostream &os, int limit) {
+	bool found = false;
+	int printed = 0;
+	for (size_t g = 0; g < table.size() && (limit < 0 || printed < limit); ++g) {
+		if (!groupBy.empty() && rows[g] == 0) {
+			continue;
+		}
+		rapidjson::Document out;
+		rapidjson::Document::AllocatorType &allocator = out.GetAllocator();
+		out.SetObject();
+		if (!groupBy.empty()) {
+			rapidjson::Document key;
+			key.Parse(table.key(g).c_str());
+			for (size_t i = 0; i < groupBy.size(); ++i) {
+				rapidjson::Value value(key[(rapidjson::SizeType)i], allocator);
+				out.AddMember(rapidjson::Value(groupBy[i].c_str(), allocator), value, allocator);
+			}
+		}
+		aggregator.summarize(table.state(g), out, allocator);
+		if (out.MemberCount() == 0) {
+			continue;
+		}
+		found = true;
+		++printed;
+		if (groupBy.empty()) {
+			printSummary(os, out);
+		} else {
+			os << toString(&out) << std::endl;
+		}
+	}
+	return found;
+}
+
+std::string MaterializedView::definition() const {
+	rapidjson::Document def;
+	rapidjson::Document::AllocatorType &allocator = def.GetAllocator();
+	def.SetObject();
+	def.AddMember("fields", rapidjson::Value(fields, allocator), allocator);
+	if (!where.IsNull()) {
+		def.AddMember("where", rapidjson::Value(where, allocator), allocator);
+	}
+	rapidjson::Value keys(rapidjson::kArrayType);
+	for (auto it = groupBy.begin(); it != groupBy.end(); ++it) {
+		keys.PushBack(rapidjson::Value(it->c_str(), allocator), allocator);
+	}
+	def.AddMember("groupBy", keys, allocator);
+	return toString(&def);
+}
+
+void MaterializedView::write(std::string &buf) {
+	bool digests = false;
+	for (size_t g = 0; g < table.size(); ++g) {
+		for (size_t i = 0; i < aggregator.slots.size(); ++i) {
+			digests = digests || table.state(g)[i].digest;
+		}
+	}
+	put64(buf, stale || digests);
+	if (stale || digests) {
+		return;
+	}
+	put64(buf, table.size());
+	for (size_t g = 0; g < table.size(); ++g) {
+		putString(buf, table.key(g));
+		put64(buf, rows[g]);
+		Accumulator *accs = table.state(g);
+		for (size_t i = 0; i < aggregator.slots.size(); ++i) {
+			Accumulator &a = accs[i];
+			put64(buf, a.count);
+			put64(buf, (uint64_t)a.isum);
+			putDouble(buf, a.fsum);
+			put64(buf, a.exact);
+			putDouble(buf, a.min);
+			putDouble(buf, a.max);
+			put64(buf, (uint64_t)a.imin);
+			put64(buf, (uint64_t)a.imax);
+			putDouble(buf, a.mean);
+			putDouble(buf, a.m2);
+			put64(buf, a.distinct != NULL);
+			if (a.distinct) {
+				std::string regs(Storage::HyperLogLog<>::Size(), '\0');
+				uint64_t pos = 0;
+				a.distinct->Write(&regs[0], pos);
+				buf.append(regs);
+			}
+		}
+	}
+}
+
+void MaterializedView::read(const char *buffer, uint64_t &pos) {
+	clear();
+	stale = Read64(buffer, pos) != 0;
+	if (stale) {
+		return;
+	}
+	uint64_t groups = Read64(buffer, pos);
+	for (uint64_t n = 0; n < groups; ++n) {
+		uint64_t len = Read64(buffer, pos);
+		size_t g;
+		Accumulator *accs = group(ReadString(buffer, pos, len), true, g);
+		rows[g] = Read64(buffer, pos);
+		for (size_t i = 0; i < aggregator.slots.size(); ++i) {
+			Accumulator &a = accs[i];
+			a.count = Read64(buffer, pos);
+			a.isum = (int64_t)Read64(buffer, pos);
+			a.fsum = readDouble(buffer, pos);
+			a.exact = Read64(buffer, pos) != 0;
+			a.min = readDouble(buffer, pos);
+			a.max = readDouble(buffer, pos);
+			a.imin = (int64_t)Read64(buffer, pos);
+			a.imax = (int64_t)Read64(buffer, pos);
+			a.mean = readDouble(buffer, pos);
+			a.m2 = readDouble(buffer, pos);
+			if (Read64(buffer, pos)) {
+				a.distinct = new Storage::HyperLogLog<>();
+				a.distinct->Read(buffer, pos);
+			}
+		}
+	}
+}
+
+/*
+ *      ViewCatalog
+ */
+
+ViewCatalog::~ViewCatalog() {
+	for (auto it = views.begin(); it != views.end(); ++it) {
+		delete it->second;
+	}
+}
+
+MaterializedView *ViewCatalog::get(const std::string &name) {
+	auto it = views.find(name);
+	return it == views.end() ? NULL : it->second;
+}
+
+MaterializedView &ViewCatalog::create(const std::string &name, Parsing::Query &q, DOCDS *docs, FILESYSTEM &fs) {
+	MaterializedView *view = new MaterializedView(name, *q.project, *q.fields, q.where, q.groupBy);
+	views[name] = view;
+	if (docs) {
+		view->refresh(*docs, fs);
+	}
+	dirty.insert(name);
+	return *view;
+}
+
+std::vector<std::string> ViewCatalog::list() {
+	std::vector<std::string> names;
+	for (auto it = views.begin(); it != views.end(); ++it) {
+		names.push_back(it->first + " of " + it->second->project);
+	}
+	return names;
+}
+
+void ViewCatalog::add(const std::string &project, const rapidjson::Value &doc) {
+	for (auto it = views.begin(); it != views.end(); ++it) {
+		if (it->second->project == project) {
+			it->second->add(doc);
+			dirty.insert(it->first);
+		}
+	}
+}
+
+void ViewCatalog::remove(const std::string &project, const rapidjson::Value &doc) {
+	for (auto it = views.begin(); it != views.end(); ++it) {
+		if (it->second->project == project) {
+			it->second->remove(doc);
+			dirty.insert(it->first);
+		}
+	}
+}
+
+bool ViewCatalog::read(const std::string &name, DOCDS *docs, FILESYSTEM &fs, int limit, std::ostream &os) {
+	MaterializedView *view = get(name);
+	if (!view) {
+		return false;
+	}
+	if (view->stale) {
+		DOCDS none;
+		view->refresh(docs ? *docs : none, fs);
+		dirty.insert(name);
+	}
+	return view->print(os, limit);
+}
+
+void ViewCatalog::save(Storage::Filesystem *fs) {
+	if (dirty.empty()) {
+		return;
+	}
+	std::vector<std::string> names;
+	for (auto it = views.begin(); it != views.end(); ++it) {
+		names.push_back(it->first);
+	}
+	File list = fs->open_file(ViewListFile);
+	uint64_t size = Type<std::vector<std::string> >::Size(names);
+	const char *bytes = Type<std::vector<std::string> >::Bytes(names);
+	fs->write(&list, bytes, size);
+	delete[] bytes;
+
+	for (auto d = dirty.begin(); d != dirty.end(); ++d) {
+		MaterializedView *view = get(*d);
+		std::string buf;
+		putString(buf, view->project);
+		putString(buf, view->definition());
+		view->write(buf);
+		File file = fs->open_file(ViewFilePrefix + *d);
+		fs->write(&file, buf.data(), buf.size());
+	}
+	dirty.clear();
+}
+
+void ViewCatalog::load(Storage::Filesystem *fs) {
+	File list = fs->open_file(ViewListFile);
+	if (list.size == 0) {
+		return;
+	}
+	char *names_buf = fs->read(&list);
+	std::vector<std::string> names = Type<std::vector<std::string> >::Create(names_buf, list.size);
+	free(names_buf);
+
+	for (auto n = names.begin(); n != names.end(); ++n) {
+		File file = fs->open_file(ViewFilePrefix + *n);
+		if (file.size == 0) continue;
+		char *buffer = fs->read(&file);
+		uint64_t pos = 0;
+
+		uint64_t len = Read64(buffer, pos);
+		std::string project = ReadString(buffer, pos, len);
+		len = Read64(buffer, pos);
+		rapidjson::Document def;
+		def.Parse(ReadString(buffer, pos, len).c_str());
+		std::vector<std::string> groupBy;
+		for (auto it = def["groupBy"].Begin(); it != def["groupBy"].End(); ++it) {
+			groupBy.push_back(it->GetString());
+		}
+		MaterializedView *view = new MaterializedView(*n, project, def["fields"], def.HasMember("where") ? &def["where"] : NULL, groupBy);
+		view->read(buffer, pos);
+		views[*n] = view;
+		free(buffer);
+	}
+}
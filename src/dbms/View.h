@@ -0,0 +1,99 @@
+#ifndef VIEW_H_
+#define VIEW_H_
+
+#include <map>
+#include <set>
+#include <string>
+#include <vector>
+#include <iostream>
+#include <rapidjson/document.h>
+
+#include "dbms.h"
+#include "Aggregator.h"
+#include "GroupBy.h"
+#include "../mmap_filesystem/Filesystem.h"
+
+/*
+ *      MaterializedView ---
+ *
+ *      The aggregates of a select over one project, kept up to date as its documents are
+ *      written instead of computed when read.  Every written document that matches the where
+ *      clause is added to the accumulators of its group, every removed one (an UPDATE removes
+ *      the old version and adds the new one) is taken back out again, so reading the view only
+ *      walks its groups.
+ *
+ *      Not every aggregate can be rolled back: the MIN or MAX that is removed, and anything that
+ *      went into a sketch, leave the view stale.  A stale view is computed again from the
+ *      project's documents the next time it is read.  Groups whose documents are all gone are
+ *      kept, empty, until then.
+ */
+
+class MaterializedView {
+public:
+	std::string name;
+	std::string project;
+	rapidjson::Document fields;           // the select list: grouped fields and aggregates
+	rapidjson::Document where;            // null without a where clause
+	std::vector<std::string> groupBy;
+	bool stale;
+
+	MaterializedView(const std::string &name_, const std::string &project_, const rapidjson::Value &fields_,
+			const rapidjson::Value *where_, const std::vector<std::string> &groupBy_);
+
+	void add(const rapidjson::Value &doc);
+	void remove(const rapidjson::Value &doc);
+	// Compute the view from scratch from all the documents of its project.
+	void refresh(DOCDS &docs, FILESYSTEM &fs);
+	// Print the rows of the view, at most 'limit' groups.  False if there are none.
+	bool print(std::ostream &os, int limit);
+
+	// The groups and their accumulators.  A t-digest is not written, a view with one is stale
+	// once loaded.
+	void write(std::string &buf);
+	void read(const char *buffer, uint64_t &pos);
+	// The definition as a JSON object, to create the view again from.
+	std::string definition() const;
+private:
+	Aggregator aggregator;
+	GroupTable table;
+	std::vector<uint64_t> rows;           // documents in each group
+
+	bool matches(const rapidjson::Value &doc);
+	Accumulator *group(const std::string &key, bool insert, size_t &g);
+	// Drop every group.  A view without GROUP BY always has its one group.
+	void clear();
+};
+
+/*
+ *      ViewCatalog ---
+ *
+ *      The materialized views by name, maintained by the write paths next to the indexes and
+ *      statistics.  Stored in the __VIEWS__ file (list of views) and one __VIEW__<name> file
+ *      per view.
+ */
+
+class ViewCatalog {
+public:
+	~ViewCatalog();
+
+	void load(Storage::Filesystem *fs);
+	void save(Storage::Filesystem *fs);
+
+	bool exists(const std::string &name) const { return views.count(name) > 0; }
+	MaterializedView *get(const std::string &name);
+	// A new view over the parsed select 'q', filled from the project's documents.
+	MaterializedView &create(const std::string &name, Parsing::Query &q, DOCDS *docs, FILESYSTEM &fs);
+	std::vector<std::string> list();
+
+	// Incremental maintenance from the write paths.
+	void add(const std::string &project, const rapidjson::Value &doc);
+	void remove(const std::string &project, const rapidjson::Value &doc);
+
+	// Print the rows of a view, computing it again first if it is stale.
+	bool read(const std::string &name, DOCDS *docs, FILESYSTEM &fs, int limit, std::ostream &os);
+private:
+	std::map<std::string, MaterializedView*> views;
+	std::set<std::string> dirty;
+};
+
+#endif
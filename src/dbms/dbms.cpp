@@ -10,16 +10,24 @@
 #include <ctime>
 #include <cstring>
 #include <stdarg.h>
+#include <set>
+#include <random>
 
 #include "dbms.h"
+#include "Catalog.h"
 #include "Aggregator.h"
+#include "Index.h"
+#include "Planner.h"
+#include "Statistics.h"
+#include "Executor.h"
+#include "View.h"
+#include "ResultCache.h"
+#include "Loader.h"
 
 #include "../parsing/Parser.h"
 #include "../parsing/Scanner.h"
 #include "../mmap_filesystem/Filesystem.h"
 
-#include "../mmap_filesystem/HerpmapWriter.h"
-#include "../mmap_filesystem/HerpmapReader.h"
 #include "../utils/Util.h"
 
 #include <pretty.h>
@@ -45,7 +53,7 @@ void waitToFinish() {
 }
 void handle(Parsing::Query *q, META *m, FILESYSTEM *f, bool print = true) {
     pool.enqueue( [=] {
-            execute(query, meta, fs, print);
+            execute(q, m, f, print);
             });
 }
 #else
@@ -89,757 +97,188 @@ PRINT(const Args& ...args)
 
 uint64_t theUUID = 0;
 
-std::string getUUID() {
-    std::string ret(std::to_string(theUUID));
+IndexCatalog indexes;
+StatsCatalog stats;
+ViewCatalog views;
+ResultCache results(RESULT_CACHE_MEMORY);
+Planner planner(indexes, stats);
+Executor executor(indexes, stats, &views);
+
+uint64_t getUUID() {
+    uint64_t ret = theUUID;
     ++theUUID;
     return ret;
 }
 
 /*
- *      appendDocToProject ---
- *      
- *      Retrieve the array of documents for the specified project from the metadata.
- *      Insert the new document ID into the array.
- *      Replace the array in the metadata with the modified array.
- *
- */
-
-void appendDocToProject(std::string &project, std::string &doc, META &meta) {
-    if (meta.count(project) > 0) {
-        meta[project].push_back(doc);
-    } else {
-        DOCDS data;
-        data.push_back(doc);
-        meta[project] = data;
-    }
-}
-
-/*
- *      insertDocument ---
- *      
- *      1.)
- *      Assign the document a UUID
- *      
- *      2.)
- *      Iterate over each field of the document and create a row containing the document ID and a field ID
- *      Insert the row into the database.
- *
- *      TODO: Inserting the data into the DB
+ *      checkpoint ---
  *
+ *      Make what a write command did to 'project' survive a crash: the next UUID, so its ids are
+ *      never handed out again, the indexes, statistics and views it changed, and the project's set
+ *      (Catalog::checkpoint).  The filesystem's metadata is flushed last, as it is what finds them.
  */
 
-void insertDocument(std::string& docUUID, std::string &doc, std::string &project, META &meta, FILESYSTEM &fs) {
-    // Insert this row into the DB
-    File file = fs.open_file(docUUID.c_str());
-    fs.write(&file, doc.c_str(), doc.size());
-    appendDocToProject(project, docUUID, meta);
+void checkpoint(const std::string &project, META &meta, FILESYSTEM &fs) {
+    File uuid = fs.open_file("HERP_UUID");
+    fs.write(&uuid, reinterpret_cast<char*>(&theUUID), sizeof(uint64_t));
+    indexes.save(&fs);
+    stats.save(&fs);
+    views.save(&fs);
+    meta.checkpoint(project);
+    fs.flush();
 }
 
 /*
- *      updateProjectList ---
- *
- *      Insert the project name into the metadata array of project names.
+ *      insertDocuments ---
  *
+ *      Insert a document, or every document of an array, into the project 'pname', which is created if
+ *      it does not exist.  Each gets the next UUID and is written, with the UUID as its "_doc" member,
+ *      into one InsertBatch (Loader.h) straight from the parsed query, which is left as it is.  Once all
+ *      are stored the indexes, statistics and views see them.  Array elements that are not objects are
+ *      skipped.
  */
 
-void updateProjectList(std::string &pname, META &meta) {
-    std::string key("__PROJECTS__");
-
-    if (meta.count(key) == 0) {
-        DOCDS data;
-        data.push_back(pname);
-        meta[key] = data;
-        return;
-    }
-    DOCDS& data = meta[key];
-
-    // Check if the project already exists
-    bool found = false;
-    for (auto it = data.begin(); it != data.end(); ++it) {
-        std::string &v = *it;
-        if (v.compare(pname) == 0) {
-            found = true;
-            break;
+void insertDocuments(const rapidjson::Value &docs, std::string &pname, META &meta, FILESYSTEM &fs) {
+    InsertBatch batch(fs, meta);
+    uint64_t first = theUUID;
+    if (docs.IsArray()) {
+        for (auto it = docs.Begin(); it != docs.End(); ++it) {
+            if (it->IsObject()) {
+                batch.add(getUUID(), *it);
+            }
         }
+    } else if (docs.IsObject()) {
+        batch.add(getUUID(), docs);
     }
-
-    // Only add the project if it is not found
-    if (!found) {
-        data.push_back(pname);
-        //meta[key] = data;
-    }
-}
-
-/*
- *      insertDocuments ---
- *
- *      1.)
- *      Create a project if 'pname' does not exist in the metadata.  This project consists of a name mapped 
- *      to a UUID and a UUID mapped to an array of document ID's.
- *      
- *      2.)
- *      If the JSON object passed in is an array, iterate over the array and insert each document into the DB.
- *      If the JSON object is a single object, insert the document into the DB.
- */
-
-void insertDocuments(rapidjson::Document &docs, std::string &pname, META &meta, FILESYSTEM &fs) {
-    updateProjectList(pname, meta);
-
-    rapidjson::Document::AllocatorType &allocator = docs.GetAllocator();
-
-    // If it's an array of documents.  Iterate over them and insert each document.
-    if (docs.GetType() == rapidjson::kArrayType) {
-        for( auto it = docs.Begin() ; it != docs.End() ; it++ ) {
-            rapidjson::Value& val = *it;
-            std::string docUUID = getUUID();
-            val.AddMember( "_doc" , rapidjson::Value( docUUID.c_str() , allocator) , allocator );
-            std::string data = toString( &val );
-            insertDocument( docUUID , data , pname, meta, fs);
-			val.RemoveMember( "_doc" );
+    batch.store(pname);
+
+    const rapidjson::Value *begin = docs.IsArray() ? docs.Begin() : &docs;
+    const rapidjson::Value *end = docs.IsArray() ? docs.End() : &docs + 1;
+    uint64_t docUUID = first;
+    for (const rapidjson::Value *val = begin; val != end; ++val) {
+        if (val->IsObject()) {
+            indexes.add(pname, docUUID, *val);
+            stats.add(pname, *val);
+            views.add(pname, *val);
+            ++docUUID;
         }
-    } else if (docs.GetType() == rapidjson::kObjectType) {
-        std::string docUUID = getUUID();
-        docs.AddMember( "_doc" , rapidjson::Value( docUUID.c_str() , allocator) , allocator );
-        std::string data = toString(&docs);
-        insertDocument( docUUID , data , pname, meta, fs);
     }
 }
 
-// Assume doc is an array or an object.
-rapidjson::Document processFields(rapidjson::Document &doc, rapidjson::Document &aggregates) {
-    rapidjson::Document newDoc;
-    newDoc.SetArray();
-
-    // Build an array of unique keys
-    for (rapidjson::Value::ConstValueIterator src = doc.Begin(); src != doc.End(); ++src) {
-        if (src->IsString()) {
-            const char *srcVal = src->GetString();
-            //std::string srcVal = src->GetString();
-            bool match = false;
-            for (rapidjson::Value::ConstValueIterator dest = newDoc.Begin(); dest != newDoc.End(); ++dest) {
-                const char* destVal = dest->GetString();
-                //std::string destVal = dest->GetString();
-                //if (srcVal.compare(destVal) == 0) {
-                if (strcmp(srcVal,destVal) == 0) {
-                    match = true;
-                    break;
-                }
-            }
-            if (!match) {
-                rapidjson::Value newVal(srcVal, newDoc.GetAllocator());
-                newDoc.PushBack(newVal, newDoc.GetAllocator());
-            }
-            }
-        }
+    /*
+     *      createIndex ---
+     *
+     *      Register a text index on a field of a project and fill it from the documents that
+     *      are already stored.
+     */
 
-        // Iterate over aggregate objects and check if the field is missing from the selected fields
-        for (rapidjson::Value::ConstValueIterator agg = aggregates.Begin(); agg != aggregates.End(); ++agg) {
-            bool found = false;
-            const rapidjson::Value &obj = *agg;
-            //std::string aggVal = obj["field"].GetString();
-            const char* aggVal = obj["field"].GetString();
-            for (rapidjson::Value::ConstValueIterator src = newDoc.Begin(); src != newDoc.End(); ++src) {
-                if (src->IsString()) {
-                    //std::string srcVal = src->GetString();
-                    const char* srcVal = src->GetString();
-                    if ( strcmp(aggVal,srcVal) == 0) {
-                        found = true;
-                        break;
-                    }
+    void createIndex(const std::string &project, const std::string &field, META &meta, FILESYSTEM &fs) {
+        Storage::TextIndex &idx = indexes.create(project, field);
+        meta.read(project, [&](DOCDS &docs) {
+            rapidjson::Document doc;
+            for (auto docID = docs.begin(); docID != docs.end(); ++docID) {
+                File file = fs.open_file(*docID);
+                char *c = fs.read(&file);
+                doc.Parse(c);
+                free(c);
+                const rapidjson::Value *v = lookupPath(doc, field);
+                if (v && v->IsString()) {
+                    idx.insert(*docID, v->GetString(), v->GetStringLength());
                 }
             }
-            if (!found) {
-                rapidjson::Value tmpField;      
-                tmpField.SetObject();
-                rapidjson::Value fieldName(aggVal, newDoc.GetAllocator());
-                tmpField.AddMember("_temporary", fieldName, newDoc.GetAllocator());
-                newDoc.PushBack(tmpField, newDoc.GetAllocator());
-            }
-        }
-
-        return newDoc;
+        });
     }
 
-    inline rapidjson::Document extractAggregates(rapidjson::Document &fields ) {
-
-        rapidjson::Document newArray;
-        newArray.SetArray();
+    /*
+     *      analyze ---
+     *
+     *      Gather statistics for a project.  Large projects are reservoir sampled down to
+     *      ANALYZE_SAMPLE documents, the distinct counts are scaled back up by the planner.
+     *      False if the project does not exist.
+     */
 
-        for (rapidjson::Value::ConstValueIterator it = fields.Begin(); it != fields.End(); ++it) {
-            if (it->GetType() == rapidjson::kObjectType) {
-                const rapidjson::Value& v_tmp = *it;
-                rapidjson::Value v(v_tmp, newArray.GetAllocator());
-                newArray.PushBack(v, newArray.GetAllocator());
-            }
+    bool analyze(const std::string &project, META &meta, FILESYSTEM &fs) {
+        if (!meta.read(project, [&](DOCDS &docs) { stats.analyze(project, docs, fs, theUUID); })) {
+            return false;
         }
-        return newArray;
+        stats.print(project, std::cout);
+        return true;
     }
 
+    /*
+     *      select ---
+     *
+     *      Run a select and print its rows, or read a view.  True if it ran over the documents
+     *      of its projects, false for views and projects that do not exist.
+     */
 
-    // Copy all fields from src to dest
-    int selectAllFields(rapidjson::Document *src, rapidjson::Value *dest, rapidjson::Document::AllocatorType &allocator) {
-        int count = 0;
-        rapidjson::Document &doc = *src;
-        for (rapidjson::Value::ConstMemberIterator field = doc.MemberBegin(); field != doc.MemberEnd(); ++field) {
-            std::string fieldTxt = field->name.GetString();
-            rapidjson::Value k(fieldTxt.c_str(), allocator);
-            rapidjson::Value &v_tmp = doc[fieldTxt.c_str()];
-            rapidjson::Value v(v_tmp, allocator);
-            dest->AddMember(k, v, allocator);
-            count++;
-        }
-        return count;
-    }
-
-    // Copy a subset of fields from src to dest
-    int projectFields(rapidjson::Document *src, rapidjson::Value *dest, rapidjson::Document *fields, rapidjson::Document::AllocatorType &allocator) {
-        rapidjson::Document &doc = *src;
-        int count = 0;
-        for (rapidjson::Value::ConstValueIterator field = fields->Begin(); field != fields->End(); ++field) {
-            // If the field is an object then it must be an aggregated field
-            if (field->GetType() == rapidjson::kObjectType) {
-                const rapidjson::Value &obj = *field;
-                // Temporary fields are not explicitly selected by the user, but must be included for the aggregation
-                if (obj.HasMember("_temporary")) {
-                    std::string tmpField = obj["_temporary"].GetString();
-                    if (doc.HasMember(tmpField.c_str())) {
-                        rapidjson::Value tempObj;
-                        tempObj.SetObject();
-                        rapidjson::Value k(tmpField.c_str(), allocator);
-                        rapidjson::Value &v_tmp = doc[tmpField.c_str()];
-                        rapidjson::Value v(v_tmp, allocator);   
-                        tempObj.AddMember("_temporary", v, allocator);
-                        dest->AddMember(k, tempObj, allocator);
-                        count++;
-                    }
-                }
-            } else if (field->GetType() == rapidjson::kStringType) {
-                std::string fieldTxt = field->GetString();
-                if (doc.HasMember(fieldTxt.c_str())) {
-                    rapidjson::Value k(fieldTxt.c_str(), allocator);
-                    rapidjson::Value &v_tmp = doc[fieldTxt.c_str()];
-                    rapidjson::Value v(v_tmp, allocator);
-                    dest->AddMember(k, v, allocator);
-                    count++;
+    bool select(Parsing::Query *q, META &meta, FILESYSTEM &fs) {
+        std::string project = *q->project;
+        if (views.exists(project)) {
+            // A view is read as it is, it only takes a LIMIT.
+            const rapidjson::Value &first = (*q->fields)[0];
+            const std::string &source = views.get(project)->project;
+            if (q->explain || q->where || q->join.active() || q->sample.active() || !q->groupBy.empty() || !q->orderBy.empty() ||
+                    q->fields->Size() != 1 || !first.IsString() || strcmp(first.GetString(), "*") != 0) {
+                PRINT("Only SELECT * FROM ", project, " [ LIMIT n ]; reads a view!\r\n");
+            } else {
+                bool printed = false;
+                if (!meta.read(source, [&](DOCDS &docs) { printed = views.read(project, &docs, fs, q->limit, std::cout); })) {
+                    printed = views.read(project, NULL, fs, q->limit, std::cout);
                 }
-            }
-        }
-        return count;
-    }
-
-    bool validateSpecialValueCompare(std::string &val) {
-        int numSpecials = sizeof(SpecialValueComparisons) / sizeof(SpecialValueComparisons[0]);
-        for (int i=0; i<numSpecials; ++i) {
-            if (SpecialValueComparisons[i].compare(val) == 0) {
-                return true;
-            }
-        }
-        return false;
-    }
-
-    bool validateSpecialKeyCompare(std::string &val) {
-        int numSpecials = sizeof(SpecialKeyComparisons) / sizeof(SpecialKeyComparisons[0]);
-        for (int i=0; i<numSpecials; ++i) {
-            if (SpecialKeyComparisons[i].compare(val) == 0) {
-                return true;
-            }
-        }
-        return false;
-    }
-
-    // First is the value from the condition.  It may contain special fields... #gt, #lt
-    bool sameValues(rapidjson::Value &first, rapidjson::Value &second, rapidjson::Document::AllocatorType &allocator) {
-        bool foundSpecial = false;
-        std::string specialCompare;
-        rapidjson::Value specialValue;
-
-        // Could be a special condition.
-        if (first.GetType() == rapidjson::kObjectType && second.GetType() != rapidjson::kObjectType) {
-            for (rapidjson::Value::MemberIterator it = first.MemberBegin(); it != first.MemberEnd(); ++it) {
-                specialCompare = it->name.GetString();
-                if (specialCompare[0] == '#') {
-                    foundSpecial = true;
-                    specialValue = rapidjson::Value(first[specialCompare.c_str()], allocator);
-                    break;
+                if (!printed) {
+                    PRINT("Result Empty!\r\n");
                 }
             }
-            if (!foundSpecial) {
-                return false;
-            }
-        } else {
-            if (first.GetType() != second.GetType()) {
-                return false;
-            }
+            return false;
         }
 
-        rapidjson::Value condition;
-        rapidjson::Type type;
-        if (foundSpecial) {
-
-            type = specialValue.GetType();
-            if (!validateSpecialValueCompare(specialCompare) || type != second.GetType()) {
+        // The id sets stay locked for reading while the select runs over them.
+        Plan *plan = NULL;
+        bool found = false;
+        bool exists;
+        if (q->join.active()) {
+            if (meta.count(q->join.project) == 0) {
+                PRINT("Project '", q->join.project, "' does not exist!\r\n");
                 return false;
             }
-            condition = rapidjson::Value(specialValue, allocator);
+            exists = meta.read(project, q->join.project, [&](DOCDS &docs, DOCDS &joined) {
+                plan = planner.plan(q, docs.size(), joined.size());
+                found = executor.selectJoin(*plan, docs, joined, *q->fields, q->limit, fs, q->explain);
+            });
         } else {
-            type = first.GetType();
-            condition = rapidjson::Value(first, allocator);
+            exists = meta.read(project, [&](DOCDS &docs) {
+                plan = planner.plan(q, docs.size());
+                found = executor.select(*plan, docs, *q->fields, q->where, q->limit, fs, q->explain);
+            });
         }
-
-        switch (type) {
-            case rapidjson::kNullType:
-                {
-                    return true;
-                    break;
-                }
-            case rapidjson::kStringType:
-                {
-                    std::string firstStr = condition.GetString();
-                    std::string secondStr = second.GetString();
-                    if (foundSpecial) {
-                        if (!specialCompare.compare("#gt")) {
-                            return secondStr.compare(firstStr) > 0;
-                        } else if (!specialCompare.compare("#lt")) {
-                            return secondStr.compare(firstStr) < 0;
-                        } else if (!specialCompare.compare("#eq")) {
-                            return firstStr.compare(secondStr) == 0;
-                        } else if (!specialCompare.compare("#contains")) {
-                            return secondStr.find(firstStr) != std::string::npos;
-                        } else if (!specialCompare.compare("#starts")) {
-                            if (secondStr.length() < firstStr.length()) {
-                                return false;
-                            } else {
-                                return secondStr.compare(0, firstStr.length(), firstStr) == 0;
-                            }
-                        } else if (!specialCompare.compare("#ends")) {
-                            if (secondStr.length() < firstStr.length()) {
-                                return false;
-                            } else {
-                                return secondStr.compare(secondStr.length() - firstStr.length(), firstStr.length(), firstStr) == 0;
-                            }
-
-                        }
-                    } else {
-                        return firstStr.compare(secondStr) == 0;
-                    }
-                    break;
-                }
-            case rapidjson::kNumberType:
-                {
-                    double firstNum;
-                    double secondNum;
-                    if (condition.IsInt()) {
-                        firstNum = (double)condition.GetInt();
-                    } else {
-                        firstNum = condition.GetDouble();
-                    }
-                    if (second.IsInt()) {
-                        secondNum = (double)second.GetInt();
-                    } else {
-                        secondNum = second.GetDouble();
-                    }
-
-                    if (foundSpecial) {
-                        if (!specialCompare.compare("#gt")) {
-                            return secondNum > firstNum;
-                        } else if (!specialCompare.compare("#lt")) {
-                            return secondNum < firstNum;
-                        } else if (!specialCompare.compare("#eq")) {
-                            return secondNum == firstNum;
-                        }
-                    } else {
-                        return firstNum == secondNum;
-                    }
-                    break;
-                }
-            case rapidjson::kFalseType:
-                {
-                    //TODO: Maybe #eq should be supported here
-                    if (foundSpecial) return false;
-                    return true;
-                    break;
-                }
-            case rapidjson::kTrueType:
-                {
-                    //TODO: Maybe #eq should be supported here
-                    if (foundSpecial) return false;
-                    return true;
-                    break;
-                }
-            case rapidjson::kObjectType: // Special case, compare fields recursively.
-                {
-                    for (rapidjson::Value::MemberIterator it = condition.MemberBegin(); it != condition.MemberEnd(); ++it) {
-                        if (!second.HasMember(it->name.GetString())) {
-                            return false;
-                        }
-                        rapidjson::Value &firstEmbed = condition[it->name.GetString()];
-                        rapidjson::Value &secondEmbed = second[it->name.GetString()];
-                        if (!sameValues(firstEmbed, secondEmbed, allocator)) {
-                            return false;
-                        }
-                    }
-                    return true;
-                }
-            case rapidjson::kArrayType:
-                {
-                    // TODO: should the special comparisons work on arrays somehow?
-                    if (foundSpecial) return false;
-                    if (condition.Size() != second.Size()) {
-                        return false;
-                    }
-                    for (rapidjson::SizeType i=0; i < condition.Size(); ++i) {
-                        if (!sameValues(condition[i], second[i], allocator)) {
-                            return false;
-                        }
-                    }
-                    return true;
-                }
+        if (!exists) {
+            PRINT("Project '", project, "' does not exist!\r\n");
+            return false;
         }
-        return false;
-    }
-
-
-
-    bool documentMatchesConditions(rapidjson::Document &doc, rapidjson::Document &conditions) {
-        auto condIt = conditions.MemberBegin();
-        while (condIt != conditions.MemberEnd()) {
-            std::string condKey = condIt->name.GetString();
-            // Special case for special key comparisons
-            if (validateSpecialKeyCompare(condKey)) {
-                rapidjson::Value &v = conditions[condKey.c_str()];
-                if (v.GetType() != rapidjson::kObjectType) {
-                    return false;
-                }
-                std::string key = v.MemberBegin()->name.GetString();
-                rapidjson::Value &ve = v[key.c_str()];
-
-                // Special case fot exists... 
-                if (condKey.compare("#exists") == 0) {
-                    if (!doc.HasMember(key.c_str()) && ve.GetType() == rapidjson::kTrueType) {
-                        return false;
-                    } else if (doc.HasMember(key.c_str()) && ve.GetType() == rapidjson::kFalseType) {
-                        return false;
-                    } else {
-                        continue;
-                    }
-                }
-
-                // Everything else relies on the existence of the key
-                if (doc.HasMember(key.c_str())) {
-                    rapidjson::Value &specVal = doc[key.c_str()];
-                    if (condKey.compare("#isnull") == 0) {
-                        if (specVal.GetType() == rapidjson::kNullType && ve.GetType() == rapidjson::kFalseType) {
-                            return false;
-                        } else if (specVal.GetType() != rapidjson::kNullType && ve.GetType() == rapidjson::kTrueType) {
-                            return false;
-                        }
-                    } else if (condKey.compare("#isstr") == 0) {
-                        if (specVal.GetType() == rapidjson::kStringType && ve.GetType() == rapidjson::kFalseType) {
-                            return false;
-                        } else if (specVal.GetType() != rapidjson::kStringType && ve.GetType() == rapidjson::kTrueType) {
-                            return false;
-                        }
-                    } else if (condKey.compare("#isnum") == 0) {
-                        if (specVal.GetType() == rapidjson::kNumberType && ve.GetType() == rapidjson::kFalseType) {
-                            return false;
-                        } else if (specVal.GetType() != rapidjson::kNumberType && ve.GetType() == rapidjson::kTrueType) {
-                            return false;
-                        }
-                    } else if (condKey.compare("#isbool") == 0) {
-                        if ((specVal.GetType() == rapidjson::kFalseType || specVal.GetType() == rapidjson::kTrueType) && 
-                                ve.GetType() == rapidjson::kFalseType) {
-                            return false;
-                        } else if ((specVal.GetType() != rapidjson::kFalseType && specVal.GetType() != rapidjson::kTrueType) && 
-                                ve.GetType() == rapidjson::kTrueType) {
-                            return false;
-                        }
-                    } else if (condKey.compare("#isobj") == 0) {
-                        if (specVal.GetType() == rapidjson::kObjectType && ve.GetType() == rapidjson::kFalseType) {
-                            return false;
-                        } else if (specVal.GetType() != rapidjson::kObjectType && ve.GetType() == rapidjson::kTrueType) {
-                            return false;
-                        }
-                    } else if (condKey.compare("#isarray") == 0) {
-                        if (specVal.GetType() == rapidjson::kArrayType && ve.GetType() == rapidjson::kFalseType) {
-                            return false;
-                        } else if (specVal.GetType() != rapidjson::kArrayType && ve.GetType() == rapidjson::kTrueType) {
-                            return false;
-                        }
-                    }
-                } else {
-                    return false;
-                }
-            } else {
-                if (!doc.HasMember(condKey.c_str())) {
-                    return false;
-                }
-                rapidjson::Value &condVal = conditions[condKey.c_str()];
-                rapidjson::Value &docVal = doc[condKey.c_str()];
-                if (!sameValues(condVal, docVal, conditions.GetAllocator())) {
-                    return false;
-                }
-            }
-            conditions.RemoveMember(condIt);
+        if (q->explain) {
+            plan->print(std::cout);
+        } else if (!found) {
+            PRINT("Result Empty!\r\n");
         }
+        delete plan;
         return true;
     }
 
-    void deleteFields(rapidjson::Document *doc, rapidjson::Document *fields) {
-        for (rapidjson::Value::ConstValueIterator it = fields->Begin(); it != fields->End(); it++) {
-            const rapidjson::Value &field = *it;
-            if (doc->HasMember(field.GetString())) {
-                doc->RemoveMember(field.GetString());
-            }
-        }
-    }
-
-    // Update the fields of the array of documents
-    void update(DOCDS& docs, rapidjson::Document &updates, rapidjson::Document *where, int limit, FILESYSTEM &fs) {
-        if (limit == 0) return;
-
-        int num = 0;
-        rapidjson::Document doc;
-
-        // Iterate over every document
-        for (auto docID = docs.begin(); docID != docs.end(); ++docID) {
-            // Open the document
-            const std::string &name = *docID;
-            File file1 = fs.open_file( name );
-            char *c = fs.read(&file1);
-            doc.Parse(c);
-            free(c);
-
-            // Parse the document
-
-            if (where) {
-                rapidjson::Document &whereDoc = *where;
-                rapidjson::Document spare;
-                spare.CopyFrom(whereDoc, spare.GetAllocator());
-                // Check if the document contains the values specified in where clause.
-                // If not, move on to the next document.
-                if (!documentMatchesConditions(doc, spare)) {
-                    continue;
-                }
-            }
-
-            // Insert or update the fields
-            for (rapidjson::Value::ConstMemberIterator update = updates.MemberBegin(); update != updates.MemberEnd(); ++update) {
-                auto key = update->name.GetString();
-                if (doc.HasMember(key)) {
-                    doc.RemoveMember(key);
-                }
-                rapidjson::Value k(key, doc.GetAllocator());
-                rapidjson::Value &v_tmp = updates[key];
-                rapidjson::Value v(v_tmp, doc.GetAllocator());
-                doc.AddMember(k,v, doc.GetAllocator());
-            }
-            //File file2 = fs.open_file(*docID);
-            std::string data = toString(&doc);
-            fs.write(&file1, data.c_str(), data.size());
-
-            // In case a limit is being used, pre-empt may be necessary
-            if (limit > 0 && ++num == limit) {
-                break;
-            }
-        }
-    }
-
-
-    // Delete the fields from the array of documents
-    void ddelete(DOCDS& docs, rapidjson::Document &origFields, rapidjson::Document *where, int limit, FILESYSTEM &fs) {
-        if (limit == 0) return;
-
-        int num = 0;
-
-        bool selectAll = false;
-
-        rapidjson::Document aggregates = extractAggregates(origFields);
-        rapidjson::Document fields = processFields(origFields, aggregates);
-
-        // Check for *
-        for (rapidjson::Value::ConstValueIterator it = fields.Begin(); it != fields.End(); ++it) {
-            if (it->GetType() != rapidjson::kStringType) continue;
-            const char* val = it->GetString();
-            if( val[0] == '*'  && val[1] == 0 ) {
-                selectAll = true;
-                break;
-            }
-        }
-
-        rapidjson::Document doc;
-
-        // Iterate over every document
-        auto docID = docs.begin();
-        while (docID != docs.end()) {
-            // Open the document
-            std::string& dID = *docID;
-            File file1 = fs.open_file(dID);
-            char *c = fs.read(&file1);
-
-            // Parse the document
-            doc.Parse(c);
-            free(c);
-
-            if (where) {
-                rapidjson::Document &whereDoc = *where;
-                rapidjson::Document spare;
-                spare.CopyFrom(whereDoc, spare.GetAllocator());
-                // Check if the document contains the values specified in where clause.
-                // If not, move on to the next document.
-                if (!documentMatchesConditions(doc, spare)) {
-                    ++docID;
-                    continue;       
-                }
-            }
-
-            // Iterate over the desired fields
-            if (selectAll) {
-                // Delete document 
-                bool success = fs.deleteFile(&file1);
-                if (success) {
-                    docs.erase(docID++);
-                }
-                //           goto next;
-            } else {
-                deleteFields(&doc, &fields);
-                std::string newData = toString(&doc);
-                File file2 = fs.open_file(dID);
-                fs.write(&file2, newData.c_str(), newData.size());
-                ++docID;
-            }
-
-
-            //next:
-            // If a limit is being used then we may need to pre-empt.
-            if (limit > 0 && ++num == limit) {
-                break;
-            }
-        }
-    }
-
-
-    // Select
-    bool select(DOCDS &docs, rapidjson::Document &origFields, rapidjson::Document *where, int limit, FILESYSTEM &fs) {
-
-        bool result = false;
-
-        if (limit == 0) return result;
-
-        bool selectAll = false;
-
-        rapidjson::Document aggregates = extractAggregates(origFields);
-        rapidjson::Document fields = processFields(origFields, aggregates);
-
-        // Check for *
-        for (rapidjson::Value::ConstValueIterator it = fields.Begin(); it != fields.End(); ++it) {
-            if (it->GetType() != rapidjson::kStringType) continue;
-            std::string val = it->GetString();
-            if (val.compare("*") == 0) {
-                selectAll = true;
-            }
-        }
-
-        int num = 0;
-
-        // Create Aggregator object
-        Aggregator *aggregator = new Aggregator();
-
-        // Iterate over every document
-        for (auto docID = docs.begin(); docID != docs.end(); ++docID) {
-            // Open the document
-            std::string& dID = *docID;
-            File file = fs.open_file(dID);
-            char *c = fs.read(&file);
-
-            // Parse the document
-            rapidjson::Document doc;
-            doc.Parse(c);
-            free(c);
-
-            rapidjson::Document::AllocatorType &allocator = doc.GetAllocator();
-
-            rapidjson::Value docVal;
-            docVal.SetObject();
-
-            if (where) {
-                rapidjson::Document &whereDoc = *where;
-                rapidjson::Document spare;
-                spare.CopyFrom(whereDoc, allocator);
-                // Check if the document contains the values specified in where clause.
-                // If not, move on to the next document
-                if (!documentMatchesConditions(doc, spare)) {
-                    continue;       
-                }
-            }
-
-            int count = 0;
-            // Iterate over the desired fields
-            if (selectAll) {
-                // Add every field of the document to the result
-                count += selectAllFields(&doc, &docVal, allocator);
-            } else {
-                count += projectFields(&doc, &docVal, &fields, allocator);
-            }
-
-            // Iterate over the aggregates.  Process this document
-            for (rapidjson::Value::ConstValueIterator agg = aggregates.Begin(); agg != aggregates.End(); ++agg) {
-                // Check if the document contains a field being aggregated.
-                // If true:
-                //	Pass field to aggregator
-                //	If field is marked as temporary, delete it from the document
-                // Else:
-                //	Continue
-                const rapidjson::Value &aggVal = *agg;
-                if (!docVal.HasMember(aggVal["field"].GetString())) {
-                    continue;
-                }
-                result = true;
-                aggregator->handle(&docVal, &aggVal, allocator);
-                count = docVal.MemberBegin()==docVal.MemberEnd()?0:count;
-            }
-
-            if (count > 0) {
-                std::cout << toString(&docVal) << std::endl;
-                result = true;
-            }
-
-            // If a limit is being used then we may need to preempt.
-            if (++num == limit) {
-                break;
-            }
-        }
-
-        for (rapidjson::Value::ConstValueIterator agg = aggregates.Begin(); agg != aggregates.End(); ++agg) {
-            const rapidjson::Value &a = *agg;
-            std::string func = a["function"].GetString();
-            std::string field = a["field"].GetString();
-            AggregateResult *res = aggregator->getResult(field, func);
-            if (res != NULL) {
-                rapidjson::Value aggRes;
-                aggRes.SetObject();
-                std::string k_txt = func + '(' + field + ')';
-                //rapidjson::Value k(k_txt.c_str(), a.GetAllocator());
-                //rapidjson::Value v(res->result);
-                std::cout << k_txt << ": " << res->result << std::endl;
-                delete res;
-            }
-        }
-        delete aggregator;
-
-        // Create a timestamp
-        time_t rawtime;
-        struct tm * timeinfo;
-
-        time (&rawtime);
-        timeinfo = localtime (&rawtime);
-
-        char buffer[80];
-        strftime(buffer,80,"%Y-%m-%d %X",timeinfo);
-
-        // Add timestamp to result
-        //std::cout << "_timestamp: " << std::string(buffer) << std::endl;
+    /*
+     *      explainWrite ---
+     *
+     *      EXPLAIN of an UPDATE or DELETE: print its plan with the estimates and leave the
+     *      documents alone.  EXPLAIN ANALYZE runs the query to show the actual rows as well.
+     *      False if the project does not exist.
+     */
 
-        return result;
+    bool explainWrite(Parsing::Query *q, META &meta) {
+        return meta.read(*q->project, [&](DOCDS &docs) {
+            Plan *plan = planner.plan(q, docs.size());
+            plan->print(std::cout, false);
+            delete plan;
+        });
     }
 
     /*
@@ -857,52 +296,177 @@ rapidjson::Document processFields(rapidjson::Document &doc, rapidjson::Document
         META &meta = *m;
         FILESYSTEM &fs = *f;
 
+        if (q->explain && q->command != Parsing::SELECT && q->command != Parsing::UPDATE && q->command != Parsing::DELETE) {
+            PRINT("Only SELECT, UPDATE and DELETE can be explained!\r\n");
+            delete q;
+            return;
+        }
+
         switch (q->command) {
             case Parsing::CREATE:
                 {
-                    // TODO: Create an index...
-                    //q.print();
+                    if (!q->view.empty()) {
+                        if (views.exists(q->view) || meta.count(q->view)) {
+                            PRINT("'", q->view, "' already exists!\r\n");
+                        } else {
+                            if (!meta.read(*q->project, [&](DOCDS &docs) { views.create(q->view, *q, &docs, fs); })) {
+                                views.create(q->view, *q, NULL, fs);
+                            }
+                            checkpoint(*q->project, meta, fs);
+                        }
+                        break;
+                    }
+                    if (!q->project) {
+                        PRINT("No project given!  Use CREATE INDEX ON [ field ] IN project;\r\n");
+                        break;
+                    }
+                    std::string project = *q->project;
+                    for (auto it = q->fields->Begin(); it != q->fields->End(); ++it) {
+                        if (!it->IsString()) continue;
+                        std::string field = it->GetString();
+                        if (indexes.exists(project, field)) {
+                            PRINT("Index on '", project, ".", field, "' already exists!\r\n");
+                        } else {
+                            createIndex(project, field, meta, fs);
+                        }
+                    }
+                    checkpoint(project, meta, fs);
                     break;
                 }
             case Parsing::INSERT:
                 {
                     // Insert documents in docs into project.
-                    if (q->with) {
-                        rapidjson::Document with;
-                        with.CopyFrom(*(q->with), with.GetAllocator());
-                        insertDocuments(with, *q->project, meta, fs);
+                    if (views.exists(*q->project)) {
+                        PRINT("'", *q->project, "' is a view!\r\n");
+                    } else if (q->with) {
+                        insertDocuments(*q->with, *q->project, meta, fs);
+                        checkpoint(*q->project, meta, fs);
+                        results.bump(*q->project);
                     }
                     break;
                 }
-            case Parsing::SELECT:
+            case Parsing::LOAD:
                 {
+                    // Insert the documents of a JSON Lines file into project.
                     std::string project = *q->project;
-                    if (meta.count(project) > 0) {
-                        if( !select(meta[project], *q->fields, q->where, q->limit, fs) ) {
-                            PRINT("Result Empty!\r\n");
+                    if (views.exists(project)) {
+                        PRINT("'", project, "' is a view!\r\n");
+                        break;
+                    }
+                    BulkLoader loader(fs, meta);
+                    bool read = loader.load(q->source, project, theUUID, [&project](uint64_t id, const rapidjson::Value &doc) {
+                        indexes.add(project, id, doc);
+                        stats.add(project, doc);
+                        views.add(project, doc);
+                    });
+                    checkpoint(project, meta, fs);
+                    results.bump(project);
+                    if (!read) {
+                        PRINT("Could not read '", q->source, "'!\r\n");
+                    } else {
+                        PRINT("Loaded ", loader.loaded, " documents into '", project, "'");
+                        if (loader.failed > 0) {
+                            PRINT(", ", loader.failed, " lines were not JSON objects");
                         }
+                        PRINT("\r\n");
+                    }
+                    break;
+                }
+            case Parsing::SELECT:
+                {
+                    // Repeated selects of projects nobody wrote to since are answered from the cache.
+                    std::string key = views.exists(*q->project) ? "" : ResultCache::key(*q);
+                    std::string cached;
+                    if (key.empty()) {
+                        select(q, meta, fs);
+                    } else if (results.lookup(key, cached)) {
+                        PRINT(cached);
                     } else {
-                        PRINT("Project '", project, "' does not exist!\r\n");
+                        OutputCapture capture(std::cout, RESULT_CACHE_MEMORY);
+                        if (select(q, meta, fs) && capture.complete()) {
+                            std::vector<std::string> projects(1, *q->project);
+                            if (q->join.active()) {
+                                projects.push_back(q->join.project);
+                            }
+                            results.store(key, projects, capture.text);
+                        }
                     }
                     break;
                 }
             case Parsing::DELETE:
                 {
                     std::string project = *q->project;
-                    if (meta.count(project)) {
-                        DOCDS& docs = meta[project];
-                        ddelete(docs, *q->fields, q->where, q->limit, fs);
-                        //meta[project] = docs;
+                    if (q->explain && !q->analyze) {
+                        if (!explainWrite(q, meta)) {
+                            PRINT("Project '", project, "' does not exist!\r\n");
+                        }
+                        break;
+                    }
+                    bool exists = meta.update(project, [&](DOCDS &docs) {
+                        Plan *plan = planner.plan(q, docs.size());
+                        executor.ddelete(*plan, docs, *q->fields, q->where, q->limit, fs);
+                        results.bump(project);
+                        if (q->explain) {
+                            plan->print(std::cout);
+                        }
+                        delete plan;
+                    });
+                    if (!exists) {
+                        PRINT("Project '", project, "' does not exist!\r\n");
                     } else {
+                        checkpoint(project, meta, fs);
+                    }
+                    break;
+                }
+            case Parsing::ANALYZE:
+                {
+                    std::string project = *q->project;
+                    if (!analyze(project, meta, fs)) {
                         PRINT("Project '", project, "' does not exist!\r\n");
+                    } else {
+                        checkpoint(project, meta, fs);
                     }
                     break;
                 }
             case Parsing::SHOW:
                 {
-                    std::string key("__PROJECTS__");
-                    if (meta.count(key)) {
-                        DOCDS& list = meta[key];
+                    if (q->project->compare("__CACHE__") == 0) {
+                        results.print(std::cout);
+                        meta.print(std::cout);
+                        if (executor.documentCache()) {
+                            executor.documentCache()->print(std::cout);
+                        }
+                        break;
+                    }
+                    if (q->project->compare("__VIEWS__") == 0) {
+                        std::vector<std::string> list = views.list();
+                        if (list.empty()) {
+                            PRINT("No views found!\r\n");
+                            break;
+                        }
+                        PRINT("[\r\n");
+                        for (auto it = list.begin(); it != list.end(); ++it) {
+                            PRINT("\t", *it, "\n");
+                        }
+                        PRINT("]\r\n");
+                        break;
+                    }
+                    if (q->project->compare("__INDEXES__") == 0) {
+                        std::vector<std::string> list = indexes.list();
+                        if (list.empty()) {
+                            PRINT("No indexes found!\r\n");
+                            break;
+                        }
+                        PRINT("[\r\n");
+                        for (auto it = list.begin(); it != list.end(); ++it) {
+                            PRINT("\t", *it, "\n");
+                        }
+                        PRINT("]\r\n");
+                        break;
+                    }
+                    std::vector<std::string> list = meta.keys();
+                    std::sort(list.begin(), list.end());
+                    if (!list.empty()) {
                         PRINT("[\r\n");
                         for (auto it = list.begin() ; it != list.end() ; ++it) {
                             PRINT("\t", *it, "\n");
@@ -916,13 +480,26 @@ rapidjson::Document processFields(rapidjson::Document &doc, rapidjson::Document
             case Parsing::UPDATE:
                 {
                     std::string project = *q->project;
-                    if (meta.count(project)) {
-                        DOCDS& docs = meta[project];
+                    if (q->explain && !q->analyze) {
+                        if (!explainWrite(q, meta)) {
+                            PRINT("Project '", project, "' does not exist!\r\n");
+                        }
+                        break;
+                    }
+                    bool exists = meta.update(project, [&](DOCDS &docs) {
                         rapidjson::Document &updates = *q->with;
-                        update( docs, updates, q->where, q->limit, fs);
-                        meta[project] = docs;
-                    } else {
+                        Plan *plan = planner.plan(q, docs.size());
+                        executor.update(*plan, docs, updates, q->where, q->limit, fs);
+                        results.bump(project);
+                        if (q->explain) {
+                            plan->print(std::cout);
+                        }
+                        delete plan;
+                    });
+                    if (!exists) {
                         PRINT("Project '", project, "' does not exist!\r\n");
+                    } else {
+                        checkpoint(project, meta, fs);
                     }
                     break;
                 }
@@ -988,6 +565,10 @@ rapidjson::Document processFields(rapidjson::Document &doc, rapidjson::Document
                 size = sizeof(Parsing::UpdateArgs) / sizeof(Parsing::UpdateArgs[0]);
                 options = &Parsing::UpdateArgs[0];
                 prefix = "UPDATE ";
+            } else if (tokens[0] == "load") {
+                size = sizeof(Parsing::LoadArgs) / sizeof(Parsing::LoadArgs[0]);
+                options = &Parsing::LoadArgs[0];
+                prefix = "LOAD ";
             }
         }
 
@@ -1013,15 +594,9 @@ rapidjson::Document processFields(rapidjson::Document &doc, rapidjson::Document
         // Start up the file system
         Storage::Filesystem *fs = new Storage::Filesystem(data_fname);
 
-        // Get the meta data
-        META *meta;
-        File meta_file = fs->open_file("__DB_METADATA__");
-        Storage::HerpmapReader<DOCDS,Num_Buckets> meta_reader(meta_file, fs);
-        if (meta_file.size > 0) {
-            meta = new META(meta_reader.read());
-        } else {
-            meta = new META();
-        }
+        // Only the project names, their documents are read when a query needs them
+        META *meta = new META(CATALOG_MEMORY, CATALOG_LOG_SIZE);
+        meta->load(fs);
 
         // Get the UUID that needs to be used
         File uuid = fs->open_file( "HERP_UUID" );
@@ -1034,6 +609,10 @@ rapidjson::Document processFields(rapidjson::Document &doc, rapidjson::Document
             free(data);
         }
 
+        indexes.load(fs);
+        stats.load(fs);
+        views.load(fs);
+
         int count = 0;
 
         std::string line;
@@ -1119,8 +698,10 @@ end:
 
         fs->write( &uuid , reinterpret_cast<char*>(&theUUID) , sizeof(uint64_t) );
 
-        Storage::HerpmapWriter<DOCDS,Num_Buckets> meta_writer(meta_file, fs);
-        meta_writer.write(*meta);
+        meta->save();
+        indexes.save(fs);
+        stats.save(fs);
+        views.save(fs);
         std::cout << "Goodbye!" << std::endl;
         free(buf);
 
@@ -1,10 +1,8 @@
 #ifndef DBMS_H_
 #define DBMS_H_
 
-#include <list>
-
 #include "../mmap_filesystem/Filesystem.h"
-#include "../storage/HerpHash.h"
+#include "../storage/DocSet.h"
 
 #define LENGTH(A) sizeof(A)/sizeof(A[0])
 #ifndef UNUSED
@@ -14,14 +12,11 @@
 #define MAJOR_VERSION 0
 #define MINOR_VERSION 1
 
-typedef std::list<std::string> DOCDS;
-
-const uint64_t Num_Buckets = 2048;
+typedef Storage::DocSet DOCDS;
 
-typedef Storage::HerpHash<std::string,DOCDS, Num_Buckets> META;
+// Id sets of the projects by name, shared by the query threads (Catalog.h)
+class Catalog;
+typedef Catalog META;
 typedef Storage::Filesystem FILESYSTEM;
 
-std::string SpecialValueComparisons[] = { "#gt", "#lt", "#eq", "#contains", "#starts", "#ends" };
-std::string SpecialKeyComparisons[] = { "#exists", "#isnull", "#isstr", "#isnum", "#isbool", "#isarray", "#isobj" };
-
 #endif
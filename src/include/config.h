@@ -17,4 +17,27 @@
 #define NUM_THREADS 0
 #define EXPERIMENTAL 1
 
+// Workers for parallel scans, 0 for one per hardware thread
+#define SCAN_THREADS 0
+// Whether parallel selects print their rows in document order
+#define SCAN_ORDERED 1
+// Bytes of groups a GROUP BY holds in memory before it spills to disk
+#define GROUP_MEMORY (64 << 20)
+// Bytes of rows an ORDER BY sorts in memory before writing them out as a sorted run
+#define SORT_MEMORY (64 << 20)
+// Bytes of documents a join keeps in its hash table before it partitions both sides to disk
+#define JOIN_MEMORY (64 << 20)
+// Bytes of printed select results kept to answer repeated selects, 0 to keep none
+#define RESULT_CACHE_MEMORY (16 << 20)
+// Bytes of parsed documents kept in memory to skip reading and parsing hot documents, 0 to keep none
+#define DOC_CACHE_MEMORY (64 << 20)
+// Bytes of project id sets kept in memory; colder projects are read again when next used
+#define CATALOG_MEMORY (64 << 20)
+// Bytes of project changes logged before they are written into the projects' own files
+#define CATALOG_LOG_SIZE (4 << 20)
+// Workers parsing a LOAD, 0 for one per hardware thread
+#define LOAD_THREADS 0
+// Bytes of a LOAD file parsed and stored at a time
+#define LOAD_BATCH (16 << 20)
+
 #endif
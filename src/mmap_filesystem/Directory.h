@@ -0,0 +1,274 @@
+#ifndef _DIRECTORY_H_
+#define _DIRECTORY_H_
+
+#include <string>
+#include <iostream>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <cstdint>
+#include <fcntl.h>
+#include <sys/stat.h>
+#if !defined(_WIN32)
+#include <sys/mman.h>
+#include <unistd.h>
+#endif
+
+#include "../assert/Assert.h"
+
+/*
+ *      Directory ---
+ *
+ *      The first block of every document file, kept in a file of its own next to the data
+ *      file and used straight from the mapping.  The file is a small header followed by a
+ *      power of two of (id, block) slots, probed linearly from the id's mixed hash, so opening
+ *      a database maps it and is done: nothing is read or rebuilt, however many documents
+ *      there are.  Puts and erases change the mapped slots in place; erasing shifts the rest
+ *      of the run back instead of leaving tombstones.  The id ~0 marks an empty slot.
+ *
+ *      When the table is 3/4 full a file twice the size is built next to it and renamed over
+ *      it.  The header carries a stamp that the data file's metadata repeats, so a directory
+ *      left behind by another database is never taken for this one's.
+ *
+ *      Included by Filesystem.h, after the platform's mmap and fallocate.
+ */
+
+namespace Storage {
+    class Directory {
+        public:
+            static const uint64_t Magic = 0x5249444b53425256ULL;    // "VRBSKDIR"
+            static const uint64_t InitialSlots = 1024;
+            static const uint64_t Empty = ~uint64_t(0);
+
+            Directory() : fd( -1 ) , header( NULL ) , slots( NULL ) {}
+
+            ~Directory() {
+                close();
+            }
+
+            // Map the directory at path, false if there is none or it is damaged.
+            bool open( const std::string &path_ ) {
+                close();
+                int f = ::open( path_.c_str() , O_RDWR );
+                if( f == -1 ) {
+                    return false;
+                }
+                struct stat st;
+                if( fstat( f , &st ) != 0 || uint64_t( st.st_size ) < sizeof( Header ) ) {
+                    ::close( f );
+                    return false;
+                }
+                if( !attach( f , st.st_size ) ) {
+                    return false;
+                }
+                if( header->magic != Magic || uint64_t( st.st_size ) != bytes( header->capacity ) ) {
+                    munmap( reinterpret_cast<char*>( header ) , st.st_size );
+                    ::close( fd );
+                    fd = -1;
+                    header = NULL;
+                    slots = NULL;
+                    return false;
+                }
+                path = path_;
+                return true;
+            }
+
+            // Start an empty directory at path, replacing any file there.
+            void create( const std::string &path_ , uint64_t stamp ) {
+                close();
+                build( path_ , stamp , InitialSlots );
+                path = path_;
+            }
+
+            void close() {
+                if( header != NULL ) {
+                    sync();
+                    munmap( reinterpret_cast<char*>( header ) , bytes( header->capacity ) );
+                    ::close( fd );
+                }
+                fd = -1;
+                header = NULL;
+                slots = NULL;
+            }
+
+            void sync() {
+                if( header != NULL ) {
+#if defined(_WIN32)
+                    FlushViewOfFile( header , bytes( header->capacity ) );
+#else
+                    msync( header , bytes( header->capacity ) , MS_SYNC );
+#endif
+                }
+            }
+
+            bool isOpen() const {
+                return header != NULL;
+            }
+
+            uint64_t stamp() const {
+                return header->stamp;
+            }
+
+            bool find( uint64_t id , uint64_t &block ) const {
+                return findIn( slots , header->capacity - 1 , id , block );
+            }
+
+            void put( uint64_t id , uint64_t block ) {
+                Assert( "The empty id can not be stored" , id != Empty );
+                if( (header->count + 1) * 4 > header->capacity * 3 ) {
+                    grow();
+                }
+                if( putIn( slots , header->capacity - 1 , id , block ) ) {
+                    ++header->count;
+                }
+            }
+
+            bool erase( uint64_t id ) {
+                if( !eraseIn( slots , header->capacity - 1 , id ) ) {
+                    return false;
+                }
+                --header->count;
+                return true;
+            }
+
+            uint64_t size() const {
+                return header->count;
+            }
+
+            // Call f(id, block) for every document, in no particular order.
+            template <class F>
+                void forEach( F f ) const {
+                    for( uint64_t i = 0 ; i < header->capacity ; ++i ) {
+                        if( slots[i].id != Empty ) {
+                            f( slots[i].id , slots[i].block );
+                        }
+                    }
+                }
+
+        private:
+            struct Header {
+                uint64_t magic;
+                uint64_t stamp;
+                uint64_t capacity;      // slots, a power of two
+                uint64_t count;
+            };
+
+            struct Slot {
+                uint64_t id;
+                uint64_t block;
+            };
+
+            std::string path;
+            int fd;
+            Header *header;
+            Slot *slots;
+
+            static uint64_t bytes( uint64_t capacity ) {
+                return sizeof( Header ) + capacity * sizeof( Slot );
+            }
+
+            bool attach( int f , uint64_t size ) {
+                void *data = mmap( NULL , size , PROT_READ | PROT_WRITE , MAP_SHARED , f , 0 );
+                if( data == MAP_FAILED || data == NULL ) {
+                    ::close( f );
+                    return false;
+                }
+                fd = f;
+                header = reinterpret_cast<Header*>( data );
+                slots = reinterpret_cast<Slot*>( header + 1 );
+                return true;
+            }
+
+            void build( const std::string &to , uint64_t stamp , uint64_t capacity ) {
+                int f = ::open( to.c_str() , O_RDWR | O_CREAT | O_TRUNC , (mode_t)0644 );
+                if( f == -1 || posix_fallocate( f , 0 , bytes( capacity ) ) != 0 || !attach( f , bytes( capacity ) ) ) {
+                    std::cerr << "Error creating document directory " << to << std::endl;
+                    std::exit( 1 );
+                }
+                header->magic = Magic;
+                header->stamp = stamp;
+                header->capacity = capacity;
+                header->count = 0;
+                // Every id ~0, every slot empty.
+                memset( slots , 0xff , capacity * sizeof( Slot ) );
+            }
+
+            void grow() {
+                Directory bigger;
+                std::string next = path + ".grow";
+                bigger.build( next , header->stamp , header->capacity * 2 );
+                forEach( [&bigger]( uint64_t id , uint64_t block ) {
+                    putIn( bigger.slots , bigger.header->capacity - 1 , id , block );
+                } );
+                bigger.header->count = header->count;
+                bigger.sync();
+                close();
+#if defined(_WIN32)
+                std::remove( path.c_str() );
+#endif
+                std::rename( next.c_str() , path.c_str() );
+                fd = bigger.fd;
+                header = bigger.header;
+                slots = bigger.slots;
+                bigger.header = NULL;
+            }
+
+            // Ids are mostly consecutive, mix them so runs do not pile up.
+            static uint64_t home( uint64_t id , uint64_t mask ) {
+                id ^= id >> 33;
+                id *= 0xff51afd7ed558ccdULL;
+                id ^= id >> 33;
+                return id & mask;
+            }
+
+            static bool findIn( const Slot *slots , uint64_t mask , uint64_t id , uint64_t &block ) {
+                for( uint64_t i = home( id , mask ) ; ; i = (i + 1) & mask ) {
+                    if( slots[i].id == id ) {
+                        block = slots[i].block;
+                        return true;
+                    }
+                    if( slots[i].id == Empty ) {
+                        return false;
+                    }
+                }
+            }
+
+            // True if id was not there yet.  There has to be an empty slot.
+            static bool putIn( Slot *slots , uint64_t mask , uint64_t id , uint64_t block ) {
+                uint64_t i = home( id , mask );
+                while( slots[i].id != Empty && slots[i].id != id ) {
+                    i = (i + 1) & mask;
+                }
+                bool added = slots[i].id == Empty;
+                slots[i].id = id;
+                slots[i].block = block;
+                return added;
+            }
+
+            static bool eraseIn( Slot *slots , uint64_t mask , uint64_t id ) {
+                uint64_t i = home( id , mask );
+                while( slots[i].id != id ) {
+                    if( slots[i].id == Empty ) {
+                        return false;
+                    }
+                    i = (i + 1) & mask;
+                }
+                // Pull back every entry of the run that may not sit after the hole.
+                for( uint64_t j = (i + 1) & mask ; slots[j].id != Empty ; j = (j + 1) & mask ) {
+                    uint64_t k = home( slots[j].id , mask );
+                    bool between = i <= j ? (i < k && k <= j) : (i < k || k <= j);
+                    if( !between ) {
+                        slots[i] = slots[j];
+                        i = j;
+                    }
+                }
+                slots[i].id = Empty;
+                return true;
+            }
+
+            Directory( const Directory& );
+            Directory& operator=( const Directory& );
+    };
+};
+
+#endif
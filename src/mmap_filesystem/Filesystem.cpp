@@ -9,6 +9,9 @@
 #include <vector>
 #include <algorithm>
 #include <cmath>
+#include <cctype>
+#include <random>
+#include <chrono>
 
 #include "../assert/Assert.h"
 #include "Filesystem.h"
@@ -48,6 +51,22 @@ void printError() {
     SPOT = NEW;                 \
 }
 
+// Marks metadata that lists the document files by id ahead of the named files.  Older
+// metadata has the named files right after its header and names documents by decimal id.
+const uint64_t DOCUMENT_DIRECTORY = 0x5249444449434f44ULL;
+// Marks metadata whose documents are in the mapped directory, followed by its stamp.
+const uint64_t MAPPED_DIRECTORY = 0x5249444450414d44ULL;
+
+// The document directory of a data file lives next to it.
+static std::string directoryName(const std::string &data) {
+    return data + ".ids";
+}
+
+static uint64_t newStamp() {
+    std::random_device rd;
+    return (uint64_t(rd()) << 32) ^ rd() ^ uint64_t(std::chrono::steady_clock::now().time_since_epoch().count());
+}
+
 /*
    Constructor--
    Checks if the filesystem and metadata exist.  If not, it creates an initial page of data.
@@ -70,50 +89,32 @@ Storage::Filesystem::Filesystem(const std::string data_): data_fname(data_) {
     initFilesystem(create_initial);
 }
 
+// Locks are by name, document files use their id as one.
+std::string Storage::Filesystem::lockName(File *f) {
+	return f->id == NO_ID ? f->name : std::to_string(f->id);
+}
+
 #if THREADING
-void Storage::Filesystem::createLockIfNotExists(lock_t type, std::string name) {
-	switch (type) {
-	case READ:
-		{
-		if (read_locks.count(name) == 0) {
-			read_locks[name] = new std::mutex();
-		}
-		break;
-		}
-	case WRITE:
-		{
-		if (write_locks.count(name) == 0) {
-			write_locks[name] = new std::mutex();
-		}
-		break;
-		}
-	}
+std::mutex *Storage::Filesystem::createLockIfNotExists(lock_t type, const std::string &name) {
+	auto make = [] { return new std::mutex(); };
+	return type == READ ? read_locks.getOrPut(name, make) : write_locks.getOrPut(name, make);
 }
 
 void Storage::Filesystem::Lock(lock_t type, File *f) {
-	createLockIfNotExists(type, f->name);
-	switch (type) {
-	case READ:
-		read_locks[f->name]->lock();		
-		break;
-	case WRITE:
-		write_locks[f->name]->lock();
-		break;
-	}
+	createLockIfNotExists(type, lockName(f))->lock();
 }
 
 void Storage::Filesystem::Unlock(lock_t type, File *f) {
-	switch (type) {
-	case READ:
-		read_locks[f->name]->unlock();
-		break;
-	case WRITE:
-		write_locks[f->name]->unlock();
-		break;
+	std::mutex *m = NULL;
+	if (type == READ) {
+		read_locks.get(lockName(f), m);
+	} else {
+		write_locks.get(lockName(f), m);
 	}
+	m->unlock();
 }
 #else
-void Storage::Filesystem::createLockIfNotExists(lock_t, std::string) {}
+std::mutex *Storage::Filesystem::createLockIfNotExists(lock_t, const std::string&) { return NULL; }
 void Storage::Filesystem::Lock(lock_t, File*) {}
 void Storage::Filesystem::Unlock(lock_t, File*) {}
 #endif
@@ -151,7 +152,7 @@ uint64_t Storage::Filesystem::getNumFiles() {
 }
 
 Storage::HerpHash<std::string, uint64_t> Storage::Filesystem::getFileMap() {
-    return metadata.files;
+    return metadata.files.snapshot();
 }
 
 /*
@@ -159,8 +160,8 @@ Storage::HerpHash<std::string, uint64_t> Storage::Filesystem::getFileMap() {
    If the file doesn't exist, create it.
    */
 File Storage::Filesystem::open_file(const std::string& name) {
-    if (metadata.files.count(name)) {
-        uint64_t block = metadata.files[name];
+    uint64_t block;
+    if (metadata.files.get(name, block)) {
         Block b = loadBlock(block);
         uint64_t size = calculateSize(b);
         File file(name, block, size);
@@ -170,10 +171,22 @@ File Storage::Filesystem::open_file(const std::string& name) {
     }
 }
 
+/*
+   Open a document file by its id, creating it if it doesn't exist.
+   */
+File Storage::Filesystem::open_file(uint64_t id) {
+    uint64_t block;
+    if (metadata.documents.find(id, block)) {
+        Block b = loadBlock(block);
+        return File(id, block, calculateSize(b));
+    }
+    return createNewFile(id);
+}
+
 File Storage::Filesystem::open_file( const char* nerm ) {
     std::string name( nerm );
-    if (metadata.files.count(name)) {
-        uint64_t block = metadata.files[name];
+    uint64_t block;
+    if (metadata.files.get(name, block)) {
         Block b = loadBlock(block);
         uint64_t size = calculateSize(b);
         File file(name, block, size);
@@ -185,10 +198,20 @@ File Storage::Filesystem::open_file( const char* nerm ) {
 
 void Storage::Filesystem::compact() {
     Filesystem *fs = new Filesystem("_compact.db");
-    uint64_t oldNumFiles = metadata.files.size();
+    uint64_t oldNumFiles = metadata.files.size() + metadata.documents.size();
     uint64_t pos = 0;
-    for (auto it = metadata.files.begin(); it != metadata.files.end(); ++it) {
-        const std::string& key = it->first;
+    metadata.documents.forEach([&](uint64_t id, uint64_t) {
+        File src = open_file(id);
+        char *buffer = read(&src);
+        File dest = fs->open_file(id);
+        fs->write(&dest, buffer, src.size);
+        free(buffer);
+        std::cout << "Compacting: " << ceil(100 * (long double)pos / oldNumFiles) << "% done.\r";
+        pos++;
+    });
+    std::vector<std::string> names = metadata.files.keys();
+    for (auto it = names.begin(); it != names.end(); ++it) {
+        const std::string& key = *it;
 
         // Don't copy over the metadata
         if (key.compare("__METADATA__") == 0) {
@@ -207,13 +230,10 @@ void Storage::Filesystem::compact() {
     uint64_t newNumPages = fs->getNumPages();
     uint64_t newNumFiles = fs->getNumFiles();
 
-    Storage::HerpHash<std::string,uint64_t> newFiles = fs->getFileMap();
     fs->shutdown();
 
-    
-    
-
-    metadata.files = newFiles;
+    metadata.files.assign(fs->metadata.files.snapshot());
+    metadata.documents.close();
     filesystem.numPages = newNumPages; 
     metadata.numFiles = newNumFiles; 
 
@@ -238,11 +258,17 @@ void Storage::Filesystem::compact() {
 	if (!MoveFile("_compact.db", data_fname.c_str())) {
 		printError();
 	}
+
+	DeleteFile(directoryName(data_fname).c_str());
+	if (!MoveFile(directoryName("_compact.db").c_str(), directoryName(data_fname).c_str())) {
+		printError();
+	}
 #else
 	// Unmap the old filesystem
 	munmap(filesystem.data, filesystem.numPages * PAGESIZE);
     std::remove(data_fname.c_str());
     std::rename("_compact.db", data_fname.c_str());
+    std::rename(directoryName("_compact.db").c_str(), directoryName(data_fname).c_str());
 #endif
 
     filesystem.fd = open(data_fname.c_str(), O_RDWR | O_CREAT, (mode_t)0644);
@@ -271,6 +297,11 @@ void Storage::Filesystem::write(File *file, const char *data, uint64_t len) {
     uint64_t pos = 0;
     Block block = loadBlock(file->block);
 
+    // An empty write still has to clear what the first block held
+    if (to_write == 0) {
+        block.used_space = 0;
+    }
+
     while (to_write > 0) {
         // How much are we going to shove in this block
         uint64_t t_w = std::min( to_write , BLOCK_SIZE );
@@ -306,6 +337,7 @@ void Storage::Filesystem::write(File *file, const char *data, uint64_t len) {
     // Write last block
     writeBlock(block);
     file->size = len;
+    file->tail = block.id;
 
     Unlock(READ, file); 
     Unlock(WRITE, file); 
@@ -340,9 +372,82 @@ void Storage::Filesystem::write(File *file, const char *data, uint64_t len) {
         }
     }	
     file->size = len;
+    file->tail = 0;
 }
 #endif
 
+/*
+   Add data to the end of a file.  Only the last block and the new ones are
+   touched, and the last block is found without walking the file when this
+   File wrote it.
+   */
+
+void Storage::Filesystem::append(File *file, const char *data, uint64_t len) {
+    if (len == 0) {
+        return;
+    }
+
+    Lock(WRITE, file);
+    Lock(READ, file);
+
+    Block block = loadBlock(file->tail != 0 ? file->tail : file->block);
+    while (block.next != 0) {
+        block = loadBlock(block.next);
+    }
+
+    uint64_t pos = 0;
+    while (true) {
+        uint64_t t_w = std::min( len - pos , BLOCK_SIZE - block.used_space );
+        memcpy(block.buffer + block.used_space, data + pos, t_w);
+        block.used_space += t_w;
+        pos += t_w;
+        if (pos == len) {
+            break;
+        }
+        block.next = getBlock();
+        writeBlock(block);
+        block = loadBlock(block.next);
+    }
+    writeBlock(block);
+    file->size += len;
+    file->tail = block.id;
+
+    Unlock(READ, file);
+    Unlock(WRITE, file);
+}
+
+/*
+   Overwrite a file with data of the same size.  Blocks that already hold
+   their part of it are left alone, so a small change rewrites one block
+   whatever the size of the file.  Returns how many blocks were rewritten.
+   */
+
+uint64_t Storage::Filesystem::patch(File *file, const char *data, uint64_t len) {
+    Assert("A patch keeps the size of the file", len == file->size);
+
+    Lock(WRITE, file);
+    Lock(READ, file);
+
+    uint64_t pos = 0;
+    uint64_t rewritten = 0;
+    uint64_t bid = file->block;
+    while (pos < len && bid != 0) {
+        Block block = loadBlock(bid);
+        uint64_t n = std::min( len - pos , block.used_space );
+        if (memcmp(block.buffer, data + pos, n) != 0) {
+            memcpy(block.buffer, data + pos, n);
+            writeBlock(block);
+            ++rewritten;
+        }
+        pos += n;
+        bid = block.next;
+    }
+
+    Unlock(READ, file);
+    Unlock(WRITE, file);
+    return rewritten;
+}
+
 void Storage::Filesystem::addToFreeList(uint64_t block) {
 #if THREADING
     freelist_lock.lock();
@@ -366,16 +471,26 @@ void Storage::Filesystem::addToFreeList(uint64_t block) {
 
 std::vector<std::string> Storage::Filesystem::getFilenames() {
     std::vector<std::string> res;
-    for (auto it = metadata.files.begin(); it != metadata.files.end(); ++it) {
-        if( it->first != "__METADATA__" ) {
-            res.push_back(it->first);
+    std::vector<std::string> names = metadata.files.keys();
+    for (auto it = names.begin(); it != names.end(); ++it) {
+        if( *it != "__METADATA__" ) {
+            res.push_back(*it);
         }
     }
     return res;
 }
 
+std::vector<uint64_t> Storage::Filesystem::getDocumentIds() {
+    std::vector<uint64_t> res;
+    res.reserve(metadata.documents.size());
+    metadata.documents.forEach([&res](uint64_t id, uint64_t) { res.push_back(id); });
+    std::sort(res.begin(), res.end());
+    return res;
+}
+
 bool Storage::Filesystem::deleteFile(File *file) {
-    if ( metadata.files.erase(file->name ) ) {
+    bool found = file->id == NO_ID ? metadata.files.erase(file->name) : metadata.documents.erase(file->id);
+    if ( found ) {
         addToFreeList(file->block);
         metadata.numFiles--;
         return true;
@@ -419,7 +534,14 @@ char *Storage::Filesystem::read(File *file) {
 
 File Storage::Filesystem::createNewFile(std::string name) {
     File file(name, getBlock(), 0);
-    metadata.files[name] = file.block;
+    metadata.files.put(name, file.block);
+    metadata.numFiles++;
+    return file;
+}
+
+File Storage::Filesystem::createNewFile(uint64_t id) {
+    File file(id, getBlock(), 0);
+    metadata.documents.put(id, file.block);
     metadata.numFiles++;
     return file;
 }
@@ -493,12 +615,12 @@ void Storage::Filesystem::writeBlock(Block block) {
    Increase the size of the filesystem by an increment of one page.
    */
 
-void Storage::Filesystem::growFilesystem() {
-    posix_fallocate(filesystem.fd, PAGESIZE * filesystem.numPages, PAGESIZE * (filesystem.numPages+1));
+void Storage::Filesystem::growFilesystem(uint64_t pages) {
+    posix_fallocate(filesystem.fd, PAGESIZE * filesystem.numPages, PAGESIZE * (filesystem.numPages+pages));
     filesystem.data = (char*)t_mremap(filesystem.fd,
             filesystem.data,
             PAGESIZE * filesystem.numPages, 
-            PAGESIZE * (filesystem.numPages+1),
+            PAGESIZE * (filesystem.numPages+pages),
             MREMAP_MAYMOVE);
 
     if( !filesystem.data ) {
@@ -506,12 +628,49 @@ void Storage::Filesystem::growFilesystem() {
         std::exit( -1 );
     }
 
-    filesystem.numPages++;
-    uint64_t firstBlock = (BLOCKS_PER_PAGE * (filesystem.numPages-1)) + 1;
-    chainPage(firstBlock);
+    uint64_t firstBlock = (BLOCKS_PER_PAGE * filesystem.numPages) + 1;
+    filesystem.numPages += pages;
+    for (uint64_t p = 0; p < pages; ++p) {
+        chainPage(firstBlock + p * BLOCKS_PER_PAGE);
+    }
 
-    // Add page to free list
-    addToFreeList(firstBlock);
+    // Put the new pages in front of the free list, as one chain
+#if THREADING
+    freelist_lock.lock();
+#endif
+    Block last = loadBlock(firstBlock + pages * BLOCKS_PER_PAGE - 1);
+    for (uint64_t p = 0; p + 1 < pages; ++p) {
+        Block b = loadBlock(firstBlock + (p + 1) * BLOCKS_PER_PAGE - 1);
+        b.next = b.id + 1;
+        writeBlock(b);
+    }
+    last.next = metadata.firstFree;
+    writeBlock(last);
+    SET_FREE(metadata.firstFree,firstBlock);
+#if THREADING
+    freelist_lock.unlock();
+#endif
+}
+
+/*
+   Make sure the free list has at least 'blocks' blocks, growing the data file
+   once for all that are missing rather than a page at a time while writing.
+   */
+
+void Storage::Filesystem::reserve(uint64_t blocks) {
+#if THREADING
+    next_lock.lock();
+#endif
+    uint64_t free = 0;
+    for (uint64_t bid = metadata.firstFree; bid != 0 && free < blocks; ++free) {
+        bid = loadBlock(bid).next;
+    }
+    if (free < blocks) {
+        growFilesystem((blocks - free + BLOCKS_PER_PAGE - 1) / BLOCKS_PER_PAGE);
+    }
+#if THREADING
+    next_lock.unlock();
+#endif
 }
 
 /*
@@ -567,6 +726,7 @@ void Storage::Filesystem::initFilesystem(bool initialFill) {
     initMetadata();
     if (initialFill) {
         chainPage(1);
+        metadata.documents.create(directoryName(data_fname), newStamp());
         metadata.file = open_file("__METADATA__");
         writeMetadata();
     } else {
@@ -601,6 +761,7 @@ void Storage::Filesystem::chainPage(uint64_t startBlock) {
 void Storage::Filesystem::initMetadata() {
     // Initial values
     metadata.numFiles = 0;
+    metadata.documents.close();
     SET_FREE(metadata.firstFree,1);
     filesystem.numPages = 1;
 }
@@ -643,8 +804,45 @@ void Storage::Filesystem::readMetadata() {
     metadata.firstFree  = Read64( buffer , pos );
 
     Assert( "position is wrong" , pos == 3 * sizeof(uint64_t) );
+    uint64_t format = pos + sizeof(uint64_t) <= metadata_size ? *reinterpret_cast<uint64_t*>(buffer + pos) : 0;
+    bool legacy = format != MAPPED_DIRECTORY && format != DOCUMENT_DIRECTORY;
+    if (format == MAPPED_DIRECTORY) {
+        pos += sizeof(uint64_t);
+        uint64_t stamp = Read64( buffer , pos );
+        if (!metadata.documents.open(directoryName(data_fname)) || metadata.documents.stamp() != stamp) {
+            std::cerr << "The document directory " << directoryName(data_fname) << " is missing or belongs to another database!" << std::endl;
+            std::exit(1);
+        }
+    } else {
+        // Metadata written before the mapped directory, the documents are moved into a new one.
+        metadata.documents.create(directoryName(data_fname), newStamp());
+    }
+    if (format == DOCUMENT_DIRECTORY) {
+        pos += sizeof(uint64_t);
+        uint64_t count = Read64( buffer , pos );
+        for (uint64_t i = 0; i < count; ++i) {
+            uint64_t id = Read64( buffer , pos );
+            metadata.documents.put(id, Read64( buffer , pos ));
+        }
+    }
     HerpmapReader<uint64_t> reader(metadata.file, this);
-    metadata.files = reader.read_buffer(buffer, pos, metadata_size);
+    metadata.files.assign(reader.read_buffer(buffer, pos, metadata_size));
+
+    // Move documents named by their decimal id over to the directory of ids.
+    std::vector<std::string> numbered;
+    std::vector<std::string> names = legacy ? metadata.files.keys() : std::vector<std::string>();
+    for (auto it = names.begin(); it != names.end(); ++it) {
+        const std::string &name = *it;
+        if (!name.empty() && name.size() < 20 && std::all_of(name.begin(), name.end(), ::isdigit) && std::to_string(std::stoull(name)) == name) {
+            numbered.push_back(name);
+        }
+    }
+    for (auto it = numbered.begin(); it != numbered.end(); ++it) {
+        uint64_t block = 0;
+        metadata.files.get(*it, block);
+        metadata.documents.put(std::stoull(*it), block);
+        metadata.files.erase(*it);
+    }
 
     free(buffer);
 #if THREADING
@@ -666,10 +864,11 @@ void Storage::Filesystem::writeMetadata() {
     char *files,*buf;
 
     // Get files
-    files = writer.write_buffer(metadata.files, &files_size);
+    Storage::HerpHash<std::string,uint64_t> named = metadata.files.snapshot();
+    files = writer.write_buffer(named, &files_size);
 
     // Allocate buffer
-    size = (3 * sizeof(uint64_t)) + files_size;
+    size = (5 * sizeof(uint64_t)) + files_size;
     buf = new char[size];
 
     // Write numPages first
@@ -678,6 +877,9 @@ void Storage::Filesystem::writeMetadata() {
     Write64(buf , pos , metadata.numFiles);
     Write64(buf , pos , metadata.firstFree);
 
+    // Then the stamp of the document directory and the named files
+    Write64(buf , pos , MAPPED_DIRECTORY);
+    Write64(buf , pos , metadata.documents.stamp());
     WriteRaw(buf, pos , files , files_size );
 
     uint64_t test = filesystem.numPages + metadata.firstFree + metadata.numFiles;
@@ -699,12 +901,17 @@ void Storage::Filesystem::writeMetadata() {
 #endif
 }
 
+void Storage::Filesystem::flush() {
+    writeMetadata();
+}
+
 /*
    Unmap the filesystem.
    */
 
 void Storage::Filesystem::shutdown() {
     writeMetadata();
+    metadata.documents.close();
     close(filesystem.fd);
 #if defined(_WIN32)
 	FlushViewOfFile(filesystem.data, filesystem.numPages * PAGESIZE);
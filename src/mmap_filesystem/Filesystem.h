@@ -16,6 +16,7 @@ typedef int mode_t;
 #include <string>
 #include <sys/stat.h>
 #include "../storage/HerpHash.h"
+#include "../storage/ConcurrentHash.h"
 #include <fcntl.h>
 #include <iostream>
 #include <vector>
@@ -112,12 +113,20 @@ inline void *linux_mremap(int UNUSED(fd), void *old_address, size_t old_size, si
 #define t_mremap linux_mremap 
 #endif
 
+#include "Directory.h"
+
+// Document files are known by a numeric id, everything else by name.
+const uint64_t NO_ID = ~uint64_t(0);
+
 struct File {
 	std::string name;
+	uint64_t id;
 	uint64_t block;
 	uint64_t size;
-	File() {}
-	File(std::string name_, uint64_t block_, uint64_t size_): name(name_), block(block_), size(size_) {}
+	uint64_t tail;      // last block once written through this File, 0 if not known
+	File(): id(NO_ID), tail(0) {}
+	File(std::string name_, uint64_t block_, uint64_t size_): name(name_), id(NO_ID), block(block_), size(size_), tail(0) {}
+	File(uint64_t id_, uint64_t block_, uint64_t size_): id(id_), block(block_), size(size_), tail(0) {}
 };
 
 struct Metadata {
@@ -125,7 +134,10 @@ struct Metadata {
 	uint64_t firstFree;
 	File file;
 	//std::map<std::string, uint64_t> files;
-    Storage::HerpHash<std::string,uint64_t> files;
+    // First block of every named file, safe to resolve from many threads
+    Storage::ConcurrentHash<std::string,uint64_t> files;
+    // First block of every document file, mapped from its own file
+    Storage::Directory documents;
 };
 
 struct FSystem {
@@ -149,10 +161,18 @@ namespace Storage {
 		void shutdown();
 		File open_file(const char*);
 		File open_file(const std::string&);
+		File open_file(uint64_t);
 		char *read(File*);
 		void write(File*, const char*, uint64_t);
+		void append(File*, const char*, uint64_t);
+		uint64_t patch(File*, const char*, uint64_t);
+		void reserve(uint64_t);
+		// Write the metadata now, as shutdown does, so a crash still finds the named files
+		// and free blocks as they are.
+		void flush();
 		bool deleteFile(File*);
 		std::vector<std::string> getFilenames();
+		std::vector<uint64_t> getDocumentIds();
 	        Storage::HerpHash<std::string,uint64_t> getFileMap();
 		void compact();
 		uint64_t getNumPages();
@@ -173,26 +193,28 @@ namespace Storage {
 
 		uint64_t getBlock();
 		File createNewFile(std::string);
+		File createNewFile(uint64_t);
 		void initFilesystem(bool);
 		void readMetadata();
 		void writeMetadata();
 		void initMetadata();
 		Block loadBlock(uint64_t);
 		void writeBlock(Block);
-		void growFilesystem();
+		void growFilesystem(uint64_t pages = 1);
 		void growMetadata();
 		uint64_t calculateSize(Block);
 		void chainPage(uint64_t);
 		void addToFreeList(uint64_t);
-		void createLockIfNotExists(lock_t, std::string);
+		std::mutex *createLockIfNotExists(lock_t, const std::string&);
+		static std::string lockName(File*);
 
 #if THREADING
 		std::mutex next_lock;
 		std::mutex freelist_lock;
 		std::mutex metadata_lock;
 
-		Storage::HerpHash<std::string,std::mutex*> read_locks;
-		Storage::HerpHash<std::string,std::mutex*> write_locks;
+		Storage::ConcurrentHash<std::string,std::mutex*> read_locks;
+		Storage::ConcurrentHash<std::string,std::mutex*> write_locks;
 #endif
 	};
 }
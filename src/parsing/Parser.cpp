@@ -38,6 +38,18 @@ Parsing::Query* Parsing::Parser::parse() {
     Parsing::Query *q = new Parsing::Query();
     bool result = false;
 
+    // EXPLAIN [ANALYZE] <query>; prints the plan of the query instead of its results
+    if (!token.compare("explain")) {
+        q->explain = true;
+        token = Parsing::Parser::sc.nextToken();
+        toLower( token );
+        if (!token.compare("analyze")) {
+            q->analyze = true;
+            token = Parsing::Parser::sc.nextToken();
+            toLower( token );
+        }
+    }
+
     if (!token.compare("create")) {
         result = create(*q);
     } else if (!token.compare("insert")) {
@@ -50,6 +62,10 @@ Parsing::Query* Parsing::Parser::parse() {
         result = ddelete(*q);
     } else if (!token.compare("show")) {
         result = show(*q);
+    } else if (!token.compare("analyze")) {
+        result = analyze(*q);
+    } else if (!token.compare("load")) {
+        result = load(*q);
     } else {
         std::cout << "PARSING ERROR: Expected a valid command, but found '" << token << "'" << std::endl;
     }
@@ -79,6 +95,9 @@ bool Parsing::Parser::create(Parsing::Query &q) {
     q.command = CREATE;
 
     std::string index(Parsing::Parser::sc.nextToken());
+    if (icompare(index,"view")) {
+        return view(q);
+    }
     std::string on(Parsing::Parser::sc.nextToken());
 
     if (icompare(index,"index") && icompare(on,"on")) {
@@ -106,6 +125,14 @@ bool Parsing::Parser::create(Parsing::Query &q) {
             std::cout << "PARSING ERROR: Invalid JSON." << std::endl;
             return false;
         }
+
+        // Optional project the index belongs to
+        std::string in(Parsing::Parser::sc.nextToken());
+        if (icompare(in,"in")) {
+            q.project = new std::string(Parsing::Parser::sc.nextToken());
+        } else {
+            Parsing::Parser::sc.push_back(in);
+        }
     } else {
         std::cout << "PARSING ERROR: Expected 'index on', found '" << index << " " << on << "'." << std::endl;
         return false;
@@ -113,19 +140,136 @@ bool Parsing::Parser::create(Parsing::Query &q) {
     return true;
 }
 
+/*
+   CREATE VIEW name AS SELECT <aggregates> FROM project [WHERE ...]
+   [GROUP BY ...].  The select of a view is kept up to date as the
+   project is written to, so it has to be made of aggregates over the
+   documents of one project.
+   */
+bool Parsing::Parser::view(Parsing::Query &q) {
+    q.view = Parsing::Parser::sc.nextToken();
+    if (q.view.empty()) {
+        std::cout << "PARSING ERROR: Expected a view name." << std::endl;
+        return false;
+    }
+    std::string as(Parsing::Parser::sc.nextToken());
+    std::string select(Parsing::Parser::sc.nextToken());
+    if (!icompare(as,"as") || !icompare(select,"select")) {
+        std::cout << "PARSING ERROR: Expected 'as select', found '" << as << " " << select << "'." << std::endl;
+        return false;
+    }
+    if (!Parsing::Parser::select(q)) {
+        return false;
+    }
+    q.command = CREATE;
+
+    if (q.join.active() || q.sample.active() || !q.orderBy.empty() || q.limit > -1) {
+        std::cout << "PARSING ERROR: A view can not have a JOIN, SAMPLE, ORDER BY or LIMIT." << std::endl;
+        return false;
+    }
+    bool aggregated = false;
+    for (auto it = q.fields->Begin(); it != q.fields->End(); ++it) {
+        if (it->IsObject()) {
+            aggregated = true;
+        } else if (q.groupBy.empty()) {
+            std::cout << "PARSING ERROR: A view only selects aggregates and grouped fields, found '" << it->GetString() << "'." << std::endl;
+            return false;
+        }
+    }
+    if (!aggregated) {
+        std::cout << "PARSING ERROR: A view needs at least one aggregate." << std::endl;
+        return false;
+    }
+    return true;
+}
+
 bool Parsing::Parser::show(Parsing::Query &q) {
     q.command = SHOW;
     std::string token(Parsing::Parser::sc.nextToken());
 
     if (icompare(token,"projects")) {
         q.project = new std::string("__PROJECTS__");
+    } else if (icompare(token,"indexes")) {
+        q.project = new std::string("__INDEXES__");
+    } else if (icompare(token,"views")) {
+        q.project = new std::string("__VIEWS__");
+    } else if (icompare(token,"cache")) {
+        q.project = new std::string("__CACHE__");
     } else {
-        std::cout << "PARSING ERROR: Expected 'projects', found '" << token << "." << std::endl;
+        std::cout << "PARSING ERROR: Expected 'projects', 'indexes', 'views' or 'cache', found '" << token << "." << std::endl;
+        return false;
+    }
+    return true;
+}
+
+bool Parsing::Parser::analyze(Parsing::Query &q) {
+    q.command = ANALYZE;
+    std::string project(Parsing::Parser::sc.nextToken());
+    if (project.empty()) {
+        std::cout << "PARSING ERROR: Expected a project name after 'analyze'." << std::endl;
+        return false;
+    }
+    q.project = new std::string(project);
+    return true;
+}
+
+// LOAD INTO project FROM 'file', a file with one JSON document per line.
+bool Parsing::Parser::load(Parsing::Query &q) {
+    q.command = LOAD;
+    std::string into(Parsing::Parser::sc.nextToken());
+    if (!icompare(into,"into")) {
+        std::cout << "Expected 'into'.  Found '" << into << "." << std::endl;
+        return false;
+    }
+    q.project = new std::string(Parsing::Parser::sc.nextToken());
+    std::string from(Parsing::Parser::sc.nextToken());
+    if (!icompare(from,"from")) {
+        std::cout << "Expected 'from'.  Found '" << from << "." << std::endl;
+        return false;
+    }
+    try {
+        q.source = Parsing::Parser::sc.nextString();
+    } catch (std::runtime_error &e) {
+        std::cout << "PARSING ERROR: Expected the file name in quotes." << std::endl;
+        return false;
+    }
+    if (q.source.empty()) {
+        std::cout << "PARSING ERROR: Expected a file name." << std::endl;
         return false;
     }
     return true;
 }
 
+// The first field path of the #set, #inc, #push or #unset operators in 'with' that has an empty
+// step ("", "a..b", ".a" or "a."), NULL if there is none.
+static const char *emptyStep(const rapidjson::Value &with) {
+    for (rapidjson::Value::ConstMemberIterator op = with.MemberBegin(); op != with.MemberEnd(); ++op) {
+        const char *name = op->name.GetString();
+        if (name[0] != '#') {
+            continue;
+        }
+        std::vector<const char*> paths;
+        if (op->value.IsObject()) {
+            for (rapidjson::Value::ConstMemberIterator it = op->value.MemberBegin(); it != op->value.MemberEnd(); ++it) {
+                paths.push_back(it->name.GetString());
+            }
+        } else if (op->value.IsArray()) {
+            for (rapidjson::Value::ConstValueIterator it = op->value.Begin(); it != op->value.End(); ++it) {
+                if (it->IsString()) {
+                    paths.push_back(it->GetString());
+                }
+            }
+        }
+        for (auto p = paths.begin(); p != paths.end(); ++p) {
+            std::string path(*p);
+            if (path.empty() || path[0] == '.' || path[path.size() - 1] == '.' || path.find("..") != std::string::npos) {
+                return *p;
+            }
+        }
+    }
+    return NULL;
+}
+
 bool Parsing::Parser::update(Parsing::Query &q) {
     q.command = UPDATE;
 
@@ -144,6 +288,11 @@ bool Parsing::Parser::update(Parsing::Query &q) {
         std::cout << "PARSING ERROR: Invalid JSON." << std::endl;
         return false;
     }
+    const char *path = q.with->IsObject() ? emptyStep(*q.with) : NULL;
+    if (path) {
+        std::cout << "PARSING ERROR: Empty step in field path '" << path << "'." << std::endl;
+        return false;
+    }
 
     std::string where(Parsing::Parser::sc.nextToken());
 
@@ -181,6 +330,13 @@ bool Parsing::Parser::select(Parsing::Query &q) {
     }
 
     q.project = new std::string(Parsing::Parser::sc.nextToken());
+    if (!join(q) || !sample(q)) {
+        return false;
+    }
+    if (q.join.active() && q.sample.active()) {
+        std::cout << "PARSING ERROR: A join can not be sampled." << std::endl;
+        return false;
+    }
     std::string where(Parsing::Parser::sc.nextToken());
 
     if (icompare(where,"where")) {
@@ -191,11 +347,276 @@ bool Parsing::Parser::select(Parsing::Query &q) {
             std::cout << "PARSING ERROR: Invalid JSON." << std::endl;
             return false;
         }
+        if (q.join.active()) {
+            for (auto it = q.where->MemberBegin(); it != q.where->MemberEnd(); ++it) {
+                std::string name = it->name.GetString();
+                if ((name != q.join.alias && name != q.join.joinedAlias) || !it->value.IsObject()) {
+                    std::cout << "PARSING ERROR: The conditions of a join go in objects under '" << q.join.alias << "' or '"
+                        << q.join.joinedAlias << "', found '" << name << "'." << std::endl;
+                    return false;
+                }
+            }
+        }
     } else {
         Parsing::Parser::sc.push_back(where);
     }
+    if (!groupBy(q) || !orderBy(q)) {
+        return false;
+    }
     if (limitPending()) {
         q.limit = Parsing::Parser::sc.nextInt();
+        // The aggregates would only cover the sampled documents before the limit.
+        bool aggregated = std::any_of(q.fields->Begin(), q.fields->End(), [](const rapidjson::Value &f) { return f.IsObject(); });
+        if (q.sample.active() && aggregated && q.groupBy.empty()) {
+            std::cout << "PARSING ERROR: A sampled select with aggregates can not have a LIMIT." << std::endl;
+            return false;
+        }
+    }
+    return true;
+}
+
+/*
+   [alias] JOIN project [alias] ON alias.field = alias.field.  The
+   aliases tell the two sides apart, they are needed to join a project
+   with itself.
+   */
+bool Parsing::Parser::join(Parsing::Query &q) {
+    std::string token(Parsing::Parser::sc.nextToken());
+    if (!icompare(token,"join")) {
+        const std::string keywords[] = {"", "sample", "where", "group", "order", "limit"};
+        for (size_t i = 0; i < sizeof(keywords) / sizeof(keywords[0]); ++i) {
+            if (icompare(token,keywords[i])) {
+                Parsing::Parser::sc.push_back(token);
+                return true;
+            }
+        }
+        q.join.alias = token;
+        token = Parsing::Parser::sc.nextToken();
+        if (!icompare(token,"join")) {
+            std::cout << "PARSING ERROR: Expected 'join' after the alias '" << q.join.alias << "', found '" << token << "'." << std::endl;
+            return false;
+        }
+    } else {
+        q.join.alias = *q.project;
+    }
+
+    q.join.project = Parsing::Parser::sc.nextToken();
+    if (q.join.project.empty()) {
+        std::cout << "PARSING ERROR: Expected a project to join." << std::endl;
+        return false;
+    }
+    token = Parsing::Parser::sc.nextToken();
+    if (icompare(token,"on")) {
+        q.join.joinedAlias = q.join.project;
+    } else {
+        q.join.joinedAlias = token;
+        token = Parsing::Parser::sc.nextToken();
+        if (!icompare(token,"on")) {
+            std::cout << "PARSING ERROR: Expected 'on', found '" << token << "'." << std::endl;
+            return false;
+        }
+    }
+    if (q.join.alias == q.join.joinedAlias) {
+        std::cout << "PARSING ERROR: Both sides of the join are called '" << q.join.alias << "', give them aliases." << std::endl;
+        return false;
+    }
+
+    std::string leftAlias, left, rightAlias, right;
+    if (!qualifiedField(leftAlias, left)) {
+        return false;
+    }
+    char c = Parsing::Parser::sc.nextChar();
+    if (c != '=') {
+        std::cout << "PARSING ERROR: Expected '=', found '" << c << "'." << std::endl;
+        return false;
+    }
+    if (!qualifiedField(rightAlias, right)) {
+        return false;
+    }
+    if (leftAlias == q.join.joinedAlias && rightAlias == q.join.alias) {
+        std::swap(leftAlias, rightAlias);
+        std::swap(left, right);
+    }
+    if (leftAlias != q.join.alias || rightAlias != q.join.joinedAlias) {
+        std::cout << "PARSING ERROR: The join has to compare a field of '" << q.join.alias << "' with one of '"
+            << q.join.joinedAlias << "'." << std::endl;
+        return false;
+    }
+    q.join.key = left;
+    q.join.joinedKey = right;
+    return true;
+}
+
+// alias.field, where the field can be a dotted path.
+bool Parsing::Parser::qualifiedField(std::string &alias, std::string &field) {
+    std::string name(fieldName());
+    size_t dot = name.find('.');
+    if (dot == std::string::npos || dot == 0 || dot + 1 == name.size()) {
+        std::cout << "PARSING ERROR: Expected alias.field in the join condition, found '" << name << "'." << std::endl;
+        return false;
+    }
+    alias = name.substr(0, dot);
+    field = name.substr(dot + 1);
+    return true;
+}
+
+// A field name, dots included: 'a.b.c' names a nested field, or a member of a joined row.
+std::string Parsing::Parser::fieldName() {
+    std::string field(Parsing::Parser::sc.nextToken());
+    while (Parsing::Parser::sc.nextChar() == '.') {
+        field += '.';
+        field += Parsing::Parser::sc.nextToken();
+    }
+    Parsing::Parser::sc.push_back(1);
+    return field;
+}
+
+/*
+   SAMPLE n PERCENT | SAMPLE k ROWS [REPEATABLE seed].  Picks the documents
+   to read before any of them is opened.
+   */
+bool Parsing::Parser::sample(Parsing::Query &q) {
+    std::string token(Parsing::Parser::sc.nextToken());
+    if (!icompare(token,"sample")) {
+        Parsing::Parser::sc.push_back(token);
+        return true;
+    }
+    double amount = Parsing::Parser::sc.nextDouble();
+    std::string unit(Parsing::Parser::sc.nextToken());
+    if (icompare(unit,"percent")) {
+        if (!(amount > 0 && amount <= 100)) {
+            std::cout << "PARSING ERROR: SAMPLE takes a percentage above 0 and up to 100." << std::endl;
+            return false;
+        }
+        q.sample.percent = amount;
+    } else if (icompare(unit,"rows")) {
+        if (!(amount >= 0 && amount <= INT32_MAX) || amount != (int)amount) {
+            std::cout << "PARSING ERROR: SAMPLE takes a whole number of rows." << std::endl;
+            return false;
+        }
+        q.sample.rows = (int)amount;
+    } else {
+        std::cout << "PARSING ERROR: Expected PERCENT or ROWS, found '" << unit << "'." << std::endl;
+        return false;
+    }
+
+    std::string repeatable(Parsing::Parser::sc.nextToken());
+    if (!icompare(repeatable,"repeatable")) {
+        Parsing::Parser::sc.push_back(repeatable);
+        return true;
+    }
+    std::string seed(Parsing::Parser::sc.nextToken());
+    char *end;
+    q.sample.seed = strtoull(seed.c_str(), &end, 10);
+    if (seed.empty() || *end) {
+        std::cout << "PARSING ERROR: Expected a seed after REPEATABLE, found '" << seed << "'." << std::endl;
+        return false;
+    }
+    q.sample.repeatable = true;
+    return true;
+}
+
+/*
+   GROUP BY field [, field].  Only the grouped fields can be selected
+   next to the aggregates.
+   */
+bool Parsing::Parser::groupBy(Parsing::Query &q) {
+    std::string group(Parsing::Parser::sc.nextToken());
+    if (!icompare(group,"group")) {
+        Parsing::Parser::sc.push_back(group);
+        return true;
+    }
+    std::string by(Parsing::Parser::sc.nextToken());
+    if (!icompare(by,"by")) {
+        std::cout << "PARSING ERROR: Expected 'by', found '" << by << "'." << std::endl;
+        return false;
+    }
+
+    bool done = false;
+    while (!done) {
+        std::string field(fieldName());
+        if (field.empty()) {
+            std::cout << "PARSING ERROR: Expected a field to group by." << std::endl;
+            return false;
+        }
+        q.groupBy.push_back(field);
+        char next = Parsing::Parser::sc.nextChar();
+        if (next != ',') {
+            Parsing::Parser::sc.push_back(1);
+            done = true;
+        }
+    }
+
+    for (auto it = q.fields->Begin(); it != q.fields->End(); ++it) {
+        if (it->IsString() && std::find(q.groupBy.begin(), q.groupBy.end(), it->GetString()) == q.groupBy.end()) {
+            std::cout << "PARSING ERROR: '" << it->GetString() << "' is neither grouped by nor aggregated." << std::endl;
+            return false;
+        }
+    }
+    return true;
+}
+
+/*
+   ORDER BY key [ASC|DESC] [, key [ASC|DESC]].  A grouped select orders
+   its groups, by grouped fields or selected aggregates.
+   */
+bool Parsing::Parser::orderBy(Parsing::Query &q) {
+    std::string order(Parsing::Parser::sc.nextToken());
+    if (!icompare(order,"order")) {
+        Parsing::Parser::sc.push_back(order);
+        return true;
+    }
+    std::string by(Parsing::Parser::sc.nextToken());
+    if (!icompare(by,"by")) {
+        std::cout << "PARSING ERROR: Expected 'by', found '" << by << "'." << std::endl;
+        return false;
+    }
+
+    bool done = false;
+    while (!done) {
+        std::string key;
+        bool aggregated = aggregatePending();
+        if (aggregated) {
+            rapidjson::Document agg;
+            agg.SetArray();
+            if (!aggregate(&agg)) {
+                return false;
+            }
+            key = aggregateName(agg[0]);
+        } else {
+            key = fieldName();
+            if (key.empty()) {
+                std::cout << "PARSING ERROR: Expected a field to order by." << std::endl;
+                return false;
+            }
+        }
+
+        bool known = !aggregated;
+        if (!q.groupBy.empty()) {
+            known = std::find(q.groupBy.begin(), q.groupBy.end(), key) != q.groupBy.end();
+            for (auto it = q.fields->Begin(); it != q.fields->End(); ++it) {
+                if (it->IsObject() && key == aggregateName(*it)) {
+                    known = true;
+                }
+            }
+        }
+        if (!known) {
+            std::cout << "PARSING ERROR: Cannot order by '" << key << "', it is neither grouped by nor a selected aggregate." << std::endl;
+            return false;
+        }
+
+        std::string direction(Parsing::Parser::sc.nextToken());
+        bool descending = icompare(direction,"desc");
+        if (!descending && !icompare(direction,"asc")) {
+            Parsing::Parser::sc.push_back(direction);
+        }
+        q.orderBy.push_back(std::make_pair(key, descending));
+
+        char next = Parsing::Parser::sc.nextChar();
+        if (next != ',') {
+            Parsing::Parser::sc.push_back(1);
+            done = true;
+        }
     }
     return true;
 }
@@ -279,7 +700,7 @@ rapidjson::Document *Parsing::Parser::fieldList() {
                 return NULL;
             }
         } else {
-            std::string field(Parsing::Parser::sc.nextToken());
+            std::string field(fieldName());
             rapidjson::Value fieldVal;
             fieldVal.SetString(field.c_str(), keys->GetAllocator());
             keys->PushBack(fieldVal, keys->GetAllocator());
@@ -301,13 +722,6 @@ bool Parsing::Parser::aggregate(rapidjson::Document *doc) {
         return false;
     }
 
-    std::string field(Parsing::Parser::sc.nextToken());
-    c = Parsing::Parser::sc.nextChar();
-    if (c != ')') {
-        std::cout << "PARSING ERROR: Expected closed parenthesis, found '" << c << "'." << std::endl;
-        return false;
-    }
-
     std::string aggregate;
 
     int numAggregates = sizeof(Aggregates) / sizeof(std::string);
@@ -317,6 +731,27 @@ bool Parsing::Parser::aggregate(rapidjson::Document *doc) {
         }
     }
 
+    std::string field(fieldName());
+    c = Parsing::Parser::sc.nextChar();
+
+    // PERCENTILE(field, p) takes the fraction of the values below the result.
+    double p = 0;
+    bool percentile = aggregate == Aggregates[PERCENTILE];
+    if (percentile) {
+        if (c == ',') {
+            p = Parsing::Parser::sc.nextDouble();
+            c = Parsing::Parser::sc.nextChar();
+        }
+        if (!(p > 0 && p < 1)) {
+            std::cout << "PARSING ERROR: PERCENTILE takes a field and a fraction between 0 and 1." << std::endl;
+            return false;
+        }
+    }
+    if (c != ')') {
+        std::cout << "PARSING ERROR: Expected closed parenthesis, found '" << c << "'." << std::endl;
+        return false;
+    }
+
     rapidjson::Value obj;
     obj.SetObject();
 
@@ -328,6 +763,9 @@ bool Parsing::Parser::aggregate(rapidjson::Document *doc) {
 
     obj.AddMember("function", functVal, doc->GetAllocator());
     obj.AddMember("field", fieldVal, doc->GetAllocator());
+    if (percentile) {
+        obj.AddMember("p", p, doc->GetAllocator());
+    }
 
     doc->PushBack(obj, doc->GetAllocator());
     return true;
@@ -2,9 +2,13 @@
 #define _PARSER_H_
 
 #include <string>
+#include <sstream>
 #include <iostream>
 #include <pretty.h>
 #include <algorithm>
+#include <vector>
+#include <utility>
+#include <cstdint>
 #include "Scanner.h"
 
 inline void toLower(std::string &s) {
@@ -12,18 +16,24 @@ inline void toLower(std::string &s) {
 }
 
 namespace Parsing {
-	const std::string Aggregates[] = {"AVG", "MIN", "MAX", "SUM" /*, TODO: Others. */};
-	const std::string Commands[] = {"CREATE", "INSERT", "SELECT", "DELETE", "UPDATE", "SHOW" /*, TODO: Others. */};
-	const std::string CreateArgs[] = {"INDEX ON"};
+	// In the order of the Aggregate enum.
+	const std::string Aggregates[] = {"AVG", "MIN", "MAX", "SUM", "COUNT", "STDDEV", "VARIANCE", "APPROX_COUNT_DISTINCT", "PERCENTILE",
+		"MEDIAN"};
+	const std::string Commands[] = {"CREATE", "INSERT", "SELECT", "DELETE", "UPDATE", "SHOW", "ANALYZE", "LOAD" /*, TODO: Others. */};
+	const std::string CreateArgs[] = {"INDEX ON", "VIEW"};
+	const std::string CreateIndexArgs[] = {"IN"};
+	const std::string CreateViewArgs[] = {"AS SELECT"};
 	const std::string SelectArgs[] = {"FROM"};
 	const std::string InsertArgs[] = {"INTO"};
 	const std::string DeleteArgs[] = {"FROM"};
 	const std::string DeleteFromArgs[] = {"WHERE", "LIMIT"};
 	const std::string InsertIntoArgs[] = {"WITH"};
-	const std::string SelectFromArgs[] = {"WHERE", "GROUP BY", "LIMIT"};
+	const std::string LoadArgs[] = {"INTO"};
+	const std::string LoadIntoArgs[] = {"FROM"};
+	const std::string SelectFromArgs[] = {"JOIN", "SAMPLE", "WHERE", "GROUP BY", "ORDER BY", "LIMIT"};
 	const std::string UpdateArgs[] = {"WITH"};
 	const std::string UpdateWithArgs[] = {"WHERE", "LIMIT"};
-	const std::string ShowArgs[] = {"PROJECTS", "INDEXES"};
+	const std::string ShowArgs[] = {"PROJECTS", "INDEXES", "VIEWS", "CACHE"};
 
 #ifdef DELETE
 #undef DELETE
@@ -35,7 +45,9 @@ namespace Parsing {
 		SELECT = 2,
 		DELETE = 3,
 		UPDATE = 4,
-		SHOW   = 5
+		SHOW   = 5,
+		ANALYZE = 6,
+		LOAD   = 7
 	};
 
 	enum Aggregate {
@@ -43,6 +55,46 @@ namespace Parsing {
 		MIN   = 1,
 		MAX   = 2,
 		SUM   = 3,
+		COUNT = 4,
+		STDDEV = 5,
+		VARIANCE = 6,
+		APPROX_COUNT_DISTINCT = 7,
+		PERCENTILE = 8,
+		MEDIAN = 9
+	};
+
+	// Column name of an aggregate of a field list, "FUNC(field)" or "PERCENTILE(field, p)".
+	inline std::string aggregateName(const rapidjson::Value &agg) {
+		std::string name = std::string(agg["function"].GetString()) + "(" + agg["field"].GetString();
+		if (agg.HasMember("p")) {
+			std::ostringstream p;
+			p << agg["p"].GetDouble();
+			name += ", " + p.str();
+		}
+		return name + ")";
+	}
+
+	// SAMPLE n PERCENT keeps every document with probability n / 100, SAMPLE k ROWS exactly k
+	// documents.  REPEATABLE s fixes the seed, so the same documents are drawn every time.
+	struct Sample {
+		double percent;
+		int rows;
+		bool repeatable;
+		uint64_t seed;
+		Sample(): percent(-1), rows(-1), repeatable(false), seed(0) {}
+		bool active() const { return percent >= 0 || rows >= 0; }
+	};
+
+	// FROM project [alias] JOIN other [alias] ON alias.field = alias.field.  A joined row holds
+	// the members of both documents, each named "alias.member"; an alias defaults to the name
+	// of its project.  The where clause puts each side's conditions under its alias.
+	struct Join {
+		std::string alias;          // of the FROM project
+		std::string project;        // the joined project, empty without a join
+		std::string joinedAlias;
+		std::string key;            // join field of the FROM project's documents
+		std::string joinedKey;      // and of the joined project's
+		bool active() const { return !project.empty(); }
 	};
 
 	struct Query {
@@ -51,8 +103,16 @@ namespace Parsing {
 		rapidjson::Document *with;
 		rapidjson::Document *where;
 		rapidjson::Document *fields;
+		std::vector<std::string> groupBy;
+		std::vector<std::pair<std::string, bool>> orderBy;    // key, descending
+		Sample sample;
+		Join join;
+		std::string view;         // CREATE VIEW view AS SELECT ...
+		std::string source;       // LOAD INTO project FROM 'source'
 		int limit;
-		Query(): project(NULL), with(NULL), where(NULL), fields(NULL), limit(-1) {}
+		bool explain;
+		bool analyze;             // EXPLAIN ANALYZE: UPDATE and DELETE are run too
+		Query(): project(NULL), with(NULL), where(NULL), fields(NULL), limit(-1), explain(false), analyze(false) {}
 		~Query() {
 			if (project) delete project;
 			if (with) delete with;
@@ -61,6 +121,12 @@ namespace Parsing {
 		}
 		void print() {
 			std::cout << "Command: " << Commands[command] << std::endl;
+			if (!view.empty()) {
+				std::cout << "View: " << view << std::endl;
+			}
+			if (!source.empty()) {
+				std::cout << "Source: " << source << std::endl;
+			}
 			if (project) {
 				std::cout << "Project: " << *project << std::endl;
 			}
@@ -70,12 +136,45 @@ namespace Parsing {
 			if (with) {
 				std::cout << "With:" << std::endl <<  toPrettyString(with) << std::endl;
 			}
+			if (join.active()) {
+				std::cout << "Join: " << join.project << " as " << join.joinedAlias << " on " << join.alias << "." << join.key
+					<< " = " << join.joinedAlias << "." << join.joinedKey << std::endl;
+			}
+			if (sample.active()) {
+				std::cout << "Sample: ";
+				if (sample.rows >= 0) {
+					std::cout << sample.rows << " rows";
+				} else {
+					std::cout << sample.percent << " percent";
+				}
+				if (sample.repeatable) {
+					std::cout << " repeatable " << sample.seed;
+				}
+				std::cout << std::endl;
+			}
 			if (where) {
 				std::cout << "Where: " << std::endl << toPrettyString(where) << std::endl;
 			}
+			if (!groupBy.empty()) {
+				std::cout << "Group by:";
+				for (auto it = groupBy.begin(); it != groupBy.end(); ++it) {
+					std::cout << ' ' << *it;
+				}
+				std::cout << std::endl;
+			}
+			if (!orderBy.empty()) {
+				std::cout << "Order by:";
+				for (auto it = orderBy.begin(); it != orderBy.end(); ++it) {
+					std::cout << (it == orderBy.begin() ? " " : ", ") << it->first << (it->second ? " DESC" : "");
+				}
+				std::cout << std::endl;
+			}
 			if (limit > -1) {
 				std::cout << "Limit: " << limit << std::endl;
 			}
+			if (explain) {
+				std::cout << "Explain: " << (analyze ? "analyze" : "true") << std::endl;
+			}
 		}
 	};
 
@@ -90,10 +189,19 @@ namespace Parsing {
 		bool select(Query &);
 		bool ddelete(Query &);
 		bool create(Query &);
+		bool view(Query &);
 		bool show(Query &q);
+		bool analyze(Query &q);
+		bool load(Query &q);
 		bool aggregatePending();
 		bool aggregate(rapidjson::Document *);
 		bool limitPending();
+		bool join(Query &);
+		bool qualifiedField(std::string &alias, std::string &field);
+		std::string fieldName();
+		bool sample(Query &);
+		bool groupBy(Query &);
+		bool orderBy(Query &);
 		rapidjson::Document *fieldList();
 	};
 }
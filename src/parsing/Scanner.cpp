@@ -5,6 +5,7 @@
 #include "Scanner.h"
 
 #include <cstdlib>
+#include <cmath>
 
 #define append(BUF,POS,VAL) {           \
     if(POS==len) {                      \
@@ -105,25 +106,26 @@ namespace Parsing {
 		//return std::string( buffer , buf_pos );;
 	}
 
+	// In double or single quotes, ended by the same kind.
 	//std::string Scanner::nextString() {
 	const char* Scanner::nextString() {
 		SKIPWHITESPACE();
 		int pos = spot;
         int buf_pos = 0;
 		spot++;
-		char t = query.at(pos);
-		if (t != '\"') {
-			throw std::runtime_error("SCAN ERROR: Expected double quote.");
+		char quote = query.at(pos);
+		if (quote != '\"' && quote != '\'') {
+			throw std::runtime_error("SCAN ERROR: Expected quote.");
 		}
 		while (spot < query.size()) {
 			pos = spot;
 			spot++;
 			char t = query.at(pos);
-			if (t == '\"') {
+			if (t == quote) {
 				break;
 			}
 			if (spot == query.size()) {
-				throw std::runtime_error("SCAN ERROR: Expected double quote.");
+				throw std::runtime_error("SCAN ERROR: Expected quote.");
 			}
 
             append(buffer,buf_pos,t);
@@ -138,6 +140,19 @@ namespace Parsing {
 		return atoi(token.c_str());
 	}
 
+	// Tokens end at '.', so the fraction is picked up on its own.
+	double Scanner::nextDouble() {
+		std::string token(nextToken());
+		if (spot < query.size() && query.at(spot) == '.') {
+			++spot;
+			token += '.';
+			token += nextToken();
+		}
+		char *end;
+		double d = strtod(token.c_str(), &end);
+		return token.empty() || *end ? NAN : d;
+	}
+
 	void Scanner::skipWhiteSpace() {
 		char t;
 		while (spot < query.size()) {
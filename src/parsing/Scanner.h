@@ -26,6 +26,8 @@ namespace Parsing {
 		const char* nextString();
 		const char* nextJSON();
 		int nextInt();
+		// NaN if the next token is not a number.
+		double nextDouble();
 		void push_back(std::string);
 		void push_back(size_t);
 
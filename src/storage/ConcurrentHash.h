@@ -0,0 +1,230 @@
+#ifndef CONCURRENTHASH_H_
+#define CONCURRENTHASH_H_
+
+#include <algorithm>
+#include <cstdint>
+#include <functional>
+#include <string>
+#include <vector>
+
+#include "FlatHash.h"
+#include "RWLock.h"
+
+/*
+ *      ConcurrentHash ---
+ *
+ *      Hash map that many threads can use at once.  Keys are spread over Shards FlatHashes by
+ *      the high bits of their hash, each behind its own RWLock, so lookups only share a lock
+ *      word with the writers of their own shard and never wait on a mutex unless a writer is
+ *      there.
+ *
+ *      Values are never handed out by reference: get copies them, and read and update run a
+ *      function on the value while its shard is locked.  The function must not use the map
+ *      again.  snapshot holds every shard at once for a consistent copy to write out.
+ */
+
+namespace Storage {
+    template <typename KEY, typename VALUE, uint64_t Shards = 64, typename HASH = std::hash<KEY> >
+        class ConcurrentHash {
+            public:
+                typedef FlatHash<KEY, VALUE, HASH> Map;
+
+                ConcurrentHash() {}
+
+                explicit ConcurrentHash( Map &&map ) {
+                    assign( std::move( map ) );
+                }
+
+                bool contains( const KEY &k ) {
+                    Shard &s = shard( k );
+                    SharedGuard g( s.lock );
+                    return s.map.contains( k );
+                }
+
+                size_t count( const KEY &k ) {
+                    return contains( k );
+                }
+
+                // Copy the value of k into value, false if there is none.
+                bool get( const KEY &k , VALUE &value ) {
+                    Shard &s = shard( k );
+                    SharedGuard g( s.lock );
+                    VALUE *found = s.map.find( k );
+                    if( found == NULL ) {
+                        return false;
+                    }
+                    value = *found;
+                    return true;
+                }
+
+                void put( const KEY &k , const VALUE &value ) {
+                    Shard &s = shard( k );
+                    ExclusiveGuard g( s.lock );
+                    s.map.put( k , value );
+                }
+
+                // The value of k, or make() put there if there is none yet.
+                template <class F>
+                    VALUE getOrPut( const KEY &k , F make ) {
+                        VALUE value;
+                        if( get( k , value ) ) {
+                            return value;
+                        }
+                        Shard &s = shard( k );
+                        ExclusiveGuard g( s.lock );
+                        VALUE *found = s.map.find( k );
+                        if( found != NULL ) {
+                            return *found;
+                        }
+                        value = make();
+                        s.map.put( k , value );
+                        return value;
+                    }
+
+                bool erase( const KEY &k ) {
+                    Shard &s = shard( k );
+                    ExclusiveGuard g( s.lock );
+                    return s.map.erase( k );
+                }
+
+                // f( value ) with k's shard locked shared.  False, without calling f, if k is missing.
+                template <class F>
+                    bool read( const KEY &k , F f ) {
+                        Shard &s = shard( k );
+                        SharedGuard g( s.lock );
+                        VALUE *found = s.map.find( k );
+                        if( found == NULL ) {
+                            return false;
+                        }
+                        f( *found );
+                        return true;
+                    }
+
+                // f( a , b ) for the values of two keys, their shards locked shared in order.
+                template <class F>
+                    bool read( const KEY &a , const KEY &b , F f ) {
+                        uint64_t i = index( a ) , j = index( b );
+                        SharedGuard first( shards[std::min( i , j )].lock );
+                        if( i == j ) {
+                            return both( shards[i].map , shards[j].map , a , b , f );
+                        }
+                        SharedGuard second( shards[std::max( i , j )].lock );
+                        return both( shards[i].map , shards[j].map , a , b , f );
+                    }
+
+                // f( value ) with k's shard locked exclusively.  False, without calling f, if k is missing.
+                template <class F>
+                    bool update( const KEY &k , F f ) {
+                        Shard &s = shard( k );
+                        ExclusiveGuard g( s.lock );
+                        VALUE *found = s.map.find( k );
+                        if( found == NULL ) {
+                            return false;
+                        }
+                        f( *found );
+                        return true;
+                    }
+
+                // Like update, but k is added with a default value first if it is missing.
+                template <class F>
+                    void upsert( const KEY &k , F f ) {
+                        Shard &s = shard( k );
+                        ExclusiveGuard g( s.lock );
+                        f( s.map[k] );
+                    }
+
+                size_t size() {
+                    size_t n = 0;
+                    for( uint64_t i = 0 ; i < Shards ; ++i ) {
+                        SharedGuard g( shards[i].lock );
+                        n += shards[i].map.size();
+                    }
+                    return n;
+                }
+
+                std::vector<KEY> keys() {
+                    std::vector<KEY> result;
+                    for( uint64_t i = 0 ; i < Shards ; ++i ) {
+                        SharedGuard g( shards[i].lock );
+                        for( auto it = shards[i].map.begin() ; it != shards[i].map.end() ; ++it ) {
+                            result.push_back( it->first );
+                        }
+                    }
+                    return result;
+                }
+
+                // A copy of all entries as they were at one moment.
+                Map snapshot() {
+                    for( uint64_t i = 0 ; i < Shards ; ++i ) {
+                        shards[i].lock.lockShared();
+                    }
+                    Map copy;
+                    uint64_t n = 0;
+                    for( uint64_t i = 0 ; i < Shards ; ++i ) {
+                        n += shards[i].map.size();
+                    }
+                    copy.reserve( n );
+                    for( uint64_t i = 0 ; i < Shards ; ++i ) {
+                        for( auto it = shards[i].map.begin() ; it != shards[i].map.end() ; ++it ) {
+                            copy.put( it->first , it->second );
+                        }
+                    }
+                    for( uint64_t i = Shards ; i-- > 0 ; ) {
+                        shards[i].lock.unlockShared();
+                    }
+                    return copy;
+                }
+
+                // Replace the contents with the entries of map.
+                void assign( Map &&map ) {
+                    Map parts[Shards];
+                    for( auto it = map.begin() ; it != map.end() ; ++it ) {
+                        parts[index( it->first )].put( it->first , it->second );
+                    }
+                    map.clear();
+                    for( uint64_t i = 0 ; i < Shards ; ++i ) {
+                        ExclusiveGuard g( shards[i].lock );
+                        shards[i].map.swap( parts[i] );
+                    }
+                }
+
+                void clear() {
+                    for( uint64_t i = 0 ; i < Shards ; ++i ) {
+                        ExclusiveGuard g( shards[i].lock );
+                        shards[i].map.clear();
+                    }
+                }
+
+            private:
+                struct Shard {
+                    RWLock lock;
+                    Map map;
+                };
+
+                Shard shards[Shards];
+                HASH hasher;
+
+                uint64_t index( const KEY &k ) const {
+                    return ((uint64_t( hasher( k ) ) * 0x9e3779b97f4a7c15ULL) >> 32) % Shards;
+                }
+
+                Shard& shard( const KEY &k ) {
+                    return shards[index( k )];
+                }
+
+                template <class F>
+                    static bool both( Map &first , Map &second , const KEY &a , const KEY &b , F f ) {
+                        VALUE *x = first.find( a ) , *y = second.find( b );
+                        if( x == NULL || y == NULL ) {
+                            return false;
+                        }
+                        f( *x , *y );
+                        return true;
+                    }
+
+                ConcurrentHash( const ConcurrentHash& );
+                ConcurrentHash& operator=( const ConcurrentHash& );
+        };
+};
+
+#endif
@@ -0,0 +1,533 @@
+#ifndef DOCSET_H_
+#define DOCSET_H_
+
+#include <cstdint>
+#include <cstdlib>
+#include <vector>
+#include <string>
+#include <iterator>
+#include <algorithm>
+
+#include "../utils/Util.h"
+
+/*
+ *      DocSet ---
+ *
+ *      Sorted set of 64 bit document ids, roaring bitmap style.  Ids are split into chunks by
+ *      their high 48 bits.  A chunk holds the low 16 bits of its ids as a sorted array of
+ *      uint16 while it has at most ArrayMax of them, and as a 65536 bit bitmap (8KB) once it
+ *      has more, so a dense project costs about one bit per document and a sparse one two
+ *      bytes.  A bitmap only turns back into an array below ArrayMax / 2 ids, so a chunk near
+ *      the limit is not rebuilt by every insert and delete.  Ids are handed out in increasing order, so appending goes to the last chunk
+ *      without a search.
+ *
+ *      Iteration is in id order, which is also insertion order.  Iterators stay valid until
+ *      the set is changed.
+ *
+ *      On disk a set is a format byte, the number of ids and the gaps between consecutive
+ *      ids, all as varints: about one byte per id for ids that were inserted together.
+ *
+ *      With a Journal attached the set notes the ids it gains and loses, so a copy on disk can
+ *      be brought up to date without writing the whole set again.  Copies of a set do not
+ *      share its journal.
+ */
+
+namespace Storage {
+    class DocSet {
+            struct Chunk {
+                uint64_t high;
+                uint32_t cardinality;
+                std::vector<uint16_t> array;    // sorted, until cardinality passes ArrayMax
+                std::vector<uint64_t> bits;     // BitmapWords words otherwise
+
+                explicit Chunk( uint64_t high_ ) : high( high_ ) , cardinality( 0 ) {}
+
+                bool isBitmap() const {
+                    return !bits.empty();
+                }
+
+                bool has( uint16_t low ) const {
+                    if( isBitmap() ) {
+                        return (bits[low >> 6] >> (low & 63)) & 1;
+                    }
+                    return std::binary_search( array.begin() , array.end() , low );
+                }
+
+                bool add( uint16_t low ) {
+                    if( isBitmap() ) {
+                        uint64_t bit = uint64_t(1) << (low & 63);
+                        if( bits[low >> 6] & bit ) {
+                            return false;
+                        }
+                        bits[low >> 6] |= bit;
+                    } else if( array.empty() || array.back() < low ) {
+                        array.push_back( low );
+                    } else {
+                        auto it = std::lower_bound( array.begin() , array.end() , low );
+                        if( *it == low ) {
+                            return false;
+                        }
+                        array.insert( it , low );
+                    }
+                    if( ++cardinality > ArrayMax && !isBitmap() ) {
+                        toBitmap();
+                    }
+                    return true;
+                }
+
+                bool remove( uint16_t low ) {
+                    if( isBitmap() ) {
+                        uint64_t bit = uint64_t(1) << (low & 63);
+                        if( !(bits[low >> 6] & bit) ) {
+                            return false;
+                        }
+                        bits[low >> 6] &= ~bit;
+                        if( --cardinality < ArrayMax / 2 ) {
+                            toArray();
+                        }
+                        return true;
+                    }
+                    auto it = std::lower_bound( array.begin() , array.end() , low );
+                    if( it == array.end() || *it != low ) {
+                        return false;
+                    }
+                    array.erase( it );
+                    --cardinality;
+                    return true;
+                }
+
+                // Position of the first id at or after 'from' (an array index, or a low value for
+                // bitmaps), or End.
+                uint32_t next( uint32_t from ) const {
+                    if( !isBitmap() ) {
+                        return from < array.size() ? from : End;
+                    }
+                    if( from >= 65536 ) {
+                        return End;
+                    }
+                    uint32_t w = from >> 6;
+                    uint64_t word = bits[w] & (~uint64_t(0) << (from & 63));
+                    while( word == 0 ) {
+                        if( ++w == BitmapWords ) {
+                            return End;
+                        }
+                        word = bits[w];
+                    }
+                    return (w << 6) + __builtin_ctzll( word );
+                }
+
+                uint64_t at( uint32_t pos ) const {
+                    return (high << 16) | (isBitmap() ? pos : array[pos]);
+                }
+
+                void toBitmap() {
+                    bits.assign( BitmapWords , 0 );
+                    for( auto it = array.begin() ; it != array.end() ; ++it ) {
+                        bits[*it >> 6] |= uint64_t(1) << (*it & 63);
+                    }
+                    std::vector<uint16_t>().swap( array );
+                }
+
+                void toArray() {
+                    array.reserve( cardinality );
+                    for( uint32_t w = 0 ; w < BitmapWords ; ++w ) {
+                        for( uint64_t word = bits[w] ; word ; word &= word - 1 ) {
+                            array.push_back( uint16_t( (w << 6) + __builtin_ctzll( word ) ) );
+                        }
+                    }
+                    std::vector<uint64_t>().swap( bits );
+                }
+            };
+
+        public:
+            static const uint32_t ArrayMax = 4096;
+            static const uint32_t BitmapWords = 65536 / 64;
+            static const uint32_t End = 0xffffffff;
+            static const char Format = 'R';
+
+            class iterator : public std::iterator<std::forward_iterator_tag, uint64_t> {
+                public:
+                    iterator() : set( NULL ) , chunk( 0 ) , pos( 0 ) {}
+                    iterator( const DocSet *set_ , size_t chunk_ ) : set( set_ ) , chunk( chunk_ ) , pos( 0 ) {
+                        settle( 0 );
+                    }
+
+                    uint64_t operator*() const {
+                        return set->chunks[chunk].at( pos );
+                    }
+
+                    iterator& operator++() {
+                        settle( pos + 1 );
+                        return *this;
+                    }
+
+                    iterator operator++(int) {
+                        iterator old( *this );
+                        settle( pos + 1 );
+                        return old;
+                    }
+
+                    bool operator==( const iterator &rhs ) const {
+                        return chunk == rhs.chunk && pos == rhs.pos;
+                    }
+
+                    bool operator!=( const iterator &rhs ) const {
+                        return !(operator==( rhs ));
+                    }
+
+                private:
+                    const DocSet *set;
+                    size_t chunk;
+                    uint32_t pos;
+
+                    // Move to the first id at or after 'from' in this chunk, or on to the next ones.
+                    void settle( uint32_t from ) {
+                        while( chunk < set->chunks.size() ) {
+                            pos = set->chunks[chunk].next( from );
+                            if( pos != End ) {
+                                return;
+                            }
+                            ++chunk;
+                            from = 0;
+                        }
+                        pos = 0;
+                    }
+            };
+            typedef iterator const_iterator;
+
+            struct Journal;
+
+            DocSet() : count( 0 ) , journal( NULL ) {}
+
+            DocSet( const DocSet &other ) : chunks( other.chunks ) , count( other.count ) , journal( NULL ) {}
+
+            DocSet( DocSet &&other ) : chunks( std::move( other.chunks ) ) , count( other.count ) , journal( NULL ) {
+                other.count = 0;
+            }
+
+            DocSet& operator=( const DocSet &other ) {
+                chunks = other.chunks;
+                count = other.count;
+                rewritten();
+                return *this;
+            }
+
+            DocSet& operator=( DocSet &&other ) {
+                chunks = std::move( other.chunks );
+                count = other.count;
+                other.count = 0;
+                rewritten();
+                return *this;
+            }
+
+            // Note changes in j from now on, none if it is NULL.
+            void attach( Journal *j ) {
+                journal = j;
+            }
+
+            bool insert( uint64_t id ) {
+                uint64_t high = id >> 16;
+                Chunk *c;
+                if( chunks.empty() || chunks.back().high < high ) {
+                    chunks.push_back( Chunk( high ) );
+                    c = &chunks.back();
+                } else if( chunks.back().high == high ) {
+                    c = &chunks.back();
+                } else {
+                    auto it = find( high );
+                    if( it == chunks.end() || it->high != high ) {
+                        it = chunks.insert( it , Chunk( high ) );
+                    }
+                    c = &*it;
+                }
+                if( !c->add( uint16_t( id ) ) ) {
+                    return false;
+                }
+                ++count;
+                if( journal != NULL ) {
+                    added( id );
+                }
+                return true;
+            }
+
+            void push_back( uint64_t id ) {
+                insert( id );
+            }
+
+            bool erase( uint64_t id ) {
+                auto it = find( id >> 16 );
+                if( it == chunks.end() || it->high != (id >> 16) || !it->remove( uint16_t( id ) ) ) {
+                    return false;
+                }
+                if( it->cardinality == 0 ) {
+                    chunks.erase( it );
+                }
+                --count;
+                if( journal != NULL ) {
+                    removed( id );
+                }
+                return true;
+            }
+
+            bool contains( uint64_t id ) const {
+                auto it = find( id >> 16 );
+                return it != chunks.end() && it->high == (id >> 16) && it->has( uint16_t( id ) );
+            }
+
+            uint64_t size() const {
+                return count;
+            }
+
+            bool empty() const {
+                return count == 0;
+            }
+
+            void clear() {
+                chunks.clear();
+                count = 0;
+                rewritten();
+            }
+
+            // Keep the first n ids.
+            void truncate( uint64_t n ) {
+                if( n >= count ) {
+                    return;
+                }
+                DocSet kept;
+                for( iterator it = begin() ; kept.size() < n ; ++it ) {
+                    kept.push_back( *it );
+                }
+                swap( kept );
+            }
+
+            void merge( const DocSet &other ) {
+                for( iterator it = other.begin() ; it != other.end() ; ++it ) {
+                    insert( *it );
+                }
+            }
+
+            // The ids of 'sorted', which is in increasing order, that are in the set.
+            void intersect( const std::vector<uint64_t> &sorted , DocSet &out ) const {
+                size_t c = 0;
+                for( auto it = sorted.begin() ; it != sorted.end() ; ++it ) {
+                    uint64_t high = *it >> 16;
+                    while( c < chunks.size() && chunks[c].high < high ) {
+                        ++c;
+                    }
+                    if( c == chunks.size() ) {
+                        break;
+                    }
+                    if( chunks[c].high == high && chunks[c].has( uint16_t( *it ) ) ) {
+                        out.push_back( *it );
+                    }
+                }
+            }
+
+            void swap( DocSet &other ) {
+                chunks.swap( other.chunks );
+                std::swap( count , other.count );
+                rewritten();
+                other.rewritten();
+            }
+
+            // Bytes of memory the set takes.
+            uint64_t memory() const {
+                uint64_t bytes = sizeof( DocSet ) + chunks.capacity() * sizeof( Chunk );
+                for( auto it = chunks.begin() ; it != chunks.end() ; ++it ) {
+                    bytes += it->array.capacity() * sizeof( uint16_t ) + it->bits.capacity() * sizeof( uint64_t );
+                }
+                return bytes;
+            }
+
+            iterator begin() const {
+                return iterator( this , 0 );
+            }
+
+            iterator end() const {
+                return iterator( this , chunks.size() );
+            }
+
+            bool operator==( const DocSet &rhs ) const {
+                if( count != rhs.count ) {
+                    return false;
+                }
+                for( iterator a = begin() , b = rhs.begin() ; a != end() ; ++a , ++b ) {
+                    if( *a != *b ) {
+                        return false;
+                    }
+                }
+                return true;
+            }
+
+            bool operator!=( const DocSet &rhs ) const {
+                return !(operator==( rhs ));
+            }
+
+            // Encoded size, see Write.
+            uint64_t Size() const {
+                uint64_t size = 1 + VarintSize( count );
+                uint64_t last = 0;
+                for( iterator it = begin() ; it != end() ; ++it ) {
+                    size += VarintSize( *it - last );
+                    last = *it;
+                }
+                return size;
+            }
+
+            void Write( char *buffer , uint64_t &pos ) const {
+                buffer[pos++] = Format;
+                WriteVarint( buffer , pos , count );
+                uint64_t last = 0;
+                for( iterator it = begin() ; it != end() ; ++it ) {
+                    WriteVarint( buffer , pos , *it - last );
+                    last = *it;
+                }
+            }
+
+            // Sets written before the format byte are lists of decimal id strings, each after
+            // its 8 byte length.  Entries that are not numbers are skipped.
+            static DocSet Read( const char *buffer , uint64_t len ) {
+                DocSet set;
+                uint64_t pos = 0;
+                if( len > 0 && buffer[0] == Format ) {
+                    ++pos;
+                    uint64_t n = ReadVarint( buffer , pos );
+                    uint64_t last = 0;
+                    for( uint64_t i = 0 ; i < n ; ++i ) {
+                        last += ReadVarint( buffer , pos );
+                        set.push_back( last );
+                    }
+                    return set;
+                }
+                while( pos + sizeof(uint64_t) <= len ) {
+                    uint64_t l = Read64( buffer , pos );
+                    std::string id = ReadString( buffer , pos , l );
+                    char *end;
+                    uint64_t value = strtoull( id.c_str() , &end , 10 );
+                    if( !id.empty() && *end == '\0' ) {
+                        set.insert( value );
+                    }
+                }
+                return set;
+            }
+
+        private:
+            std::vector<Chunk> chunks;      // by high
+            uint64_t count;
+            Journal *journal;
+
+            void added( uint64_t id );
+            void removed( uint64_t id );
+            void rewritten();
+
+            std::vector<Chunk>::iterator find( uint64_t high ) {
+                return std::lower_bound( chunks.begin() , chunks.end() , high ,
+                        []( const Chunk &c , uint64_t h ) { return c.high < h; } );
+            }
+
+            std::vector<Chunk>::const_iterator find( uint64_t high ) const {
+                return std::lower_bound( chunks.begin() , chunks.end() , high ,
+                        []( const Chunk &c , uint64_t h ) { return c.high < h; } );
+            }
+    };
+
+    /*
+     *      DocSet::Journal ---
+     *
+     *      What a set gained and lost since the journal was last cleared, netted out: an id
+     *      added and then erased again is in neither.  Changes that are not a matter of single
+     *      ids, like clear or assigning another set, mark it to be written whole instead.
+     */
+
+    struct DocSet::Journal {
+        DocSet gained;
+        DocSet lost;
+        bool whole;
+
+        Journal() : whole( false ) {}
+
+        void add( uint64_t id ) {
+            if( !lost.erase( id ) ) {
+                gained.insert( id );
+            }
+        }
+
+        void remove( uint64_t id ) {
+            if( !gained.erase( id ) ) {
+                lost.insert( id );
+            }
+        }
+
+        // Follow these changes with the ones in 'later'.
+        void merge( const Journal &later ) {
+            if( later.whole ) {
+                whole = true;
+            }
+            for( iterator it = later.lost.begin() ; it != later.lost.end() ; ++it ) {
+                remove( *it );
+            }
+            for( iterator it = later.gained.begin() ; it != later.gained.end() ; ++it ) {
+                add( *it );
+            }
+        }
+
+        // Bring a set that was as it is now up to date.  Does nothing about whole.
+        void apply( DocSet &set ) const {
+            for( iterator it = lost.begin() ; it != lost.end() ; ++it ) {
+                set.erase( *it );
+            }
+            for( iterator it = gained.begin() ; it != gained.end() ; ++it ) {
+                set.insert( *it );
+            }
+        }
+
+        bool empty() const {
+            return !whole && gained.empty() && lost.empty();
+        }
+
+        void clear() {
+            DocSet().swap( gained );
+            DocSet().swap( lost );
+            whole = false;
+        }
+
+        uint64_t memory() const {
+            return gained.memory() + lost.memory();
+        }
+    };
+
+    inline void DocSet::added( uint64_t id ) {
+        journal->add( id );
+    }
+
+    inline void DocSet::removed( uint64_t id ) {
+        journal->remove( id );
+    }
+
+    inline void DocSet::rewritten() {
+        if( journal != NULL ) {
+            journal->whole = true;
+        }
+    }
+};
+
+template <>
+    struct Type<Storage::DocSet> {
+        static uint64_t Size( Storage::DocSet &set ) {
+            return set.Size();
+        }
+        static Storage::DocSet Create( const char *data , uint64_t len ) {
+            return Storage::DocSet::Read( data , len );
+        }
+        static const char* Bytes( Storage::DocSet &set ) {
+            char *buff = new char[set.Size()];
+            uint64_t pos = 0;
+            set.Write( buff , pos );
+            return buff;
+        }
+        static const std::string Name() {
+            return "Storage::DocSet";
+        }
+    };
+
+#endif
@@ -0,0 +1,462 @@
+#ifndef FLATHASH_H_
+#define FLATHASH_H_
+
+#include <iostream>
+#include <cstdint>
+#include <cstring>
+#include <functional>
+#include <iterator>
+#include <new>
+#include <utility>
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+#include "../assert/Assert.h"
+
+/*
+ *      FlatHash ---
+ *
+ *      Open addressing hash map, Swiss table style.  Entries live in one flat array of slots
+ *      next to an array of control bytes, one per slot: empty, deleted, or the low 7 bits of
+ *      the entry's hash.  Slots are probed a group of 16 at a time, the group's control bytes
+ *      compared with the hash in one SSE2 instruction, so a lookup usually touches one group
+ *      of control bytes and one slot.
+ *
+ *      Growing is incremental.  When the table is 7/8 full a table twice as large takes its
+ *      place and the old one is kept aside; every insertion of a new key then moves two
+ *      groups of the old table over, and lookups look in both until it is empty.  No single
+ *      insertion rehashes the whole map.
+ *
+ *      Iteration is in no particular order.  Inserting a new key or erasing one moves entries
+ *      and invalidates iterators and references; looking up or assigning to an existing key
+ *      does not.
+ */
+
+namespace Storage {
+    template <typename KEY, typename VALUE, typename HASH = std::hash<KEY> >
+        class FlatHash {
+            public:
+                typedef std::pair<const KEY, VALUE> value_type;
+
+                static const uint64_t GroupWidth = 16;
+                static const uint64_t MigrateGroups = 2;    // old groups moved per insertion
+
+            private:
+                static const int8_t Empty = -128;
+                static const int8_t Deleted = -2;
+                static const uint64_t None = ~uint64_t(0);
+
+                struct Table {
+                    int8_t *ctrl;
+                    value_type *slots;
+                    uint64_t capacity;      // a power of two, at least GroupWidth
+                    uint64_t size;
+                    uint64_t deleted;
+
+                    Table() : ctrl( NULL ) , slots( NULL ) , capacity( 0 ) , size( 0 ) , deleted( 0 ) {}
+
+                    void allocate( uint64_t capacity_ ) {
+                        capacity = capacity_;
+                        ctrl = new int8_t[capacity];
+                        memset( ctrl , Empty , capacity );
+                        slots = static_cast<value_type*>( ::operator new( capacity * sizeof( value_type ) ) );
+                        size = 0;
+                        deleted = 0;
+                    }
+
+                    void release() {
+                        for( uint64_t i = 0 ; i < capacity ; ++i ) {
+                            if( ctrl[i] >= 0 ) {
+                                slots[i].~value_type();
+                            }
+                        }
+                        delete[] ctrl;
+                        ::operator delete( slots );
+                        *this = Table();
+                    }
+                };
+
+                // Bit i is set for every control byte i of the group that matches.
+                struct Group {
+#if defined(__SSE2__)
+                    __m128i bytes;
+
+                    explicit Group( const int8_t *ctrl ) : bytes( _mm_loadu_si128( reinterpret_cast<const __m128i*>( ctrl ) ) ) {}
+
+                    uint32_t match( int8_t h2 ) const {
+                        return _mm_movemask_epi8( _mm_cmpeq_epi8( _mm_set1_epi8( h2 ) , bytes ) );
+                    }
+
+                    // Empty and deleted bytes are the ones with the sign bit set.
+                    uint32_t matchFree() const {
+                        return _mm_movemask_epi8( bytes );
+                    }
+#else
+                    const int8_t *bytes;
+
+                    explicit Group( const int8_t *ctrl ) : bytes( ctrl ) {}
+
+                    uint32_t match( int8_t h2 ) const {
+                        uint32_t mask = 0;
+                        for( uint32_t i = 0 ; i < GroupWidth ; ++i ) {
+                            mask |= uint32_t( bytes[i] == h2 ) << i;
+                        }
+                        return mask;
+                    }
+
+                    uint32_t matchFree() const {
+                        uint32_t mask = 0;
+                        for( uint32_t i = 0 ; i < GroupWidth ; ++i ) {
+                            mask |= uint32_t( bytes[i] < 0 ) << i;
+                        }
+                        return mask;
+                    }
+#endif
+
+                    uint32_t matchEmpty() const {
+                        return match( Empty );
+                    }
+                };
+
+            public:
+                class HerpIterator : public std::iterator<std::forward_iterator_tag, value_type> {
+                    public:
+                        HerpIterator() : map( NULL ) , table( NULL ) , pos( 0 ) {}
+                        HerpIterator( const FlatHash *map_ , const Table *table_ , uint64_t pos_ ) : map( map_ ) , table( table_ ) , pos( pos_ ) {
+                            settle();
+                        }
+
+                        HerpIterator& operator++() {
+                            ++pos;
+                            settle();
+                            return *this;
+                        }
+
+                        HerpIterator operator++(int) {
+                            HerpIterator old( *this );
+                            operator++();
+                            return old;
+                        }
+
+                        value_type* operator->() const {
+                            return &table->slots[pos];
+                        }
+
+                        value_type* operator*() const {
+                            return &table->slots[pos];
+                        }
+
+                        bool operator==( const HerpIterator &rhs ) const {
+                            return table == rhs.table && pos == rhs.pos;
+                        }
+
+                        bool operator!=( const HerpIterator &rhs ) const {
+                            return !(operator==( rhs ));
+                        }
+
+                        KEY first() const {
+                            return table->slots[pos].first;
+                        }
+
+                        VALUE second() const {
+                            return table->slots[pos].second;
+                        }
+
+                    private:
+                        const FlatHash *map;
+                        const Table *table;     // NULL at the end
+                        uint64_t pos;
+
+                        // Move to the next full slot, from the current table on to the old one.
+                        void settle() {
+                            while( table != NULL ) {
+                                for( ; pos < table->capacity ; ++pos ) {
+                                    if( table->ctrl[pos] >= 0 ) {
+                                        return;
+                                    }
+                                }
+                                table = table == &map->current && map->old.size > 0 ? &map->old : NULL;
+                                pos = 0;
+                            }
+                        }
+                };
+                typedef HerpIterator iterator;
+
+                FlatHash() : migrated( 0 ) {}
+
+                FlatHash( const FlatHash &other ) : migrated( 0 ) {
+                    reserve( other.size() );
+                    for( HerpIterator it = other.begin() ; it != other.end() ; ++it ) {
+                        insertNew( it->first , hash( it->first ) , it->second );
+                    }
+                }
+
+                FlatHash( FlatHash &&other ) : migrated( 0 ) {
+                    swap( other );
+                }
+
+                ~FlatHash() {
+                    current.release();
+                    old.release();
+                }
+
+                FlatHash& operator=( const FlatHash &rhs ) {
+                    if( this != &rhs ) {
+                        FlatHash copy( rhs );
+                        swap( copy );
+                    }
+                    return *this;
+                }
+
+                FlatHash& operator=( FlatHash &&rhs ) {
+                    swap( rhs );
+                    return *this;
+                }
+
+                void swap( FlatHash &other ) {
+                    std::swap( current , other.current );
+                    std::swap( old , other.old );
+                    std::swap( migrated , other.migrated );
+                    std::swap( hasher , other.hasher );
+                }
+
+                VALUE& operator[]( const KEY &k ) {
+                    uint64_t h = hash( k );
+                    value_type *found = lookup( k , h );
+                    if( found != NULL ) {
+                        return found->second;
+                    }
+                    return insertNew( k , h , VALUE() )->second;
+                }
+
+                size_t count( const KEY &k ) const {
+                    return contains( k );
+                }
+
+                bool contains( const KEY &k ) const {
+                    return const_cast<FlatHash*>( this )->lookup( k , hash( k ) ) != NULL;
+                }
+
+                // The value of k, NULL if it is missing.
+                VALUE* find( const KEY &k ) {
+                    value_type *found = lookup( k , hash( k ) );
+                    return found != NULL ? &found->second : NULL;
+                }
+
+                void put( const KEY &k , const VALUE &v ) {
+                    uint64_t h = hash( k );
+                    value_type *found = lookup( k , h );
+                    if( found != NULL ) {
+                        found->second = v;
+                    } else {
+                        insertNew( k , h , v );
+                    }
+                }
+
+                // The value of k, which is added with a default value if it is missing.
+                VALUE get( const KEY &k ) {
+                    return (*this)[k];
+                }
+
+                bool erase( const KEY &k ) {
+                    uint64_t h = hash( k );
+                    uint64_t i = find( current , k , h );
+                    if( i != None ) {
+                        remove( current , i , false );
+                        return true;
+                    }
+                    i = find( old , k , h );
+                    if( i != None ) {
+                        // Migrated slots are tombstones too, probes through the old table go past them.
+                        remove( old , i , true );
+                        return true;
+                    }
+                    return false;
+                }
+
+                size_t size() const {
+                    return current.size + old.size;
+                }
+
+                bool empty() const {
+                    return size() == 0;
+                }
+
+                void clear() {
+                    current.release();
+                    old.release();
+                    migrated = 0;
+                }
+
+                // Make room for n entries without growing.
+                void reserve( uint64_t n ) {
+                    uint64_t capacity = GroupWidth;
+                    while( capacity * 7 / 8 < n ) {
+                        capacity *= 2;
+                    }
+                    if( capacity > current.capacity ) {
+                        finishMigration();
+                        rehash( capacity );
+                        finishMigration();
+                    }
+                }
+
+                // Bytes of memory the map takes, not counting what keys and values point to.
+                uint64_t memory() const {
+                    return sizeof( FlatHash ) + (current.capacity + old.capacity) * (1 + sizeof( value_type ));
+                }
+
+                HerpIterator begin() const {
+                    if( current.size > 0 ) {
+                        return HerpIterator( this , &current , 0 );
+                    }
+                    return HerpIterator( this , old.size > 0 ? &old : NULL , 0 );
+                }
+
+                HerpIterator end() const {
+                    return HerpIterator( this , NULL , 0 );
+                }
+
+            private:
+                Table current;
+                Table old;              // being moved into current while it has entries
+                uint64_t migrated;      // groups of old moved so far
+                HASH hasher;
+
+                // The hash, mixed so the low bits of small integer keys are spread out too.
+                uint64_t hash( const KEY &k ) const {
+                    uint64_t h = hasher( k );
+                    h ^= h >> 33;
+                    h *= 0xff51afd7ed558ccdULL;
+                    h ^= h >> 33;
+                    return h;
+                }
+
+                static int8_t h2( uint64_t h ) {
+                    return int8_t( h & 0x7f );
+                }
+
+                // Groups are visited by triangular numbers, which reaches all of them.
+                static uint64_t find( const Table &t , const KEY &k , uint64_t h ) {
+                    if( t.size == 0 ) {
+                        return None;
+                    }
+                    uint64_t groups = t.capacity / GroupWidth - 1;
+                    uint64_t g = (h >> 7) & groups;
+                    for( uint64_t step = 1 ; ; ++step ) {
+                        Group group( t.ctrl + g * GroupWidth );
+                        for( uint32_t m = group.match( h2( h ) ) ; m != 0 ; m &= m - 1 ) {
+                            uint64_t i = g * GroupWidth + __builtin_ctz( m );
+                            if( t.slots[i].first == k ) {
+                                return i;
+                            }
+                        }
+                        if( group.matchEmpty() != 0 ) {
+                            return None;
+                        }
+                        g = (g + step) & groups;
+                    }
+                }
+
+                value_type* lookup( const KEY &k , uint64_t h ) {
+                    uint64_t i = find( current , k , h );
+                    if( i != None ) {
+                        return &current.slots[i];
+                    }
+                    i = find( old , k , h );
+                    return i != None ? &old.slots[i] : NULL;
+                }
+
+                // The first empty or deleted slot on the probe sequence of h.
+                static uint64_t freeSlot( const Table &t , uint64_t h ) {
+                    uint64_t groups = t.capacity / GroupWidth - 1;
+                    uint64_t g = (h >> 7) & groups;
+                    for( uint64_t step = 1 ; ; ++step ) {
+                        uint32_t m = Group( t.ctrl + g * GroupWidth ).matchFree();
+                        if( m != 0 ) {
+                            return g * GroupWidth + __builtin_ctz( m );
+                        }
+                        g = (g + step) & groups;
+                    }
+                }
+
+                template <class V>
+                    static value_type* place( Table &t , const KEY &k , uint64_t h , V &&v ) {
+                        uint64_t i = freeSlot( t , h );
+                        if( t.ctrl[i] == Deleted ) {
+                            --t.deleted;
+                        }
+                        t.ctrl[i] = h2( h );
+                        ++t.size;
+                        return new ( &t.slots[i] ) value_type( k , std::forward<V>( v ) );
+                    }
+
+                // A slot can go back to empty when its group has an empty slot: no probe went
+                // on past this group, so none passes through the slot.
+                static void remove( Table &t , uint64_t i , bool tombstone ) {
+                    t.slots[i].~value_type();
+                    if( !tombstone && Group( t.ctrl + (i & ~(GroupWidth - 1)) ).matchEmpty() != 0 ) {
+                        t.ctrl[i] = Empty;
+                    } else {
+                        t.ctrl[i] = Deleted;
+                        ++t.deleted;
+                    }
+                    --t.size;
+                }
+
+                template <class V>
+                    value_type* insertNew( const KEY &k , uint64_t h , V &&v ) {
+                        migrate( MigrateGroups );
+                        if( (current.size + current.deleted + 1) * 8 > current.capacity * 7 ) {
+                            finishMigration();
+                            // Mostly tombstones: rebuild at the same size.
+                            uint64_t capacity = current.capacity == 0 ? GroupWidth : current.capacity;
+                            if( (current.size + 1) * 16 > capacity * 7 ) {
+                                capacity *= 2;
+                            }
+                            rehash( capacity );
+                            migrate( MigrateGroups );
+                        }
+                        return place( current , k , h , std::forward<V>( v ) );
+                    }
+
+                // Start moving everything over to a new table of the given capacity.
+                void rehash( uint64_t capacity ) {
+                    Assert( "Migration still running" , old.capacity == 0 );
+                    old = current;
+                    current = Table();
+                    current.allocate( capacity );
+                    migrated = 0;
+                    if( old.size == 0 ) {
+                        old.release();
+                    }
+                }
+
+                void migrate( uint64_t groups ) {
+                    if( old.capacity == 0 ) {
+                        return;
+                    }
+                    uint64_t total = old.capacity / GroupWidth;
+                    for( ; groups > 0 && migrated < total ; --groups , ++migrated ) {
+                        for( uint64_t i = migrated * GroupWidth ; i < (migrated + 1) * GroupWidth ; ++i ) {
+                            if( old.ctrl[i] >= 0 ) {
+                                value_type &entry = old.slots[i];
+                                place( current , entry.first , hash( entry.first ) , std::move( entry.second ) );
+                                remove( old , i , true );
+                            }
+                        }
+                    }
+                    if( migrated == total || old.size == 0 ) {
+                        old.release();
+                        migrated = 0;
+                    }
+                }
+
+                void finishMigration() {
+                    migrate( old.capacity / GroupWidth );
+                }
+        };
+};
+
+#endif
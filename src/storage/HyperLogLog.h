@@ -0,0 +1,101 @@
+#ifndef HYPERLOGLOG_H_
+#define HYPERLOGLOG_H_
+
+#include <cstdint>
+#include <cmath>
+#include <array>
+#include <algorithm>
+
+#include "../utils/Util.h"
+
+/*
+ *      HyperLogLog ---
+ *
+ *      Distinct count estimate in a fixed 2^P bytes of registers.  The standard error is about
+ *      1.04 / sqrt(2^P), 1.6% for the default of 4096 registers.  Two sketches built with the
+ *      same precision merge by taking the register-wise maximum.
+ */
+
+namespace Storage {
+    template <unsigned P = 12>
+        class HyperLogLog {
+            public:
+                static const uint64_t Registers = uint64_t(1) << P;
+
+                HyperLogLog() {
+                    registers.fill( 0 );
+                }
+
+                void add( const char *data , uint64_t len ) {
+                    addHash( Hash64( data , len ) );
+                }
+
+                void addHash( uint64_t h ) {
+                    uint64_t idx = h >> (64 - P);
+                    uint64_t rest = (h << P) | (uint64_t(1) << (P - 1));
+                    uint8_t rank = uint8_t( leadingZeros( rest ) + 1 );
+                    if( rank > registers[idx] ) {
+                        registers[idx] = rank;
+                    }
+                }
+
+                void merge( const HyperLogLog &other ) {
+                    for( uint64_t i = 0 ; i < Registers ; ++i ) {
+                        registers[i] = std::max( registers[i] , other.registers[i] );
+                    }
+                }
+
+                double estimate() const {
+                    double sum = 0;
+                    uint64_t zeros = 0;
+                    for( uint64_t i = 0 ; i < Registers ; ++i ) {
+                        sum += std::ldexp( 1.0 , -int(registers[i]) );
+                        if( registers[i] == 0 ) ++zeros;
+                    }
+                    double m = double(Registers);
+                    double alpha = 0.7213 / (1.0 + 1.079 / m);
+                    double e = alpha * m * m / sum;
+
+                    // Small range correction, linear counting over the empty registers.
+                    if( e <= 2.5 * m && zeros > 0 ) {
+                        e = m * std::log( m / double(zeros) );
+                    }
+                    return e;
+                }
+
+                void clear() {
+                    registers.fill( 0 );
+                }
+
+                static uint64_t Size() {
+                    return Registers;
+                }
+
+                void Write( char *buffer , uint64_t &pos ) const {
+                    WriteRaw( buffer , pos , reinterpret_cast<const char*>( registers.data() ) , Registers );
+                }
+
+                void Read( const char *buffer , uint64_t &pos ) {
+                    std::copy( buffer + pos , buffer + pos + Registers , reinterpret_cast<char*>( registers.data() ) );
+                    pos += Registers;
+                }
+
+            private:
+                std::array<uint8_t,Registers> registers;
+
+                static int leadingZeros( uint64_t v ) {
+#if defined(__GNUC__)
+                    return v ? __builtin_clzll( v ) : 64;
+#else
+                    int n = 0;
+                    while( n < 64 && !(v & (uint64_t(1) << 63)) ) {
+                        v <<= 1;
+                        ++n;
+                    }
+                    return n;
+#endif
+                }
+        };
+}
+
+#endif
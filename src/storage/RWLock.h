@@ -0,0 +1,101 @@
+#ifndef RWLOCK_H_
+#define RWLOCK_H_
+
+#include <atomic>
+#include <cstdint>
+#include <mutex>
+#include <condition_variable>
+
+/*
+ *      RWLock ---
+ *
+ *      Reader-writer lock.  Readers take it with one compare and swap on a counter and never
+ *      touch a mutex unless a writer holds or waits for the lock.  A waiting writer keeps new
+ *      readers out, so writers are not starved by a steady stream of them.  Not reentrant:
+ *      a thread holding it shared must not take it again while a writer may be waiting.
+ */
+
+namespace Storage {
+    class RWLock {
+        public:
+            RWLock() : state( 0 ) {}
+
+            void lockShared() {
+                uint32_t s = state.load( std::memory_order_relaxed );
+                while( true ) {
+                    if( !(s & Writer) ) {
+                        if( state.compare_exchange_weak( s , s + 1 , std::memory_order_acquire , std::memory_order_relaxed ) ) {
+                            return;
+                        }
+                        continue;
+                    }
+                    std::unique_lock<std::mutex> l( wait );
+                    released.wait( l , [this] { return !(state.load() & Writer); } );
+                    s = state.load( std::memory_order_relaxed );
+                }
+            }
+
+            void unlockShared() {
+                // The last reader out lets a waiting writer in.
+                if( state.fetch_sub( 1 , std::memory_order_release ) == (Writer | 1) ) {
+                    std::lock_guard<std::mutex> l( wait );
+                    released.notify_all();
+                }
+            }
+
+            void lock() {
+                writers.lock();
+                state.fetch_or( Writer , std::memory_order_acquire );
+                std::unique_lock<std::mutex> l( wait );
+                released.wait( l , [this] { return state.load() == Writer; } );
+            }
+
+            void unlock() {
+                {
+                    std::lock_guard<std::mutex> l( wait );
+                    state.store( 0 , std::memory_order_release );
+                }
+                released.notify_all();
+                writers.unlock();
+            }
+
+        private:
+            static const uint32_t Writer = uint32_t(1) << 31;
+
+            std::atomic<uint32_t> state;        // readers inside, and Writer
+            std::mutex writers;                 // one writer at a time
+            std::mutex wait;
+            std::condition_variable released;
+
+            RWLock( const RWLock& );
+            RWLock& operator=( const RWLock& );
+    };
+
+    // Holds an RWLock shared for its scope.
+    class SharedGuard {
+        public:
+            explicit SharedGuard( RWLock &lock_ ) : lock( lock_ ) {
+                lock.lockShared();
+            }
+            ~SharedGuard() {
+                lock.unlockShared();
+            }
+        private:
+            RWLock &lock;
+    };
+
+    // Holds an RWLock exclusively for its scope.
+    class ExclusiveGuard {
+        public:
+            explicit ExclusiveGuard( RWLock &lock_ ) : lock( lock_ ) {
+                lock.lock();
+            }
+            ~ExclusiveGuard() {
+                lock.unlock();
+            }
+        private:
+            RWLock &lock;
+    };
+};
+
+#endif
@@ -0,0 +1,153 @@
+#ifndef TDIGEST_H_
+#define TDIGEST_H_
+
+#include <cstdint>
+#include <cmath>
+#include <vector>
+#include <algorithm>
+
+/*
+ *      TDigest ---
+ *
+ *      Quantile estimate in a bounded number of centroids (the merging t-digest of Dunning and
+ *      Ertl).  Values are buffered and merged into the sorted centroids in batches.  A centroid
+ *      only takes in neighbours while it spans at most one unit of k(q) = C / (2 pi) asin(2q - 1),
+ *      so centroids stay small near the tails, where the quantiles need them, and there are
+ *      never more than about C of them (C = 100 by default).  Two digests merge by merging
+ *      their centroids.
+ */
+
+namespace Storage {
+    class TDigest {
+        public:
+            TDigest( double compression_ = 100 ): compression( compression_ ), total( 0 ), buffered( 0 ), min( 0 ), max( 0 ) {}
+
+            void add( double x , double w = 1 ) {
+                if( total + buffered == 0 ) {
+                    min = max = x;
+                }
+                min = std::min( min , x );
+                max = std::max( max , x );
+                buffer.push_back( Centroid( x , w ) );
+                buffered += w;
+                if( buffer.size() >= BufferSize( compression ) ) {
+                    compress();
+                }
+            }
+
+            void merge( const TDigest &other ) {
+                for( auto it = other.centroids.begin() ; it != other.centroids.end() ; ++it ) {
+                    add( it->mean , it->weight );
+                }
+                for( auto it = other.buffer.begin() ; it != other.buffer.end() ; ++it ) {
+                    add( it->mean , it->weight );
+                }
+                if( other.total + other.buffered > 0 ) {
+                    min = std::min( min , other.min );
+                    max = std::max( max , other.max );
+                }
+            }
+
+            // The value below which a fraction q of the values lie.  NaN when empty.
+            double quantile( double q ) const {
+                if( !buffer.empty() ) {
+                    TDigest merged( *this );
+                    merged.compress();
+                    return merged.quantile( q );
+                }
+                if( centroids.empty() ) {
+                    return NAN;
+                }
+                if( q <= 0 ) {
+                    return min;
+                }
+                if( q >= 1 ) {
+                    return max;
+                }
+
+                // Each centroid's mean sits at the middle of its weight; interpolate between
+                // those, and from min and max out at the ends.
+                double index = q * total;
+                const Centroid &first = centroids.front();
+                const Centroid &last = centroids.back();
+                if( index < first.weight / 2 ) {
+                    return min + (first.mean - min) * index / (first.weight / 2);
+                }
+                if( index > total - last.weight / 2 ) {
+                    return max - (max - last.mean) * (total - index) / (last.weight / 2);
+                }
+                double center = first.weight / 2;
+                for( size_t i = 0 ; i + 1 < centroids.size() ; ++i ) {
+                    double next = center + (centroids[i].weight + centroids[i + 1].weight) / 2;
+                    if( index <= next ) {
+                        double t = next > center ? (index - center) / (next - center) : 0;
+                        return centroids[i].mean + (centroids[i + 1].mean - centroids[i].mean) * t;
+                    }
+                    center = next;
+                }
+                return last.mean;
+            }
+
+            // Upper bound of the bytes a digest holds on to.
+            static uint64_t Bytes( double compression = 100 ) {
+                return (uint64_t( compression ) + BufferSize( compression )) * 2 * sizeof( Centroid );
+            }
+
+        private:
+            struct Centroid {
+                double mean;
+                double weight;
+                Centroid( double mean_ , double weight_ ): mean( mean_ ), weight( weight_ ) {}
+                bool operator<( const Centroid &other ) const { return mean < other.mean; }
+            };
+
+            double compression;
+            std::vector<Centroid> centroids;
+            std::vector<Centroid> buffer;
+            double total;
+            double buffered;
+            double min;
+            double max;
+
+            static size_t BufferSize( double compression ) {
+                return size_t( 5 * compression );
+            }
+
+            double scale( double q ) const {
+                return compression / (2 * M_PI) * std::asin( 2 * q - 1 );
+            }
+
+            void compress() {
+                if( buffer.empty() ) {
+                    return;
+                }
+                buffer.insert( buffer.end() , centroids.begin() , centroids.end() );
+                std::sort( buffer.begin() , buffer.end() );
+                double n = total + buffered;
+
+                centroids.clear();
+                Centroid cur = buffer[0];
+                double before = 0;
+                double kBefore = scale( 0 );
+                for( size_t i = 1 ; i < buffer.size() ; ++i ) {
+                    const Centroid &c = buffer[i];
+                    if( scale( (before + cur.weight + c.weight) / n ) - kBefore <= 1 ) {
+                        cur.weight += c.weight;
+                        cur.mean += (c.mean - cur.mean) * c.weight / cur.weight;
+                    } else {
+                        centroids.push_back( cur );
+                        before += cur.weight;
+                        kBefore = scale( before / n );
+                        cur = c;
+                    }
+                }
+                centroids.push_back( cur );
+
+                total = n;
+                buffered = 0;
+                buffer.clear();
+            }
+    };
+}
+
+#endif
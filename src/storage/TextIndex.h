@@ -0,0 +1,280 @@
+#ifndef TEXTINDEX_H_
+#define TEXTINDEX_H_
+
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <vector>
+#include <set>
+#include <unordered_map>
+#include <algorithm>
+#include <limits>
+
+#include "../utils/Util.h"
+
+/*
+ *      TextIndex ---
+ *
+ *      Index over the string values of a single field.  Three structures are kept side by side:
+ *
+ *      values   - (value, doc) pairs sorted by value.  Serves #starts, #eq, #gt and #lt.
+ *      reversed - (reversed value, doc) pairs sorted.  Serves #ends.
+ *      grams    - trigram -> sorted doc ids.  Serves #contains by intersecting the posting lists
+ *                 of every trigram in the needle.
+ *
+ *      Every lookup returns a sorted list of candidate doc ids.  Trigram results are a superset of
+ *      the real matches, so callers still have to verify each candidate against the document.
+ */
+
+namespace Storage {
+    class TextIndex {
+        public:
+            typedef std::vector<uint64_t> IDS;
+            typedef std::pair<std::string,uint64_t> ENTRY;
+
+            static const size_t GRAM = 3;
+
+            void insert( uint64_t id , const char *value , size_t len ) {
+                std::string v( value , len );
+                values.insert( ENTRY( v , id ) );
+                std::reverse( v.begin() , v.end() );
+                reversed.insert( ENTRY( v , id ) );
+
+                std::vector<uint32_t> g;
+                trigrams( value , len , g );
+                for( auto it = g.begin() ; it != g.end() ; ++it ) {
+                    IDS &post = grams[*it];
+                    if( post.empty() || post.back() < id ) {
+                        post.push_back( id );
+                    } else {
+                        auto at = std::lower_bound( post.begin() , post.end() , id );
+                        if( at == post.end() || *at != id ) {
+                            post.insert( at , id );
+                        }
+                    }
+                }
+            }
+
+            void remove( uint64_t id , const char *value , size_t len ) {
+                std::string v( value , len );
+                values.erase( ENTRY( v , id ) );
+                std::reverse( v.begin() , v.end() );
+                reversed.erase( ENTRY( v , id ) );
+
+                std::vector<uint32_t> g;
+                trigrams( value , len , g );
+                for( auto it = g.begin() ; it != g.end() ; ++it ) {
+                    auto f = grams.find( *it );
+                    if( f == grams.end() ) continue;
+                    IDS &post = f->second;
+                    auto at = std::lower_bound( post.begin() , post.end() , id );
+                    if( at != post.end() && *at == id ) {
+                        post.erase( at );
+                    }
+                    if( post.empty() ) {
+                        grams.erase( f );
+                    }
+                }
+            }
+
+            // Returns false when the needle is too short to be answered from the trigrams.
+            bool contains( const char *needle , size_t len , IDS &out ) const {
+                out.clear();
+                if( len < GRAM ) return false;
+
+                std::vector<uint32_t> g;
+                trigrams( needle , len , g );
+
+                // Intersect starting from the rarest trigram so the working set stays small.
+                std::vector<const IDS*> lists;
+                for( auto it = g.begin() ; it != g.end() ; ++it ) {
+                    auto f = grams.find( *it );
+                    if( f == grams.end() ) return true;
+                    lists.push_back( &f->second );
+                }
+                std::sort( lists.begin() , lists.end() , []( const IDS *a , const IDS *b ) {
+                        return a->size() < b->size();
+                        });
+
+                out = *lists[0];
+                for( size_t i = 1 ; i < lists.size() && !out.empty() ; ++i ) {
+                    Intersect( out , *lists[i] );
+                }
+                return true;
+            }
+
+            void starts( const char *prefix , size_t len , IDS &out ) const {
+                out.clear();
+                std::string p( prefix , len );
+                prefixScan( values , p , out );
+            }
+
+            void ends( const char *suffix , size_t len , IDS &out ) const {
+                out.clear();
+                std::string s( suffix , len );
+                std::reverse( s.begin() , s.end() );
+                prefixScan( reversed , s , out );
+            }
+
+            void equals( const char *value , size_t len , IDS &out ) const {
+                out.clear();
+                std::string v( value , len );
+                for( auto it = values.lower_bound( ENTRY( v , 0 ) ) ; it != values.end() && it->first == v ; ++it ) {
+                    out.push_back( it->second );
+                }
+            }
+
+            // Values strictly greater (or less) than the given value.
+            void range( const char *value , size_t len , bool greater , IDS &out ) const {
+                out.clear();
+                ENTRY bound( std::string( value , len ) , std::numeric_limits<uint64_t>::max() );
+                if( greater ) {
+                    for( auto it = values.upper_bound( bound ) ; it != values.end() ; ++it ) {
+                        out.push_back( it->second );
+                    }
+                } else {
+                    bound.second = 0;
+                    for( auto it = values.begin() ; it != values.end() && *it < bound ; ++it ) {
+                        out.push_back( it->second );
+                    }
+                }
+                std::sort( out.begin() , out.end() );
+            }
+
+            uint64_t size() const {
+                return values.size();
+            }
+
+            uint64_t numGrams() const {
+                return grams.size();
+            }
+
+            // Size of the shortest posting list among the needle's trigrams, an upper bound on the matches.
+            uint64_t estimateContains( const char *needle , size_t len ) const {
+                if( len < GRAM ) return values.size();
+                std::vector<uint32_t> g;
+                trigrams( needle , len , g );
+                uint64_t best = values.size();
+                for( auto it = g.begin() ; it != g.end() ; ++it ) {
+                    auto f = grams.find( *it );
+                    if( f == grams.end() ) return 0;
+                    best = std::min<uint64_t>( best , f->second.size() );
+                }
+                return best;
+            }
+
+            /*
+             *  Bounded counts for the planner.  They walk at most 'cap' entries, so a very
+             *  unselective predicate is reported as 'cap' matches rather than counted exactly.
+             */
+
+            uint64_t countStarts( const char *prefix , size_t len , uint64_t cap ) const {
+                return prefixCount( values , std::string( prefix , len ) , cap );
+            }
+
+            uint64_t countEnds( const char *suffix , size_t len , uint64_t cap ) const {
+                std::string s( suffix , len );
+                std::reverse( s.begin() , s.end() );
+                return prefixCount( reversed , s , cap );
+            }
+
+            uint64_t countEquals( const char *value , size_t len , uint64_t cap ) const {
+                std::string v( value , len );
+                uint64_t n = 0;
+                for( auto it = values.lower_bound( ENTRY( v , 0 ) ) ; it != values.end() && it->first == v && n < cap ; ++it ) {
+                    ++n;
+                }
+                return n;
+            }
+
+            uint64_t countRange( const char *value , size_t len , bool greater , uint64_t cap ) const {
+                uint64_t n = 0;
+                ENTRY bound( std::string( value , len ) , std::numeric_limits<uint64_t>::max() );
+                if( greater ) {
+                    for( auto it = values.upper_bound( bound ) ; it != values.end() && n < cap ; ++it ) {
+                        ++n;
+                    }
+                } else {
+                    bound.second = 0;
+                    for( auto it = values.begin() ; it != values.end() && *it < bound && n < cap ; ++it ) {
+                        ++n;
+                    }
+                }
+                return n;
+            }
+
+            /*
+             *  Serialization.  Only the sorted (value, doc) pairs are written; the reversed
+             *  set and the trigram postings are rebuilt when the index is read back.
+             */
+
+            uint64_t Size() const {
+                uint64_t sum = 0;
+                for( auto it = values.begin() ; it != values.end() ; ++it ) {
+                    sum += 2 * sizeof(uint64_t) + it->first.size();
+                }
+                return sum;
+            }
+
+            void Write( char *buffer , uint64_t &pos ) const {
+                for( auto it = values.begin() ; it != values.end() ; ++it ) {
+                    Write64( buffer , pos , it->second );
+                    Write64( buffer , pos , it->first.size() );
+                    WriteRaw( buffer , pos , it->first.data() , it->first.size() );
+                }
+            }
+
+            void Read( const char *buffer , uint64_t pos , uint64_t size ) {
+                while( pos < size ) {
+                    uint64_t id = Read64( buffer , pos );
+                    uint64_t len = Read64( buffer , pos );
+                    insert( id , buffer + pos , len );
+                    pos += len;
+                }
+            }
+
+            static void Intersect( IDS &a , const IDS &b ) {
+                IDS res;
+                res.reserve( std::min( a.size() , b.size() ) );
+                std::set_intersection( a.begin() , a.end() , b.begin() , b.end() , std::back_inserter( res ) );
+                a.swap( res );
+            }
+
+        private:
+            std::set<ENTRY> values;
+            std::set<ENTRY> reversed;
+            std::unordered_map<uint32_t,IDS> grams;
+
+            static void trigrams( const char *value , size_t len , std::vector<uint32_t> &out ) {
+                out.clear();
+                if( len < GRAM ) return;
+                const unsigned char *v = reinterpret_cast<const unsigned char*>( value );
+                for( size_t i = 0 ; i + GRAM <= len ; ++i ) {
+                    out.push_back( (uint32_t(v[i]) << 16) | (uint32_t(v[i+1]) << 8) | uint32_t(v[i+2]) );
+                }
+                std::sort( out.begin() , out.end() );
+                out.erase( std::unique( out.begin() , out.end() ) , out.end() );
+            }
+
+            static uint64_t prefixCount( const std::set<ENTRY> &s , const std::string &p , uint64_t cap ) {
+                uint64_t n = 0;
+                for( auto it = s.lower_bound( ENTRY( p , 0 ) ) ; it != s.end() && n < cap ; ++it ) {
+                    const std::string &v = it->first;
+                    if( v.size() < p.size() || v.compare( 0 , p.size() , p ) != 0 ) break;
+                    ++n;
+                }
+                return n;
+            }
+
+            static void prefixScan( const std::set<ENTRY> &s , const std::string &p , IDS &out ) {
+                for( auto it = s.lower_bound( ENTRY( p , 0 ) ) ; it != s.end() ; ++it ) {
+                    const std::string &v = it->first;
+                    if( v.size() < p.size() || v.compare( 0 , p.size() , p ) != 0 ) break;
+                    out.push_back( it->second );
+                }
+                std::sort( out.begin() , out.end() );
+            }
+    };
+}
+
+#endif
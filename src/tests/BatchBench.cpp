@@ -0,0 +1,81 @@
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <chrono>
+#include <cstdlib>
+#include <cassert>
+
+#include "../dbms/Executor.h"
+#include "../parsing/Parser.h"
+
+/*
+ *      Compares the row at a time executor with the column batch one on aggregate queries.
+ *      Both have to print the same results.
+ */
+
+static double run(Executor &executor, Planner &planner, DOCDS &docs, Storage::Filesystem &fs, const std::string &query, bool batches,
+        std::string &out) {
+    Parsing::Parser parser(query);
+    Parsing::Query *q = parser.parse();
+    assert( q != NULL );
+    Plan *plan = planner.plan(q, docs.size());
+
+    std::ostringstream captured;
+    std::streambuf *old = std::cout.rdbuf(captured.rdbuf());
+    executor.setVectorized(batches);
+    auto start = std::chrono::steady_clock::now();
+    executor.select(*plan, docs, *q->fields, q->where, q->limit, fs);
+    double ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+    std::cout.rdbuf(old);
+
+    out = captured.str();
+    delete plan;
+    delete q;
+    return ms;
+}
+
+int main(int argc, char *argv[]) {
+    uint64_t count = argc > 1 ? strtoull(argv[1], NULL, 10) : 20000;
+
+    Storage::Filesystem fs("test.dat");
+    DOCDS docs;
+    for( uint64_t i = 0 ; i < count ; ++i ) {
+        std::ostringstream doc;
+        doc << "{\"name\":\"n" << (i % 100) << "\",\"age\":" << (i % 90) << ",\"score\":" << (i * 0.5)
+            << ",\"city\":\"c" << (i % 7) << "\",\"tags\":[\"a\",\"b\",{\"c\":" << i << "}]"
+            << ",\"address\":{\"street\":\"" << i << " Main St\",\"zip\":" << (10000 + i % 500) << "}}";
+        File file = fs.open_file(i);
+        std::string data = doc.str();
+        fs.write(&file, data.c_str(), data.size());
+        docs.push_back(i);
+    }
+
+    IndexCatalog indexes;
+    StatsCatalog stats;
+    Planner planner(indexes, stats);
+    Executor executor(indexes, stats);
+
+    const std::string queries[] = {
+        "SELECT AVG(age), MAX(score) FROM bench;",
+        "SELECT SUM(score) FROM bench WHERE { \"age\" : { \"#gt\" : 30 } };",
+        "SELECT MIN(age), SUM(score) FROM bench WHERE { \"city\" : \"c3\", \"name\" : { \"#starts\" : \"n1\" } };",
+        "SELECT MAX(age) FROM bench WHERE { \"#exists\" : { \"nope\" : false } } LIMIT 5000;",
+        "SELECT COUNT(*), COUNT(address), SUM(age), STDDEV(score), VARIANCE(age) FROM bench WHERE { \"age\" : { \"#lt\" : 60 } };",
+        "SELECT APPROX_COUNT_DISTINCT(name), APPROX_COUNT_DISTINCT(age), APPROX_COUNT_DISTINCT(city) FROM bench;",
+    };
+
+    std::cout << count << " documents" << std::endl;
+    for( size_t i = 0 ; i < sizeof(queries) / sizeof(queries[0]) ; ++i ) {
+        std::string rows, batches;
+        double rowMs = run(executor, planner, docs, fs, queries[i], false, rows);
+        double batchMs = run(executor, planner, docs, fs, queries[i], true, batches);
+        std::cout << queries[i] << std::endl;
+        std::cout << "    rows " << rowMs << " ms, batches " << batchMs << " ms (" << rowMs / batchMs << "x)" << std::endl;
+        if( rows != batches ) {
+            std::cout << "Results differ:" << std::endl << rows << "--" << std::endl << batches;
+            return 1;
+        }
+        assert( !rows.empty() );
+    }
+    return 0;
+}
@@ -0,0 +1,185 @@
+#include <iostream>
+#include <string>
+#include <vector>
+#include <thread>
+#include <algorithm>
+#include <cstdio>
+#include <cassert>
+
+#include "../dbms/Catalog.h"
+#include "../mmap_filesystem/HerpmapWriter.h"
+
+/*
+ *      The catalog under a budget far smaller than its projects: sets are dropped and read
+ *      again as they are used, changes to dropped sets are not lost, and after saving only
+ *      the names are read back until a project is used.  Changes go to the log, a few bytes
+ *      each, and survive its compaction.  A catalog written as one map by an older version is
+ *      moved to one file per project, threads can share the catalog, and a checkpoint after each
+ *      change keeps it without a save.
+ */
+
+const int PROJECTS = 40;
+const uint64_t IDS = 5000;      // per project
+
+static std::string name(int p) {
+    return "p" + std::to_string(p);
+}
+
+// Project p holds every id below IDS that is a multiple of p + 1, plus the ones added later,
+// and has lost 0 once 'zero' is false.
+static void check(Catalog &catalog, int p, uint64_t extra, bool zero = true) {
+    assert( catalog.read(name(p), [&](DOCDS &docs) {
+        uint64_t expected = (IDS + p) / (p + 1) + extra - !zero;
+        assert( docs.size() == expected );
+        assert( docs.contains(0) == zero && (p == 0 || !docs.contains(1)) );
+    }) );
+}
+
+static uint64_t logSize(Storage::Filesystem &fs) {
+    return fs.open_file("__CATALOG_LOG__").size;
+}
+
+int main(void) {
+    remove("test.dat");
+    remove("test.dat.ids");
+    size_t budget = 0;
+    {
+        Storage::Filesystem fs("test.dat");
+        Catalog catalog(1 << 14, 1 << 30);
+        catalog.load(&fs);
+        for( int p = 0 ; p < PROJECTS ; ++p ) {
+            for( uint64_t id = 0 ; id < IDS ; id += p + 1 ) {
+                catalog.upsert(name(p), [id](DOCDS &docs) { docs.push_back(id); });
+            }
+        }
+        assert( catalog.size() == size_t(PROJECTS) && catalog.evictions > 0 );
+        assert( catalog.memory() <= size_t(1 << 14) );
+        for( int p = 0 ; p < PROJECTS ; ++p ) {
+            check(catalog, p, 0);
+        }
+        assert( catalog.loads > 0 );
+        assert( !catalog.read("missing", [](DOCDS&) { assert( false ); }) );
+        assert( !catalog.update("missing", [](DOCDS&) { assert( false ); }) );
+
+        // Two projects at once, even when both do not fit.
+        assert( catalog.read(name(0), name(1), [](DOCDS &a, DOCDS &b) { assert( a.size() == IDS && b.size() == IDS / 2 ); }) );
+        assert( catalog.read(name(3), name(3), [](DOCDS &a, DOCDS &b) { assert( &a == &b ); }) );
+
+        // Changed, then dropped by the next ones: a few bytes of log each, not their sets.
+        uint64_t before = logSize(fs);
+        for( int p = 0 ; p < PROJECTS ; ++p ) {
+            catalog.update(name(p), [](DOCDS &docs) { docs.push_back(IDS * 2); });
+        }
+        catalog.save();
+        assert( logSize(fs) > before && logSize(fs) - before < uint64_t(PROJECTS) * 20 && catalog.compactions == 0 );
+        fs.shutdown();
+    }
+    {
+        Storage::Filesystem fs("test.dat");
+        Catalog catalog(1 << 20, 1 << 30);
+        catalog.load(&fs);
+        std::vector<std::string> names = catalog.keys();
+        assert( names.size() == size_t(PROJECTS) );
+        assert( catalog.memory() == 0 && catalog.loads == 0 );
+        check(catalog, 5, 1);
+        assert( catalog.loads == 1 && catalog.memory() > 0 );
+        budget = catalog.memory();
+
+        // Write the catalog as older versions did, one map in __DB_METADATA__.
+        Storage::HerpHash<std::string, DOCDS> all;
+        for( auto n = names.begin() ; n != names.end() ; ++n ) {
+            catalog.read(*n, [&](DOCDS &docs) { all[*n] = docs; });
+        }
+        all["__PROJECTS__"] = DOCDS();
+        File legacy = fs.open_file("__DB_METADATA__");
+        Storage::HerpmapWriter<DOCDS> writer(legacy, &fs);
+        writer.write(all);
+        File list = fs.open_file("__CATALOG__");
+        assert( fs.deleteFile(&list) );
+        File log = fs.open_file("__CATALOG_LOG__");
+        assert( fs.deleteFile(&log) );
+        fs.shutdown();
+    }
+    {
+        Storage::Filesystem fs("test.dat");
+        Catalog catalog(budget * 3, 256);
+        catalog.load(&fs);
+        assert( catalog.size() == size_t(PROJECTS) && !catalog.contains("__PROJECTS__") );
+        File legacy = fs.open_file("__DB_METADATA__");
+        assert( legacy.size == 0 );
+
+        // Threads reading and appending to overlapping projects under a small budget.
+        std::vector<std::thread> threads;
+        for( int t = 0 ; t < 4 ; ++t ) {
+            threads.push_back(std::thread([&catalog, t] {
+                for( int round = 0 ; round < 50 ; ++round ) {
+                    for( int p = t ; p < PROJECTS ; p += 4 ) {
+                        catalog.update(name(p), [round](DOCDS &docs) { docs.push_back(IDS * 3 + round); });
+                        catalog.read(name((p + 1) % PROJECTS), [](DOCDS &docs) { assert( docs.contains(0) ); });
+                    }
+                }
+            }));
+        }
+        for( auto it = threads.begin() ; it != threads.end() ; ++it ) {
+            it->join();
+        }
+        for( int p = 0 ; p < PROJECTS ; ++p ) {
+            check(catalog, p, 51);
+        }
+        catalog.save();
+        assert( catalog.compactions == 1 && logSize(fs) == 0 );
+        fs.shutdown();
+    }
+    {
+        Storage::Filesystem fs("test.dat");
+        Catalog catalog(0, 1 << 30);
+        catalog.load(&fs);
+        for( int p = 0 ; p < PROJECTS ; ++p ) {
+            check(catalog, p, 51);
+            assert( catalog.update(name(p), [](DOCDS &docs) { assert( docs.erase(0) ); }) );
+        }
+        assert( catalog.memory() == 0 && logSize(fs) > 0 );
+        catalog.save();
+        fs.shutdown();
+    }
+    {
+        Storage::Filesystem fs("test.dat");
+        Catalog catalog(0, 1 << 30);
+        catalog.load(&fs);
+        for( int p = 0 ; p < PROJECTS ; ++p ) {
+            check(catalog, p, 51, false);
+        }
+        catalog.compact();
+        assert( logSize(fs) == 0 );
+        check(catalog, 9, 51, false);
+        fs.shutdown();
+    }
+    {
+        // Checkpointed as each command ends, the changes outlive a catalog that is never saved.
+        Storage::Filesystem fs("test.dat");
+        Catalog catalog(1 << 20, 1 << 30);
+        catalog.load(&fs);
+        assert( catalog.update(name(2), [](DOCDS &docs) { docs.push_back(IDS * 4); }) );
+        catalog.checkpoint(name(2));
+        catalog.upsert("new", [](DOCDS &docs) { docs.push_back(7); });
+        catalog.checkpoint("new");
+        uint64_t size = logSize(fs);
+        catalog.checkpoint(name(2));
+        catalog.checkpoint("missing");
+        assert( logSize(fs) == size && size > 0 );
+        fs.shutdown();
+    }
+    {
+        Storage::Filesystem fs("test.dat");
+        Catalog catalog(1 << 20, 1 << 30);
+        catalog.load(&fs);
+        check(catalog, 2, 52, false);
+        assert( catalog.read("new", [](DOCDS &docs) { assert( docs.size() == 1 && docs.contains(7) ); }) );
+        fs.shutdown();
+    }
+    remove("test.dat");
+    remove("test.dat.ids");
+
+    std::cout << "Catalog works" << std::endl;
+    return 0;
+}
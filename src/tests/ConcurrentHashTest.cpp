@@ -0,0 +1,104 @@
+#include <iostream>
+#include <string>
+#include <vector>
+#include <thread>
+#include <atomic>
+#include <cassert>
+
+#include "../storage/ConcurrentHash.h"
+#include "../storage/DocSet.h"
+
+/*
+ *      ConcurrentHash under threads: writers append ids to their own projects while readers
+ *      look them up, iterate id sets and take snapshots.  A reader never sees a set with a gap,
+ *      every snapshot is a consistent cut, and the final map holds exactly what was written.
+ */
+
+const int WRITERS = 4;
+const int READERS = 4;
+const uint64_t APPENDS = 20000;
+const int PROJECTS = 8;       // per writer
+
+static std::string name(int writer, int project) {
+    return "p" + std::to_string(writer) + "_" + std::to_string(project);
+}
+
+int main(void) {
+    Storage::ConcurrentHash<std::string, Storage::DocSet> meta;
+    Storage::ConcurrentHash<std::string, uint64_t> files;
+    std::atomic<bool> done(false);
+    std::atomic<uint64_t> reads(0);
+
+    std::vector<std::thread> threads;
+    for( int w = 0 ; w < WRITERS ; ++w ) {
+        threads.push_back(std::thread([&, w] {
+            for( uint64_t i = 0 ; i < APPENDS ; ++i ) {
+                // Ids 0..n-1 in order, so a set of size n must hold exactly those.
+                meta.upsert(name(w, i % PROJECTS), [i](Storage::DocSet &docs) { docs.push_back(i / PROJECTS); });
+                files.put(name(w, 0) + "/" + std::to_string(i), i);
+                if( i % 7 == 0 ) {
+                    files.erase(name(w, 0) + "/" + std::to_string(i));
+                }
+            }
+        }));
+    }
+    for( int r = 0 ; r < READERS ; ++r ) {
+        threads.push_back(std::thread([&, r] {
+            while( !done ) {
+                for( int w = 0 ; w < WRITERS ; ++w ) {
+                    meta.read(name(w, r % PROJECTS), [](Storage::DocSet &docs) {
+                        uint64_t expected = 0;
+                        for( auto it = docs.begin() ; it != docs.end() ; ++it ) {
+                            assert( *it == expected++ );
+                        }
+                        assert( expected == docs.size() );
+                    });
+                    uint64_t value;
+                    if( files.get(name(w, 0) + "/" + std::to_string(r * 100), value) ) {
+                        assert( value == uint64_t(r * 100) );
+                    }
+                    ++reads;
+                }
+                // Within one writer, project k never has fewer ids than project k + 1.
+                Storage::FlatHash<std::string, Storage::DocSet> cut = meta.snapshot();
+                for( int w = 0 ; w < WRITERS ; ++w ) {
+                    for( int p = 0 ; p + 1 < PROJECTS ; ++p ) {
+                        uint64_t a = cut.count(name(w, p)) ? cut[name(w, p)].size() : 0;
+                        uint64_t b = cut.count(name(w, p + 1)) ? cut[name(w, p + 1)].size() : 0;
+                        assert( a >= b && a <= b + 1 );
+                    }
+                }
+            }
+        }));
+    }
+    for( int w = 0 ; w < WRITERS ; ++w ) {
+        threads[w].join();
+    }
+    done = true;
+    for( size_t t = WRITERS ; t < threads.size() ; ++t ) {
+        threads[t].join();
+    }
+
+    assert( reads > 0 );
+    assert( meta.size() == size_t(WRITERS * PROJECTS) );
+    for( int w = 0 ; w < WRITERS ; ++w ) {
+        for( int p = 0 ; p < PROJECTS ; ++p ) {
+            uint64_t size = 0;
+            assert( meta.read(name(w, p), [&size](Storage::DocSet &docs) { size = docs.size(); }) );
+            assert( size == APPENDS / PROJECTS );
+        }
+    }
+    uint64_t erased = (APPENDS + 6) / 7;
+    assert( files.size() == WRITERS * (APPENDS - erased) );
+    assert( files.keys().size() == files.size() && files.snapshot().size() == files.size() );
+    assert( !meta.update("missing", [](Storage::DocSet&) { assert( false ); }) );
+
+    std::mutex *made = NULL;
+    Storage::ConcurrentHash<std::string, std::mutex*> locks;
+    std::mutex *first = locks.getOrPut("a", [&made] { return made = new std::mutex(); });
+    assert( first == made && locks.getOrPut("a", [] { return (std::mutex*)NULL; }) == made );
+    delete made;
+
+    std::cout << "Concurrent maps agree" << std::endl;
+    return 0;
+}
@@ -0,0 +1,168 @@
+#ifndef TESTS_DATABASE_H_
+#define TESTS_DATABASE_H_
+
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <vector>
+#include <map>
+#include <algorithm>
+#include <cstdlib>
+#include <cassert>
+
+#include "../dbms/Executor.h"
+#include "../dbms/View.h"
+#include "../parsing/Parser.h"
+
+/*
+ *      Database ---
+ *
+ *      What the query tests run on: a filesystem with the catalogs, planner and executor the
+ *      shell keeps, without the shell.  The documents of a generator are written as documents
+ *      0 to count - 1.  A query on one project runs over 'docs', whatever project it names; a
+ *      JOIN finds its two projects by name in 'projects'.  run() captures what a query prints,
+ *      line by line, and keeps its plan for the test to look at.  EXPLAIN runs as in the shell:
+ *      an UPDATE or DELETE is only planned, unless it is EXPLAIN ANALYZE.
+ */
+
+typedef std::string (*Generator)(uint64_t i);
+
+struct Database {
+    Storage::Filesystem fs;
+    DOCDS docs;
+    std::map<std::string, DOCDS> projects;
+    IndexCatalog indexes;
+    StatsCatalog stats;
+    ViewCatalog views;
+    Planner planner;
+    Executor executor;
+    Plan *plan;                             // of the last query run
+    uint64_t next;                          // id of the next document insert() adds
+
+    Database(const std::string &file, uint64_t count = 0, Generator generate = NULL):
+        fs(file), planner(indexes, stats), executor(indexes, stats, &views), plan(NULL), next(count) {
+        for( uint64_t i = 0 ; i < count ; ++i ) {
+            add(i, generate(i));
+        }
+    }
+
+    ~Database() {
+        delete plan;
+    }
+
+    // Write 'data' as document 'id' of 'docs', or of the named project.
+    void add(uint64_t id, const std::string &data) {
+        write(id, data);
+        docs.push_back(id);
+    }
+
+    void add(const std::string &project, uint64_t id, const std::string &data) {
+        write(id, data);
+        projects[project].push_back(id);
+    }
+
+    // What insertDocuments does: 'count' more documents, which the views of 'project' see.
+    void insert(const std::string &project, uint64_t count, Generator generate) {
+        for( uint64_t i = 0 ; i < count ; ++i, ++next ) {
+            std::string data = generate(next);
+            add(next, data);
+            rapidjson::Document doc;
+            doc.Parse(data.c_str());
+            views.add(project, doc);
+        }
+    }
+
+    std::string stored(uint64_t id) {
+        File f = fs.open_file(id);
+        char *c = fs.read(&f);
+        std::string text(c, f.size);
+        free(c);
+        return text;
+    }
+
+    Parsing::Query *parse(const std::string &query) {
+        Parsing::Parser parser(query);
+        Parsing::Query *q = parser.parse();
+        assert( q != NULL );
+        return q;
+    }
+
+    // SELECT (with or without a JOIN), UPDATE or DELETE, explained or not; the lines it prints.
+    std::vector<std::string> run(const std::string &query) {
+        Parsing::Query *q = parse(query);
+        delete plan;
+        if( q->join.active() ) {
+            plan = planner.plan(q, projects[*q->project].size(), projects[q->join.project].size());
+        } else {
+            plan = planner.plan(q, docs.size());
+        }
+
+        std::ostringstream captured;
+        std::streambuf *old = std::cout.rdbuf(captured.rdbuf());
+        bool execute = !q->explain || q->analyze || q->command == Parsing::SELECT;
+        switch( q->command ) {
+            case Parsing::SELECT:
+                if( q->join.active() ) {
+                    executor.selectJoin(*plan, projects[*q->project], projects[q->join.project], *q->fields, q->limit, fs, q->explain);
+                } else {
+                    executor.select(*plan, docs, *q->fields, q->where, q->limit, fs, q->explain);
+                }
+                break;
+            case Parsing::UPDATE:
+                if( execute ) {
+                    executor.update(*plan, docs, *q->with, q->where, q->limit, fs);
+                }
+                break;
+            case Parsing::DELETE:
+                if( execute ) {
+                    executor.ddelete(*plan, docs, *q->fields, q->where, q->limit, fs);
+                }
+                break;
+            default:
+                assert( false );
+        }
+        if( q->explain ) {
+            plan->print(std::cout, execute);
+        }
+        std::cout.rdbuf(old);
+        delete q;
+        return lines(captured.str());
+    }
+
+    // The lines of run(), for results in no particular order.
+    std::vector<std::string> sorted(const std::string &query) {
+        return sort(run(query));
+    }
+
+    // What reading a view prints, sorted.
+    std::vector<std::string> view(const std::string &name) {
+        std::ostringstream captured;
+        views.read(name, &docs, fs, -1, captured);
+        return sort(lines(captured.str()));
+    }
+
+    static std::vector<std::string> lines(const std::string &text) {
+        std::vector<std::string> out;
+        std::istringstream in(text);
+        for( std::string line ; std::getline(in, line) ; ) {
+            out.push_back(line);
+        }
+        return out;
+    }
+
+    static std::vector<std::string> sort(std::vector<std::string> lines) {
+        std::sort(lines.begin(), lines.end());
+        return lines;
+    }
+
+private:
+    void write(uint64_t id, const std::string &data) {
+        File f = fs.open_file(id);
+        fs.write(&f, data.c_str(), data.size());
+    }
+
+    Database(const Database&);
+    Database& operator=(const Database&);
+};
+
+#endif
@@ -0,0 +1,111 @@
+#include <iostream>
+#include <string>
+#include <vector>
+#include <map>
+#include <random>
+#include <cstdio>
+#include <cassert>
+
+#include "../mmap_filesystem/Filesystem.h"
+
+/*
+ *      Document files by id: the Directory against a std::map through inserts and deletes, then
+ *      documents written, deleted and read back after reopening, apart from the named files.
+ *      The mapped directory grows several times on the way and keeps changes made after it
+ *      was reopened.
+ */
+
+static std::string body(uint64_t id) {
+    return "{\"id\":" + std::to_string(id) + ",\"pad\":\"" + std::string(id % 700, 'x') + "\"}";
+}
+
+int main(void) {
+    remove("test.ids");
+    Storage::Directory table;
+    table.create("test.ids", 1);
+    std::map<uint64_t, uint64_t> expected;
+    std::mt19937_64 rng(3);
+    for( int i = 0 ; i < 200000 ; ++i ) {
+        uint64_t id = rng() % 50000;
+        if( rng() % 3 ) {
+            table.put(id, i);
+            expected[id] = i;
+        } else {
+            assert( table.erase(id) == (expected.erase(id) > 0) );
+        }
+    }
+    assert( table.size() == expected.size() );
+    for( uint64_t id = 0 ; id < 50000 ; ++id ) {
+        uint64_t value;
+        bool found = table.find(id, value);
+        assert( found == (expected.count(id) > 0) );
+        assert( !found || value == expected[id] );
+    }
+    table.close();
+    remove("test.ids");
+
+    const uint64_t count = 20000;
+    remove("test.dat");
+    remove("test.dat.ids");
+    {
+        Storage::Filesystem fs("test.dat");
+        for( uint64_t id = 0 ; id < count ; ++id ) {
+            File f = fs.open_file(id);
+            std::string data = body(id);
+            fs.write(&f, data.c_str(), data.size());
+        }
+        for( uint64_t id = 0 ; id < count ; id += 3 ) {
+            File f = fs.open_file(id);
+            assert( fs.deleteFile(&f) );
+        }
+        File named = fs.open_file("7");
+        std::string data = "named";
+        fs.write(&named, data.c_str(), data.size());
+        fs.shutdown();
+    }
+
+    Storage::Filesystem fs("test.dat");
+    std::vector<uint64_t> ids = fs.getDocumentIds();
+    assert( ids.size() == count - (count + 2) / 3 && ids.back() == count - 1 );
+    for( uint64_t id = 0 ; id < count ; ++id ) {
+        File f = fs.open_file(id);
+        if( id % 3 == 0 ) {
+            assert( f.size == 0 );
+            continue;
+        }
+        char *c = fs.read(&f);
+        assert( std::string(c) == body(id) );
+        free(c);
+    }
+    File named = fs.open_file("7");
+    char *c = fs.read(&named);
+    assert( std::string(c) == "named" );
+    free(c);
+
+    // Changes to the reopened directory are made in place.  Opening the deleted ids above
+    // made them again, as empty files.
+    for( uint64_t id = 1 ; id < count ; id += 3 ) {
+        File f = fs.open_file(id);
+        assert( fs.deleteFile(&f) );
+    }
+    File late = fs.open_file(count * 10);
+    fs.write(&late, "late", 4);
+    fs.shutdown();
+
+    Storage::Filesystem again("test.dat");
+    ids = again.getDocumentIds();
+    assert( ids.size() == count - (count + 1) / 3 + 1 && ids.back() == count * 10 );
+    for( auto it = ids.begin() ; it + 1 != ids.end() ; ++it ) {
+        assert( *it % 3 != 1 );
+    }
+    File f = again.open_file(count * 10);
+    c = again.read(&f);
+    assert( std::string(c) == "late" );
+    free(c);
+    again.shutdown();
+    remove("test.dat");
+    remove("test.dat.ids");
+
+    std::cout << "Directory works" << std::endl;
+    return 0;
+}
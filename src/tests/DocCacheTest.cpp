@@ -0,0 +1,120 @@
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <vector>
+#include <cstdio>
+#include <cassert>
+
+#include "../dbms/DocCache.h"
+#include "Database.h"
+
+/*
+ *      The document cache: documents read again are hits, a scan over many cold documents does
+ *      not push out the ones read all the time, the budget holds, and selects print the same
+ *      with and without the cache while UPDATE and DELETE erase what they change.
+ */
+
+const uint64_t PEOPLE = 3000;
+
+static std::string person(uint64_t i) {
+    std::ostringstream doc;
+    doc << "{\"id\":" << i << ",\"age\":" << (i % 90) << ",\"city\":\"c" << (i % 7) << "\"}";
+    return doc.str();
+}
+
+// What DocSource does: the cached document, or the parsed one offered to the cache.
+static bool read(DocCache &cache, uint64_t i) {
+    if( cache.get(i) ) {
+        return true;
+    }
+    std::string data = person(i);
+    rapidjson::Document doc;
+    doc.Parse(data.c_str());
+    cache.put(i, doc, data.size());
+    return false;
+}
+
+const char *SELECTS[] = {
+    "SELECT * FROM people WHERE { \"city\" : \"c3\" };",
+    "SELECT id, age FROM people WHERE { \"age\" : { \"#lt\" : 10 } };",
+    "SELECT city, COUNT(*), SUM(age), MAX(id) FROM people GROUP BY city;",
+    "SELECT COUNT(*), AVG(age) FROM people WHERE { \"age\" : { \"#gt\" : 40 } };",
+};
+const size_t NUM_SELECTS = sizeof(SELECTS) / sizeof(SELECTS[0]);
+
+int main() {
+    {
+        const size_t budget = DOC_CACHE_SHARDS * 16000;
+        DocCache cache(budget);
+        assert( !read(cache, 1) );
+        assert( read(cache, 1) && cache.hits == 1 && cache.misses == 1 );
+        cache.erase(1);
+        assert( !cache.get(1) );
+
+        // A hot set read over and over, then a scan over far more cold documents than fit.
+        for( int round = 0 ; round < 5 ; ++round ) {
+            for( uint64_t i = 0 ; i < 32 ; ++i ) {
+                read(cache, i);
+            }
+        }
+        for( uint64_t i = 1000 ; i < 6000 ; ++i ) {
+            read(cache, i);
+            assert( cache.memory() <= budget );
+        }
+        assert( cache.rejected > 0 );
+        uint64_t hits = cache.hits;
+        for( uint64_t i = 0 ; i < 32 ; ++i ) {
+            assert( read(cache, i) );
+        }
+        assert( cache.hits == hits + 32 );
+
+        DocCache::Handle doc = cache.get(7);
+        assert( doc && (*doc)["id"].GetInt() == 7 );
+        cache.clear();
+        assert( cache.size() == 0 && cache.memory() == 0 );
+        // The handle outlives the entry.
+        assert( (*doc)["city"] == "c0" );
+    }
+
+    remove("test.dat");
+    remove("test.dat.ids");
+    Database db("test.dat", PEOPLE, person);
+    DocCache *cache = db.executor.documentCache();
+    assert( cache != NULL );
+    db.executor.setDocCacheMemory(0);
+    assert( db.executor.documentCache() == NULL );
+    std::vector<std::vector<std::string> > expected;
+    for( size_t i = 0 ; i < NUM_SELECTS ; ++i ) {
+        expected.push_back(db.sorted(SELECTS[i]));
+    }
+
+    // Cold, then warm: the same rows, and the second run reads from the cache.
+    db.executor.setDocCacheMemory(64 << 20);
+    cache = db.executor.documentCache();
+    for( int run = 0 ; run < 2 ; ++run ) {
+        for( size_t i = 0 ; i < NUM_SELECTS ; ++i ) {
+            assert( db.sorted(SELECTS[i]) == expected[i] );
+        }
+    }
+    assert( cache->hits > 0 && cache->size() == PEOPLE );
+
+    // Writes go through to the next read.
+    db.run("UPDATE people WITH { \"city\" : \"moved\" } WHERE { \"city\" : \"c3\" };");
+    assert( db.sorted(SELECTS[0]).empty() );
+    std::vector<std::string> moved = db.sorted("SELECT COUNT(*) FROM people WHERE { \"city\" : \"moved\" };");
+    db.executor.setDocCacheMemory(0);
+    assert( db.sorted("SELECT COUNT(*) FROM people WHERE { \"city\" : \"moved\" };") == moved );
+    db.executor.setDocCacheMemory(64 << 20);
+
+    std::vector<std::string> before = db.sorted(SELECTS[1]);
+    db.run("DELETE * FROM people WHERE { \"age\" : 5 };");
+    std::vector<std::string> after = db.sorted(SELECTS[1]);
+    db.executor.setDocCacheMemory(0);
+    assert( db.sorted(SELECTS[1]) == after && after.size() < before.size() );
+
+    db.fs.shutdown();
+    remove("test.dat");
+    remove("test.dat.ids");
+    std::cout << "Document cache works" << std::endl;
+    return 0;
+}
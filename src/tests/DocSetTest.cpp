@@ -0,0 +1,123 @@
+#include <iostream>
+#include <string>
+#include <vector>
+#include <set>
+#include <random>
+#include <cassert>
+
+#include "../storage/DocSet.h"
+
+/*
+ *      DocSet against a std::set of the same ids: appends, inserts out of order, erases that
+ *      turn bitmaps back into arrays, intersection, truncation and both on disk formats.
+ */
+
+static bool same(const Storage::DocSet &docs, const std::set<uint64_t> &expected) {
+    if( docs.size() != expected.size() ) {
+        return false;
+    }
+    auto e = expected.begin();
+    for( auto it = docs.begin() ; it != docs.end() ; ++it, ++e ) {
+        if( *it != *e ) {
+            return false;
+        }
+    }
+    return true;
+}
+
+static Storage::DocSet roundTrip(Storage::DocSet &docs) {
+    uint64_t size = Type<Storage::DocSet>::Size(docs);
+    const char *bytes = Type<Storage::DocSet>::Bytes(docs);
+    Storage::DocSet read = Type<Storage::DocSet>::Create(bytes, size);
+    delete[] bytes;
+    return read;
+}
+
+int main(void) {
+    Storage::DocSet docs;
+    std::set<uint64_t> expected;
+    assert( docs.empty() && docs.begin() == docs.end() );
+
+    // Dense appends over three chunks, the middle one a bitmap.
+    for( uint64_t i = 0 ; i < 200000 ; ++i ) {
+        docs.push_back(i);
+        expected.insert(i);
+    }
+    assert( same(docs, expected) );
+    assert( docs.memory() < 200000 / 4 );
+    // About a byte per id on disk.
+    assert( Type<Storage::DocSet>::Size(docs) < 200000 + 16 );
+
+    // Sparse ids far away, and ids inserted out of order.
+    std::mt19937_64 rng(7);
+    for( int i = 0 ; i < 5000 ; ++i ) {
+        uint64_t id = rng() >> 20;
+        assert( docs.insert(id) == expected.insert(id).second );
+    }
+    assert( !docs.insert(17) );
+    assert( same(docs, expected) );
+
+    // Erase most of a bitmap chunk, it goes back to an array.
+    for( uint64_t i = 65536 ; i < 131072 - 100 ; ++i ) {
+        assert( docs.erase(i) );
+        expected.erase(i);
+    }
+    assert( !docs.erase(65536) && !docs.contains(65536) && docs.contains(131071) );
+    assert( same(docs, expected) );
+
+    // A chunk that just became a bitmap stays one while ids come and go around the limit.
+    Storage::DocSet edge;
+    for( uint64_t i = 0 ; i <= Storage::DocSet::ArrayMax ; ++i ) {
+        edge.push_back(i * 2);
+    }
+    uint64_t bitmap = edge.memory();
+    for( uint64_t i = 0 ; i < 100 ; ++i ) {
+        assert( edge.erase(i * 2) && edge.insert(i * 2) );
+        assert( edge.memory() == bitmap );
+    }
+    // Down to ArrayMax / 2 - 1 ids it is an array again.
+    for( uint64_t i = 0 ; i < Storage::DocSet::ArrayMax / 2 + 2 ; ++i ) {
+        assert( edge.erase(i * 2) );
+        assert( (edge.memory() == bitmap) == (edge.size() >= Storage::DocSet::ArrayMax / 2) );
+    }
+    assert( edge.size() == Storage::DocSet::ArrayMax / 2 - 1 );
+
+    std::vector<uint64_t> probe;
+    for( uint64_t i = 60000 ; i < 140000 ; i += 3 ) {
+        probe.push_back(i);
+    }
+    Storage::DocSet both;
+    docs.intersect(probe, both);
+    std::set<uint64_t> bothExpected;
+    for( auto it = probe.begin() ; it != probe.end() ; ++it ) {
+        if( expected.count(*it) ) {
+            bothExpected.insert(*it);
+        }
+    }
+    assert( same(both, bothExpected) );
+
+    Storage::DocSet copy = roundTrip(docs);
+    assert( copy == docs );
+
+    Storage::DocSet merged;
+    merged.merge(both);
+    merged.truncate(10);
+    assert( merged.size() == 10 && *merged.begin() == *both.begin() );
+
+    // The list of decimal strings written by older versions.
+    std::list<std::string> legacy;
+    legacy.push_back("12");
+    legacy.push_back("3");
+    legacy.push_back("__not_an_id__");
+    uint64_t size = Type<std::list<std::string> >::Size(legacy);
+    const char *bytes = Type<std::list<std::string> >::Bytes(legacy);
+    Storage::DocSet old = Type<Storage::DocSet>::Create(bytes, size);
+    delete[] bytes;
+    assert( old.size() == 2 && *old.begin() == 3 && old.contains(12) );
+
+    Storage::DocSet none;
+    assert( roundTrip(none).empty() );
+
+    std::cout << "Doc sets match" << std::endl;
+    return 0;
+}
@@ -0,0 +1,79 @@
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <vector>
+#include <cstdio>
+#include <cassert>
+
+#include "Database.h"
+
+/*
+ *      Runs the same GROUP BY queries with groups held in memory and with a budget small
+ *      enough to spill them to disk, more than one level down.  Both have to print the same
+ *      groups, in whatever order.
+ */
+
+static std::string doc(uint64_t i) {
+    std::ostringstream doc;
+    doc << "{\"name\":\"n" << (i % 1000) << "\",\"age\":" << (i % 90) << ",\"score\":" << (i % 1000)
+        << ",\"city\":\"c" << (i % 7) << "\"";
+    if( i % 11 ) {
+        doc << ",\"zip\":" << (i % 3);
+    }
+    doc << "}";
+    return doc.str();
+}
+
+int main() {
+    uint64_t count = 7000;
+    Database memory("test.dat", count, doc);
+    memory.executor.setGroupMemory(64 << 20);
+    Database spilled("test2.dat", count, doc);
+    spilled.executor.setGroupMemory(1024);
+
+    const std::string queries[] = {
+        "SELECT city, COUNT(*) FROM p GROUP BY city;",
+        "SELECT city, name, SUM(score), AVG(age) FROM p GROUP BY city, name;",
+        "SELECT name, MIN(age), MAX(age), STDDEV(score), COUNT(zip) FROM p WHERE { \"age\" : { \"#lt\" : 45 } } GROUP BY name;",
+        "SELECT zip, COUNT(*), VARIANCE(age) FROM p GROUP BY zip;",
+        "SELECT city, MEDIAN(age), PERCENTILE(score, 0.9), APPROX_COUNT_DISTINCT(name) FROM p GROUP BY city;",
+        "SELECT city FROM p GROUP BY city;",
+    };
+    const size_t groups[] = { 7, 7000, 1000, 4, 7, 7 };
+
+    for( size_t i = 0 ; i < sizeof(queries) / sizeof(queries[0]) ; ++i ) {
+        std::vector<std::string> a = memory.sorted(queries[i]);
+        std::vector<std::string> b = spilled.sorted(queries[i]);
+        if( a != b || a.size() != groups[i] ) {
+            std::cout << queries[i] << std::endl << "Expected " << groups[i] << " groups, got " << a.size() << " and " << b.size() << std::endl;
+            return 1;
+        }
+    }
+
+    std::vector<std::string> cities = memory.sorted("SELECT city, COUNT(*) FROM p GROUP BY city;");
+    assert( cities[0] == "{\"city\":\"c0\",\"COUNT(*)\":1000}" );
+    std::vector<std::string> zips = memory.sorted("SELECT zip, COUNT(*) FROM p GROUP BY zip;");
+    assert( zips[3] == "{\"zip\":null,\"COUNT(*)\":637}" );
+    assert( spilled.sorted("SELECT name, COUNT(*) FROM p GROUP BY name LIMIT 10;").size() == 10 );
+
+    // Every spill file is gone again.
+    assert( spilled.fs.getFilenames().empty() && spilled.fs.getDocumentIds().size() == count );
+
+    // Integers past 2^53 keep every digit through MIN and MAX.
+    Database big("test3.dat");
+    const char *values[] = { "9007199254740993", "9007199254740992", "9007199254740995", "-9007199254740993" };
+    for( uint64_t i = 0 ; i < 4 ; ++i ) {
+        big.add(i, std::string("{\"g\":") + (i < 3 ? "1" : "2") + ",\"v\":" + values[i] + "}");
+    }
+    std::vector<std::string> extremes = big.sorted("SELECT g, MIN(v), MAX(v) FROM p GROUP BY g;");
+    assert( extremes.size() == 2 );
+    assert( extremes[0] == "{\"g\":1,\"MIN(v)\":9007199254740992,\"MAX(v)\":9007199254740995}" );
+    assert( extremes[1] == "{\"g\":2,\"MIN(v)\":-9007199254740993,\"MAX(v)\":-9007199254740993}" );
+
+    std::cout << "Spilled groups match" << std::endl;
+    remove("test2.dat");
+    remove("test2.dat.ids");
+    remove("test3.dat");
+    remove("test3.dat.ids");
+    return 0;
+}
@@ -0,0 +1,147 @@
+#include <iostream>
+#include <string>
+#include <vector>
+#include <unordered_map>
+#include <random>
+#include <chrono>
+#include <cstdlib>
+#include <cassert>
+
+#include "../storage/HerpHash.h"
+#include "../storage/BucketHash.h"
+
+/*
+ *      Compares FlatHash, which HerpHash is now, with the array of std::maps it replaced on
+ *      the catalog's operations: inserts, lookups that hit and miss, erases, iteration and
+ *      copies.  Both have to hold the same entries as a std::unordered_map after a random mix
+ *      of puts and erases.  The slowest single insert shows what incremental growing saves.
+ */
+
+typedef Storage::FlatHash<std::string, uint64_t> Flat;
+typedef Storage::BucketHash<std::string, uint64_t, 2048> Buckets;
+
+static double since(std::chrono::steady_clock::time_point start) {
+    return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+}
+
+template <class MAP>
+static bool same(MAP &map, const std::unordered_map<std::string, uint64_t> &expected) {
+    if( map.size() != expected.size() ) {
+        return false;
+    }
+    uint64_t seen = 0;
+    for( auto it = map.begin() ; it != map.end() ; ++it, ++seen ) {
+        auto e = expected.find(it->first);
+        if( e == expected.end() || e->second != it->second ) {
+            return false;
+        }
+    }
+    return seen == expected.size();
+}
+
+struct Timings {
+    double insert, slowest, hit, miss, erase, iterate, copy;
+};
+
+template <class MAP>
+static Timings run(const std::vector<std::string> &keys, const std::vector<std::string> &missing) {
+    Timings t;
+    uint64_t sum = 0;
+    MAP *map = new MAP();
+
+    t.slowest = 0;
+    auto start = std::chrono::steady_clock::now();
+    for( uint64_t i = 0 ; i < keys.size() ; ++i ) {
+        auto one = std::chrono::steady_clock::now();
+        map->put(keys[i], i);
+        t.slowest = std::max(t.slowest, since(one));
+    }
+    t.insert = since(start);
+
+    start = std::chrono::steady_clock::now();
+    for( auto it = keys.begin() ; it != keys.end() ; ++it ) {
+        sum += map->count(*it);
+    }
+    t.hit = since(start);
+    assert( sum == keys.size() );
+
+    start = std::chrono::steady_clock::now();
+    for( auto it = missing.begin() ; it != missing.end() ; ++it ) {
+        sum += map->count(*it);
+    }
+    t.miss = since(start);
+    assert( sum == keys.size() );
+
+    start = std::chrono::steady_clock::now();
+    for( auto it = map->begin() ; it != map->end() ; ++it ) {
+        sum += it->second;
+    }
+    t.iterate = since(start);
+
+    start = std::chrono::steady_clock::now();
+    MAP *copy = new MAP(*map);
+    t.copy = since(start);
+    assert( copy->size() == keys.size() );
+    delete copy;
+
+    start = std::chrono::steady_clock::now();
+    for( uint64_t i = 0 ; i < keys.size() ; i += 2 ) {
+        std::string key = keys[i];
+        map->erase(key);
+    }
+    t.erase = since(start);
+    assert( map->size() == keys.size() / 2 );
+    delete map;
+    return t;
+}
+
+static void report(const char *what, double flat, double buckets) {
+    std::cout << "    " << what << ": flat " << flat << " ms, buckets " << buckets << " ms (" << buckets / flat << "x)" << std::endl;
+}
+
+int main(int argc, char *argv[]) {
+    uint64_t count = argc > 1 ? strtoull(argv[1], NULL, 10) : 300000;
+
+    // Puts and erases over a small key space, growing and shrinking through many rehashes.
+    Flat flat;
+    Buckets buckets;
+    std::unordered_map<std::string, uint64_t> expected;
+    std::mt19937_64 rng(11);
+    for( int i = 0 ; i < 200000 ; ++i ) {
+        std::string key = "k" + std::to_string(rng() % 20000);
+        if( rng() % 4 ) {
+            flat.put(key, i);
+            buckets.put(key, i);
+            expected[key] = i;
+        } else {
+            bool erased = expected.erase(key) > 0;
+            assert( flat.erase(key) == erased );
+            assert( buckets.erase(key) == erased );
+        }
+        assert( flat.count(key) == expected.count(key) );
+    }
+    assert( same(flat, expected) && same(buckets, expected) );
+    Flat copied(flat);
+    Flat moved(std::move(copied));
+    assert( same(moved, expected) && copied.empty() );
+    flat["k1"] += 5;
+    assert( flat["k1"] == expected["k1"] + 5 );
+
+    std::vector<std::string> keys, missing;
+    for( uint64_t i = 0 ; i < count ; ++i ) {
+        keys.push_back("project_" + std::to_string(i));
+        missing.push_back("other_" + std::to_string(i));
+    }
+
+    Timings f = run<Flat>(keys, missing);
+    Timings b = run<Buckets>(keys, missing);
+    std::cout << count << " keys" << std::endl;
+    report("insert", f.insert, b.insert);
+    report("slowest insert", f.slowest, b.slowest);
+    report("lookup", f.hit, b.hit);
+    report("missing lookup", f.miss, b.miss);
+    report("iterate", f.iterate, b.iterate);
+    report("copy", f.copy, b.copy);
+    report("erase half", f.erase, b.erase);
+    return 0;
+}
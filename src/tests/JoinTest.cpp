@@ -0,0 +1,136 @@
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <vector>
+#include <algorithm>
+#include <cstdio>
+#include <cassert>
+
+#include "Database.h"
+
+/*
+ *      Joins two projects with the hash table in memory, with a budget small enough to
+ *      partition both sides to disk more than one level down, and through an index on the
+ *      probe side.  All of them have to find the rows a nested loop finds.
+ */
+
+const uint64_t PEOPLE = 1000;
+const uint64_t ORDERS = 6000;
+
+static std::string person(uint64_t i) {
+    std::ostringstream doc;
+    doc << "{\"id\":" << i << ",\"name\":\"n" << i << "\",\"city\":\"c" << (i % 5) << "\",\"key\":\"k" << i << "\"}";
+    return doc.str();
+}
+
+// Every 13th order has no person, some refer to people that do not exist.
+static std::string order(uint64_t j) {
+    std::ostringstream doc;
+    doc << "{\"total\":" << (j % 100) << ",\"pkey\":\"k" << (j % 1200) << "\"";
+    if( j % 13 ) {
+        doc << ",\"person\":" << (j % 1200);
+    }
+    doc << "}";
+    return doc.str();
+}
+
+// The people, then their orders.
+static void load(Database &db) {
+    for( uint64_t i = 0 ; i < PEOPLE + ORDERS ; ++i ) {
+        if( i < PEOPLE ) {
+            db.add("people", i, person(i));
+        } else {
+            db.add("orders", i, order(i - PEOPLE));
+        }
+    }
+}
+
+static void index(Database &db, const std::string &project, const std::string &field) {
+    db.indexes.create(project, field);
+    DOCDS &docs = db.projects[project];
+    for( auto it = docs.begin() ; it != docs.end() ; ++it ) {
+        rapidjson::Document doc;
+        doc.Parse(db.stored(*it).c_str());
+        db.indexes.add(project, *it, doc);
+    }
+}
+
+int main() {
+    Database memory("test.dat");
+    memory.executor.setJoinMemory(64 << 20);
+    load(memory);
+    Database spilled("test2.dat");
+    spilled.executor.setJoinMemory(2048);
+    load(spilled);
+
+    // The rows a nested loop over both projects finds.
+    std::vector<std::string> expected;
+    uint64_t cityOrders[5] = {0}, cityTotals[5] = {0};
+    for( uint64_t j = 0 ; j < ORDERS ; ++j ) {
+        for( uint64_t i = 0 ; i < PEOPLE ; ++i ) {
+            if( j % 13 && j % 1200 == i ) {
+                expected.push_back("{\"o.total\":" + std::to_string(j % 100) + ",\"p.name\":\"n" + std::to_string(i) + "\"}");
+                ++cityOrders[i % 5];
+                cityTotals[i % 5] += j % 100;
+            }
+        }
+    }
+    std::sort(expected.begin(), expected.end());
+
+    const std::string join = "SELECT o.total, p.name FROM orders o JOIN people p ON o.person = p.id;";
+    std::vector<std::string> a = memory.sorted(join);
+    std::vector<std::string> b = spilled.sorted(join);
+    if( a != expected || b != expected ) {
+        std::cout << join << std::endl << "Expected " << expected.size() << " rows, got " << a.size() << " and " << b.size() << std::endl;
+        return 1;
+    }
+    assert( memory.plan->join->detail.find("spilled") == std::string::npos );
+    assert( spilled.plan->join->detail.find("spilled") != std::string::npos );
+    // The ON clause reads the same either way round.
+    assert( memory.sorted("SELECT o.total, p.name FROM orders o JOIN people p ON p.id = o.person;") == expected );
+
+    const std::string queries[] = {
+        "SELECT o.total, p.name, p.city FROM orders o JOIN people p ON o.person = p.id WHERE { \"p\" : { \"city\" : \"c1\" }, \"o\" : { \"total\" : { \"#lt\" : 50 } } };",
+        "SELECT p.city, COUNT(*), SUM(o.total) FROM orders o JOIN people p ON o.person = p.id GROUP BY p.city;",
+        "SELECT a.id, b.id FROM people a JOIN people b ON a.city = b.city WHERE { \"a\" : { \"id\" : 3 } };",
+        "SELECT * FROM people JOIN orders ON people.key = orders.pkey WHERE { \"orders\" : { \"total\" : 7 } };",
+    };
+    const size_t rows[] = { 464, 5, PEOPLE / 5, 50 };
+    for( size_t i = 0 ; i < sizeof(queries) / sizeof(queries[0]) ; ++i ) {
+        std::vector<std::string> x = memory.sorted(queries[i]);
+        std::vector<std::string> y = spilled.sorted(queries[i]);
+        if( x != y || x.size() != rows[i] ) {
+            std::cout << queries[i] << std::endl << "Expected " << rows[i] << " rows, got " << x.size() << " and " << y.size() << std::endl;
+            return 1;
+        }
+    }
+    std::vector<std::string> cities = memory.sorted(queries[1]);
+    for( int c = 0 ; c < 5 ; ++c ) {
+        assert( cities[c] == "{\"p.city\":\"c" + std::to_string(c) + "\",\"COUNT(*)\":" + std::to_string(cityOrders[c]) +
+                ",\"SUM(o.total)\":" + std::to_string(cityTotals[c]) + "}" );
+    }
+
+    // Sorted and limited joined rows.
+    std::vector<std::string> top = spilled.run("SELECT o.total, p.name FROM orders o JOIN people p ON o.person = p.id ORDER BY o.total DESC, p.name LIMIT 3;");
+    assert( top.size() == 3 && top[0] == "{\"o.total\":99,\"p.name\":\"n199\"}" );
+    assert( spilled.run("SELECT o.total FROM orders o JOIN people p ON o.person = p.id LIMIT 10;").size() == 10 );
+
+    // With an index on the probe side only the documents holding a build key are read.
+    const std::string keyed = "SELECT o.total, p.name FROM orders o JOIN people p ON o.pkey = p.key WHERE { \"o\" : { \"total\" : 7 } };";
+    std::vector<std::string> scanned = memory.sorted(keyed);
+    assert( !memory.plan->probe->seekKeys );
+    index(memory, "people", "key");
+    std::vector<std::string> seeked = memory.sorted(keyed);
+    if( !memory.plan->probe->seekKeys || seeked != scanned || seeked.size() != 50 ) {
+        std::cout << keyed << std::endl << "Index probe found " << seeked.size() << " rows, the scan " << scanned.size() << std::endl;
+        return 1;
+    }
+
+    // Every spill file is gone again.
+    assert( spilled.fs.getFilenames().empty() && spilled.fs.getDocumentIds().size() == PEOPLE + ORDERS );
+
+    std::cout << "Joins match" << std::endl;
+    remove("test2.dat");
+    remove("test2.dat.ids");
+    return 0;
+}
@@ -0,0 +1,105 @@
+#include <iostream>
+#include <fstream>
+#include <string>
+#include <vector>
+#include <chrono>
+#include <cstdio>
+#include <cassert>
+#include <rapidjson/document.h>
+
+#include "../dbms/Loader.h"
+#include "../dbms/Catalog.h"
+#include <pretty.h>
+
+/*
+ *      LOAD of a JSON Lines file through many batches and workers: every object line is
+ *      stored, in file order and under consecutive ids, as INSERT would store it with its id
+ *      written in as "_doc", and the project gets exactly those ids.  Blank lines are skipped,
+ *      broken ones counted, and a line longer than a batch still goes in whole.
+ */
+
+const uint64_t DOCS = 20000;
+
+static std::string line(uint64_t i) {
+    std::string text = "{\"n\": " + std::to_string(i) + ", \"name\": \"doc" + std::to_string(i) + "\"";
+    if( i == 7 ) {
+        // Longer than a batch and than a block.
+        text += ", \"long\": \"" + std::string(10000, 'x') + "\"";
+    }
+    return text + ", \"tags\": [1, 2, 3]}";
+}
+
+int main(void) {
+    remove("test.dat");
+    remove("test.dat.ids");
+    remove("test.jsonl");
+    {
+        std::ofstream out("test.jsonl");
+        for( uint64_t i = 0 ; i < DOCS ; ++i ) {
+            out << line(i) << (i % 3 == 0 ? "\r\n" : "\n");
+            if( i == 100 ) {
+                out << "\n   \n";
+            }
+            if( i == 200 ) {
+                out << "{\"broken\": \n[1, 2]\n";
+            }
+        }
+        // No line end after the last line.
+        out << "{\"n\": " << DOCS << "}";
+    }
+
+    const uint64_t first = 42;
+    {
+        Storage::Filesystem fs("test.dat");
+        Catalog catalog(1 << 20, 1 << 20);
+        catalog.load(&fs);
+        BulkLoader loader(fs, catalog, 4, 4096);
+        uint64_t next = first;
+        uint64_t expected = first;
+        auto start = std::chrono::steady_clock::now();
+        assert( loader.load("test.jsonl", "p", next, [&expected](uint64_t id, const rapidjson::Value &doc) {
+            assert( id == expected++ );
+            assert( doc["n"].GetUint64() == id - first && !doc.HasMember("_doc") );
+        }) );
+        double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        assert( loader.loaded == DOCS + 1 && loader.failed == 2 );
+        assert( next == first + DOCS + 1 && expected == next );
+        std::cout << "Loaded " << loader.loaded << " documents in " << seconds << "s" << std::endl;
+
+        BulkLoader missing(fs, catalog);
+        assert( !missing.load("missing.jsonl", "q", next, [](uint64_t, const rapidjson::Value&) { assert( false ); }) );
+        assert( !catalog.contains("q") );
+        catalog.save();
+        fs.shutdown();
+    }
+    {
+        Storage::Filesystem fs("test.dat");
+        Catalog catalog(1 << 20, 1 << 20);
+        catalog.load(&fs);
+        assert( catalog.read("p", [](DOCDS &docs) {
+            assert( docs.size() == DOCS + 1 );
+            uint64_t id = first;
+            for( auto it = docs.begin() ; it != docs.end() ; ++it, ++id ) {
+                assert( *it == id );
+            }
+        }) );
+        for( uint64_t i = 0 ; i < DOCS ; i += 97 ) {
+            rapidjson::Document doc;
+            doc.Parse(line(i).c_str());
+            doc.AddMember("_doc", rapidjson::Value(std::to_string(first + i).c_str(), doc.GetAllocator()), doc.GetAllocator());
+            File file = fs.open_file(first + i);
+            char *stored = fs.read(&file);
+            assert( std::string(stored, file.size) == toString(&doc) );
+            free(stored);
+        }
+        File file = fs.open_file(first + 7);
+        assert( file.size > 10000 );
+        fs.shutdown();
+    }
+    remove("test.dat");
+    remove("test.dat.ids");
+    remove("test.jsonl");
+
+    std::cout << "Load works" << std::endl;
+    return 0;
+}
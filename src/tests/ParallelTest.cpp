@@ -0,0 +1,96 @@
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <vector>
+#include <cstdio>
+#include <cassert>
+
+#include "../dbms/Parallel.h"
+#include "Database.h"
+
+/*
+ *      Runs the same queries with parallel scans off and on.  Both have to print the same
+ *      results and leave the same documents behind.  Index seeks, row by row or in batches,
+ *      only return documents that are still in the project, whatever the index holds.
+ */
+
+// Index city in db, then take every other c3 document out of the project but not the index.
+static uint64_t stale(Database &db) {
+    db.indexes.create("p", "city");
+    std::vector<uint64_t> dropped;
+    uint64_t kept = 0;
+    for( auto it = db.docs.begin() ; it != db.docs.end() ; ++it ) {
+        rapidjson::Document doc;
+        doc.Parse(db.stored(*it).c_str());
+        db.indexes.add("p", *it, doc);
+        if( doc.HasMember("city") && std::string(doc["city"].GetString()) == "c3" && kept++ % 2 ) {
+            dropped.push_back(*it);
+        }
+    }
+    for( auto it = dropped.begin() ; it != dropped.end() ; ++it ) {
+        db.docs.erase(*it);
+    }
+    return kept - dropped.size();
+}
+
+static std::string doc(uint64_t i) {
+    std::ostringstream doc;
+    doc << "{\"name\":\"n" << (i % 100) << "\",\"age\":" << (i % 90) << ",\"score\":" << (i % 1000)
+        << ",\"city\":\"c" << (i % 7) << "\",\"tags\":[\"a\",{\"c\":" << i << "}]}";
+    return doc.str();
+}
+
+int main() {
+    uint64_t count = 4 * PARALLEL_MIN_DOCS + 123;
+    Database serial("test.dat", count, doc);
+    serial.executor.setThreads(1);
+    Database parallel("test2.dat", count, doc);
+    parallel.executor.setThreads(4);
+
+    const std::string queries[] = {
+        "SELECT name, age FROM p WHERE { \"city\" : \"c3\" };",
+        "SELECT * FROM p WHERE { \"age\" : { \"#gt\" : 50 } } LIMIT 10000;",
+        "SELECT name FROM p WHERE { \"age\" : 7 } LIMIT 3;",
+        "SELECT AVG(age), MAX(score), MIN(score) FROM p;",
+        "SELECT SUM(score) FROM p WHERE { \"age\" : { \"#lt\" : 10 } };",
+        "SELECT name, SUM(age) FROM p WHERE { \"city\" : \"c1\" };",
+        "SELECT COUNT(*), COUNT(tags), STDDEV(score), VARIANCE(age), MIN(age) FROM p;",
+        "SELECT name, COUNT(*), STDDEV(age) FROM p WHERE { \"city\" : \"c4\" };",
+        "SELECT APPROX_COUNT_DISTINCT(name), APPROX_COUNT_DISTINCT(score), APPROX_COUNT_DISTINCT(tags) FROM p;",
+        "UPDATE p WITH { \"age\" : 500 } WHERE { \"city\" : \"c2\" } LIMIT 4000;",
+        "DELETE * FROM p WHERE { \"name\" : \"n5\" };",
+        "DELETE city FROM p WHERE { \"age\" : { \"#lt\" : 3 } } LIMIT 200;",
+        "SELECT * FROM p;",
+    };
+
+    for( size_t i = 0 ; i < sizeof(queries) / sizeof(queries[0]) ; ++i ) {
+        std::vector<std::string> a = serial.run(queries[i]);
+        std::vector<std::string> b = parallel.run(queries[i]);
+        if( a != b ) {
+            std::cout << queries[i] << std::endl << "Results differ, " << a.size() << " and " << b.size() << " lines" << std::endl;
+            return 1;
+        }
+    }
+    assert( serial.docs == parallel.docs );
+
+    uint64_t c3 = stale(serial);
+    assert( stale(parallel) == c3 );
+    const std::string seeks[] = {
+        "SELECT name FROM p WHERE { \"city\" : \"c3\" };",
+        "SELECT COUNT(*) FROM p WHERE { \"city\" : \"c3\" };",
+    };
+    for( size_t i = 0 ; i < sizeof(seeks) / sizeof(seeks[0]) ; ++i ) {
+        std::vector<std::string> a = serial.run(seeks[i]);
+        assert( serial.plan->indexed() );
+        assert( a == parallel.run(seeks[i]) );
+        if( i == 0 ) {
+            assert( a.size() == c3 );
+        } else {
+            assert( a.size() == 1 && a[0].find(std::to_string(c3)) != std::string::npos );
+        }
+    }
+    std::cout << "Parallel scans match" << std::endl;
+    remove("test2.dat");
+    remove("test2.dat.ids");
+    return 0;
+}
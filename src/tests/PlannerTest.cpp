@@ -0,0 +1,114 @@
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <vector>
+#include <cstdio>
+#include <cassert>
+
+#include "Database.h"
+
+/*
+ *      The planner's choices on a project whose indexed fields match known numbers of
+ *      documents: a scan without a usable index or when a seek returns nearly everything, an
+ *      IndexSeek for a selective condition, an IndexIntersect while a second seek saves more
+ *      documents than it costs, and a single seek once it does not.  Filters test their most
+ *      selective conditions first.  EXPLAIN prints the estimated next to the actual rows, and
+ *      only EXPLAIN ANALYZE runs an UPDATE or DELETE.
+ */
+
+const uint64_t DOCS = 20000;
+
+// a matches 20 documents a value, c 400, b 5000 and all every one.  e and n are not indexed,
+// e matches 20 documents a value and n > 10 nearly all.
+static std::string doc(uint64_t i) {
+    std::ostringstream doc;
+    doc << "{\"a\":\"a" << (i % 1000) << "\",\"b\":\"b" << (i % 4) << "\",\"c\":\"c" << (i % 50) << "\",\"all\":\"x\""
+        << ",\"e\":" << (i % 1000) << ",\"n\":" << (i % 100) << "}";
+    return doc.str();
+}
+
+static void index(Database &db, const std::string &field) {
+    db.indexes.create("p", field);
+    for( auto it = db.docs.begin() ; it != db.docs.end() ; ++it ) {
+        rapidjson::Document d;
+        d.Parse(db.stored(*it).c_str());
+        db.indexes.add("p", *it, d);
+    }
+}
+
+static bool starts(const std::string &line, const std::string &prefix) {
+    if( line.compare(0, prefix.size(), prefix) != 0 ) {
+        std::cout << "'" << line << "' does not start with '" << prefix << "'" << std::endl;
+        return false;
+    }
+    return true;
+}
+
+int main(void) {
+    Database db("test.dat", DOCS, doc);
+    index(db, "a");
+    index(db, "b");
+    index(db, "c");
+    index(db, "all");
+    db.stats.analyze("p", db.docs, db.fs, 7);
+
+    // No where clause, nothing to seek.
+    std::vector<std::string> lines = db.run("EXPLAIN SELECT * FROM p;");
+    assert( db.plan->access->type == SCAN && !db.plan->indexed() );
+    assert( lines.size() == 2 && starts(lines[1], "    -> Scan p  (cost=20000.00 rows=20000) (actual rows=20000 in=20000 ") );
+
+    // A selective condition is sought, the index counts its 20 documents exactly.
+    lines = db.run("EXPLAIN SELECT * FROM p WHERE { \"a\" : \"a7\" };");
+    assert( db.plan->access->type == INDEX_SEEK && db.plan->seeks.size() == 1 );
+    assert( lines.size() == 3 );
+    assert( starts(lines[0], "Project *  (cost=20.25 rows=20) (actual rows=20 in=20 ") );
+    assert( starts(lines[2], "        -> IndexSeek a #eq \"a7\"  (cost=20.25 rows=20) (actual rows=20 in=20 ") );
+
+    // Seeking every document costs more than reading them all.
+    db.run("EXPLAIN SELECT * FROM p WHERE { \"all\" : \"x\" };");
+    assert( db.plan->access->type == SCAN && !db.plan->indexed() );
+
+    // The 400 c3 documents are worth narrowing down with b, most selective seek first.  The
+    // two are correlated, so twice the estimated rows come out.
+    lines = db.run("EXPLAIN SELECT * FROM p WHERE { \"b\" : \"b1\", \"c\" : \"c3\" };");
+    assert( db.plan->access->type == INDEX_INTERSECT && db.plan->access->children.size() == 2 );
+    assert( db.plan->seeks.size() == 2 && db.plan->seeks[0].field == "c" && db.plan->seeks[1].field == "b" );
+    assert( db.plan->filter->detail == "{\"c\":\"c3\",\"b\":\"b1\"}" );
+    assert( lines.size() == 5 && starts(lines[2], "        -> IndexIntersect  (cost=158.01 rows=100) (actual rows=200 in=200 ") );
+    assert( starts(lines[3], "            -> IndexSeek c #eq \"c3\"  (cost=4.05 rows=400) (actual rows=400 in=400 ") );
+
+    // Past 20 documents the index work on b1 outweighs the few documents it would save.
+    lines = db.run("EXPLAIN SELECT * FROM p WHERE { \"b\" : \"b1\", \"a\" : \"a5\" };");
+    assert( db.plan->access->type == INDEX_SEEK && db.plan->seeks.size() == 1 && db.plan->seeks[0].field == "a" );
+    assert( db.plan->filter->detail == "{\"a\":\"a5\",\"b\":\"b1\"}" );
+    assert( starts(lines[1], "    -> Filter {\"a\":\"a5\",\"b\":\"b1\"}  (cost=20.25 rows=5) (actual rows=20 in=20 ") );
+
+    // Without indexes the filter still tests the rarer condition first.
+    db.run("EXPLAIN SELECT * FROM p WHERE { \"n\" : { \"#gt\" : 10 }, \"e\" : 7 };");
+    assert( db.plan->access->type == SCAN );
+    assert( db.plan->filter->detail == "{\"e\":7,\"n\":{\"#gt\":10}}" );
+    assert( db.plan->filter->estRows > 10 && db.plan->filter->estRows < 30 && db.plan->filter->actualRows == 0 );
+
+    // EXPLAIN UPDATE and DELETE print the estimates and change nothing.
+    std::string before = db.stored(7);
+    lines = db.run("EXPLAIN UPDATE p WITH { \"#inc\" : { \"n\" : 1 } } WHERE { \"a\" : \"a7\" };");
+    assert( lines.size() == 3 && lines[0] == "Update p  (cost=40.25 rows=20)" );
+    assert( lines[2] == "        -> IndexSeek a #eq \"a7\"  (cost=20.25 rows=20)" );
+    lines = db.run("EXPLAIN DELETE * FROM p WHERE { \"a\" : \"a7\" };");
+    assert( lines.size() == 3 && lines[0] == "Delete p  (cost=40.25 rows=20)" );
+    assert( db.stored(7) == before && db.docs.size() == DOCS && db.docs.contains(7) );
+
+    // EXPLAIN ANALYZE runs them.
+    lines = db.run("EXPLAIN ANALYZE UPDATE p WITH { \"#inc\" : { \"n\" : 1 } } WHERE { \"a\" : \"a7\" };");
+    assert( starts(lines[0], "Update p  (cost=40.25 rows=20) (actual rows=20 in=20 ") );
+    assert( db.stored(7) != before && db.stored(7).find("\"n\":8") != std::string::npos );
+    db.run("EXPLAIN ANALYZE DELETE * FROM p WHERE { \"a\" : \"a7\" };");
+    assert( db.docs.size() == DOCS - 20 && !db.docs.contains(7) );
+
+    db.fs.shutdown();
+    remove("test.dat");
+    remove("test.dat.ids");
+
+    std::cout << "Planner works" << std::endl;
+    return 0;
+}
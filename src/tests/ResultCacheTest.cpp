@@ -0,0 +1,86 @@
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <vector>
+#include <cassert>
+
+#include "../dbms/ResultCache.h"
+#include "../parsing/Parser.h"
+
+/*
+ *      Cached select results: the same select written differently shares an entry, a write to
+ *      a project it read invalidates it, least recently used entries go first once the budget
+ *      is full, and a capture passes the output on while copying it.
+ */
+
+static std::string keyOf(const std::string &query) {
+    Parsing::Parser parser(query);
+    Parsing::Query *q = parser.parse();
+    assert( q != NULL );
+    std::string key = ResultCache::key(*q);
+    delete q;
+    return key;
+}
+
+int main() {
+    std::string key = keyOf("SELECT city, SUM(age) FROM people WHERE { \"age\" : { \"#gt\" : 5 } } GROUP BY city;");
+    assert( !key.empty() );
+    assert( keyOf("select city,SUM(age)  from people where {\"age\":{\"#gt\":5}}   group by city;") == key );
+    assert( keyOf("SELECT city, SUM(age) FROM people WHERE { \"age\" : { \"#gt\" : 6 } } GROUP BY city;") != key );
+    assert( keyOf("SELECT city, SUM(age) FROM people GROUP BY city LIMIT 3;") != keyOf("SELECT city, SUM(age) FROM people GROUP BY city;") );
+    assert( keyOf("EXPLAIN SELECT * FROM people;").empty() );
+    assert( keyOf("SELECT * FROM people SAMPLE 10 PERCENT;").empty() );
+    assert( !keyOf("SELECT * FROM people SAMPLE 10 PERCENT REPEATABLE 3;").empty() );
+    assert( keyOf("DELETE * FROM people;").empty() );
+
+    ResultCache cache(1 << 20);
+    std::string out;
+    assert( !cache.lookup(key, out) );
+    cache.store(key, std::vector<std::string>(1, "people"), "rows\n");
+    assert( cache.lookup(key, out) && out == "rows\n" );
+
+    // Writes to other projects leave it alone, writes to its own project invalidate it.
+    cache.bump("orders");
+    assert( cache.lookup(key, out) );
+    cache.bump("people");
+    assert( !cache.lookup(key, out) && cache.size() == 0 && cache.memory() == 0 );
+
+    // A join reads two projects.
+    std::vector<std::string> both;
+    both.push_back("people");
+    both.push_back("orders");
+    cache.store("join", both, "joined\n");
+    cache.bump("orders");
+    assert( !cache.lookup("join", out) );
+    assert( cache.hits == 2 && cache.misses == 3 );
+
+    // Room for about three entries of 1000 bytes: the least recently used goes first.
+    cache.setBudget(3500);
+    std::string big(1000, 'x');
+    cache.store("a", both, big);
+    cache.store("b", both, big);
+    cache.store("c", both, big);
+    assert( cache.size() == 3 );
+    assert( cache.lookup("a", out) );
+    cache.store("d", both, big);
+    assert( cache.size() == 3 && cache.evictions == 1 );
+    assert( !cache.lookup("b", out) && cache.lookup("a", out) && cache.lookup("c", out) && cache.lookup("d", out) );
+    // Bigger than the whole budget, not kept.
+    cache.store("e", both, std::string(4000, 'x'));
+    assert( !cache.lookup("e", out) && cache.size() == 3 );
+
+    // Captured output still reaches the stream.
+    std::ostringstream stream;
+    {
+        OutputCapture capture(stream, 16);
+        stream << "{\"a\":1}" << std::endl;
+        assert( capture.complete() && capture.text == "{\"a\":1}\n" );
+        stream << "a longer line that does not fit" << std::endl;
+        assert( !capture.complete() && capture.text.empty() );
+    }
+    stream << "after";
+    assert( stream.str() == "{\"a\":1}\na longer line that does not fit\nafter" );
+
+    std::cout << "Result cache works" << std::endl;
+    return 0;
+}
@@ -0,0 +1,114 @@
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <vector>
+#include <map>
+#include <cstdio>
+#include <cstdlib>
+#include <cassert>
+
+#include "Database.h"
+
+/*
+ *      Sampled selects: the drawn ids are repeatable and in document order, a full sample is
+ *      exact, a single drawn document gets no interval, and over many seeds the 95% intervals of SUM, AVG and COUNT mostly hold the true
+ *      values.  The batch and row executors have to agree on the same sample.
+ */
+
+static std::string doc(uint64_t i) {
+    std::ostringstream doc;
+    doc << "{\"id\":" << i << ",\"age\":" << (i % 90) << ",\"city\":\"c" << (i % 7) << "\"}";
+    return doc.str();
+}
+
+// The "name: value" and "name 95% CI: [low, high]" lines of a summary.
+struct Estimate {
+    double value;
+    double low;
+    double high;
+};
+
+static std::map<std::string, Estimate> summary(const std::vector<std::string> &lines) {
+    std::map<std::string, Estimate> out;
+    for( auto it = lines.begin() ; it != lines.end() ; ++it ) {
+        size_t colon = it->rfind(": ");
+        std::string name = it->substr(0, colon);
+        std::string value = it->substr(colon + 2);
+        const std::string ci = " 95% CI";
+        if( name.size() > ci.size() && name.compare(name.size() - ci.size(), ci.size(), ci) == 0 ) {
+            Estimate &e = out[name.substr(0, name.size() - ci.size())];
+            sscanf(value.c_str(), "[%lf, %lf]", &e.low, &e.high);
+        } else {
+            out[name].value = atof(value.c_str());
+        }
+    }
+    return out;
+}
+
+int main() {
+    const uint64_t count = 20000;
+    Database db("test.dat", count, doc);
+    db.executor.setThreads(1);
+
+    // Exactly the asked number of rows, in document order, the same ones every time.
+    std::vector<std::string> rows = db.run("SELECT id FROM p SAMPLE 250 ROWS REPEATABLE 3;");
+    assert( rows.size() == 250 );
+    for( size_t i = 1 ; i < rows.size() ; ++i ) {
+        assert( atoi(rows[i - 1].c_str() + 6) < atoi(rows[i].c_str() + 6) );
+    }
+    assert( db.run("SELECT id FROM p SAMPLE 250 ROWS REPEATABLE 3;") == rows );
+    assert( db.run("SELECT id FROM p SAMPLE 250 ROWS REPEATABLE 4;") != rows );
+    size_t percent = db.run("SELECT id FROM p SAMPLE 10 PERCENT REPEATABLE 3;").size();
+    assert( percent > count / 10 * 0.9 && percent < count / 10 * 1.1 );
+
+    // True values over the documents of city c1.
+    double sum = 0;
+    double matches = 0;
+    for( uint64_t i = 0 ; i < count ; ++i ) {
+        if( i % 7 == 1 ) {
+            sum += i % 90;
+            ++matches;
+        }
+    }
+
+    // Everything drawn is exact, with nothing left to the intervals.
+    std::map<std::string, Estimate> all = summary(db.run("SELECT SUM(age), COUNT(*) FROM p SAMPLE 100 PERCENT WHERE { \"city\" : \"c1\" };"));
+    assert( all["SUM(age)"].value == sum && all["SUM(age)"].low == sum && all["SUM(age)"].high == sum );
+    assert( all["COUNT(*)"].value == matches );
+
+    // A single drawn document gives the estimates but no spread to put an interval on.
+    std::vector<std::string> one = db.run("SELECT SUM(age), COUNT(*), AVG(age) FROM p SAMPLE 1 ROWS REPEATABLE 5;");
+    assert( one.size() == 3 );
+    for( auto it = one.begin() ; it != one.end() ; ++it ) {
+        assert( it->find("95% CI") == std::string::npos );
+    }
+    assert( summary(one)["COUNT(*)"].value == count );
+
+    // A 95% interval misses about one seed in twenty.
+    const int seeds = 40;
+    int sumHits = 0, avgHits = 0, countHits = 0;
+    for( int seed = 1 ; seed <= seeds ; ++seed ) {
+        std::string query = "SELECT SUM(age), AVG(age), COUNT(*), MAX(age) FROM p SAMPLE 5 PERCENT REPEATABLE " + std::to_string(seed) +
+            " WHERE { \"city\" : \"c1\" };";
+        db.executor.setVectorized(false);
+        std::vector<std::string> byRow = db.run(query);
+        db.executor.setVectorized(true);
+        std::vector<std::string> byBatch = db.run(query);
+        if( byRow != byBatch ) {
+            std::cout << query << std::endl << "Row and batch estimates differ" << std::endl;
+            return 1;
+        }
+        std::map<std::string, Estimate> e = summary(byBatch);
+        assert( e.count("MAX(age) 95% CI") == 0 && e["MAX(age)"].value <= 89 );
+        sumHits += e["SUM(age)"].low <= sum && sum <= e["SUM(age)"].high;
+        avgHits += e["AVG(age)"].low <= sum / matches && sum / matches <= e["AVG(age)"].high;
+        countHits += e["COUNT(*)"].low <= matches && matches <= e["COUNT(*)"].high;
+    }
+    if( sumHits < seeds * 0.85 || avgHits < seeds * 0.85 || countHits < seeds * 0.85 ) {
+        std::cout << "Intervals held " << sumHits << ", " << avgHits << " and " << countHits << " of " << seeds << " times" << std::endl;
+        return 1;
+    }
+
+    std::cout << "Samples within their intervals" << std::endl;
+    return 0;
+}
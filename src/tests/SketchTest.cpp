@@ -0,0 +1,78 @@
+#include <iostream>
+#include <string>
+#include <vector>
+#include <cmath>
+#include <cassert>
+
+#include "../storage/HyperLogLog.h"
+#include "../storage/TDigest.h"
+
+// Rank of x among the values 0 .. n-1 passed through f, which has to be increasing.
+template <class F>
+static double rankOf(double x, uint64_t n, F f) {
+    uint64_t lo = 0, hi = n;
+    while( lo < hi ) {
+        uint64_t mid = (lo + hi) / 2;
+        if( f(mid) < x ) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+    return double(lo);
+}
+
+int main(void) {
+    const uint64_t n = 100000;
+    const double qs[] = { 0.001 , 0.01 , 0.1 , 0.25 , 0.5 , 0.75 , 0.9 , 0.99 , 0.999 };
+    auto square = [](uint64_t i) { return double(i) * double(i); };
+
+    // Values in a scrambled order, into one digest and split over four merged ones
+    Storage::TDigest whole;
+    Storage::TDigest parts[4];
+    for( uint64_t i = 0 ; i < n ; ++i ) {
+        uint64_t v = (i * 7919) % n;
+        whole.add( square( v ) );
+        parts[i % 4].add( square( v ) );
+    }
+    Storage::TDigest merged;
+    for( int p = 0 ; p < 4 ; ++p ) {
+        merged.merge( parts[p] );
+    }
+
+    for( size_t i = 0 ; i < sizeof(qs) / sizeof(qs[0]) ; ++i ) {
+        double a = rankOf( whole.quantile( qs[i] ) , n , square ) / n;
+        double b = rankOf( merged.quantile( qs[i] ) , n , square ) / n;
+        // A hundred centroids place every quantile within a few tenths of a percent of its rank
+        if( std::fabs( a - qs[i] ) > 0.003 || std::fabs( b - qs[i] ) > 0.003 ) {
+            std::cout << "Quantile " << qs[i] << " came out at ranks " << a << " and " << b << std::endl;
+            return 1;
+        }
+    }
+    assert( whole.quantile( 0 ) == 0 && whole.quantile( 1 ) == square( n - 1 ) );
+
+    // Few values are kept exactly
+    Storage::TDigest small;
+    assert( std::isnan( small.quantile( 0.5 ) ) );
+    for( int i = 1 ; i <= 5 ; ++i ) {
+        small.add( i );
+    }
+    assert( small.quantile( 0.5 ) == 3 );
+    small.add( 6 );
+    assert( small.quantile( 0.5 ) == 3.5 );
+
+    // Distinct counts stay within a few standard errors (1.6%), merged or not
+    Storage::HyperLogLog<> hll;
+    Storage::HyperLogLog<> halves[2];
+    for( uint64_t i = 0 ; i < n ; ++i ) {
+        std::string s = "value" + std::to_string( i % (n / 2) );
+        hll.add( s.data() , s.size() );
+        halves[i % 2].add( s.data() , s.size() );
+    }
+    halves[0].merge( halves[1] );
+    assert( std::fabs( hll.estimate() / (n / 2) - 1 ) < 0.05 );
+    assert( halves[0].estimate() == hll.estimate() );
+
+    std::cout << "Sketches within bounds" << std::endl;
+    return 0;
+}
@@ -0,0 +1,80 @@
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <vector>
+#include <algorithm>
+#include <cstdio>
+#include <cassert>
+
+#include "Database.h"
+
+/*
+ *      Runs the same ORDER BY queries sorted in memory and with a budget small enough to
+ *      write out more sorted runs than are merged at once.  Both have to print the same rows
+ *      in the same order, and that order has to be the expected one.
+ */
+
+static std::string doc(uint64_t i) {
+    std::ostringstream doc;
+    doc << "{\"id\":" << i << ",\"name\":\"n" << (i * 7919 % 1000) << "\",\"score\":" << ((double)(i % 200) - 100) / 4;
+    if( i % 13 ) {
+        doc << ",\"age\":" << (i % 90);
+    }
+    doc << "}";
+    return doc.str();
+}
+
+int main() {
+    uint64_t count = 5000;
+    Database memory("test.dat", count, doc);
+    memory.executor.setSortMemory(64 << 20);
+    Database spilled("test2.dat", count, doc);
+    spilled.executor.setSortMemory(2048);
+
+    const std::string queries[] = {
+        "SELECT id, age FROM p ORDER BY age;",
+        "SELECT * FROM p ORDER BY score DESC, name;",
+        "SELECT name, score FROM p WHERE { \"score\" : { \"#lt\" : 0 } } ORDER BY name DESC, age;",
+        "SELECT id FROM p ORDER BY age DESC, score LIMIT 40;",
+        "SELECT age, COUNT(*), MIN(score) FROM p GROUP BY age ORDER BY COUNT(*) DESC, age;",
+        "SELECT name, AVG(score) FROM p ORDER BY name;",
+    };
+
+    for( size_t i = 0 ; i < sizeof(queries) / sizeof(queries[0]) ; ++i ) {
+        std::vector<std::string> a = memory.run(queries[i]);
+        std::vector<std::string> b = spilled.run(queries[i]);
+        if( a != b || a.empty() ) {
+            std::cout << queries[i] << std::endl << "Sorted rows differ (" << a.size() << " and " << b.size() << " rows)" << std::endl;
+            return 1;
+        }
+    }
+
+    // Scores descending, ties in document order.
+    std::vector<uint64_t> expected;
+    for( uint64_t i = 0 ; i < count ; ++i ) {
+        expected.push_back(i);
+    }
+    std::stable_sort(expected.begin(), expected.end(), [](uint64_t a, uint64_t b) { return a % 200 > b % 200; });
+    std::vector<std::string> ids = spilled.run("SELECT id FROM p ORDER BY score DESC;");
+    assert( ids.size() == count );
+    for( uint64_t i = 0 ; i < count ; ++i ) {
+        assert( ids[i] == "{\"id\":" + std::to_string(expected[i]) + "}" );
+    }
+
+    // Missing values come first, and a limit keeps the first rows of the full order.
+    std::vector<std::string> all = memory.run("SELECT id, age FROM p ORDER BY age, id DESC;");
+    std::vector<std::string> top = spilled.run("SELECT id, age FROM p ORDER BY age, id DESC LIMIT 25;");
+    assert( all[0] == "{\"id\":4992}" );
+    assert( top.size() == 25 && std::equal(top.begin(), top.end(), all.begin()) );
+
+    std::vector<std::string> groups = memory.run("SELECT age, COUNT(*) FROM p GROUP BY age ORDER BY COUNT(*) DESC, age DESC LIMIT 1;");
+    assert( groups.size() == 1 && groups[0] == "{\"age\":null,\"COUNT(*)\":385}" );
+
+    // Every run is gone again.
+    assert( spilled.fs.getFilenames().empty() && spilled.fs.getDocumentIds().size() == count );
+
+    std::cout << "Sorted runs match" << std::endl;
+    remove("test2.dat");
+    remove("test2.dat.ids");
+    return 0;
+}
@@ -0,0 +1,108 @@
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <cstdio>
+#include <cmath>
+#include <cassert>
+
+#include "Database.h"
+
+/*
+ *      ANALYZE of a project twice the sample size, whose null fractions, distinct counts and
+ *      value ranges are known: the estimates have to come out close to them.  They have to stay
+ *      close after inserts, and after deletes that take most of the project, far more documents
+ *      than were ever sampled.
+ */
+
+const uint64_t DOCS = 2 * ANALYZE_SAMPLE;
+
+// k has 50 values spread evenly, v is unique, s is null one time in four and opt is only in
+// one document in five.
+static std::string doc(uint64_t i) {
+    std::ostringstream doc;
+    doc << "{\"k\":" << (i % 50) << ",\"v\":" << i << ",\"s\":";
+    if( i % 4 == 0 ) {
+        doc << "null";
+    } else {
+        doc << "\"s" << (i % 10) << "\"";
+    }
+    if( i % 5 == 0 ) {
+        doc << ",\"opt\":true";
+    }
+    doc << "}";
+    return doc.str();
+}
+
+static bool near(double estimate, double expected, double tolerance) {
+    if( std::fabs(estimate - expected) > tolerance ) {
+        std::cout << "Estimated " << estimate << ", expected " << expected << std::endl;
+        return false;
+    }
+    return true;
+}
+
+static double selectivity(Database &db, const std::string &key, const std::string &cond) {
+    rapidjson::Document c;
+    c.Parse(cond.c_str());
+    return db.stats.selectivity("p", key, c, 0.5);
+}
+
+// The estimates against what the documents left in the project hold.
+static void check(Database &db) {
+    double nulls = 0, opts = 0, high = 0;
+    for( auto it = db.docs.begin() ; it != db.docs.end() ; ++it ) {
+        rapidjson::Document d;
+        d.Parse(db.stored(*it).c_str());
+        nulls += d["s"].IsNull();
+        opts += d.HasMember("opt");
+        high += d["k"].GetInt() > 42;
+    }
+    double n = db.docs.size();
+    ProjectStats *ps = db.stats.get("p");
+    assert( ps && ps->rows == db.docs.size() );
+    assert( ps->observed > 0 && ps->observed <= ps->rows );
+    assert( near(ps->typeFraction("k", ST_NUMBER), 1, 0.001) );
+    assert( near(ps->nullFraction("s"), nulls / n, 0.03) );
+    assert( near(ps->typeFraction("s", ST_STRING), 1 - nulls / n, 0.03) );
+    assert( near(ps->nullFraction("opt"), 1 - opts / n, 0.03) );
+    assert( near(selectivity(db, "k", "{\"#gt\":42}"), high / n, 0.05) );
+}
+
+int main(void) {
+    Database db("test.dat", DOCS, doc);
+    ProjectStats &ps = db.stats.analyze("p", db.docs, db.fs, 42);
+    assert( ps.rows == DOCS && ps.observed == ANALYZE_SAMPLE );
+    check(db);
+    assert( near(ps.distinct("k"), 50, 5) );
+    assert( near(ps.distinct("s"), 10, 1) );
+    assert( near(ps.distinct("v") / DOCS, 1, 0.15) );
+    assert( near(ps.distinct("missing"), 0, 0) );
+    assert( near(selectivity(db, "v", "{\"#lt\":" + std::to_string(DOCS / 4) + "}"), 0.25, 0.02) );
+    assert( near(selectivity(db, "k", "7"), 0.02, 0.005) );
+    assert( near(selectivity(db, "#exists", "{\"opt\":true}"), 0.2, 0.02) );
+
+    // Inserts are observed in the proportion the project was, half of them.
+    for( uint64_t i = DOCS ; i < DOCS + DOCS / 4 ; ++i ) {
+        db.add(i, doc(i));
+        rapidjson::Document d;
+        d.Parse(doc(i).c_str());
+        db.stats.add("p", d);
+    }
+    assert( near(ps.observed, ANALYZE_SAMPLE + DOCS / 8, 300) );
+    check(db);
+    assert( near(selectivity(db, "v", "{\"#lt\":" + std::to_string(DOCS / 4) + "}"), 0.2, 0.03) );
+
+    // Deleting 3/4 of the project takes out more documents than were observed.
+    db.run("DELETE * FROM p WHERE { \"k\" : { \"#lt\" : 38 } };");
+    assert( db.docs.size() == (DOCS + DOCS / 4) * 12 / 50 );
+    check(db);
+    // An update takes a document out and puts it back.
+    db.run("UPDATE p WITH { \"#inc\" : { \"v\" : 1 } } WHERE { \"k\" : 49 };");
+    check(db);
+    db.fs.shutdown();
+    remove("test.dat");
+    remove("test.dat.ids");
+
+    std::cout << "Statistics work" << std::endl;
+    return 0;
+}
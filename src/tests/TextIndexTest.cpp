@@ -0,0 +1,53 @@
+#include <iostream>
+#include <string>
+#include <cassert>
+
+#include "../storage/TextIndex.h"
+
+int main(void) {
+    const char *names[] = { "alice" , "bob" , "carol" , "caroline" , "bobcat" , "al" };
+    Storage::TextIndex idx;
+    for( uint64_t i = 0 ; i < 6 ; ++i ) {
+        idx.insert( i , names[i] , strlen( names[i] ) );
+    }
+    Storage::TextIndex::IDS out;
+
+    assert( idx.contains( "aro" , 3 , out ) );
+    assert( out.size() == 2 && out[0] == 2 && out[1] == 3 );
+
+    // Too short for trigrams, the caller has to scan
+    assert( !idx.contains( "al" , 2 , out ) );
+
+    idx.starts( "bob" , 3 , out );
+    assert( out.size() == 2 && out[0] == 1 && out[1] == 4 );
+
+    idx.ends( "ine" , 3 , out );
+    assert( out.size() == 1 && out[0] == 3 );
+
+    idx.equals( "al" , 2 , out );
+    assert( out.size() == 1 && out[0] == 5 );
+
+    idx.range( "bobcat" , 6 , true , out );
+    assert( out.size() == 2 && out[0] == 2 && out[1] == 3 );
+
+    // Removing a value takes it out of every structure
+    idx.remove( 2 , "carol" , 5 );
+    assert( idx.contains( "aro" , 3 , out ) && out.size() == 1 && out[0] == 3 );
+    idx.ends( "rol" , 3 , out );
+    assert( out.empty() );
+
+    // Round trip through the serialized form
+    uint64_t size = idx.Size();
+    uint64_t pos = 0;
+    char *buffer = new char[size];
+    idx.Write( buffer , pos );
+    assert( pos == size );
+
+    Storage::TextIndex copy;
+    copy.Read( buffer , 0 , size );
+    delete[] buffer;
+    assert( copy.size() == idx.size() );
+    assert( copy.contains( "cat" , 3 , out ) && out.size() == 1 && out[0] == 4 );
+
+    return 0;
+}
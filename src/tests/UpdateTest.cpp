@@ -0,0 +1,108 @@
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <cstdio>
+#include <cassert>
+
+#include "../dbms/Documents.h"
+#include "Database.h"
+#include <pretty.h>
+
+/*
+ *      UPDATE with the field operators: #set, #inc, #unset and #push by dotted path, next to
+ *      plain members that replace a field as before.  A document that keeps its size is patched
+ *      in place, one block for a counter, and reads back the same as one written whole.  #inc turns
+ *      to a double past the int64 range, and paths with an empty step are parse errors.
+ */
+
+const uint64_t DOCS = 200;
+
+static std::string counter(uint64_t i) {
+    // Long enough to take several blocks, with the counters in the first one.
+    std::ostringstream doc;
+    doc << "{\"id\":" << i << ",\"hits\":" << (10 + i % 80) << ",\"stats\":{\"views\":0},\"pad\":\"" << std::string(1500, 'p') << "\"}";
+    return doc.str();
+}
+
+static std::string applied(const std::string &doc, const std::string &updates) {
+    rapidjson::Document d, u;
+    d.Parse(doc.c_str());
+    u.Parse(updates.c_str());
+    applyUpdates(d, u);
+    return toString(&d);
+}
+
+int main(void) {
+    // The operators on their own.
+    assert( applied("{\"a\":1,\"b\":2}", "{\"#set\":{\"a\":5,\"c.d\":true}}") == "{\"a\":5,\"b\":2,\"c\":{\"d\":true}}" );
+    assert( applied("{\"a\":1,\"b\":2.5,\"s\":\"x\"}", "{\"#inc\":{\"a\":2,\"b\":1,\"s\":1,\"n.m\":-3}}") ==
+            "{\"a\":3,\"b\":3.5,\"s\":\"x\",\"n\":{\"m\":-3}}" );
+    assert( applied("{\"a\":1,\"b\":{\"c\":2,\"d\":3},\"e\":4}", "{\"#unset\":[\"a\",\"b.c\",\"x.y\"]}") == "{\"b\":{\"d\":3},\"e\":4}" );
+    assert( applied("{\"a\":1,\"e\":4}", "{\"#unset\":{\"e\":1}}") == "{\"a\":1}" );
+    assert( applied("{\"t\":[1],\"s\":\"x\"}", "{\"#push\":{\"t\":{\"k\":2},\"s\":3,\"u\":\"v\"}}") ==
+            "{\"t\":[1,{\"k\":2}],\"s\":\"x\",\"u\":[\"v\"]}" );
+    assert( applied("{\"a\":1,\"b\":2}", "{\"a\":{\"z\":0}}") == "{\"b\":2,\"a\":{\"z\":0}}" );
+    assert( applied("{\"a\":1}", "{\"#set\":{\"a.b\":1}}") == "{\"a\":1}" );
+    // Past the int64 range the counter becomes a double.
+    assert( applied("{\"a\":9223372036854775806}", "{\"#inc\":{\"a\":1}}") == "{\"a\":9223372036854775807}" );
+    assert( applied("{\"a\":9223372036854775807}", "{\"#inc\":{\"a\":1}}") == "{\"a\":9223372036854776000.0}" );
+    assert( applied("{\"a\":-9223372036854775807}", "{\"#inc\":{\"a\":-2}}") == "{\"a\":-9223372036854776000.0}" );
+    // Paths with an empty step are refused by the parser, and change nothing if they get through.
+    const char *empty[] = { "a..b", "a.", ".a", "" };
+    for( size_t i = 0 ; i < sizeof(empty) / sizeof(empty[0]) ; ++i ) {
+        std::string path = empty[i];
+        Parsing::Parser parser("UPDATE c WITH { \"#set\" : { \"" + path + "\" : 1 } };");
+        Parsing::Query *q = parser.parse();
+        assert( q == NULL );
+        Parsing::Parser unset("UPDATE c WITH { \"#unset\" : [ \"" + path + "\" ] };");
+        assert( unset.parse() == NULL );
+        assert( applied("{\"a\":{}}", "{\"#set\":{\"" + path + "\":1}}") == "{\"a\":{}}" );
+    }
+    Parsing::Query *dotted = Parsing::Parser("UPDATE c WITH { \"#inc\" : { \"a.b\" : 1 }, \"x.y\" : 2 };").parse();
+    assert( dotted != NULL );
+    delete dotted;
+
+    remove("test.dat");
+    remove("test.dat.ids");
+    {
+        // Patching a file rewrites the blocks that changed and no others.
+        Storage::Filesystem fs("test.dat");
+        std::string data = counter(7);
+        File f = fs.open_file(uint64_t(0));
+        fs.write(&f, data.c_str(), data.size());
+        std::string changed = data;
+        changed[9] = '9';
+        changed[changed.size() - 3] = 'q';
+        assert( fs.patch(&f, changed.c_str(), changed.size()) == 2 );
+        assert( fs.patch(&f, changed.c_str(), changed.size()) == 0 );
+        char *c = fs.read(&f);
+        assert( std::string(c, f.size) == changed );
+        free(c);
+        fs.shutdown();
+    }
+    remove("test.dat");
+    remove("test.dat.ids");
+    {
+        Database db("test.dat", DOCS, counter);
+        // Counters that keep their width are patched, those that grow a digit are rewritten.
+        for( int round = 0 ; round < 15 ; ++round ) {
+            db.run("UPDATE c WITH { \"#inc\" : { \"hits\" : 1, \"stats.views\" : 2 } };");
+        }
+        for( uint64_t i = 0 ; i < DOCS ; ++i ) {
+            std::string expected = applied(counter(i), "{\"#inc\":{\"hits\":15,\"stats.views\":30}}");
+            assert( db.stored(i) == expected );
+        }
+
+        db.run("UPDATE c WITH { \"#set\" : { \"stats.last\" : \"today\" }, \"#push\" : { \"tags\" : \"hot\" } } WHERE { \"id\" : 3 };");
+        db.run("UPDATE c WITH { \"#unset\" : [ \"pad\" ], \"flag\" : true } WHERE { \"id\" : 4 };");
+        assert( db.stored(3) == applied(counter(3), "{\"#inc\":{\"hits\":15,\"stats.views\":30},\"#set\":{\"stats.last\":\"today\"},\"#push\":{\"tags\":\"hot\"}}") );
+        assert( db.stored(4) == applied(counter(4), "{\"#inc\":{\"hits\":15,\"stats.views\":30},\"#unset\":[\"pad\"],\"flag\":true}") );
+        assert( db.stored(5) == applied(counter(5), "{\"#inc\":{\"hits\":15,\"stats.views\":30}}") );
+        db.fs.shutdown();
+    }
+    remove("test.dat");
+    remove("test.dat.ids");
+
+    std::cout << "Update operators work" << std::endl;
+    return 0;
+}
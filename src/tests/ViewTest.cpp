@@ -0,0 +1,132 @@
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <vector>
+#include <cmath>
+#include <cstdio>
+#include <cassert>
+
+#include "Database.h"
+
+/*
+ *      Keeps materialized views up to date through inserts, updates and deletes, and checks
+ *      after each of them that reading a view prints what running its select prints.  SUM,
+ *      COUNT and AVG are rolled back in place; deleting a MIN leaves the view stale until it
+ *      is read.  The views survive being saved and loaded again.
+ */
+
+const char *VIEWS[][2] = {
+    { "byCity", "CREATE VIEW byCity AS SELECT city, COUNT(*), SUM(age), AVG(age), MIN(age), MAX(age) FROM people GROUP BY city;" },
+    { "young", "CREATE VIEW young AS SELECT COUNT(*), SUM(score), COUNT(zip) FROM people WHERE { \"age\" : { \"#lt\" : 30 } };" },
+    { "spread", "CREATE VIEW spread AS SELECT zip, VARIANCE(score) FROM people GROUP BY zip;" },
+};
+const size_t NUM_VIEWS = sizeof(VIEWS) / sizeof(VIEWS[0]);
+
+static std::string person(uint64_t i) {
+    std::ostringstream doc;
+    doc << "{\"age\":" << (i % 90) << ",\"score\":" << (i % 1000) << ",\"city\":\"c" << (i % 7) << "\"";
+    if( i % 11 ) {
+        doc << ",\"zip\":" << (i % 3);
+    }
+    doc << "}";
+    return doc.str();
+}
+
+// The select of a view, run directly.
+static std::string selectOf(const std::string &create) {
+    return create.substr(create.find("SELECT"));
+}
+
+// Rows equal up to rounding in the last digits of their doubles.  Summary lines as they are.
+static bool close(const std::vector<std::string> &a, const std::vector<std::string> &b) {
+    if( a.size() != b.size() ) {
+        return false;
+    }
+    for( size_t i = 0 ; i < a.size() ; ++i ) {
+        rapidjson::Document x, y;
+        x.Parse(a[i].c_str());
+        y.Parse(b[i].c_str());
+        if( !x.IsObject() || !y.IsObject() ) {
+            if( a[i] != b[i] ) {
+                return false;
+            }
+            continue;
+        }
+        for( auto m = x.MemberBegin() ; m != x.MemberEnd() ; ++m ) {
+            const rapidjson::Value &other = y[m->name.GetString()];
+            if( m->value.IsDouble() ? std::fabs(m->value.GetDouble() - other.GetDouble()) > 1e-6 * (1 + std::fabs(other.GetDouble()))
+                                    : m->value != other ) {
+                return false;
+            }
+        }
+    }
+    return true;
+}
+
+static bool check(Database &db, const std::string &step) {
+    for( size_t v = 0 ; v < NUM_VIEWS ; ++v ) {
+        std::vector<std::string> viewed = db.view(VIEWS[v][0]);
+        std::vector<std::string> selected = db.sorted(selectOf(VIEWS[v][1]));
+        if( viewed.empty() || !close(viewed, selected) ) {
+            std::cout << step << ": view " << VIEWS[v][0] << " has " << viewed.size() << " rows, its select "
+                << selected.size() << std::endl;
+            for( size_t i = 0 ; i < viewed.size() ; ++i ) {
+                std::cout << viewed[i] << std::endl;
+            }
+            return false;
+        }
+    }
+    return true;
+}
+
+int main() {
+    remove("test.dat");
+    remove("test.dat.ids");
+    {
+        Database db("test.dat");
+        db.insert("people", 2000, person);
+        for( size_t v = 0 ; v < NUM_VIEWS ; ++v ) {
+            Parsing::Query *q = db.parse(VIEWS[v][1]);
+            assert( q->command == Parsing::CREATE && q->view == VIEWS[v][0] );
+            db.views.create(q->view, *q, &db.docs, db.fs);
+            delete q;
+        }
+        if( !check(db, "Created") ) return 1;
+
+        db.insert("people", 500, person);
+        if( !check(db, "Inserted") ) return 1;
+
+        // Only moves documents between groups, nothing has to be computed again.
+        db.run("UPDATE people WITH { \"city\" : \"c9\", \"score\" : 5 } WHERE { \"age\" : 40 };");
+        db.run("DELETE * FROM people WHERE { \"age\" : 50 };");
+        db.run("DELETE zip FROM people WHERE { \"age\" : 12 };");
+        for( size_t v = 0 ; v < NUM_VIEWS ; ++v ) {
+            assert( !db.views.get(VIEWS[v][0])->stale );
+        }
+        if( !check(db, "Updated") ) return 1;
+
+        // Takes the youngest out of every city.
+        db.run("DELETE * FROM people WHERE { \"age\" : 0 };");
+        assert( db.views.get("byCity")->stale );
+        if( !check(db, "Deleted the minimum") ) return 1;
+        assert( !db.views.get("byCity")->stale );
+
+        db.views.save(&db.fs);
+        db.fs.shutdown();
+    }
+
+    Database loaded("test.dat");
+    loaded.views.load(&loaded.fs);
+    assert( loaded.views.list().size() == NUM_VIEWS );
+    std::vector<uint64_t> ids = loaded.fs.getDocumentIds();
+    for( auto it = ids.begin() ; it != ids.end() ; ++it ) {
+        loaded.docs.push_back(*it);
+    }
+    for( size_t v = 0 ; v < NUM_VIEWS ; ++v ) {
+        assert( !loaded.views.get(VIEWS[v][0])->stale );
+    }
+    if( !check(loaded, "Loaded") ) return 1;
+
+    std::cout << "Views match" << std::endl;
+    return 0;
+}
@@ -20,7 +20,7 @@
         pos += value.size();
     }
 
-    static void WriteRaw( char *buffer , uint64_t &pos , const char* value , uint64_t length ) {
+    static inline void WriteRaw( char *buffer , uint64_t &pos , const char* value , uint64_t length ) {
         std::copy( value , value + length , buffer + pos );
         pos += length;
     }
@@ -37,6 +37,71 @@
         return str;
     }
 
+    // LEB128: seven bits a byte, low bits first, the high bit set on all but the last byte.
+    static inline void WriteVarint( char *buffer , uint64_t &pos , uint64_t value ) {
+        while( value >= 0x80 ) {
+            buffer[pos++] = char( (value & 0x7f) | 0x80 );
+            value >>= 7;
+        }
+        buffer[pos++] = char( value );
+    }
+
+    static inline uint64_t ReadVarint( const char *buffer , uint64_t &pos ) {
+        uint64_t result = 0;
+        for( int shift = 0 ; shift < 64 ; shift += 7 ) {
+            uint8_t byte = uint8_t( buffer[pos++] );
+            result |= uint64_t( byte & 0x7f ) << shift;
+            if( !(byte & 0x80) ) {
+                break;
+            }
+        }
+        return result;
+    }
+
+    static inline uint64_t VarintSize( uint64_t value ) {
+        uint64_t n = 1;
+        while( value >= 0x80 ) {
+            value >>= 7;
+            ++n;
+        }
+        return n;
+    }
+
+    // MurmurHash64A.  Used wherever a well mixed 64 bit hash of raw bytes is needed.
+    static inline uint64_t Hash64( const char *data , uint64_t len , uint64_t seed = 0 ) {
+        const uint64_t m = 0xc6a4a7935bd1e995ULL;
+        const int r = 47;
+        uint64_t h = seed ^ (len * m);
+
+        const char *end = data + (len & ~uint64_t(7));
+        for( const char *p = data ; p != end ; p += 8 ) {
+            uint64_t k;
+            std::copy( p , p + 8 , reinterpret_cast<char*>(&k) );
+            k *= m;
+            k ^= k >> r;
+            k *= m;
+            h ^= k;
+            h *= m;
+        }
+
+        const unsigned char *tail = reinterpret_cast<const unsigned char*>(end);
+        switch( len & 7 ) {
+            case 7: h ^= uint64_t(tail[6]) << 48; // fall through
+            case 6: h ^= uint64_t(tail[5]) << 40; // fall through
+            case 5: h ^= uint64_t(tail[4]) << 32; // fall through
+            case 4: h ^= uint64_t(tail[3]) << 24; // fall through
+            case 3: h ^= uint64_t(tail[2]) << 16; // fall through
+            case 2: h ^= uint64_t(tail[1]) << 8;  // fall through
+            case 1: h ^= uint64_t(tail[0]);
+                    h *= m;
+        }
+
+        h ^= h >> r;
+        h *= m;
+        h ^= h >> r;
+        return h;
+    }
+
     template <class K>
         struct Type {
             static uint64_t Size( K ) {